@@ -0,0 +1,1361 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <future>
+#include <functional>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/format.hpp>
+
+#include "../lib/ClientSession.hpp"
+#include "../lib/IoContextPool.hpp"
+#include "../lib/PartitionRouter.hpp"
+#include "../lib/PersistableMap.hpp"
+#include "../lib/Protocol.hpp"
+#include "../lib/Serialization.hpp"
+#include "../lib/Server.hpp"
+
+/// Microbenchmarks of kvdb internals
+/// Usage: kvdb_bench [benchmark name] [number of keys]
+
+using Clock = std::chrono::steady_clock;
+
+/// allocations made by all threads of the process, counted by replaced operator new
+static std::atomic<std::size_t> g_numAllocations(0);
+static std::atomic<std::size_t> g_allocatedBytes(0);
+
+void* operator new(const std::size_t size)
+{
+    g_numAllocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+static std::string benchMapFile(const std::string& name)
+{
+    const auto path = std::filesystem::temp_directory_path() / name;
+    std::filesystem::remove(path);
+    std::filesystem::remove(path.string() + ".wal");
+    return path.string();
+}
+
+/// @brief generates keys similar to the typical workload (20 bytes)
+static std::vector<std::string> generateKeys(const std::size_t numKeys)
+{
+    std::vector<std::string> keys;
+    keys.reserve(numKeys);
+    for (std::size_t i = 0; i < numKeys; ++i)
+    {
+        keys.push_back((boost::format("key:%016u") % i).str());
+    }
+
+    return keys;
+}
+
+/// @return number of TCP segments sent by the host, 0 if it is not available
+static std::size_t tcpOutSegments()
+{
+    std::ifstream snmp("/proc/net/snmp");
+    std::string line;
+    std::vector<std::string> names;
+    while (std::getline(snmp, line))
+    {
+        if (line.compare(0, 4, "Tcp:") != 0)
+        {
+            continue;
+        }
+
+        std::istringstream fields(line.substr(4));
+        if (names.empty())
+        {
+            names.assign(std::istream_iterator<std::string>(fields), std::istream_iterator<std::string>());
+            continue;
+        }
+
+        const auto it = std::find(names.begin(), names.end(), "OutSegs");
+        std::vector<std::string> values((std::istream_iterator<std::string>(fields)),
+                                        std::istream_iterator<std::string>());
+        const auto idx = std::size_t(it - names.begin());
+        return idx < values.size() ? std::stoul(values[idx]) : 0;
+    }
+
+    return 0;
+}
+
+static double perSecond(const std::size_t count, const Clock::duration& duration)
+{
+    return count / std::chrono::duration<double>(duration).count();
+}
+
+/// @brief measures number of successful Insert and Get calls per second on a single thread
+void benchMapLookup(const std::string& name,
+                    const std::size_t numKeys,
+                    const kvdb::PersistableMap::Options& options)
+{
+    static const std::size_t scNumLookups = 2000000;
+    const auto lockTout = std::chrono::milliseconds(500);
+    const std::string value(50, 'v');
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    map.InitStorage(benchMapFile("kvdb_bench_lookup.map"), options);
+
+    const auto keys = generateKeys(numKeys);
+    const auto insertStart = Clock::now();
+    for (const auto& key : keys)
+    {
+        try
+        {
+            map.Insert(key, value, lockTout);
+        }
+        catch (const boost::interprocess::bad_alloc&)
+        {
+            map.Grow();
+            map.Insert(key, value, lockTout);
+        }
+    }
+    const auto insertTime = Clock::now() - insertStart;
+
+    std::mt19937 random(42);
+    std::uniform_int_distribution<std::size_t> distribution(0, keys.size() - 1);
+    std::vector<std::size_t> order(scNumLookups);
+    for (auto& idx : order)
+    {
+        idx = distribution(random);
+    }
+
+    std::string output;
+    const auto lookupStart = Clock::now();
+    for (const auto idx : order)
+    {
+        map.Get(keys[idx], output, lockTout);
+    }
+    const auto lookupTime = Clock::now() - lookupStart;
+
+    const auto stat = map.GetStat();
+    std::cout << boost::format("%1%: keys = %2%, inserts/s = %3$.0f, lookups/s = %4$.0f, "
+                               "bytes/record = %5$.1f, overhead/record = %6$.1f\n")
+                 % name
+                 % numKeys
+                 % perSecond(keys.size(), insertTime)
+                 % perSecond(order.size(), lookupTime)
+                 % stat.m_bytesPerRecord
+                 % stat.m_overheadPerRecord;
+}
+
+static void reportLatencies(const std::string& name,
+                            const std::size_t numKeys,
+                            std::vector<Clock::duration>& latencies)
+{
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&latencies](const double p)
+    {
+        const auto idx = std::min(latencies.size() - 1, std::size_t(p * latencies.size()));
+        return std::chrono::duration<double, std::micro>(latencies[idx]).count();
+    };
+
+    std::cout << boost::format("%1%: keys = %2%, insert latency us: p50 = %3$.2f, p99 = %4$.2f, "
+                               "p99.9 = %5$.2f, max = %6$.2f\n")
+                 % name
+                 % numKeys
+                 % percentile(0.5)
+                 % percentile(0.99)
+                 % percentile(0.999)
+                 % percentile(1.0);
+}
+
+/// @brief measures distribution of single Insert latency, segment is preallocated
+/// so only growth of the index itself is measured
+void benchInsertLatency(const std::string& name, const std::size_t numKeys, const kvdb::IndexEngine engine)
+{
+    const auto lockTout = std::chrono::milliseconds(500);
+    const std::string value(50, 'v');
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    map.InitStorage(benchMapFile("kvdb_bench_latency.map"), {1, engine});
+    while (map.GetStat().m_size < numKeys * 300)
+    {
+        map.Grow();
+    }
+
+    const auto keys = generateKeys(numKeys);
+    std::vector<Clock::duration> latencies;
+    latencies.reserve(numKeys);
+    for (const auto& key : keys)
+    {
+        const auto start = Clock::now();
+        map.Insert(key, value, lockTout);
+        latencies.push_back(Clock::now() - start);
+    }
+
+    reportLatencies(name, numKeys, latencies);
+}
+
+/// @brief measures distribution of single Insert latency while segment is grown
+/// in background each time it reaches the high-water mark, like server does
+void benchGrowthLatency(const std::string& name, const std::size_t numKeys, const kvdb::IndexEngine engine)
+{
+    const auto lockTout = std::chrono::milliseconds(500);
+    const std::string value(50, 'v');
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    kvdb::PersistableMap::Options options;
+    options.m_engine = engine;
+    map.InitStorage(benchMapFile("kvdb_bench_growth.map"), options);
+
+    std::atomic<bool> stop(false);
+    std::thread grower([&map, &stop]()
+    {
+        while (!stop)
+        {
+            if (map.NeedsGrowth())
+            {
+                map.Grow();
+            }
+
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    const auto keys = generateKeys(numKeys);
+    std::vector<Clock::duration> latencies;
+    latencies.reserve(numKeys);
+    for (const auto& key : keys)
+    {
+        const auto start = Clock::now();
+        while (true)
+        {
+            try
+            {
+                map.Insert(key, value, lockTout);
+                break;
+            }
+            catch (const boost::interprocess::bad_alloc&)
+            {
+                // background growth did not keep up, grow synchronously
+                map.Grow();
+            }
+        }
+
+        latencies.push_back(Clock::now() - start);
+    }
+
+    stop = true;
+    grower.join();
+    reportLatencies(name, numKeys, latencies);
+}
+
+/// @brief measures number of durable inserts per second made by concurrent writers,
+/// writers waiting for the same fsync are committed as one group
+void benchLogCommit(const std::string& name,
+                    const std::size_t numKeys,
+                    const kvdb::WriteAheadLog::SyncPolicy policy)
+{
+    static const std::size_t scNumThreads = 8;
+    const auto lockTout = std::chrono::milliseconds(500);
+    const std::string value(50, 'v');
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    kvdb::PersistableMap::Options options;
+    options.m_numShards = scNumThreads;
+    options.m_walSyncPolicy = policy;
+    map.InitStorage(benchMapFile("kvdb_bench_wal.map"), options);
+    while (map.GetStat().m_size < numKeys * 300)
+    {
+        map.Grow();
+    }
+
+    const auto keys = generateKeys(numKeys);
+    const auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < scNumThreads; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            for (std::size_t i = t; i < keys.size(); i += scNumThreads)
+            {
+                map.Insert(keys[i], value, lockTout);
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    std::cout << boost::format("%1%: keys = %2%, threads = %3%, inserts/s = %4$.0f\n")
+                 % name
+                 % numKeys
+                 % scNumThreads
+                 % perSecond(keys.size(), Clock::now() - start);
+}
+
+/// @brief measures distribution of single Insert latency while map is checkpointed
+/// continuously from another thread
+void benchCheckpointStall(const std::string& name, const std::size_t numKeys)
+{
+    const auto lockTout = std::chrono::milliseconds(500);
+    const std::string value(50, 'v');
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    map.InitStorage(benchMapFile("kvdb_bench_checkpoint.map"), {4, kvdb::IndexEngine::Swiss});
+    while (map.GetStat().m_size < numKeys * 300)
+    {
+        map.Grow();
+    }
+
+    std::atomic<bool> stop(false);
+    std::thread checkpointer([&map, &stop]()
+    {
+        while (!stop)
+        {
+            map.Flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    });
+
+    const auto keys = generateKeys(numKeys);
+    std::vector<Clock::duration> latencies;
+    latencies.reserve(numKeys);
+    for (const auto& key : keys)
+    {
+        const auto start = Clock::now();
+        map.Insert(key, value, lockTout);
+        latencies.push_back(Clock::now() - start);
+    }
+
+    stop = true;
+    checkpointer.join();
+    reportLatencies(name, numKeys, latencies);
+
+    const auto stat = map.GetStat();
+    std::cout << boost::format("%1%: checkpoints = %2%, max checkpoint ms = %3$.1f, "
+                               "background flushes = %4%, flushed MiB = %5$.1f\n")
+                 % name
+                 % stat.m_checkpoints.m_numFlushes
+                 % (stat.m_checkpoints.m_maxTime.count() / 1000.0)
+                 % stat.m_background.m_numFlushes
+                 % (stat.m_background.m_flushedBytes / 1024.0 / 1024.0);
+}
+
+/// @brief measures number of keys per second returned by paged range scans
+void benchScan(const std::string& name, const std::size_t numKeys, const std::size_t pageSize)
+{
+    const auto lockTout = std::chrono::milliseconds(500);
+    const std::string value(50, 'v');
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    kvdb::PersistableMap::Options options;
+    options.m_numShards = 4;
+    options.m_orderedIndex = true;
+    map.InitStorage(benchMapFile("kvdb_bench_scan.map"), options);
+
+    for (const auto& key : generateKeys(numKeys))
+    {
+        try
+        {
+            map.Insert(key, value, lockTout);
+        }
+        catch (const boost::interprocess::bad_alloc&)
+        {
+            map.Grow();
+            map.Insert(key, value, lockTout);
+        }
+    }
+
+    std::vector<kvdb::PersistableMap::KeyValue> pairs;
+    std::string cursor;
+    std::size_t numScanned = 0;
+    std::size_t numPages = 0;
+    const auto start = Clock::now();
+    do
+    {
+        pairs.clear();
+        cursor = map.Scan(cursor, std::string(), pageSize, pairs, lockTout);
+        numScanned += pairs.size();
+        ++numPages;
+    }
+    while (!cursor.empty());
+    const auto scanTime = Clock::now() - start;
+
+    std::cout << boost::format("%1%: keys = %2%, page = %3%, keys/s = %4$.0f, pages/s = %5$.0f\n")
+                 % name
+                 % numScanned
+                 % pageSize
+                 % perSecond(numScanned, scanTime)
+                 % perSecond(numPages, scanTime);
+}
+
+/// @brief measures growth and fragmentation of the storage under updates of values of varying sizes
+void benchUpdateChurn(const std::string& name,
+                      const std::size_t numKeys,
+                      const std::size_t maxValueSize,
+                      const kvdb::IndexEngine engine)
+{
+    static const std::size_t scUpdatesPerKey = 20;
+    const auto lockTout = std::chrono::milliseconds(500);
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    map.InitStorage(benchMapFile("kvdb_bench_churn.map"), {1, engine});
+
+    // sizes are distributed log-uniformly from 16 bytes up to the maximum value size
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> distribution(std::log(16.0), std::log(double(maxValueSize)));
+    const std::string buffer(maxValueSize, 'v');
+    const auto randomValue = [&]()
+    {
+        return std::string_view(buffer.data(), std::size_t(std::exp(distribution(random))));
+    };
+
+    const auto keys = generateKeys(numKeys);
+    std::size_t numGrowths = 0;
+    const auto growIfNeeded = [&]()
+    {
+        if (map.NeedsGrowth())
+        {
+            map.Grow();
+            ++numGrowths;
+        }
+    };
+
+    for (const auto& key : keys)
+    {
+        map.Insert(key, randomValue(), lockTout);
+        growIfNeeded();
+    }
+
+    const std::size_t numUpdates = numKeys * scUpdatesPerKey;
+    std::uniform_int_distribution<std::size_t> keyDistribution(0, keys.size() - 1);
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < numUpdates; ++i)
+    {
+        map.Update(keys[keyDistribution(random)], randomValue(), lockTout);
+        growIfNeeded();
+    }
+    const auto updateTime = Clock::now() - start;
+
+    const auto stat = map.GetStat();
+    std::cout << boost::format("%1%: keys = %2%, updates/s = %3$.0f, growths = %4%, file MiB = %5%, "
+                               "free MiB = %6%, largest free MiB = %7%, heap free MiB = %8%, "
+                               "bytes/record = %9$.0f, payload/record = %10$.0f\n")
+                 % name
+                 % numKeys
+                 % perSecond(numUpdates, updateTime)
+                 % numGrowths
+                 % (stat.m_size >> 20)
+                 % (stat.m_free >> 20)
+                 % (stat.m_largestFree >> 20)
+                 % (stat.m_heapFree >> 20)
+                 % stat.m_bytesPerRecord
+                 % (double(stat.m_payloadBytes) / stat.m_numRecords);
+}
+
+/// @brief measures compaction of the map after deletion of 90% of keys
+/// and the longest update of a key blocked by it
+void benchCompaction(const std::string& name, const std::size_t numKeys, const kvdb::IndexEngine engine)
+{
+    const auto lockTout = std::chrono::milliseconds(60000);
+    const std::string value(50, 'v');
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    kvdb::PersistableMap::Options options;
+    options.m_numShards = 8;
+    options.m_engine = engine;
+    map.InitStorage(benchMapFile("kvdb_bench_compact.map"), options);
+
+    const auto keys = generateKeys(numKeys);
+    for (const auto& key : keys)
+    {
+        map.Insert(key, value, lockTout);
+        if (map.NeedsGrowth())
+        {
+            map.Grow();
+        }
+    }
+
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        if (i % 10 != 0)
+        {
+            map.Delete(keys[i], lockTout);
+        }
+    }
+
+    std::atomic<bool> stop(false);
+    Clock::duration maxStall(0);
+    std::thread writer([&]()
+    {
+        for (std::size_t i = 0; !stop; i += 10)
+        {
+            const auto start = Clock::now();
+            map.Update(keys[i % keys.size()], value, lockTout);
+            maxStall = std::max(maxStall, Clock::now() - start);
+        }
+    });
+
+    const auto sizeBefore = map.GetStat().m_size;
+    const auto start = Clock::now();
+    const auto reclaimed = map.Compact();
+    const auto compactTime = Clock::now() - start;
+    stop = true;
+    writer.join();
+
+    std::cout << boost::format("%1%: keys = %2%, file MiB %3% -> %4%, time ms = %5%, max update stall ms = %6$.2f\n")
+                 % name
+                 % (numKeys / 10)
+                 % (sizeBefore >> 20)
+                 % ((sizeBefore - reclaimed) >> 20)
+                 % std::chrono::duration_cast<std::chrono::milliseconds>(compactTime).count()
+                 % std::chrono::duration<double, std::milli>(maxStall).count();
+}
+
+/// @brief measures number of round trips per second through the codec of the protocol version:
+/// GET command and it's result are encoded and decoded the same way sessions do it
+void benchProtocol(const std::string& name, const std::size_t numMessages, const uint32_t version)
+{
+    const auto keys = generateKeys(1000);
+    const std::string value(50, 'v');
+    std::size_t numBytes = 0;
+
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < numMessages; ++i)
+    {
+        kvdb::CommandMessage command(kvdb::CommandMessage::GET, keys[i % keys.size()]);
+        command.id = kvdb::CommandID(i);
+        std::string buffer;
+        kvdb::SerializeMessage(command, version, buffer);
+        numBytes += buffer.size();
+
+        kvdb::CommandMessage received;
+        kvdb::DeserializeMessage(buffer.data(), buffer.size(), version, received);
+
+        kvdb::ResultMessage result(kvdb::ResultMessage::GetSuccess, value);
+        result.commandId = received.id;
+        buffer.clear();
+        kvdb::SerializeMessage(result, version, buffer);
+        numBytes += buffer.size();
+
+        kvdb::ResultMessage resultReceived;
+        kvdb::DeserializeMessage(buffer.data(), buffer.size(), version, resultReceived);
+    }
+    const auto codecTime = Clock::now() - start;
+
+    std::cout << boost::format("%1%: round trips/s = %2$.0f, bytes per round trip = %3$.1f\n")
+                 % name
+                 % perSecond(numMessages, codecTime)
+                 % (double(numBytes) / numMessages);
+}
+
+/// @brief server listening on loopback with map filled by given keys, server and it's clients
+/// share numThreads threads, or connections are served by numCores contexts of their own
+/// when it is not 0. Partitioned server keeps keys in the map of every core,
+/// sockets of sessions are read and written through io_uring if ioUring is set
+class LoopbackServer
+{
+public:
+    LoopbackServer(const std::string& fileName,
+                   const std::vector<std::string>& keys,
+                   const std::size_t numThreads,
+                   const std::size_t numCores = 0,
+                   const bool partitioned = false,
+                   const bool ioUring = false)
+        : m_work(boost::asio::make_work_guard(m_ioContext))
+    {
+        if (numCores != 0)
+        {
+            m_cores = std::make_unique<kvdb::IoContextPool>(m_logger, numCores);
+        }
+
+        std::vector<kvdb::Partition> partitions;
+        for (std::size_t i = 0; i < (partitioned ? numCores : 1); ++i)
+        {
+            m_maps.emplace_back(new kvdb::PersistableMap(m_logger));
+            m_maps.back()->InitStorage(benchMapFile(fileName + "." + std::to_string(i)), kvdb::PersistableMap::Options());
+            auto& context = partitioned ? m_cores->Context(i) : m_ioContext;
+            m_processors.emplace_back(new kvdb::CommandProcessor(kvdb::CommandProcessorContext {
+                                                                     context, m_logger, *m_maps.back(), 60
+                                                                 }));
+            partitions.push_back(kvdb::Partition { context, *m_processors.back() });
+        }
+
+        if (partitioned)
+        {
+            m_router = std::make_unique<kvdb::PartitionRouter>(partitions);
+        }
+
+        const auto lockTout = std::chrono::milliseconds(500);
+        for (const auto& key : keys)
+        {
+            m_maps[m_router ? m_router->PartitionOf(key) : 0]->Insert(key, std::string(50, 'v'), lockTout);
+        }
+
+        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), 0);
+        if (numCores == 0)
+        {
+            m_servers.emplace_back(new kvdb::Server(kvdb::ServerContext {
+                                                        m_ioContext, m_logger, *m_processors.front(), endpoint,
+                                                        false, nullptr, 0, ioUring
+                                                    }));
+        }
+        else
+        {
+            for (std::size_t i = 0; i < numCores; ++i)
+            {
+                m_servers.emplace_back(new kvdb::Server(kvdb::ServerContext {
+                                                            m_cores->Context(i),
+                                                            m_logger,
+                                                            *m_processors[partitioned ? i : 0],
+                                                            endpoint,
+                                                            true,
+                                                            m_router.get(),
+                                                            i,
+                                                            ioUring
+                                                        }));
+                endpoint.port(m_servers.front()->Port());
+            }
+
+            m_cores->Start(false);
+        }
+
+        for (auto& server : m_servers)
+        {
+            server->Start();
+        }
+
+        for (std::size_t i = 0; i < numThreads; ++i)
+        {
+            m_threads.emplace_back([this]()
+            {
+                m_ioContext.run();
+            });
+        }
+    }
+
+    ~LoopbackServer()
+    {
+        if (m_cores)
+        {
+            m_cores->Stop();
+        }
+
+        m_ioContext.stop();
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    kvdb::ClientSession& Connect(const uint32_t version)
+    {
+        std::promise<bool> connected;
+        m_sessions.emplace_back(new kvdb::ClientSession(kvdb::ClientSessionContext {
+                                                            m_ioContext,
+                                                            m_logger,
+                                                            [&connected](bool success)
+                                                            {
+                                                                connected.set_value(success);
+                                                            },
+                                                            []() {},
+                                                            version
+                                                        }));
+        m_sessions.back()->Connect("127.0.0.1", Port());
+        if (!connected.get_future().get())
+        {
+            throw std::runtime_error("Failed to connect to server");
+        }
+
+        return *m_sessions.back();
+    }
+
+    uint16_t Port() const
+    {
+        return m_servers.front()->Port();
+    }
+
+private:
+    kvdb::Logger                                        m_logger;
+    boost::asio::io_context                             m_ioContext;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_work;
+    std::unique_ptr<kvdb::IoContextPool>                m_cores;
+    std::vector<std::unique_ptr<kvdb::PersistableMap>>  m_maps;
+    std::vector<std::unique_ptr<kvdb::CommandProcessor>> m_processors;
+    std::unique_ptr<kvdb::PartitionRouter>              m_router;
+    std::vector<std::unique_ptr<kvdb::Server>>          m_servers;
+    std::vector<std::thread>                            m_threads;
+    std::vector<std::unique_ptr<kvdb::ClientSession>>   m_sessions;
+};
+
+/// @brief measures number of GET commands per second executed by one connection over loopback
+/// while up to depth commands are in flight, server and client share numThreads threads
+void benchPipelining(const std::string& name,
+                     const std::size_t numCommands,
+                     const std::size_t depth,
+                     const uint32_t version,
+                     const std::size_t numThreads = 1)
+{
+    static const std::size_t scNumKeys = 1000;
+    const auto keys = generateKeys(scNumKeys);
+    LoopbackServer server("kvdb_bench_pipelining.map", keys, numThreads);
+    auto& session = server.Connect(version);
+
+    std::atomic<std::size_t> numSent(0);
+    std::atomic<std::size_t> numFinished(0);
+    std::promise<void> finished;
+    std::function<void()> sendNext = [&]()
+    {
+        const auto idx = numSent++;
+        if (idx >= numCommands)
+        {
+            return;
+        }
+
+        session.SendCommand(kvdb::CommandMessage(kvdb::CommandMessage::GET, keys[idx % scNumKeys]),
+                            [&](bool, const std::string&)
+                            {
+                                if (++numFinished == numCommands)
+                                {
+                                    finished.set_value();
+                                    return;
+                                }
+
+                                sendNext();
+                            });
+    };
+
+    const auto outSegments = tcpOutSegments();
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < depth; ++i)
+    {
+        sendNext();
+    }
+
+    finished.get_future().wait();
+    const auto runTime = Clock::now() - start;
+
+    // segments are counted by the whole host, both commands and results are included
+    std::cout << boost::format("%1%: commands = %2%, depth = %3%, threads = %4%, commands/s = %5$.0f, "
+                               "tcp segments/command = %6$.2f\n")
+                 % name
+                 % numCommands
+                 % depth
+                 % numThreads
+                 % perSecond(numCommands, runTime)
+                 % (double(tcpOutSegments() - outSegments) / numCommands);
+}
+
+/// @brief measures number of GET or UPDATE commands per second executed by numConnections connections
+/// with 16 commands in flight each, connections are served by the shared context of the server
+/// or, when numCores is not 0, by per-core contexts which accept them on the same port,
+/// every core owns a partition of the keys if partitioned
+void benchConnections(const std::string& name,
+                      const std::size_t numCommands,
+                      const std::size_t numConnections,
+                      const std::size_t numCores,
+                      const bool partitioned,
+                      const int type)
+{
+    static const std::size_t scNumKeys = 1000;
+    static const std::size_t scDepth = 16;
+    const auto keys = generateKeys(scNumKeys);
+    const auto numThreads = std::max(2u, std::thread::hardware_concurrency());
+    LoopbackServer server("kvdb_bench_connections.map", keys, numThreads, numCores, partitioned);
+    const std::string value(type == kvdb::CommandMessage::UPDATE ? 50 : 0, 'u');
+
+    std::vector<kvdb::ClientSession*> sessions;
+    for (std::size_t i = 0; i < numConnections; ++i)
+    {
+        sessions.push_back(&server.Connect(kvdb::scProtocolBinary));
+    }
+
+    std::atomic<std::size_t> numSent(0);
+    std::atomic<std::size_t> numFinished(0);
+    std::promise<void> finished;
+    std::function<void(kvdb::ClientSession&)> sendNext = [&](kvdb::ClientSession& session)
+    {
+        const auto idx = numSent++;
+        if (idx >= numCommands)
+        {
+            return;
+        }
+
+        session.SendCommand(kvdb::CommandMessage(type, keys[idx % scNumKeys], value),
+                            [&](bool, const std::string&)
+                            {
+                                if (++numFinished == numCommands)
+                                {
+                                    finished.set_value();
+                                    return;
+                                }
+
+                                sendNext(session);
+                            });
+    };
+
+    const auto start = Clock::now();
+    for (auto session : sessions)
+    {
+        for (std::size_t i = 0; i < scDepth; ++i)
+        {
+            sendNext(*session);
+        }
+    }
+
+    finished.get_future().wait();
+    const auto runTime = Clock::now() - start;
+
+    std::cout << boost::format("%1%: %2% commands = %3%, connections = %4%, cores = %5%, commands/s = %6$.0f\n")
+                 % name
+                 % (type == kvdb::CommandMessage::UPDATE ? "UPDATE" : "GET")
+                 % numCommands
+                 % numConnections
+                 % numCores
+                 % perSecond(numCommands, runTime);
+}
+
+/// @brief measures number of GET commands per second received by the server from numConnections
+/// connections, every connection writes depth pipelined commands at once and reads their results
+void benchReceive(const std::string& name,
+                  const std::size_t numCommands,
+                  const std::size_t numConnections,
+                  const std::size_t depth)
+{
+    static const std::size_t scNumKeys = 1000;
+    const auto keys = generateKeys(scNumKeys);
+    const auto numThreads = std::max(2u, std::thread::hardware_concurrency());
+    LoopbackServer server("kvdb_bench_receive.map", keys, numThreads);
+
+    boost::asio::io_context ioContext;
+    std::vector<std::unique_ptr<boost::asio::ip::tcp::socket>> sockets;
+    for (std::size_t i = 0; i < numConnections; ++i)
+    {
+        sockets.emplace_back(new boost::asio::ip::tcp::socket(ioContext));
+        auto& socket = *sockets.back();
+        socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), server.Port()));
+        socket.set_option(boost::asio::ip::tcp::no_delay(true));
+        kvdb::Handshake handshake(kvdb::scProtocolBinary);
+        boost::asio::write(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+        boost::asio::read(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+    }
+
+    // every key has the value of the same size, so results of a burst have known size
+    std::string burst;
+    for (std::size_t i = 0; i < depth; ++i)
+    {
+        std::string message(kvdb::scMessageHeaderSize, '\0');
+        kvdb::SerializeMessage(kvdb::CommandMessage(kvdb::CommandMessage::GET, keys[i % scNumKeys]),
+                               kvdb::scProtocolBinary, message);
+        const kvdb::MessageHeader header(uint32_t(message.size() - kvdb::scMessageHeaderSize));
+        std::memcpy(&message[0], &header, kvdb::scMessageHeaderSize);
+        burst += message;
+    }
+
+    std::string result(kvdb::scMessageHeaderSize, '\0');
+    kvdb::SerializeMessage(kvdb::ResultView(0, kvdb::ResultMessage::GetSuccess, std::string(50, 'v')),
+                           kvdb::scProtocolBinary, result);
+    std::string results(depth * result.size(), '\0');
+
+    const std::size_t numRounds = std::max<std::size_t>(1, numCommands / (numConnections * depth));
+    const auto start = Clock::now();
+    for (std::size_t round = 0; round < numRounds; ++round)
+    {
+        for (auto& socket : sockets)
+        {
+            boost::asio::write(*socket, boost::asio::buffer(burst));
+        }
+
+        for (auto& socket : sockets)
+        {
+            boost::asio::read(*socket, boost::asio::buffer(&results[0], results.size()));
+        }
+    }
+
+    const auto runTime = Clock::now() - start;
+    std::cout << boost::format("%1%: commands = %2%, connections = %3%, depth = %4%, commands/s = %5$.0f\n")
+                 % name
+                 % (numRounds * numConnections * depth)
+                 % numConnections
+                 % depth
+                 % perSecond(numRounds * numConnections * depth, runTime);
+}
+
+/// @brief compares transports of sessions by number of GET commands per second received by the server
+/// from numConnections connections, every connection writes depth pipelined commands at once and reads
+/// their results. Connections are made by a client process, so every process has one descriptor per
+/// connection, and they come from several loopback addresses, each having fewer ephemeral ports
+void benchTransport(const std::string& name,
+                    const std::size_t numCommands,
+                    const std::size_t numConnections,
+                    const std::size_t depth,
+                    const bool ioUring)
+{
+    using boost::asio::ip::tcp;
+    using BindAddressNoPort = boost::asio::detail::socket_option::boolean<IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT>;
+
+    static const std::size_t scNumKeys = 1000;
+    static const std::size_t scConnectionsPerAddress = 20000;
+    static const rlim_t scReservedDescriptors = 256;    ///< map files, listening sockets, pipes and rings
+
+    /// @brief numbers reported by the client
+    struct Report
+    {
+        uint64_t    m_numCommands = 0;
+        double      m_seconds = 0;
+    };
+
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = std::max(limit.rlim_cur, std::min<rlim_t>(limit.rlim_max, numConnections + scReservedDescriptors));
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < numConnections + scReservedDescriptors)
+    {
+        std::cout << boost::format("%1%: connections = %2% skipped, limit of descriptors is %3%\n")
+                     % name
+                     % numConnections
+                     % limit.rlim_cur;
+        return;
+    }
+
+    // client is forked before threads of the server are started, results are printed by the server
+    int portPipe[2];
+    int reportPipe[2];
+    if (pipe(portPipe) != 0 || pipe(reportPipe) != 0)
+    {
+        throw std::runtime_error("Failed to create pipes of the client");
+    }
+
+    std::cout.flush();
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(portPipe[1]);
+        close(reportPipe[0]);
+        uint16_t port = 0;
+        if (read(portPipe[0], &port, sizeof(port)) != sizeof(port) || port == 0)
+        {
+            _exit(1);
+        }
+
+        try
+        {
+            const auto keys = generateKeys(scNumKeys);
+            boost::asio::io_context ioContext;
+            std::vector<std::unique_ptr<tcp::socket>> sockets;
+            for (std::size_t i = 0; i < numConnections; ++i)
+            {
+                sockets.emplace_back(new tcp::socket(ioContext));
+                auto& socket = *sockets.back();
+                const auto source = boost::asio::ip::address_v4(
+                                        boost::asio::ip::address_v4::loopback().to_uint() + 1
+                                        + uint32_t(i / scConnectionsPerAddress));
+                socket.open(tcp::v4());
+                socket.set_option(BindAddressNoPort(true));
+                socket.bind(tcp::endpoint(source, 0));
+                socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+                socket.set_option(tcp::no_delay(true));
+                kvdb::Handshake handshake(kvdb::scProtocolBinary);
+                boost::asio::write(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+                boost::asio::read(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+            }
+
+            std::string burst;
+            for (std::size_t i = 0; i < depth; ++i)
+            {
+                std::string message(kvdb::scMessageHeaderSize, '\0');
+                kvdb::SerializeMessage(kvdb::CommandMessage(kvdb::CommandMessage::GET, keys[i % scNumKeys]),
+                                       kvdb::scProtocolBinary, message);
+                const kvdb::MessageHeader header(uint32_t(message.size() - kvdb::scMessageHeaderSize));
+                std::memcpy(&message[0], &header, kvdb::scMessageHeaderSize);
+                burst += message;
+            }
+
+            std::string result(kvdb::scMessageHeaderSize, '\0');
+            kvdb::SerializeMessage(kvdb::ResultView(0, kvdb::ResultMessage::GetSuccess, std::string(50, 'v')),
+                                   kvdb::scProtocolBinary, result);
+            std::string results(depth * result.size(), '\0');
+
+            // server measures it's CPU time between the start and the report
+            const char started = 1;
+            if (write(reportPipe[1], &started, 1) != 1)
+            {
+                _exit(1);
+            }
+
+            const std::size_t numRounds = std::max<std::size_t>(1, numCommands / (numConnections * depth));
+            const auto start = Clock::now();
+            for (std::size_t round = 0; round < numRounds; ++round)
+            {
+                for (auto& socket : sockets)
+                {
+                    boost::asio::write(*socket, boost::asio::buffer(burst));
+                }
+
+                for (auto& socket : sockets)
+                {
+                    boost::asio::read(*socket, boost::asio::buffer(&results[0], results.size()));
+                }
+            }
+
+            Report report;
+            report.m_numCommands = numRounds * numConnections * depth;
+            report.m_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            _exit(write(reportPipe[1], &report, sizeof(report)) == sizeof(report) ? 0 : 1);
+        }
+        catch (std::exception& err)
+        {
+            std::cerr << name << ": client failed: " << err.what() << std::endl;
+            _exit(1);
+        }
+    }
+
+    close(portPipe[0]);
+    close(reportPipe[1]);
+    const auto cpuTime = []()
+    {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return double(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+                + double(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    };
+
+    const auto finish = [&](const uint16_t port)
+    {
+        const bool sent = write(portPipe[1], &port, sizeof(port)) == sizeof(port);
+        char started = 0;
+        const bool running = sent && port != 0 && read(reportPipe[0], &started, 1) == 1;
+        const double startCpu = cpuTime();
+        Report report;
+        const bool reported = running && read(reportPipe[0], &report, sizeof(report)) == sizeof(report);
+        const double serverCpu = cpuTime() - startCpu;
+        close(portPipe[1]);
+        close(reportPipe[0]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!reported)
+        {
+            return false;
+        }
+
+        std::cout << boost::format("%1%: commands = %2%, connections = %3%, depth = %4%, commands/s = %5$.0f, "
+                                   "server cpu us/command = %6$.2f\n")
+                     % name
+                     % report.m_numCommands
+                     % numConnections
+                     % depth
+                     % (double(report.m_numCommands) / report.m_seconds)
+                     % (serverCpu * 1e6 / double(report.m_numCommands));
+        return true;
+    };
+
+    std::unique_ptr<LoopbackServer> server;
+    try
+    {
+        const auto numThreads = std::max(2u, std::thread::hardware_concurrency());
+        server.reset(new LoopbackServer("kvdb_bench_transport.map", generateKeys(scNumKeys), numThreads,
+                                        0, false, ioUring));
+    }
+    catch (std::runtime_error& err)
+    {
+        finish(0);
+        std::cout << boost::format("%1%: connections = %2% skipped, %3%\n") % name % numConnections % err.what();
+        return;
+    }
+
+    if (!finish(server->Port()))
+    {
+        throw std::runtime_error("Client of the transport benchmark failed");
+    }
+}
+
+/// @brief measures number of keys per second read by one connection over loopback
+/// with MGET of batchSize keys or, when batchSize is 1, with GET, one command in flight
+void benchBatch(const std::string& name, const std::size_t numKeys, const std::size_t batchSize)
+{
+    static const std::size_t scNumKeys = 1000;
+    const auto keys = generateKeys(scNumKeys);
+    LoopbackServer server("kvdb_bench_batch.map", keys, 1);
+    auto& session = server.Connect(kvdb::scProtocolBinary);
+
+    std::size_t numRead = 0;
+    const auto start = Clock::now();
+    for (std::size_t offset = 0; offset < numKeys; offset += batchSize)
+    {
+        std::promise<std::size_t> done;
+        if (batchSize == 1)
+        {
+            session.SendCommand(kvdb::CommandMessage(kvdb::CommandMessage::GET, keys[offset % scNumKeys]),
+                                [&done](bool success, const std::string&)
+                                {
+                                    done.set_value(success ? 1 : 0);
+                                });
+        }
+        else
+        {
+            std::vector<std::string> batch;
+            for (std::size_t i = offset; i < offset + batchSize; ++i)
+            {
+                batch.push_back(keys[i % scNumKeys]);
+            }
+
+            session.MultiGet(batch, [&done](bool success, const std::vector<kvdb::BatchItem>& items)
+            {
+                done.set_value(success ? items.size() : 0);
+            });
+        }
+
+        numRead += done.get_future().get();
+    }
+
+    const auto runTime = Clock::now() - start;
+    if (numRead < numKeys)
+    {
+        throw std::runtime_error("Failed to read keys");
+    }
+
+    std::cout << boost::format("%1%: keys = %2%, batch = %3%, keys/s = %4$.0f\n")
+                 % name
+                 % numRead
+                 % batchSize
+                 % perSecond(numRead, runTime);
+}
+
+/// @brief measures number and size of allocations made by the server per command of every type,
+/// commands with values of valueSize bytes are sent one by one over a raw socket, so the client
+/// itself does not allocate while measured
+void benchAllocations(const std::string& name, const std::size_t numCommands, const std::size_t valueSize)
+{
+    using boost::asio::ip::tcp;
+
+    LoopbackServer server("kvdb_bench_allocations.map", std::vector<std::string>(), 1);
+    boost::asio::io_context ioContext;
+    tcp::socket socket(ioContext);
+    socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), server.Port()));
+    socket.set_option(tcp::no_delay(true));
+
+    kvdb::Handshake handshake(kvdb::scProtocolBinary);
+    boost::asio::write(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+    boost::asio::read(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+
+    const auto keys = generateKeys(numCommands);
+    const std::string value(valueSize, 'v');
+    std::vector<char> result(kvdb::scMaxResultSize);
+
+    const auto run = [&](const std::string& operation, const int type, const std::string& commandValue,
+                         const int successCode)
+    {
+        std::vector<std::string> messages;
+        for (std::size_t i = 0; i < numCommands; ++i)
+        {
+            kvdb::CommandMessage command(type, keys[i], commandValue);
+            command.id = kvdb::CommandID(i + 1);
+            std::string body;
+            kvdb::SerializeMessage(command, kvdb::scProtocolBinary, body);
+            const kvdb::MessageHeader header(uint32_t(body.size()));
+            messages.emplace_back(reinterpret_cast<const char*>(&header), kvdb::scMessageHeaderSize);
+            messages.back().append(body);
+        }
+
+        const auto numAllocations = g_numAllocations.load();
+        const auto allocatedBytes = g_allocatedBytes.load();
+        std::size_t numFailed = 0;
+        for (const auto& message : messages)
+        {
+            kvdb::MessageHeader header;
+            boost::asio::write(socket, boost::asio::buffer(message));
+            boost::asio::read(socket, boost::asio::buffer(&header, kvdb::scMessageHeaderSize));
+            boost::asio::read(socket, boost::asio::buffer(result.data(), header.m_msgSize));
+            // code follows the id of the command
+            numFailed += result[sizeof(kvdb::CommandID)] == successCode ? 0 : 1;
+        }
+
+        std::cout << boost::format("%1%: %2%, value = %3% bytes, allocations/command = %4$.1f, "
+                                   "allocated bytes/command = %5$.0f, failed = %6%\n")
+                     % name
+                     % operation
+                     % valueSize
+                     % (double(g_numAllocations.load() - numAllocations) / numCommands)
+                     % (double(g_allocatedBytes.load() - allocatedBytes) / numCommands)
+                     % numFailed;
+    };
+
+    run("INSERT", kvdb::CommandMessage::INSERT, value, kvdb::ResultMessage::InsertSuccess);
+    run("GET", kvdb::CommandMessage::GET, std::string(), kvdb::ResultMessage::GetSuccess);
+    run("UPDATE", kvdb::CommandMessage::UPDATE, value, kvdb::ResultMessage::UpdateSuccess);
+    run("DELETE", kvdb::CommandMessage::DELETE, std::string(), kvdb::ResultMessage::DeleteSuccess);
+}
+
+int main(int argc, char** argv)
+{
+    const std::string benchmark = argc > 1 ? argv[1] : "all";
+    const std::size_t numKeys = argc > 2 ? std::stoul(argv[2]) : 1000000;
+
+    if (benchmark == "all" || benchmark == "map_lookup")
+    {
+        benchMapLookup("map_lookup", numKeys, {1, kvdb::IndexEngine::Hashed});
+    }
+
+    if (benchmark == "all" || benchmark == "engines")
+    {
+        benchMapLookup("engines[hashed]", numKeys, {1, kvdb::IndexEngine::Hashed});
+        benchMapLookup("engines[swiss]", numKeys, {1, kvdb::IndexEngine::Swiss});
+    }
+
+    if (benchmark == "all" || benchmark == "insert_latency")
+    {
+        benchInsertLatency("insert_latency[hashed]", numKeys, kvdb::IndexEngine::Hashed);
+        benchInsertLatency("insert_latency[swiss]", numKeys, kvdb::IndexEngine::Swiss);
+    }
+
+    if (benchmark == "all" || benchmark == "growth_latency")
+    {
+        benchGrowthLatency("growth_latency[hashed]", numKeys, kvdb::IndexEngine::Hashed);
+        benchGrowthLatency("growth_latency[swiss]", numKeys, kvdb::IndexEngine::Swiss);
+    }
+
+    if (benchmark == "all" || benchmark == "wal_commit")
+    {
+        using SyncPolicy = kvdb::WriteAheadLog::SyncPolicy;
+        benchLogCommit("wal_commit[per-op]", numKeys, SyncPolicy::PerOperation);
+        benchLogCommit("wal_commit[interval]", numKeys, SyncPolicy::Interval);
+        benchLogCommit("wal_commit[none]", numKeys, SyncPolicy::None);
+    }
+
+    if (benchmark == "all" || benchmark == "checkpoint_stall")
+    {
+        benchCheckpointStall("checkpoint_stall", numKeys);
+    }
+
+    if (benchmark == "all" || benchmark == "ordered_index")
+    {
+        kvdb::PersistableMap::Options options;
+        benchMapLookup("ordered_index[off]", numKeys, options);
+        options.m_orderedIndex = true;
+        benchMapLookup("ordered_index[on]", numKeys, options);
+        benchScan("ordered_index[scan]", numKeys, 100);
+        benchScan("ordered_index[scan]", numKeys, 1000);
+    }
+
+    if (benchmark == "all" || benchmark == "update_churn")
+    {
+        // values are up to 1 MiB, so number of keys is scaled down
+        const auto numChurnKeys = std::max<std::size_t>(numKeys / 1000, 100);
+        benchUpdateChurn("update_churn[hashed]", numChurnKeys, kvdb::scMaxValueSize, kvdb::IndexEngine::Hashed);
+        benchUpdateChurn("update_churn[swiss]", numChurnKeys, kvdb::scMaxValueSize, kvdb::IndexEngine::Swiss);
+        benchUpdateChurn("update_churn[small]", numChurnKeys * 20, 16 * 1024, kvdb::IndexEngine::Swiss);
+    }
+
+    if (benchmark == "all" || benchmark == "compaction")
+    {
+        benchCompaction("compaction[hashed]", numKeys, kvdb::IndexEngine::Hashed);
+        benchCompaction("compaction[swiss]", numKeys, kvdb::IndexEngine::Swiss);
+    }
+
+    if (benchmark == "all" || benchmark == "protocol")
+    {
+        benchProtocol("protocol[text]", numKeys, kvdb::scProtocolText);
+        benchProtocol("protocol[binary]", numKeys, kvdb::scProtocolBinary);
+    }
+
+    if (benchmark == "all" || benchmark == "pipelining")
+    {
+        benchPipelining("pipelining[text]", numKeys, 1, kvdb::scProtocolText);
+        benchPipelining("pipelining[binary]", numKeys, 1, kvdb::scProtocolBinary);
+        benchPipelining("pipelining[binary]", numKeys, 16, kvdb::scProtocolBinary);
+        benchPipelining("pipelining[binary]", numKeys, 1000, kvdb::scProtocolBinary);
+        benchPipelining("pipelining[binary]", numKeys, 1000, kvdb::scProtocolBinary,
+                        std::max(2u, std::thread::hardware_concurrency()));
+    }
+
+    if (benchmark == "all" || benchmark == "connections")
+    {
+        const std::size_t numCores = std::thread::hardware_concurrency();
+        // sessions log every connection
+        kvdb::Logger::SetLevel(kvdb::LogLevel::Off);
+        for (const int type : { kvdb::CommandMessage::GET, kvdb::CommandMessage::UPDATE })
+        {
+            benchConnections("connections[shared]", numKeys, 64, 0, false, type);
+            benchConnections("connections[per-core]", numKeys, 64, numCores, false, type);
+            benchConnections("connections[partitioned]", numKeys, 64, numCores, true, type);
+        }
+        kvdb::Logger::SetLevel(kvdb::LogLevel::Info);
+    }
+
+    if (benchmark == "all" || benchmark == "receive")
+    {
+        // every connection takes 2 descriptors of the process, 10000 and more connections
+        // require ulimit -n to be raised, sessions log every connection
+        kvdb::Logger::SetLevel(kvdb::LogLevel::Off);
+        for (const std::size_t numConnections : { 1000, 8000 })
+        {
+            benchReceive("receive", numKeys, numConnections, 1);
+            benchReceive("receive", numKeys, numConnections, 16);
+        }
+        kvdb::Logger::SetLevel(kvdb::LogLevel::Info);
+    }
+
+    if (benchmark == "all" || benchmark == "transport")
+    {
+        // sessions log every connection
+        kvdb::Logger::SetLevel(kvdb::LogLevel::Off);
+        for (const std::size_t numConnections : { 1000, 10000, 50000 })
+        {
+            benchTransport("transport[asio]", numKeys, numConnections, 16, false);
+            benchTransport("transport[io_uring]", numKeys, numConnections, 16, true);
+        }
+        kvdb::Logger::SetLevel(kvdb::LogLevel::Info);
+    }
+
+    if (benchmark == "all" || benchmark == "batch")
+    {
+        benchBatch("batch[get]", numKeys / 10, 1);
+        benchBatch("batch[mget]", numKeys, 20);
+        benchBatch("batch[mget]", numKeys, 200);
+    }
+
+    if (benchmark == "all" || benchmark == "allocations")
+    {
+        benchAllocations("allocations", numKeys, 100);
+        benchAllocations("allocations", std::max<std::size_t>(numKeys / 100, 100), 256 * 1024);
+    }
+
+    return 0;
+}
@@ -4,8 +4,6 @@
 #include <boost/asio.hpp>
 #include <boost/program_options.hpp>
 #include <boost/format.hpp>
-#include <boost/log/sinks.hpp>
-#include <boost/core/null_deleter.hpp>
 
 #include "../lib/ClientSession.hpp"
 #include "../lib/Application.hpp"
@@ -20,24 +18,13 @@ public:
     static constexpr char scArgHostname[] = "hostname";
     static constexpr char scArgPort[] = "port";
     static constexpr char scArgCommand[] = "command";
+    static constexpr char scArgLimit[] = "limit";
+    static constexpr char scArgProtocol[] = "protocol";
+    static constexpr char scArgLogLevel[] = "log-level";
     static constexpr int scDefaultPort = 1524;
 
     ClientApp(int argc, char** argv)
     {
-        ///-----------------------------------------------------------------------------------------
-        /// Configure logger
-
-        {
-            using namespace boost::log;
-
-            using text_sink = sinks::asynchronous_sink<sinks::text_ostream_backend>;
-            boost::shared_ptr<text_sink> sink = boost::make_shared<text_sink>();
-
-            boost::shared_ptr<std::ostream> stream{ &std::clog, boost::null_deleter{} };
-            sink->locked_backend()->add_stream(stream);
-            core::get()->add_sink(sink);
-        }
-
         ///-----------------------------------------------------------------------------------------
         /// Configure application arguments
         using namespace boost::program_options;
@@ -49,10 +36,16 @@ public:
                 (scArgPort, value<int>()->default_value(scDefaultPort),
                  "[required] port of the KVDB host to connect to")
                 (scArgCommand, value<std::vector<std::string>>(),
-                 "[required] command to execute");
+                 "[required] command to execute")
+                (scArgLimit, value<uint32_t>()->default_value(scDefaultScanLimit),
+                 "[optional] number of pairs requested by every page of SCAN and SCAN_PREFIX")
+                (scArgProtocol, value<std::string>()->default_value("binary"),
+                 "[optional] encoding of messages proposed to the server: binary or text")
+                (scArgLogLevel, value<std::string>()->default_value("info"),
+                 "[optional] minimum level of logged records: debug, info, warning, error or off");
 
         positional_options_description posDesc;
-        posDesc.add(scArgCommand, 3);
+        posDesc.add(scArgCommand, -1);
 
         try
         {
@@ -65,30 +58,54 @@ public:
         }
         catch (boost::program_options::error& e)
         {
-            m_logger.LogRecord(std::string("Error while parse comand line arguments: ") + e.what());
-            std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+            m_logger.LogRecord(LogLevel::Error, std::string("Error while parse comand line arguments: ") + e.what());
+            Logger::Flush();
             exit(-1);
         }
 
+        LogLevel logLevel = LogLevel::Info;
+        const auto logLevelName = m_varMap[scArgLogLevel].as<std::string>();
+        if (!Logger::ParseLevel(logLevelName, logLevel))
+        {
+            m_logger.LogRecord(LogLevel::Error, std::string("Unknown log level : ") + logLevelName);
+            Logger::Flush();
+            exit(-1);
+        }
+
+        Logger::SetLevel(logLevel);
+
         if (m_varMap.count(scArgHostname) == 0)
         {
-            m_logger.LogRecord("host is required");
-            std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+            m_logger.LogRecord(LogLevel::Error, "host is required");
+            Logger::Flush();
             exit(-1);
         }
 
         if (m_varMap.count(scArgCommand) == 0)
         {
-            m_logger.LogRecord("command is required");
-            std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+            m_logger.LogRecord(LogLevel::Error, "command is required");
+            Logger::Flush();
             exit(-1);
         }
 
         const auto command = m_varMap[scArgCommand].as<std::vector<std::string>>();
         if (!parseCommand(command, m_command))
         {
-            m_logger.LogRecord("Unable to parse command");
-            std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+            m_logger.LogRecord(LogLevel::Error, "Unable to parse command");
+            Logger::Flush();
+            exit(-1);
+        }
+
+        const auto protocol = m_varMap[scArgProtocol].as<std::string>();
+        uint32_t protocolVersion = scProtocolBinary;
+        if (protocol == "text")
+        {
+            protocolVersion = scProtocolText;
+        }
+        else if (protocol != "binary")
+        {
+            m_logger.LogRecord(LogLevel::Error, std::string("Unknown protocol : ") + protocol);
+            Logger::Flush();
             exit(-1);
         }
 
@@ -101,7 +118,8 @@ public:
                                                         m_logger,
                                                         std::bind(&ClientApp::onConnect, this,
                                                                   std::placeholders::_1),
-                                                        std::bind(&ClientApp::onClose, this)
+                                                        std::bind(&ClientApp::onClose, this),
+                                                        protocolVersion
                                                     });
     }
 
@@ -171,6 +189,75 @@ private:
             msg.key.Set(command[scKeyIdx]);
             msg.value.Set(std::string());
         }
+        else if (operation == "SCAN")
+        {
+            if (command.size() > 3)
+            {
+                m_logger.LogRecord("SCAN accepts up to 2 arguments: SCAN [<start> [<end>]]");
+                return false;
+            }
+
+            msg.type = CommandMessage::SCAN;
+            msg.key.Set(command.size() > 1 ? command[scKeyIdx] : std::string());
+            msg.value.Set(command.size() > 2 ? command[scValueIdx] : std::string());
+            msg.limit = m_varMap[scArgLimit].as<uint32_t>();
+        }
+        else if (operation == "SCAN_PREFIX")
+        {
+            if (command.size() != 2)
+            {
+                m_logger.LogRecord("SCAN_PREFIX requires 1 argument: SCAN_PREFIX <prefix>");
+                return false;
+            }
+
+            msg.type = CommandMessage::SCAN_PREFIX;
+            msg.key.Set(command[scKeyIdx]);
+            msg.value.Set(std::string());
+            msg.limit = m_varMap[scArgLimit].as<uint32_t>();
+        }
+        else if (operation == "COMPACT")
+        {
+            if (command.size() != 1)
+            {
+                m_logger.LogRecord("COMPACT has no arguments");
+                return false;
+            }
+
+            msg.type = CommandMessage::COMPACT;
+            msg.key.Set(std::string());
+            msg.value.Set(std::string());
+        }
+        else if (operation == "MGET" || operation == "MDELETE")
+        {
+            if (command.size() < 2)
+            {
+                m_logger.LogRecord(operation + " requires at least 1 argument: " + operation + " <key> [<key> ...]");
+                return false;
+            }
+
+            m_batchKeys.assign(command.begin() + scKeyIdx, command.end());
+            msg.type = operation == "MGET" ? CommandMessage::MGET : CommandMessage::MDELETE;
+            msg.key.Set(std::string());
+            msg.value.Set(std::string());
+        }
+        else if (operation == "MSET")
+        {
+            if (command.size() < 3 || command.size() % 2 != 1)
+            {
+                m_logger.LogRecord("MSET requires pairs of arguments: MSET <key> <value> [<key> <value> ...]");
+                return false;
+            }
+
+            for (std::size_t idx = scKeyIdx; idx < command.size(); idx += 2)
+            {
+                m_batchPairs.emplace_back(command[idx], command[idx + 1]);
+                m_batchKeys.push_back(command[idx]);
+            }
+
+            msg.type = CommandMessage::MSET;
+            msg.key.Set(std::string());
+            msg.value.Set(std::string());
+        }
         else
         {
             m_logger.LogRecord(std::string("Unknown operation : ") + operation);
@@ -189,13 +276,85 @@ private:
         else
         {
             m_logger.LogRecord("ClientSession connected!");
-            m_session->SendCommand(m_command,
-                                   std::bind(&ClientApp::onResultReceived, this,
-                                             std::placeholders::_1,
-                                             std::placeholders::_2));
+            sendCommand();
+        }
+    }
+
+    void sendCommand()
+    {
+        if (m_command.type == CommandMessage::SCAN || m_command.type == CommandMessage::SCAN_PREFIX)
+        {
+            m_session->SendScan(m_command,
+                                std::bind(&ClientApp::onBatchReceived, this,
+                                          std::placeholders::_1),
+                                std::bind(&ClientApp::onScanFinished, this,
+                                          std::placeholders::_1,
+                                          std::placeholders::_2));
+            return;
+        }
+
+        // payload of the batch is encoded with the protocol accepted by the server
+        if (isBatch(m_command.type))
+        {
+            const auto callback = std::bind(&ClientApp::onBatchFinished, this,
+                                            std::placeholders::_1,
+                                            std::placeholders::_2);
+            if (m_command.type == CommandMessage::MSET)
+            {
+                m_session->MultiSet(m_batchPairs, callback);
+            }
+            else if (m_command.type == CommandMessage::MGET)
+            {
+                m_session->MultiGet(m_batchKeys, callback);
+            }
+            else
+            {
+                m_session->MultiDelete(m_batchKeys, callback);
+            }
+
+            return;
+        }
+
+        m_session->SendCommand(m_command,
+                               std::bind(&ClientApp::onResultReceived, this,
+                                         std::placeholders::_1,
+                                         std::placeholders::_2));
+    }
+
+    void onBatchReceived(const std::vector<KeyValue>& pairs)
+    {
+        for (const auto& pair : pairs)
+        {
+            std::cout << pair.first << ' ' << pair.second << '\n';
         }
     }
 
+    /// @brief requests pages one by one until the whole range is received
+    void onScanFinished(bool success, const std::string& cursor)
+    {
+        if (!success)
+        {
+            throw std::runtime_error("Server failed to execute command");
+        }
+
+        if (cursor.empty())
+        {
+            m_ioContext.stop();
+            return;
+        }
+
+        if (m_command.type == CommandMessage::SCAN)
+        {
+            m_command.key.Set(cursor);
+        }
+        else
+        {
+            m_command.value.Set(cursor);
+        }
+
+        sendCommand();
+    }
+
     void onResultReceived(bool success, const std::string& value)
     {
         if (!success)
@@ -210,6 +369,52 @@ private:
         m_ioContext.stop();
     }
 
+    static bool isBatch(int type)
+    {
+        return type == CommandMessage::MGET || type == CommandMessage::MSET || type == CommandMessage::MDELETE;
+    }
+
+    /// @brief prints result of every item of the batch next to it's key
+    void onBatchFinished(bool success, const std::vector<BatchItem>& items)
+    {
+        if (!success)
+        {
+            throw std::runtime_error("Server failed to execute command");
+        }
+
+        if (items.size() != m_batchKeys.size())
+        {
+            throw std::runtime_error("Server returned wrong number of batch items");
+        }
+
+        for (std::size_t idx = 0; idx < items.size(); ++idx)
+        {
+            std::cout << m_batchKeys[idx] << ' ' << describeItem(items[idx]) << '\n';
+        }
+
+        m_ioContext.stop();
+    }
+
+    static std::string describeItem(const BatchItem& item)
+    {
+        switch (item.code)
+        {
+        case ResultMessage::GetSuccess:
+            return item.value;
+        case ResultMessage::GetFailed:
+        case ResultMessage::DeleteFailed:
+            return "(not found)";
+        case ResultMessage::InsertSuccess:
+            return "(inserted)";
+        case ResultMessage::UpdateSuccess:
+            return "(updated)";
+        case ResultMessage::DeleteSuccess:
+            return "(deleted)";
+        default:
+            return "(failed)";
+        }
+    }
+
     void onClose()
     {
         m_logger.LogRecord("Connection closed. Exiting...");
@@ -219,6 +424,8 @@ private:
     boost::program_options::variables_map   m_varMap;
     ClientSession::Ptr      m_session;
     CommandMessage          m_command;
+    std::vector<std::string> m_batchKeys;   ///< keys of MGET, MSET or MDELETE in the order of items
+    std::vector<KeyValue>   m_batchPairs;   ///< pairs of MSET
 };
 
 } // namespace kvdb
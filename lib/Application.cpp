@@ -24,7 +24,7 @@ void Application::Run(uint numThreads)
         }
         catch (std::exception e)
         {
-            m_logger.LogRecord((boost::format("Exception: %1%") % e.what()).str());
+            m_logger.LogRecord(LogLevel::Error, (boost::format("Exception: %1%") % e.what()).str());
             exit(-1);
         }
     };
@@ -1,6 +1,7 @@
 #include <boost/format.hpp>
 
 #include "ClientSession.hpp"
+#include "Serialization.hpp"
 
 namespace kvdb
 {
@@ -15,14 +16,14 @@ ClientSession::ClientSession(const ClientSessionContext& context)
 
 ClientSession::~ClientSession()
 {
-    m_logger.LogRecord("ClientSession destroyed");
+    m_logger.LogRecord(LogLevel::Debug, "ClientSession destroyed");
 }
 
 void ClientSession::Connect(const std::string& hostname, int port)
 {
     if (m_socket.is_open())
     {
-        m_logger.LogRecord("Already connected");
+        m_logger.LogRecord(LogLevel::Warning, "Already connected");
         return;
     }
 
@@ -35,18 +36,85 @@ void ClientSession::Connect(const std::string& hostname, int port)
 void ClientSession::SendCommand(const CommandMessage& command,
                                 const ResultCallback& callback)
 {
-    m_strand.post([this, command, callback]()
+    sendCommand(command, BatchCallback(), callback);
+}
+
+void ClientSession::SendScan(const CommandMessage& command,
+                             const BatchCallback& batchCallback,
+                             const ResultCallback& callback)
+{
+    sendCommand(command, batchCallback, callback);
+}
+
+void ClientSession::MultiGet(const std::vector<std::string>& keys, const BatchResultCallback& callback)
+{
+    sendBatch(CommandMessage::MGET, SerializeKeys(keys, m_protocolVersion), callback);
+}
+
+void ClientSession::MultiSet(const std::vector<KeyValue>& pairs, const BatchResultCallback& callback)
+{
+    sendBatch(CommandMessage::MSET, SerializeKeyValues(pairs, m_protocolVersion), callback);
+}
+
+void ClientSession::MultiDelete(const std::vector<std::string>& keys, const BatchResultCallback& callback)
+{
+    sendBatch(CommandMessage::MDELETE, SerializeKeys(keys, m_protocolVersion), callback);
+}
+
+void ClientSession::sendBatch(const int type, const std::string& payload, const BatchResultCallback& callback)
+{
+    const CommandMessage command(type, std::string(), payload);
+    SendCommand(command, [this, callback](bool success, const std::string& value)
     {
-        if (m_resultCallbacks.count(command.id) != 0)
+        std::vector<BatchItem> items;
+        try
+        {
+            if (success)
+            {
+                DeserializeBatchItems(value, m_protocolVersion, items);
+            }
+        }
+        catch (const std::runtime_error& e)
         {
-            m_logger.LogRecord((boost::format("Command with id %1% is already in processing")
-                                % command.id).str());
-            callback(false, std::string());
-            return;
+            m_logger.LogRecord(LogLevel::Error, std::string("Failed to parse batch result: ") + e.what());
+            success = false;
         }
 
-        m_resultCallbacks.insert({ command.id, callback });
-        m_sender->SendMessage(command);
+        callback(success, items);
+    });
+}
+
+void ClientSession::sendCommand(const CommandMessage& command,
+                                const BatchCallback& batchCallback,
+                                const ResultCallback& callback)
+{
+    m_strand.post([this, message = command, batchCallback, callback]() mutable
+    {
+        // ids wrap around after 2^32 commands, so ids of commands still in flight are skipped
+        do
+        {
+            message.id = m_nextCommandId++;
+        }
+        while (m_resultCallbacks.count(message.id) != 0);
+
+        m_resultCallbacks.insert({ message.id, callback });
+        if (batchCallback)
+        {
+            m_batchCallbacks.insert({ message.id, batchCallback });
+        }
+
+        if (m_protocolVersion == scProtocolText)
+        {
+            // text protocol does not carry ids, so results are matched by order
+            // and the next command is sent only when the previous one is finished
+            m_textQueue.push_back(message);
+            if (m_textQueue.size() > 1)
+            {
+                return;
+            }
+        }
+
+        m_sender->SendMessage(message);
     });
 }
 
@@ -55,7 +123,7 @@ void ClientSession::onEPResolved(const boost::system::error_code& ec,
 {
     if (ec)
     {
-        m_logger.LogRecord(std::string("Failed to resolve EP: ") + ec.message());
+        m_logger.LogRecord(LogLevel::Error, std::string("Failed to resolve EP: ") + ec.message());
         m_connectCallback(false);
         return;
     }
@@ -68,7 +136,53 @@ void ClientSession::onSocketConnected(const boost::system::error_code& ec)
 {
     if (ec)
     {
-        m_logger.LogRecord(std::string("Failed to connect to server: ") + ec.message());
+        m_logger.LogRecord(LogLevel::Error, std::string("Failed to connect to server: ") + ec.message());
+        m_connectCallback(false);
+        return;
+    }
+
+    // small coalesced messages must not wait behind Nagle for acks of previous writes
+    boost::system::error_code optionEc;
+    m_socket.set_option(boost::asio::ip::tcp::no_delay(true), optionEc);
+
+    auto handshake = std::make_shared<Handshake>(m_protocolVersion);
+    boost::asio::async_write(m_socket,
+                             boost::asio::const_buffer(handshake.get(), scHandshakeSize),
+                             m_strand.wrap(std::bind(&ClientSession::onHandshakeSent, this,
+                                                     std::placeholders::_1, handshake)));
+}
+
+void ClientSession::onHandshakeSent(const boost::system::error_code& ec, const Handshake::Ptr&)
+{
+    if (ec)
+    {
+        m_logger.LogRecord(LogLevel::Error, std::string("Failed to send handshake: ") + ec.message());
+        m_connectCallback(false);
+        return;
+    }
+
+    auto answer = std::make_shared<Handshake>();
+    boost::asio::async_read(m_socket,
+                            boost::asio::mutable_buffer(answer.get(), scHandshakeSize),
+                            m_strand.wrap(std::bind(&ClientSession::onHandshakeReceived, this,
+                                                    std::placeholders::_1, answer)));
+}
+
+void ClientSession::onHandshakeReceived(const boost::system::error_code& ec, const Handshake::Ptr& handshake)
+{
+    if (ec)
+    {
+        m_logger.LogRecord(LogLevel::Error, std::string("Failed to receive handshake: ") + ec.message());
+        m_connectCallback(false);
+        return;
+    }
+
+    const uint32_t version = handshake->m_version;
+    if (!handshake->IsValid() || version == 0 || version > m_protocolVersion)
+    {
+        m_logger.LogRecord(LogLevel::Error, (boost::format("Server does not support protocol version %1%")
+                            % m_protocolVersion).str());
+        m_socket.close();
         m_connectCallback(false);
         return;
     }
@@ -77,7 +191,10 @@ void ClientSession::onSocketConnected(const boost::system::error_code& ec)
                    MessageSenderContext {
                        m_logger,
                        m_strand,
-                       m_socket
+                       m_socket,
+                       version,
+                       nullptr,
+                       std::weak_ptr<void>()
                    });
 
     m_receiver = std::make_shared<Receiver>(
@@ -88,38 +205,105 @@ void ClientSession::onSocketConnected(const boost::system::error_code& ec)
                          m_logger,
                          m_strand.wrap(std::bind(&ClientSession::onResultReceived, this,
                                                  std::placeholders::_1)),
-                         m_onCloseCallback,
-                         scReceiveDataTOutMs
+                         m_strand.wrap(std::bind(&ClientSession::onConnectionClosed, this)),
+                         scReceiveDataTOutMs,
+                         version,
+                         nullptr,
+                         std::weak_ptr<void>()
                      });
 
+    // commands are encoded with the version accepted by the server from now on
+    m_protocolVersion = version;
     m_receiver->Start();
     m_connectCallback(true);
-    return;
 }
 
 void ClientSession::onResultReceived(const ResultMessage& result)
 {
-     const auto cbIt = m_resultCallbacks.find(result.commandId);
+     auto commandId = result.commandId;
+     if (m_protocolVersion == scProtocolText)
+     {
+         if (m_textQueue.empty())
+         {
+             m_logger.LogRecord(LogLevel::Warning, "Result received while no command is in processing");
+             return;
+         }
+
+         commandId = m_textQueue.front().id;
+     }
+
+     const auto cbIt = m_resultCallbacks.find(commandId);
      if (cbIt == m_resultCallbacks.end())
      {
-         m_logger.LogRecord(std::string("Result for unknown comand received : ")
-                           + std::to_string(result.commandId));
+         m_logger.LogRecord(LogLevel::Warning, std::string("Result for unknown comand received : ")
+                           + std::to_string(commandId));
          return;
      }
 
-     const auto& callback = (*cbIt).second;
+     // batches precede the final result of the scan, callback is kept until it arrives
+     if (result.code == ResultMessage::ScanBatch)
+     {
+         const auto batchIt = m_batchCallbacks.find(commandId);
+         if (batchIt == m_batchCallbacks.end())
+         {
+             m_logger.LogRecord(LogLevel::Warning, "Scan batch received for command which is not a scan");
+             return;
+         }
+
+         std::vector<KeyValue> pairs;
+         try
+         {
+             DeserializeKeyValues(result.value.Get(), m_protocolVersion, pairs);
+         }
+         catch (const std::exception& e)
+         {
+             m_logger.LogRecord(LogLevel::Error, std::string("Failed to parse scan batch: ") + e.what());
+             return;
+         }
+
+         (*batchIt).second(pairs);
+         return;
+     }
+
+     // results of leading items of large batch precede the final one
+     if (result.code == ResultMessage::BatchPart)
+     {
+         m_batchParts[commandId].append(result.value.Get());
+         return;
+     }
+
+     // command is finished, callback is released before evaluation
+     const auto callback = std::move((*cbIt).second);
+     m_resultCallbacks.erase(cbIt);
+     m_batchCallbacks.erase(commandId);
+     std::string parts;
+     const auto partsIt = m_batchParts.find(commandId);
+     if (partsIt != m_batchParts.end())
+     {
+         parts = std::move((*partsIt).second);
+         m_batchParts.erase(partsIt);
+     }
+
+     if (m_protocolVersion == scProtocolText)
+     {
+         m_textQueue.pop_front();
+         if (!m_textQueue.empty())
+         {
+             m_sender->SendMessage(m_textQueue.front());
+         }
+     }
 
      switch (result.code)
      {
      case ResultMessage::UnknownCommand:
      {
-         m_logger.LogRecord("Unknown command");
+         m_logger.LogRecord(LogLevel::Debug, "Unknown command");
          callback(false, std::string());
          break;
      }
      case ResultMessage::WrongCommandFormat:
      {
-         m_logger.LogRecord("Wrong command format");
+         m_logger.LogRecord(LogLevel::Debug, "Wrong command format");
          callback(false, std::string());
          break;
      }
@@ -127,30 +311,56 @@ void ClientSession::onResultReceived(const ResultMessage& result)
      case ResultMessage::UpdateSuccess:
      case ResultMessage::GetSuccess:
      case ResultMessage::DeleteSuccess:
+     case ResultMessage::ScanSuccess:
+     case ResultMessage::CompactSuccess:
      {
-         m_logger.LogRecord("OK");
+         m_logger.LogRecord(LogLevel::Debug, "OK");
          callback(true, result.value.Get());
          break;
      }
 
+     case ResultMessage::BatchSuccess:
+     {
+         m_logger.LogRecord(LogLevel::Debug, "OK");
+         callback(true, parts.empty() ? result.value.Get() : parts.append(result.value.Get()));
+         break;
+     }
+
      case ResultMessage::InsertFailed:
      case ResultMessage::UpdateFailed:
      case ResultMessage::GetFailed:
      case ResultMessage::DeleteFailed:
+     case ResultMessage::ScanFailed:
+     case ResultMessage::CompactFailed:
+     case ResultMessage::BatchFailed:
      {
-         m_logger.LogRecord("Failed");
+         m_logger.LogRecord(LogLevel::Debug, "Failed");
          callback(false, std::string());
          break;
      }
      default:
      {
-         m_logger.LogRecord(std::string("Unknown result code : ") + std::to_string(result.code));
+         m_logger.LogRecord(LogLevel::Warning, std::string("Unknown result code : ") + std::to_string(result.code));
          callback(false, std::string());
          break;
      }
      }
+}
 
-     m_resultCallbacks.erase(cbIt);
+void ClientSession::onConnectionClosed()
+{
+    // commands in flight will never be finished
+    auto callbacks = std::move(m_resultCallbacks);
+    m_resultCallbacks.clear();
+    m_batchCallbacks.clear();
+    m_batchParts.clear();
+    m_textQueue.clear();
+    for (const auto& entry : callbacks)
+    {
+        entry.second(false, std::string());
+    }
+
+    m_onCloseCallback();
 }
 
 }// namespace kvdb
@@ -2,7 +2,9 @@
 
 #include <memory>
 #include <functional>
-#include <map>
+#include <deque>
+#include <unordered_map>
+#include <vector>
 
 #include <boost/asio.hpp>
 
@@ -22,6 +24,8 @@ struct ClientSessionContext
     Logger&                     m_logger;
     ConnectCallback             m_connectCallback;
     CloseCallback               m_onCloseCallback;
+    uint32_t                    m_protocolVersion = scMaxProtocolVersion; ///< proposed to the server,
+                                                                          ///< then accepted by it
 };
 
 /// @brief manages client connection
@@ -37,15 +41,42 @@ public:
     /// 2nd arg - optional string with execution result data (string)
     using ResultCallback = std::function<void(bool, const std::string&)>;
 
+    /// @brief callback type for every batch of pairs streamed by SCAN commands
+    using BatchCallback = std::function<void(const std::vector<KeyValue>&)>;
+
+    /// @brief callback type for results of MGET, MSET and MDELETE commands
+    /// 1st arg - true if batch was executed, false otherwise
+    /// 2nd arg - result of every item in the order of items
+    using BatchResultCallback = std::function<void(bool, const std::vector<BatchItem>&)>;
+
     explicit ClientSession(const ClientSessionContext& context);
 
     virtual ~ClientSession();
 
     void Connect(const std::string& hostname, int port);
 
+    /// @brief sends command without waiting for results of previous ones,
+    /// id of the command is assigned by the session and results are matched by it,
+    /// so results of independent commands may be received in any order
+    /// Commands of the text protocol are sent one by one, since it does not carry ids
     void SendCommand(const CommandMessage& command,
                      const ResultCallback& callback);
 
+    /// @brief sends SCAN or SCAN_PREFIX command, batchCallback is evaluated for every
+    /// received batch, callback - once when scan is finished with the cursor of the next page
+    /// (empty when range is exhausted)
+    void SendScan(const CommandMessage& command,
+                  const BatchCallback& batchCallback,
+                  const ResultCallback& callback);
+
+    /// Batch commands are sent as one message and executed by the server with one lock
+    /// of every shard holding some of the keys
+    /// @throw std::runtime_error if batch does not fit one message
+
+    void MultiGet(const std::vector<std::string>& keys, const BatchResultCallback& callback);
+    void MultiSet(const std::vector<KeyValue>& pairs, const BatchResultCallback& callback);
+    void MultiDelete(const std::vector<std::string>& keys, const BatchResultCallback& callback);
+
 private:
     using Sender = MessageSender<CommandMessage>;
     using Receiver = MessageReceiver<ResultMessage>;
@@ -55,14 +86,32 @@ private:
 
     void onSocketConnected(const boost::system::error_code& ec);
 
+    void onHandshakeSent(const boost::system::error_code& ec, const Handshake::Ptr& handshake);
+
+    /// @brief starts exchange of messages with the version of the protocol accepted by the server
+    void onHandshakeReceived(const boost::system::error_code& ec, const Handshake::Ptr& handshake);
+
+    void sendCommand(const CommandMessage& command,
+                     const BatchCallback& batchCallback,
+                     const ResultCallback& callback);
+
+    void sendBatch(int type, const std::string& payload, const BatchResultCallback& callback);
+
     void onResultReceived(const ResultMessage& result);
 
+    /// @brief fails all commands in flight
+    void onConnectionClosed();
+
     boost::asio::io_context::strand m_strand;
     boost::asio::ip::tcp::resolver  m_resolver;
     boost::asio::ip::tcp::socket    m_socket;
     Sender::Ptr                     m_sender;
     Receiver::Ptr                   m_receiver;
-    std::map<CommandID, ResultCallback> m_resultCallbacks;
+    std::unordered_map<CommandID, ResultCallback>   m_resultCallbacks;
+    std::unordered_map<CommandID, BatchCallback>    m_batchCallbacks;
+    std::unordered_map<CommandID, std::string>      m_batchParts;   ///< received results of leading items of batches
+    std::deque<CommandMessage>                      m_textQueue;    ///< text protocol: command in flight and following ones
+    CommandID                                       m_nextCommandId = 1;
 };
 
 }
@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <chrono>
 
 #include <boost/format.hpp>
 
 #include "CommandProcessor.hpp"
+#include "Serialization.hpp"
 
 namespace kvdb
 {
@@ -11,46 +13,74 @@ CommandProcessor::CommandProcessor(const CommandProcessorContext& context)
     : CommandProcessorContext(context)
     , m_strand(context.m_ioContext)
     , m_reportTimer(context.m_ioContext)
+    , m_latencies(scNumResultCodes * NumLatencyKinds)
+    , m_lastReportTime(Clock::now())
+    , m_growthScheduled(false)
+    , m_compactionScheduled(false)
 {
     m_performanceCounters.insert({
                                      ResultMessage::UnknownCommand,
-                                     PerfCounter("Number of unknown commands     ")
+                                     PerfCounter("Number of unknown commands     ", "unknown_command")
                                  });
     m_performanceCounters.insert({
                                      ResultMessage::WrongCommandFormat,
-                                     PerfCounter("Number of wrong format commands")
+                                     PerfCounter("Number of wrong format commands", "wrong_format")
                                  });
     m_performanceCounters.insert({
                                      ResultMessage::InsertSuccess,
-                                     PerfCounter("INSERT Ok      ")
+                                     PerfCounter("INSERT Ok      ", "insert_ok")
                                  });
     m_performanceCounters.insert({
                                      ResultMessage::InsertFailed,
-                                     PerfCounter("INSERT Failed  ")
+                                     PerfCounter("INSERT Failed  ", "insert_failed")
                                  });
     m_performanceCounters.insert({
                                      ResultMessage::UpdateSuccess,
-                                     PerfCounter("UPDATE Ok      ")
+                                     PerfCounter("UPDATE Ok      ", "update_ok")
                                  });
     m_performanceCounters.insert({
                                      ResultMessage::UpdateFailed,
-                                     PerfCounter("UPDATE Failed  ")
+                                     PerfCounter("UPDATE Failed  ", "update_failed")
                                  });
     m_performanceCounters.insert({
                                      ResultMessage::GetSuccess,
-                                     PerfCounter("GET Ok         ")
+                                     PerfCounter("GET Ok         ", "get_ok")
                                  });
     m_performanceCounters.insert({
                                      ResultMessage::GetFailed,
-                                     PerfCounter("GET Failed     ")
+                                     PerfCounter("GET Failed     ", "get_failed")
                                  });
     m_performanceCounters.insert({
                                      ResultMessage::DeleteSuccess,
-                                     PerfCounter("DELETE Ok      ")
+                                     PerfCounter("DELETE Ok      ", "delete_ok")
                                  });
     m_performanceCounters.insert({
                                      ResultMessage::DeleteFailed,
-                                     PerfCounter("DELETE Failed  ")
+                                     PerfCounter("DELETE Failed  ", "delete_failed")
+                                 });
+    m_performanceCounters.insert({
+                                     ResultMessage::ScanSuccess,
+                                     PerfCounter("SCAN Ok        ", "scan_ok")
+                                 });
+    m_performanceCounters.insert({
+                                     ResultMessage::ScanFailed,
+                                     PerfCounter("SCAN Failed    ", "scan_failed")
+                                 });
+    m_performanceCounters.insert({
+                                     ResultMessage::CompactSuccess,
+                                     PerfCounter("COMPACT Ok     ", "compact_ok")
+                                 });
+    m_performanceCounters.insert({
+                                     ResultMessage::CompactFailed,
+                                     PerfCounter("COMPACT Failed ", "compact_failed")
+                                 });
+    m_performanceCounters.insert({
+                                     ResultMessage::BatchSuccess,
+                                     PerfCounter("BATCH Ok       ", "batch_ok")
+                                 });
+    m_performanceCounters.insert({
+                                     ResultMessage::BatchFailed,
+                                     PerfCounter("BATCH Failed   ", "batch_failed")
                                  });
 }
 
@@ -65,14 +95,16 @@ void CommandProcessor::Start()
     scheduleNextPerformanceReport();
 }
 
-void CommandProcessor::ProcessCommand(const CommandMessage& command,
+void CommandProcessor::ProcessCommand(const CommandView& command,
                                       const ResultCallback& callback)
 {
     ResultMessage result;
+    result.commandId = command.id;
 
-    const auto& key = command.key.Get();
-    const auto& value = command.value.Get();
+    const auto key = command.key;
+    const auto value = command.value;
     const auto lockTout = std::chrono::milliseconds(scLockToutMs);
+    const auto started = Clock::now();
 
     try
     {
@@ -89,6 +121,7 @@ void CommandProcessor::ProcessCommand(const CommandMessage& command,
 
             m_mapInstance.Insert(key, value, lockTout);
             result.code = ResultMessage::InsertSuccess;
+            scheduleGrowthIfNeeded();
             break;
         }
 
@@ -103,6 +136,7 @@ void CommandProcessor::ProcessCommand(const CommandMessage& command,
 
             m_mapInstance.Update(key, value, lockTout);
             result.code = ResultMessage::UpdateSuccess;
+            scheduleGrowthIfNeeded();
             break;
         }
 
@@ -114,11 +148,22 @@ void CommandProcessor::ProcessCommand(const CommandMessage& command,
                 break;
             }
 
-            std::string outValue;
-            m_mapInstance.Get(key, outValue, lockTout);
-            result.value.Set(outValue);
-            result.code = ResultMessage::GetSuccess;
-            break;
+            // result is encoded straight from the entry while it is locked,
+            // so value is copied only to the sent message
+            const bool found = m_mapInstance.Visit(key, [&command, &callback](std::string_view value)
+            {
+                callback(ResultView(command.id, ResultMessage::GetSuccess, value));
+            }, lockTout);
+
+            if (!found)
+            {
+                result.code = ResultMessage::GetFailed;
+                break;
+            }
+
+            // result is passed to the sender while the entry is locked
+            countResult(ResultMessage::GetSuccess, command.received, started, Clock::now());
+            return;
         }
 
         case CommandMessage::DELETE:
@@ -134,6 +179,60 @@ void CommandProcessor::ProcessCommand(const CommandMessage& command,
             break;
         }
 
+        case CommandMessage::SCAN:
+        case CommandMessage::SCAN_PREFIX:
+        {
+            std::string start(key);
+            std::string end(value);
+            if (command.type == CommandMessage::SCAN_PREFIX)
+            {
+                // value of the prefix scan is the cursor of the previous page
+                start = std::string(std::max(key, value));
+                end = PersistableMap::PrefixEnd(key);
+            }
+
+            std::vector<KeyValue> pairs;
+            const auto cursor = m_mapInstance.Scan(start, end, ScanLimit(command.limit), pairs, lockTout);
+            SendScanBatches(pairs, command.id, command.version, callback);
+            result.value.Set(FitCursor(cursor));
+            result.code = ResultMessage::ScanSuccess;
+            break;
+        }
+
+        case CommandMessage::COMPACT:
+        {
+            if (!key.empty() || !value.empty())
+            {
+                result.code = ResultMessage::WrongCommandFormat;
+                break;
+            }
+
+            // result is sent when compaction is finished
+            scheduleCompaction(command.id, command.received, callback);
+            return;
+        }
+
+        case CommandMessage::MGET:
+        case CommandMessage::MSET:
+        case CommandMessage::MDELETE:
+        {
+            std::vector<BatchItem> items;
+            if (!executeBatch(command, items))
+            {
+                result.code = ResultMessage::WrongCommandFormat;
+                break;
+            }
+
+            result.value.Set(SendBatchParts(items, command.id, command.version, callback));
+            result.code = ResultMessage::BatchSuccess;
+            if (command.type == CommandMessage::MSET)
+            {
+                scheduleGrowthIfNeeded();
+            }
+
+            break;
+        }
+
         default:
         {
             result.code = ResultMessage::UnknownCommand;
@@ -143,10 +242,10 @@ void CommandProcessor::ProcessCommand(const CommandMessage& command,
     }
     catch (const boost::interprocess::bad_alloc&)
     {
-        m_logger.LogRecord("Probably there's lack of memory. Trying to grow segment...");
+        m_logger.LogRecord(LogLevel::Warning, "Probably there's lack of memory. Trying to grow segment...");
         if (!m_mapInstance.Grow())
         {
-            m_logger.LogRecord("Failed to grow mapped file! Further inserting is not available");
+            m_logger.LogRecord(LogLevel::Error, "Failed to grow mapped file! Further inserting is not available");
         }
         else
         {
@@ -158,7 +257,7 @@ void CommandProcessor::ProcessCommand(const CommandMessage& command,
     }
     catch (const std::exception& e)
     {
-        m_logger.LogRecord(std::string("Exception occured when performing operation on map: ") + e.what());
+        m_logger.LogRecord(LogLevel::Error, std::string("Exception occured when performing operation on map: ") + e.what());
         switch (command.type)
         {
         case CommandMessage::INSERT:
@@ -173,16 +272,253 @@ void CommandProcessor::ProcessCommand(const CommandMessage& command,
         case CommandMessage::DELETE:
             result.code = ResultMessage::DeleteFailed;
             break;
+        case CommandMessage::SCAN:
+        case CommandMessage::SCAN_PREFIX:
+            result.code = ResultMessage::ScanFailed;
+            break;
+        case CommandMessage::MGET:
+        case CommandMessage::MSET:
+        case CommandMessage::MDELETE:
+            result.code = ResultMessage::BatchFailed;
+            break;
+        }
+    }
+
+    countResult(result.code, command.received, started, Clock::now());
+    callback(result);
+}
+
+void CommandProcessor::countResult(const int code,
+                                   const Clock::time_point received,
+                                   const Clock::time_point started,
+                                   const Clock::time_point executed)
+{
+    // every thread records into histograms of it's own, they are merged by reports
+    if (code < 0 || std::size_t(code) >= scNumResultCodes)
+    {
+        return;
+    }
+
+    const std::size_t series = std::size_t(code) * NumLatencyKinds;
+    m_latencies.Record(series + ExecutionLatency, executed - started);
+    if (received != Clock::time_point())
+    {
+        m_latencies.Record(series + ServiceLatency, executed - received);
+    }
+}
+
+bool CommandProcessor::executeBatch(const CommandView& command, std::vector<BatchItem>& items)
+{
+    using BatchStatus = PersistableMap::BatchStatus;
+
+    // keys and values refer to the received message
+    std::vector<std::string_view> keys;
+    std::vector<KeyValueView> pairs;
+    try
+    {
+        if (command.type == CommandMessage::MSET)
+        {
+            DeserializeKeyValues(command.value, command.version, pairs);
+        }
+        else
+        {
+            DeserializeKeys(command.value, command.version, keys);
         }
     }
+    catch (const std::runtime_error&)
+    {
+        return false;
+    }
+
+    const auto isValidKey = [](std::string_view key)
+    {
+        return !key.empty() && key.size() <= scMaxKeySize;
+    };
+
+    if (!command.key.empty()
+            || (keys.empty() && pairs.empty())
+            || !std::all_of(keys.begin(), keys.end(), isValidKey)
+            || !std::all_of(pairs.begin(), pairs.end(), [&isValidKey](const KeyValueView& pair)
+                            {
+                                return isValidKey(pair.first);
+                            }))
+    {
+        return false;
+    }
+
+    const auto lockTout = std::chrono::milliseconds(scLockToutMs);
+    std::vector<BatchStatus> statuses;
+    std::vector<std::string> values;
+    switch (command.type)
+    {
+    case CommandMessage::MGET:
+        m_mapInstance.MultiGet(keys, values, statuses, lockTout);
+        break;
+    case CommandMessage::MSET:
+        m_mapInstance.MultiSet(pairs, statuses, lockTout);
+        break;
+    case CommandMessage::MDELETE:
+        m_mapInstance.MultiDelete(keys, statuses, lockTout);
+        break;
+    }
 
-    m_strand.post([this, result]()
+    items.resize(statuses.size());
+    for (std::size_t i = 0; i < statuses.size(); ++i)
     {
-        // protect m_performanceCounters from concurrent access
-        ++m_performanceCounters[result.code];
+        const bool done = statuses[i] != BatchStatus::NotFound;
+        switch (command.type)
+        {
+        case CommandMessage::MGET:
+            items[i].code = done ? ResultMessage::GetSuccess : ResultMessage::GetFailed;
+            items[i].value = std::move(values[i]);
+            break;
+        case CommandMessage::MSET:
+            items[i].code = statuses[i] == BatchStatus::Updated ? ResultMessage::UpdateSuccess
+                                                                : ResultMessage::InsertSuccess;
+            break;
+        case CommandMessage::MDELETE:
+            items[i].code = done ? ResultMessage::DeleteSuccess : ResultMessage::DeleteFailed;
+            break;
+        }
+    }
+
+    return true;
+}
+
+uint32_t CommandProcessor::ScanLimit(const uint32_t limit)
+{
+    return limit == 0 ? scDefaultScanLimit : std::min(limit, scMaxScanLimit);
+}
+
+std::string CommandProcessor::FitCursor(std::string cursor)
+{
+    if (cursor.size() > scMaxKeySize)
+    {
+        // cursor following the longest key does not fit the command,
+        // but only keys following all it's extensions can be next
+        cursor = PersistableMap::PrefixEnd(std::string_view(cursor).substr(0, cursor.size() - 1));
+    }
+
+    return cursor;
+}
+
+void CommandProcessor::SendScanBatches(std::vector<KeyValue>& pairs,
+                                       const CommandID commandId,
+                                       const uint32_t version,
+                                       const ResultCallback& callback)
+{
+    std::vector<KeyValue> batch;
+    std::size_t batchSize = 0;
+    const auto sendBatch = [&batch, &batchSize, commandId, version, &callback]()
+    {
+        ResultMessage result(ResultMessage::ScanBatch, SerializeKeyValues(batch, version));
+        result.commandId = commandId;
+        callback(result);
+        batch.clear();
+        batchSize = 0;
+    };
+
+    for (auto& pair : pairs)
+    {
+        // large pair is sent in a separate batch
+        const auto pairSize = pair.first.size() + pair.second.size();
+        if (!batch.empty() && batchSize + pairSize > scScanBatchSize)
+        {
+            sendBatch();
+        }
+
+        batchSize += pairSize;
+        batch.push_back(std::move(pair));
+    }
+
+    if (!batch.empty())
+    {
+        sendBatch();
+    }
+}
+
+std::string CommandProcessor::SendBatchParts(const std::vector<BatchItem>& items,
+                                            const CommandID commandId,
+                                            const uint32_t version,
+                                            const ResultCallback& callback)
+{
+    std::string part;
+    for (const auto& item : items)
+    {
+        // result of every item fits alone, so part is sent before the item exceeding the limit
+        const auto size = part.size();
+        AppendBatchItem(part, item, version);
+        if (size != 0 && part.size() > scMaxResultSize)
+        {
+            callback(ResultView(commandId, ResultMessage::BatchPart, std::string_view(part).substr(0, size)));
+            part.erase(0, size);
+        }
+    }
+
+    return part;
+}
+
+void CommandProcessor::scheduleGrowthIfNeeded()
+{
+    if (!m_mapInstance.NeedsGrowth() || m_growthScheduled.exchange(true))
+    {
+        return;
+    }
+
+    boost::asio::post(m_ioContext, [this]()
+    {
+        m_logger.LogRecord("Free memory is below the threshold. Growing segment...");
+        if (!m_mapInstance.Grow())
+        {
+            m_logger.LogRecord(LogLevel::Error, "Failed to grow mapped file!");
+        }
+        else
+        {
+            m_logger.LogRecord("Memory segment grown");
+        }
+
+        m_growthScheduled = false;
     });
+}
 
-    callback(result);
+void CommandProcessor::scheduleCompaction(const CommandID commandId,
+                                          const Clock::time_point received,
+                                          const ResultCallback& callback)
+{
+    ResultMessage result(ResultMessage::CompactSuccess);
+    result.commandId = commandId;
+    if (m_compactionScheduled.exchange(true))
+    {
+        if (callback)
+        {
+            result.code = ResultMessage::CompactFailed;
+            callback(result);
+        }
+
+        return;
+    }
+
+    boost::asio::post(m_ioContext, [this, result, callback, received]() mutable
+    {
+        const auto started = Clock::now();
+        try
+        {
+            m_logger.LogRecord("Compacting map file...");
+            result.value.Set(std::to_string(m_mapInstance.Compact()));
+        }
+        catch (const std::exception& e)
+        {
+            m_logger.LogRecord(LogLevel::Error, std::string("Failed to compact map file: ") + e.what());
+            result.code = ResultMessage::CompactFailed;
+        }
+
+        m_compactionScheduled = false;
+        if (callback)
+        {
+            countResult(result.code, received, started, Clock::now());
+            callback(result);
+        }
+    });
 }
 
 void CommandProcessor::scheduleNextPerformanceReport()
@@ -196,11 +532,11 @@ void CommandProcessor::onReportTimerElapsed(const boost::system::error_code& ec)
 {
     if (ec)
     {
-        m_logger.LogRecord((boost::format("Timer error occured: %1%") % ec).str());
+        m_logger.LogRecord(LogLevel::Error, (boost::format("Timer error occured: %1%") % ec).str());
     }
     else
     {
-        // protect m_performanceCounters from concurrent access
+        // reports are not executed concurrently
         m_strand.post(std::bind(&CommandProcessor::reportPerformance, this));
         scheduleNextPerformanceReport();
     }
@@ -209,23 +545,60 @@ void CommandProcessor::onReportTimerElapsed(const boost::system::error_code& ec)
 void CommandProcessor::reportPerformance()
 {
     std::string message("\n================== PERFORMANCE REPORT ==================\n");
+    const auto now = Clock::now();
+    const double elapsedSec = std::max(std::chrono::duration<double>(now - m_lastReportTime).count(), 1e-3);
+    m_lastReportTime = now;
+
     message += "\nSession statistics:\n";
-    for (const auto& entry : m_performanceCounters)
+    for (auto& entry : m_performanceCounters)
     {
         auto& counter = entry.second;
-        message += (boost::format("   %1%: %2%\n") % counter.m_name % counter.m_counter).str();
+        const auto numResults = m_latencies.Snapshot(entry.first * NumLatencyKinds + ExecutionLatency).Count();
+        message += (boost::format("   %1%: %2%, %3$.1f per second\n")
+                    % counter.m_name
+                    % numResults
+                    % (double(numResults - counter.m_numReported) / elapsedSec)).str();
+        counter.m_numReported = numResults;
+        if (numResults != 0)
+        {
+            message += "      execution (us) : " + formatLatencies(entry.first, ExecutionLatency);
+            message += "      received to result (us) : " + formatLatencies(entry.first, ServiceLatency);
+        }
     }
 
     message += "\nStorage statistics:\n";
     const auto& mapStat = m_mapInstance.GetStat();
     message += (boost::format("   Total memory (bytes) : %1%\n") % mapStat.m_size).str();
     message += (boost::format("   Free memory (bytes) : %1%\n") % mapStat.m_free).str();
+    message += (boost::format("   Largest free block (bytes) : %1%, free in heaps (bytes) : %2%\n")
+                % mapStat.m_largestFree
+                % mapStat.m_heapFree).str();
     message += (boost::format("   Total records : %1%\n") % mapStat.m_numRecords).str();
+    message += (boost::format("   Shards : %1%\n") % mapStat.m_numShards).str();
+    message += (boost::format("   Keys and values (bytes) : %1%\n") % mapStat.m_payloadBytes).str();
+    message += (boost::format("   Bytes per record : %1$.1f, overhead %2$.1f\n")
+                % mapStat.m_bytesPerRecord
+                % mapStat.m_overheadPerRecord).str();
+    message += (boost::format("   Dirty memory (bytes) : %1%\n") % mapStat.m_dirtyBytes).str();
+    message += (boost::format("   Background flushes : %1%, %2% bytes, total %3% us, max %4% us\n")
+                % mapStat.m_background.m_numFlushes
+                % mapStat.m_background.m_flushedBytes
+                % mapStat.m_background.m_totalTime.count()
+                % mapStat.m_background.m_maxTime.count()).str();
+    message += (boost::format("   Checkpoints : %1%, total %2% us, max %3% us\n")
+                % mapStat.m_checkpoints.m_numFlushes
+                % mapStat.m_checkpoints.m_totalTime.count()
+                % mapStat.m_checkpoints.m_maxTime.count()).str();
     message += "\n========================================================\n";
+    if (m_mapInstance.NeedsCompaction(mapStat))
+    {
+        scheduleCompaction(0, Clock::time_point(), ResultCallback());
+    }
+
     m_logger.LogRecord(message);
     if (!m_mapInstance.Flush())
     {
-        m_logger.LogRecord("Failed to flush map content on disk");
+        m_logger.LogRecord(LogLevel::Error, "Failed to flush map content on disk");
     }
     else
     {
@@ -233,4 +606,65 @@ void CommandProcessor::reportPerformance()
     }
 }
 
+void CommandProcessor::CollectMetrics(MetricsWriter& writer, const MetricsWriter::Labels& labels) const
+{
+    for (const auto& entry : m_performanceCounters)
+    {
+        auto resultLabels = labels;
+        resultLabels.emplace_back("result", entry.second.m_label);
+        const std::size_t series = std::size_t(entry.first) * NumLatencyKinds;
+        const auto execution = m_latencies.Snapshot(series + ExecutionLatency);
+        writer.Counter("kvdb_results_total", "Number of results of commands",
+                       resultLabels, double(execution.Count()));
+        writer.Histogram("kvdb_command_execution_seconds",
+                         "Execution of commands, including wait for locks of the map",
+                         resultLabels, execution);
+        writer.Histogram("kvdb_command_service_seconds",
+                         "Time since commands were received until their results were ready",
+                         resultLabels, m_latencies.Snapshot(series + ServiceLatency));
+    }
+
+    const auto mapStat = m_mapInstance.GetStat();
+    const double fragmentation = mapStat.m_free != 0 ? 1.0 - double(mapStat.m_largestFree) / mapStat.m_free : 0.0;
+    writer.Gauge("kvdb_map_size_bytes", "Size of the map file", labels, double(mapStat.m_size));
+    writer.Gauge("kvdb_map_free_bytes", "Free memory of the map file", labels, double(mapStat.m_free));
+    writer.Gauge("kvdb_map_largest_free_bytes", "Largest block the map file is able to allocate, "
+                 "measured by the last growth or compaction and limited by free memory",
+                 labels, double(mapStat.m_largestFree));
+    writer.Gauge("kvdb_map_heap_free_bytes", "Free memory cached by heaps of shards",
+                 labels, double(mapStat.m_heapFree));
+    writer.Gauge("kvdb_map_fragmentation_ratio", "Share of free memory outside of the largest free block",
+                 labels, fragmentation);
+    writer.Gauge("kvdb_map_records", "Number of records", labels, double(mapStat.m_numRecords));
+    writer.Gauge("kvdb_map_payload_bytes", "Size of keys and values", labels, double(mapStat.m_payloadBytes));
+    writer.Gauge("kvdb_map_dirty_bytes", "Approximate size of modified regions not flushed on disk",
+                 labels, double(mapStat.m_dirtyBytes));
+    writer.Counter("kvdb_map_background_flushes_total", "Number of background flushes of modified regions",
+                   labels, double(mapStat.m_background.m_numFlushes));
+    writer.Counter("kvdb_map_background_flushed_bytes_total", "Bytes written by background flushes",
+                   labels, double(mapStat.m_background.m_flushedBytes));
+    writer.Counter("kvdb_map_checkpoints_total", "Number of checkpoints", labels,
+                   double(mapStat.m_checkpoints.m_numFlushes));
+}
+
+std::string CommandProcessor::formatLatencies(const int code, const LatencyKind kind) const
+{
+    const auto snapshot = m_latencies.Snapshot(std::size_t(code) * NumLatencyKinds + kind);
+    if (snapshot.Count() == 0)
+    {
+        return "none\n";
+    }
+
+    const auto micros = [](const std::chrono::nanoseconds latency)
+    {
+        return double(latency.count()) / 1000;
+    };
+
+    return (boost::format("p50 %1$.1f, p99 %2$.1f, p99.9 %3$.1f, max %4$.1f\n")
+            % micros(snapshot.Percentile(0.5))
+            % micros(snapshot.Percentile(0.99))
+            % micros(snapshot.Percentile(0.999))
+            % micros(snapshot.Max())).str();
+}
+
 } // namespace kvdb
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <memory>
 
 #include <boost/asio.hpp>
+#include "LatencyHistogram.hpp"
+#include "Metrics.hpp"
 #include "PersistableMap.hpp"
 #include "Protocol.hpp"
 #include "Logger.hpp"
@@ -24,44 +28,107 @@ class CommandProcessor
         : private CommandProcessorContext
 {
 public:
-    using ResultCallback = std::function<void(const ResultMessage& result)>;
+    /// @brief receives results of the command, value of the result may refer to
+    /// the locked entry of the map, so it must be serialized before callback returns
+    using ResultCallback = std::function<void(const ResultView& result)>;
 
     explicit CommandProcessor(const CommandProcessorContext& context);
 
     virtual ~CommandProcessor();
 
-    void ProcessCommand(const CommandMessage& command, const ResultCallback& callback);
+    /// @brief key and value of the command are stored without intermediate copies
+    void ProcessCommand(const CommandView& command, const ResultCallback& callback);
 
     void Start();
 
+    /// @return number of pairs returned by SCAN command with given limit
+    static uint32_t ScanLimit(uint32_t limit);
+
+    /// @return cursor which fits the key of the following command,
+    /// cursor following the longest key is replaced by the end of it's prefix
+    static std::string FitCursor(std::string cursor);
+
+    /// @brief adds results, their latencies and statistics of the map to metrics,
+    /// may be called by any thread
+    void CollectMetrics(MetricsWriter& writer, const MetricsWriter::Labels& labels) const;
+
+    /// @brief streams pairs found by SCAN as a number of ScanBatch results,
+    /// final result with the cursor is sent by the caller
+    static void SendScanBatches(std::vector<KeyValue>& pairs, CommandID commandId, uint32_t version,
+                                const ResultCallback& callback);
+
+    /// @brief streams results of leading items of the batch as BatchPart results while all of them
+    /// do not fit one result, so values of any size up to the limit are returned
+    /// @return encoded results of the rest of items, they are sent by the caller as BatchSuccess
+    static std::string SendBatchParts(const std::vector<BatchItem>& items, CommandID commandId, uint32_t version,
+                                      const ResultCallback& callback);
+
 private:
+    using Clock = std::chrono::steady_clock;
+
+    /// @brief results with one code, their latencies are recorded by m_latencies
     struct PerfCounter
     {
-        std::string m_name;
-        uint32_t    m_counter = 0;
+        std::string     m_name;
+        std::string     m_label;            ///< value of the result label of metrics
+        uint64_t        m_numReported = 0;  ///< number of results at the previous report
 
-        explicit PerfCounter(const std::string& name = std::string())
+        explicit PerfCounter(const std::string& name = std::string(), const std::string& label = std::string())
             : m_name(name)
+            , m_label(label)
         {}
+    };
 
-        void operator++()
-        {
-            ++m_counter;
-        }
+    /// latencies recorded for every result code
+    enum LatencyKind
+    {
+        ExecutionLatency = 0,   ///< execution of the command, including wait for locks of the map
+        ServiceLatency,         ///< since the command was received until it's result is ready
+        NumLatencyKinds
     };
 
+    static constexpr std::size_t scNumResultCodes = ResultMessage::BatchFailed + 1;
+
     void scheduleNextPerformanceReport();
 
+    /// @brief records latencies of the result
+    /// @param received time the command was received, latency since then is not recorded if it is unknown
+    /// @param started time execution of the command started
+    /// @param executed time the result was ready, it ends both latencies
+    void countResult(int code, Clock::time_point received, Clock::time_point started, Clock::time_point executed);
+
+    /// @brief executes MGET, MSET or MDELETE command
+    /// @return false if command has wrong format
+    bool executeBatch(const CommandView& command, std::vector<BatchItem>& items);
+
+    /// @brief posts growth of the map if it reached the high-water mark,
+    /// so allocations do not fail under load
+    void scheduleGrowthIfNeeded();
+
+    /// @brief posts compaction of the map unless it is already scheduled
+    /// @param commandId id of the COMPACT command, result is marked with it
+    /// @param received time the COMPACT command was received
+    /// @param callback receives result of the compaction, may be empty
+    void scheduleCompaction(CommandID commandId, Clock::time_point received, const ResultCallback& callback);
+
     void onReportTimerElapsed(const boost::system::error_code& ec);
 
     void reportPerformance();
 
+    /// @return percentiles of latencies of the result code
+    std::string formatLatencies(int code, LatencyKind kind) const;
+
     static const uint32_t scLockToutMs = 500;
 
     boost::asio::deadline_timer     m_reportTimer;
+    /// counters of all codes are inserted by constructor, so map is not modified afterwards
     std::map<uint8_t, PerfCounter>  m_performanceCounters;
-    boost::asio::io_context::strand m_strand; ///< pretects m_performanceCounters
-                                              ///< from concurrent access
+    /// series of result code is code * NumLatencyKinds + kind
+    LatencyRecorder                 m_latencies;
+    Clock::time_point               m_lastReportTime;
+    boost::asio::io_context::strand m_strand; ///< serializes performance reports
+    std::atomic<bool>               m_growthScheduled;
+    std::atomic<bool>               m_compactionScheduled;
 };
 
 }
@@ -0,0 +1,108 @@
+#include <algorithm>
+
+#include "DirtyRegions.hpp"
+
+namespace kvdb
+{
+
+DirtyRegions::DirtyRegions(char* base, const std::size_t capacity)
+    : m_base(base)
+    , m_capacity(capacity)
+    , m_numWords((capacity + scRegionSize * scRegionsPerWord - 1) / (scRegionSize * scRegionsPerWord))
+    , m_words(new Word[m_numWords])
+{
+    for (std::size_t i = 0; i < m_numWords; ++i)
+    {
+        m_words[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void DirtyRegions::Mark(const void* address, const std::size_t size)
+{
+    const auto begin = static_cast<const char*>(address);
+    if (size == 0 || begin < m_base || begin >= m_base + m_capacity)
+    {
+        return;
+    }
+
+    const std::size_t first = std::size_t(begin - m_base) / scRegionSize;
+    const std::size_t last = std::min(std::size_t(begin - m_base) + size - 1, m_capacity - 1) / scRegionSize;
+    for (std::size_t region = first; region <= last; ++region)
+    {
+        auto& word = m_words[region / scRegionsPerWord];
+        const uint64_t bit = uint64_t(1) << (region % scRegionsPerWord);
+
+        // most modifications hit regions which are already dirty,
+        // avoid contended read-modify-write in this case
+        if ((word.load(std::memory_order_relaxed) & bit) == 0)
+        {
+            word.fetch_or(bit, std::memory_order_relaxed);
+        }
+    }
+}
+
+std::size_t DirtyRegions::Flush(const std::size_t limit, const std::size_t maxBytes, const FlushFunc& flush)
+{
+    const std::size_t numWords = std::min(m_numWords,
+                                          (limit + scRegionSize * scRegionsPerWord - 1)
+                                          / (scRegionSize * scRegionsPerWord));
+    std::size_t flushed = 0;
+    for (std::size_t i = 0; i < numWords && flushed < maxBytes; ++i)
+    {
+        const std::size_t wordIdx = (m_cursor + i) % numWords;
+        uint64_t bits = m_words[wordIdx].exchange(0, std::memory_order_acquire);
+        while (bits)
+        {
+            // adjacent dirty regions are flushed by single call
+            const auto first = std::size_t(__builtin_ctzll(bits));
+            std::size_t last = first;
+            while (last + 1 < scRegionsPerWord && (bits & (uint64_t(1) << (last + 1))))
+            {
+                ++last;
+            }
+
+            const uint64_t range = (last + 1 == scRegionsPerWord ? ~uint64_t(0) : (uint64_t(1) << (last + 1)) - 1)
+                                   & ~((uint64_t(1) << first) - 1);
+            bits &= ~range;
+
+            const std::size_t offset = (wordIdx * scRegionsPerWord + first) * scRegionSize;
+            if (offset >= limit)
+            {
+                continue;
+            }
+
+            const std::size_t size = std::min((last - first + 1) * scRegionSize, limit - offset);
+            if (!flush(m_base + offset, size))
+            {
+                m_words[wordIdx].fetch_or(range, std::memory_order_relaxed);
+                continue;
+            }
+
+            flushed += size;
+            if (flushed >= maxBytes)
+            {
+                // rest of the word is left for the next call
+                m_words[wordIdx].fetch_or(bits, std::memory_order_relaxed);
+                m_cursor = wordIdx;
+                return flushed;
+            }
+        }
+
+        m_cursor = (wordIdx + 1) % numWords;
+    }
+
+    return flushed;
+}
+
+std::size_t DirtyRegions::DirtyBytes() const
+{
+    std::size_t numRegions = 0;
+    for (std::size_t i = 0; i < m_numWords; ++i)
+    {
+        numRegions += __builtin_popcountll(m_words[i].load(std::memory_order_relaxed));
+    }
+
+    return numRegions * scRegionSize;
+}
+
+} // namespace kvdb
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace kvdb
+{
+
+/// @brief coarse bitmap of regions of the mapping modified since they were
+/// written on disk
+/// Regions are marked by modifying operations under their shard locks only,
+/// background flusher collects them concurrently. Marking is best effort: memory
+/// modified internally by the segment allocator is not tracked, so full flush is
+/// still required before write-ahead log is dropped
+class DirtyRegions
+{
+public:
+    static const std::size_t scRegionSize = 64 * 1024;
+
+    /// @brief called for every range of adjacent dirty regions
+    /// @return false if range was not written, it is kept dirty in this case
+    using FlushFunc = std::function<bool(char* begin, std::size_t size)>;
+
+    /// @param capacity size of the address range which can be tracked
+    DirtyRegions(char* base, std::size_t capacity);
+
+    void Mark(const void* address, std::size_t size);
+
+    template<typename Type>
+    void Mark(const Type* object)
+    {
+        Mark(object, sizeof(Type));
+    }
+
+    /// @brief passes dirty ranges below the limit to the flush function and clears them
+    /// Every call continues from the position where previous one has stopped
+    /// @param maxBytes approximate number of bytes to flush
+    /// @return number of flushed bytes
+    std::size_t Flush(std::size_t limit, std::size_t maxBytes, const FlushFunc& flush);
+
+    /// @return number of bytes in dirty regions
+    std::size_t DirtyBytes() const;
+
+private:
+    using Word = std::atomic<uint64_t>;
+    static const std::size_t scRegionsPerWord = 64;
+
+    char*                   m_base;
+    std::size_t             m_capacity;
+    std::size_t             m_numWords;
+    std::unique_ptr<Word[]> m_words;
+    std::size_t             m_cursor = 0;   ///< word to start next flush from
+};
+
+} // namespace kvdb
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace kvdb
+{
+
+/// @brief recycles memory of asynchronous handlers of one connection
+/// Connection has few operations in flight at a time: read, write and posts of commands
+/// and results, so memory of their handlers is taken from a fixed number of slots and
+/// steady state operations do not allocate. Slots are taken and released by any thread,
+/// handlers larger than a slot or beyond the number of slots are allocated from the heap
+template<std::size_t NumSlots, std::size_t SlotSize = 256>
+class HandlerMemory
+{
+public:
+
+    HandlerMemory() = default;
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+    void* Allocate(const std::size_t size)
+    {
+        if (size <= SlotSize)
+        {
+            for (std::size_t i = 0; i < NumSlots; ++i)
+            {
+                if (!m_used[i].load(std::memory_order_relaxed)
+                        && !m_used[i].exchange(true, std::memory_order_acquire))
+                {
+                    return m_slots[i].m_data;
+                }
+            }
+        }
+
+        return ::operator new(size);
+    }
+
+    void Deallocate(void* ptr)
+    {
+        const auto address = reinterpret_cast<std::uintptr_t>(ptr);
+        const auto begin = reinterpret_cast<std::uintptr_t>(m_slots.data());
+        if (address >= begin && address < begin + sizeof(m_slots))
+        {
+            m_used[(address - begin) / sizeof(Slot)].store(false, std::memory_order_release);
+            return;
+        }
+
+        ::operator delete(ptr);
+    }
+
+private:
+    struct alignas(std::max_align_t) Slot
+    {
+        char    m_data[SlotSize];
+    };
+
+    std::array<Slot, NumSlots>              m_slots;
+    std::array<std::atomic<bool>, NumSlots> m_used {};
+};
+
+/// @brief handler which takes memory of it's operations from HandlerMemory
+/// Wrappers of asio (strands, binders and composed operations) forward allocation hooks
+/// to the handler they wrap, so it is used as the innermost handler
+template<typename Memory, typename Handler>
+class AllocHandler
+{
+public:
+    AllocHandler(Memory& memory, Handler handler)
+        : m_memory(memory)
+        , m_handler(std::move(handler))
+    {}
+
+    template<typename... Args>
+    void operator()(Args&&... args)
+    {
+        m_handler(std::forward<Args>(args)...);
+    }
+
+    friend void* asio_handler_allocate(const std::size_t size, AllocHandler* handler)
+    {
+        return handler->m_memory.Allocate(size);
+    }
+
+    friend void asio_handler_deallocate(void* ptr, std::size_t, AllocHandler* handler)
+    {
+        handler->m_memory.Deallocate(ptr);
+    }
+
+private:
+    Memory&     m_memory;
+    Handler     m_handler;
+};
+
+template<typename Memory, typename Handler>
+inline AllocHandler<Memory, typename std::decay<Handler>::type> MakeAllocHandler(Memory& memory, Handler&& handler)
+{
+    return AllocHandler<Memory, typename std::decay<Handler>::type>(memory, std::forward<Handler>(handler));
+}
+
+} // namespace kvdb
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace kvdb
+{
+
+/// @brief fast non-cryptographic 64-bit hash of byte strings
+/// Based on wyhash (public domain, Wang Yi). Result is persisted inside
+/// mapped file, so function MUST NOT change without format version update
+class Hash
+{
+public:
+    static uint64_t Bytes(const void* data, const std::size_t size, uint64_t seed = 0)
+    {
+        const auto* p = static_cast<const uint8_t*>(data);
+        uint64_t a = 0;
+        uint64_t b = 0;
+
+        seed ^= mix(seed ^ scSecret[0], scSecret[1]);
+        if (size <= 16)
+        {
+            if (size >= 4)
+            {
+                const std::size_t shift = (size >> 3) << 2;
+                a = (read32(p) << 32) | read32(p + shift);
+                b = (read32(p + size - 4) << 32) | read32(p + size - 4 - shift);
+            }
+            else if (size > 0)
+            {
+                a = (uint64_t(p[0]) << 16) | (uint64_t(p[size >> 1]) << 8) | p[size - 1];
+            }
+        }
+        else
+        {
+            std::size_t left = size;
+            if (left > 48)
+            {
+                uint64_t seed1 = seed;
+                uint64_t seed2 = seed;
+                do
+                {
+                    seed = mix(read64(p) ^ scSecret[1], read64(p + 8) ^ seed);
+                    seed1 = mix(read64(p + 16) ^ scSecret[2], read64(p + 24) ^ seed1);
+                    seed2 = mix(read64(p + 32) ^ scSecret[3], read64(p + 40) ^ seed2);
+                    p += 48;
+                    left -= 48;
+                }
+                while (left > 48);
+                seed ^= seed1 ^ seed2;
+            }
+
+            while (left > 16)
+            {
+                seed = mix(read64(p) ^ scSecret[1], read64(p + 8) ^ seed);
+                p += 16;
+                left -= 16;
+            }
+
+            a = read64(p + left - 16);
+            b = read64(p + left - 8);
+        }
+
+        a ^= scSecret[1];
+        b ^= seed;
+        multiply(a, b);
+        return mix(a ^ scSecret[0] ^ size, b ^ scSecret[1]);
+    }
+
+    static uint64_t String(const std::string_view& str)
+    {
+        return Bytes(str.data(), str.size());
+    }
+
+private:
+    static constexpr uint64_t scSecret[4] =
+    {
+        0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+    };
+
+    static void multiply(uint64_t& a, uint64_t& b)
+    {
+        const __uint128_t result = static_cast<__uint128_t>(a) * b;
+        a = static_cast<uint64_t>(result);
+        b = static_cast<uint64_t>(result >> 64);
+    }
+
+    static uint64_t mix(uint64_t a, uint64_t b)
+    {
+        multiply(a, b);
+        return a ^ b;
+    }
+
+    static uint64_t read64(const uint8_t* p)
+    {
+        uint64_t result;
+        std::memcpy(&result, p, sizeof(result));
+        return result;
+    }
+
+    static uint64_t read32(const uint8_t* p)
+    {
+        uint32_t result;
+        std::memcpy(&result, p, sizeof(result));
+        return result;
+    }
+};
+
+} // namespace kvdb
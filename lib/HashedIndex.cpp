@@ -0,0 +1,149 @@
+#include "HashedIndex.hpp"
+
+namespace kvdb
+{
+
+static const char scCountersSuffix[] = ".Counters";
+
+std::unique_ptr<StorageIndex> HashedIndex::Open(ReservedMappedFile& mappedFile,
+                                                const std::string& name,
+                                                SlabHeap& heap)
+{
+    auto& file = mappedFile.File();
+    const SlabAllocator<RecordRef> allocator(&heap);
+    auto storage = file.find_or_construct<InternalStorage>(name.c_str())(allocator);
+    auto counters = file.find_or_construct<Counters>((name + scCountersSuffix).c_str())();
+    return std::unique_ptr<StorageIndex>(new HashedIndex(storage, counters, heap, mappedFile.Dirty()));
+}
+
+HashedIndex::HashedIndex(InternalStorage* storage,
+                         Counters* counters,
+                         SlabHeap& heap,
+                         DirtyRegions& dirty)
+    : m_storage(storage)
+    , m_counters(counters)
+    , m_heap(heap)
+    , m_dirty(dirty)
+{
+}
+
+bool HashedIndex::Insert(const KeyView& key, std::string_view value)
+{
+    auto& index = m_storage->get<ByKey>();
+    if (index.find(key) != index.end())
+    {
+        return false;
+    }
+
+    Record* record = Record::Create(m_heap, key, value);
+    try
+    {
+        // links of neighbour nodes and buckets are not tracked
+        const auto it = index.insert(RecordRef { key.m_hash, record }).first;
+        m_dirty.Mark(&*it);
+    }
+    catch (...)
+    {
+        Record::Destroy(m_heap, record);
+        throw;
+    }
+
+    m_counters->m_payloadBytes += record->PayloadSize();
+    m_dirty.Mark(m_storage);
+    m_dirty.Mark(m_counters);
+    record->MarkDirty(m_dirty);
+    return true;
+}
+
+bool HashedIndex::Update(const KeyView& key, std::string_view value)
+{
+    auto& index = m_storage->get<ByKey>();
+    auto it = index.find(key);
+    if (it == index.end())
+    {
+        return false;
+    }
+
+    Record* record = it->m_record.get();
+    const auto payloadSize = record->PayloadSize();
+    if (!record->AssignValue(m_heap, value))
+    {
+        // value does not fit, record is replaced by the new one,
+        // key stays the same so node is not relinked
+        Record* newRecord = Record::Create(m_heap, key, value);
+        index.modify(it, [newRecord](RecordRef& ref)
+        {
+            ref.m_record = newRecord;
+        });
+
+        Record::Destroy(m_heap, record);
+        record = newRecord;
+        m_dirty.Mark(&*it);
+    }
+
+    m_counters->m_payloadBytes += record->PayloadSize();
+    m_counters->m_payloadBytes -= payloadSize;
+    m_dirty.Mark(m_counters);
+    record->MarkDirty(m_dirty);
+    return true;
+}
+
+bool HashedIndex::Get(const KeyView& key, std::string& output) const
+{
+    auto& index = m_storage->get<ByKey>();
+    auto it = index.find(key);
+    if (it == index.end())
+    {
+        return false;
+    }
+
+    const auto value = it->m_record->Value();
+    output.assign(value.data(), value.size());
+    return true;
+}
+
+const Record* HashedIndex::Find(const KeyView& key) const
+{
+    auto& index = m_storage->get<ByKey>();
+    auto it = index.find(key);
+    return it != index.end() ? it->m_record.get() : nullptr;
+}
+
+bool HashedIndex::Delete(const KeyView& key)
+{
+    auto& index = m_storage->get<ByKey>();
+    auto it = index.find(key);
+    if (it == index.end())
+    {
+        return false;
+    }
+
+    Record* record = it->m_record.get();
+    m_counters->m_payloadBytes -= record->PayloadSize();
+    m_dirty.Mark(m_storage);
+    m_dirty.Mark(m_counters);
+    record->MarkDirty(m_dirty);
+    index.erase(it);
+    Record::Destroy(m_heap, record);
+    return true;
+}
+
+std::size_t HashedIndex::Size() const
+{
+    return m_storage->get<ByKey>().size();
+}
+
+std::size_t HashedIndex::PayloadBytes() const
+{
+    return m_counters->m_payloadBytes;
+}
+
+void HashedIndex::ForEach(const RecordCallback& callback) const
+{
+    for (const auto& ref : m_storage->get<ByKey>())
+    {
+        callback(*ref.m_record);
+    }
+}
+
+} // namespace kvdb
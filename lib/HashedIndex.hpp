@@ -0,0 +1,125 @@
+#pragma once
+
+#include <memory>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+
+#include "ReservedMappedFile.hpp"
+#include "SlabHeap.hpp"
+#include "StorageIndex.hpp"
+
+namespace kvdb
+{
+
+/// @brief index based on node-based boost::multi_index hashed_unique container
+/// Nodes refer to records allocated separately, both are allocated from shard's heap
+class HashedIndex
+        : public StorageIndex
+{
+public:
+    /// @brief finds index with given name inside mapped file or constructs new one
+    static std::unique_ptr<StorageIndex> Open(ReservedMappedFile& mappedFile,
+                                              const std::string& name,
+                                              SlabHeap& heap);
+
+    bool Insert(const KeyView& key, std::string_view value) override;
+    bool Update(const KeyView& key, std::string_view value) override;
+    bool Get(const KeyView& key, std::string& output) const override;
+    const Record* Find(const KeyView& key) const override;
+    bool Delete(const KeyView& key) override;
+    std::size_t Size() const override;
+    std::size_t PayloadBytes() const override;
+    void ForEach(const RecordCallback& callback) const override;
+
+private:
+    /// @brief node of the container referring to the record
+    struct RecordRef
+    {
+        std::size_t                             m_hash; ///< copy of the record's hash, so buckets are
+                                                        ///< scanned and rehashed without touching records
+        boost::interprocess::offset_ptr<Record> m_record;
+    };
+
+    /// @brief key of the node, record's key is read only on full hash match
+    struct RecordKey
+    {
+        std::size_t     m_hash;
+        const Record*   m_record;
+    };
+
+    /// @brief key extractor of the index
+    struct EntryKey
+    {
+        using result_type = RecordKey;
+
+        result_type operator()(const RecordRef& ref) const
+        {
+            return RecordKey { ref.m_hash, ref.m_record.get() };
+        }
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const RecordKey& key) const
+        {
+            return key.m_hash;
+        }
+
+        std::size_t operator()(const KeyView& key) const
+        {
+            return key.m_hash;
+        }
+    };
+
+    struct KeyEqual
+    {
+        bool operator()(const RecordKey& lhs, const RecordKey& rhs) const
+        {
+            return lhs.m_hash == rhs.m_hash && lhs.m_record->Key() == rhs.m_record->Key();
+        }
+
+        bool operator()(const KeyView& lhs, const RecordKey& rhs) const
+        {
+            return lhs.m_hash == rhs.m_hash && lhs == rhs.m_record->Key();
+        }
+
+        bool operator()(const RecordKey& lhs, const KeyView& rhs) const
+        {
+            return (*this)(rhs, lhs);
+        }
+    };
+
+    struct ByKey{};
+
+    using InternalStorage =
+        boost::multi_index_container<
+            RecordRef,
+            boost::multi_index::indexed_by<
+                boost::multi_index::hashed_unique<
+                    boost::multi_index::tag<ByKey>,
+                    EntryKey,
+                    KeyHash,
+                    KeyEqual
+                >
+            >,
+            SlabAllocator<RecordRef>>;
+
+    /// @brief persistent counters of the index stored next to the container
+    struct Counters
+    {
+        std::size_t m_payloadBytes = 0;
+    };
+
+    HashedIndex(InternalStorage* storage,
+                Counters* counters,
+                SlabHeap& heap,
+                DirtyRegions& dirty);
+
+    InternalStorage*        m_storage;
+    Counters*               m_counters;
+    SlabHeap&               m_heap;
+    DirtyRegions&           m_dirty;
+};
+
+} // namespace kvdb
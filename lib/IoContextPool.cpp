@@ -0,0 +1,81 @@
+#include <algorithm>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <boost/format.hpp>
+
+#include "IoContextPool.hpp"
+
+namespace kvdb
+{
+
+IoContextPool::IoContextPool(Logger& logger, const std::size_t numContexts)
+    : m_logger(logger)
+{
+    m_contexts.reserve(numContexts);
+    m_work.reserve(numContexts);
+    for (std::size_t i = 0; i < numContexts; ++i)
+    {
+        // context is run by one thread, so it's queue is not contended
+        m_contexts.emplace_back(new boost::asio::io_context(1));
+        m_work.push_back(boost::asio::make_work_guard(*m_contexts.back()));
+    }
+}
+
+IoContextPool::~IoContextPool()
+{
+    Stop();
+}
+
+void IoContextPool::Start(const bool pinThreads)
+{
+    const std::size_t numCpus = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < m_contexts.size(); ++i)
+    {
+        auto& context = *m_contexts[i];
+        m_threads.emplace_back([this, &context]()
+        {
+            try
+            {
+                context.run();
+            }
+            catch (const std::exception& e)
+            {
+                m_logger.LogRecord(LogLevel::Error, (boost::format("Exception: %1%") % e.what()).str());
+                exit(-1);
+            }
+        });
+
+        if (pinThreads && !pinThread(m_threads.back(), i % numCpus))
+        {
+            m_logger.LogRecord(LogLevel::Warning, (boost::format("Failed to pin thread of context %1% to CPU %2%")
+                                % i % (i % numCpus)).str());
+        }
+    }
+}
+
+void IoContextPool::Stop()
+{
+    for (auto& context : m_contexts)
+    {
+        context->stop();
+    }
+
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+
+    m_threads.clear();
+}
+
+bool IoContextPool::pinThread(std::thread& thread, const std::size_t cpu)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) == 0;
+}
+
+} // namespace kvdb
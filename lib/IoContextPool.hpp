@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include "Logger.hpp"
+
+namespace kvdb
+{
+
+/// @brief io contexts run by one thread each
+/// Handlers of a context are always executed by the same thread, so connections served
+/// by the context stay on one core and do not share the queue of handlers with other threads
+class IoContextPool
+{
+public:
+    IoContextPool(Logger& logger, std::size_t numContexts);
+
+    virtual ~IoContextPool();
+
+    std::size_t Size() const
+    {
+        return m_contexts.size();
+    }
+
+    boost::asio::io_context& Context(const std::size_t idx)
+    {
+        return *m_contexts[idx];
+    }
+
+    /// @brief starts thread of every context
+    /// @param pinThreads thread of i-th context is pinned to i-th CPU (modulo number of CPUs)
+    void Start(bool pinThreads);
+
+    /// @brief stops all contexts and waits for their threads
+    void Stop();
+
+private:
+    using WorkGuard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+
+    /// @return false if thread is not pinned
+    static bool pinThread(std::thread& thread, std::size_t cpu);
+
+    Logger&                                                 m_logger;
+    std::vector<std::unique_ptr<boost::asio::io_context>>   m_contexts;
+    std::vector<WorkGuard>                                  m_work;     ///< contexts run until stopped
+    std::vector<std::thread>                                m_threads;
+};
+
+} // namespace kvdb
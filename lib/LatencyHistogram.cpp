@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cmath>
+
+#include "LatencyHistogram.hpp"
+
+namespace kvdb
+{
+
+uint64_t LatencyHistogram::LowestOf(const std::size_t index)
+{
+    if (index < scNumSubBuckets)
+    {
+        return index;
+    }
+
+    const uint64_t shift = index / scNumSubBuckets - 1;
+    return (scNumSubBuckets + index % scNumSubBuckets) << shift;
+}
+
+uint64_t LatencyHistogram::HighestOf(const std::size_t index)
+{
+    if (index < scNumSubBuckets)
+    {
+        return index;
+    }
+
+    const uint64_t shift = index / scNumSubBuckets - 1;
+    return ((scNumSubBuckets + index % scNumSubBuckets + 1) << shift) - 1;
+}
+
+LatencySnapshot::LatencySnapshot()
+    : m_buckets(LatencyHistogram::scNumBuckets, 0)
+{}
+
+void LatencySnapshot::Merge(const LatencyHistogram& histogram)
+{
+    for (std::size_t i = 0; i < m_buckets.size(); ++i)
+    {
+        const auto count = histogram.Bucket(i);
+        m_buckets[i] += count;
+        m_count += count;
+    }
+
+    m_max = std::max(m_max, histogram.Max());
+    m_sum += histogram.Sum();
+}
+
+std::chrono::nanoseconds LatencySnapshot::Percentile(const double fraction) const
+{
+    if (m_count == 0)
+    {
+        return std::chrono::nanoseconds(0);
+    }
+
+    const auto rank = std::max<uint64_t>(1, uint64_t(std::ceil(fraction * double(m_count))));
+    uint64_t counted = 0;
+    for (std::size_t i = 0; i < m_buckets.size(); ++i)
+    {
+        counted += m_buckets[i];
+        if (counted >= rank)
+        {
+            const auto middle = (LatencyHistogram::LowestOf(i) + LatencyHistogram::HighestOf(i)) / 2;
+            // max is recorded after the bucket, so it may lag behind it
+            return std::chrono::nanoseconds(m_max != 0 ? std::min(middle, m_max) : middle);
+        }
+    }
+
+    return Max();
+}
+
+LatencyRecorder::LatencyRecorder(const std::size_t numSeries)
+    : m_numSeries(numSeries)
+{}
+
+LatencyRecorder::~LatencyRecorder()
+{
+    for (auto& stripe : m_stripes)
+    {
+        delete[] stripe.load();
+    }
+}
+
+LatencySnapshot LatencyRecorder::Snapshot(const std::size_t series) const
+{
+    LatencySnapshot snapshot;
+    for (const auto& stripe : m_stripes)
+    {
+        if (const auto* histograms = stripe.load(std::memory_order_acquire))
+        {
+            snapshot.Merge(histograms[series]);
+        }
+    }
+
+    return snapshot;
+}
+
+LatencyHistogram* LatencyRecorder::allocateStripe(const std::size_t index)
+{
+    // threads sharing the stripe may allocate it concurrently, only one of them installs it
+    auto* stripe = new LatencyHistogram[m_numSeries];
+    LatencyHistogram* installed = nullptr;
+    if (!m_stripes[index].compare_exchange_strong(installed, stripe, std::memory_order_acq_rel))
+    {
+        delete[] stripe;
+        return installed;
+    }
+
+    return stripe;
+}
+
+} // namespace kvdb
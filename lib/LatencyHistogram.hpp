@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kvdb
+{
+
+/// @brief log-linear (HDR-style) histogram of latencies in nanoseconds
+/// Every range between two powers of two is split into scNumSubBuckets buckets, so latencies
+/// of any magnitude are kept with relative error below 1 / scNumSubBuckets. Buckets are
+/// incremented atomically by any thread and never reset
+class alignas(64) LatencyHistogram
+{
+public:
+    static constexpr unsigned       scSubBucketBits = 4;
+    static constexpr uint64_t       scNumSubBuckets = uint64_t(1) << scSubBucketBits;
+    /// latencies of 2^scMaxBits ns (about 68 seconds) and longer are counted by the last bucket
+    static constexpr unsigned       scMaxBits = 36;
+    static constexpr std::size_t    scNumBuckets = (scMaxBits - scSubBucketBits + 1) * scNumSubBuckets;
+
+    void Record(const std::chrono::nanoseconds latency)
+    {
+        const auto value = uint64_t(std::max<std::chrono::nanoseconds::rep>(latency.count(), 0));
+        m_buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+
+        auto max = m_max.load(std::memory_order_relaxed);
+        while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    uint64_t Bucket(const std::size_t index) const
+    {
+        return m_buckets[index].load(std::memory_order_relaxed);
+    }
+
+    uint64_t Max() const
+    {
+        return m_max.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Sum() const
+    {
+        return m_sum.load(std::memory_order_relaxed);
+    }
+
+    static std::size_t BucketOf(uint64_t value)
+    {
+        value = std::min(value, (uint64_t(1) << scMaxBits) - 1);
+        if (value < scNumSubBuckets)
+        {
+            return std::size_t(value);
+        }
+
+        const unsigned shift = 63 - __builtin_clzll(value) - scSubBucketBits;
+        return std::size_t((shift + 1) * scNumSubBuckets + (value >> shift) - scNumSubBuckets);
+    }
+
+    /// @return smallest latency counted by the bucket
+    static uint64_t LowestOf(std::size_t index);
+
+    /// @return largest latency counted by the bucket
+    static uint64_t HighestOf(std::size_t index);
+
+private:
+    std::array<std::atomic<uint64_t>, scNumBuckets> m_buckets {};
+    std::atomic<uint64_t>                           m_max { 0 };
+    std::atomic<uint64_t>                           m_sum { 0 };    ///< of all recorded latencies
+};
+
+/// @brief counts of histograms merged while they are recorded
+class LatencySnapshot
+{
+public:
+    LatencySnapshot();
+
+    void Merge(const LatencyHistogram& histogram);
+
+    uint64_t Count() const
+    {
+        return m_count;
+    }
+
+    /// @return latency which is not exceeded by the fraction of recorded ones,
+    /// middle of the bucket it falls into
+    std::chrono::nanoseconds Percentile(double fraction) const;
+
+    std::chrono::nanoseconds Max() const
+    {
+        return std::chrono::nanoseconds(m_max);
+    }
+
+    std::chrono::nanoseconds Sum() const
+    {
+        return std::chrono::nanoseconds(m_sum);
+    }
+
+    /// @return number of latencies counted by the bucket
+    uint64_t Bucket(const std::size_t index) const
+    {
+        return m_buckets[index];
+    }
+
+private:
+    std::vector<uint64_t>   m_buckets;
+    uint64_t                m_count = 0;
+    uint64_t                m_max = 0;
+    uint64_t                m_sum = 0;
+};
+
+/// @brief latency histograms of a number of series recorded by many threads
+/// Every thread records into a stripe of histograms of it's own, allocated when it records
+/// first time, so threads do not share cache lines of the buckets. Stripes are merged only
+/// when snapshot is taken. Threads beyond the number of stripes share them
+class LatencyRecorder
+{
+public:
+    static constexpr std::size_t scMaxStripes = 16;
+
+    explicit LatencyRecorder(std::size_t numSeries);
+
+    LatencyRecorder(const LatencyRecorder&) = delete;
+    LatencyRecorder& operator=(const LatencyRecorder&) = delete;
+
+    ~LatencyRecorder();
+
+    void Record(const std::size_t series, const std::chrono::nanoseconds latency)
+    {
+        const auto index = threadStripe();
+        auto* stripe = m_stripes[index].load(std::memory_order_acquire);
+        if (stripe == nullptr)
+        {
+            stripe = allocateStripe(index);
+        }
+
+        stripe[series].Record(latency);
+    }
+
+    /// @return histograms of the series of all stripes merged together
+    LatencySnapshot Snapshot(std::size_t series) const;
+
+private:
+    static std::size_t threadStripe()
+    {
+        static std::atomic<std::size_t> s_numThreads { 0 };
+        thread_local const std::size_t t_stripe = s_numThreads.fetch_add(1) % scMaxStripes;
+        return t_stripe;
+    }
+
+    LatencyHistogram* allocateStripe(std::size_t index);
+
+    const std::size_t                                           m_numSeries;
+    std::array<std::atomic<LatencyHistogram*>, scMaxStripes>    m_stripes {};
+};
+
+} // namespace kvdb
@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Logger.hpp"
+#include "SpscQueue.hpp"
+
+namespace kvdb
+{
+
+namespace
+{
+
+using Clock = std::chrono::system_clock;
+
+struct LogEntry
+{
+    Clock::time_point   m_time;
+    LogLevel            m_level = LogLevel::Info;
+    std::string         m_record;
+};
+
+/// @brief records of one thread, kept by the writer after the thread exits until they are written
+struct LogRing
+{
+    static constexpr std::size_t scCapacity = 4096;
+
+    SpscQueue<LogEntry>         m_queue { scCapacity };
+    std::atomic<std::size_t>    m_numDropped { 0 };     ///< records which did not fit the ring
+    std::atomic<bool>           m_retired { false };    ///< thread exited, nothing is added anymore
+};
+
+/// serializes output of the writer and of records written after it is destroyed
+std::mutex g_outputMutex;
+
+void writeEntry(std::ostream& output, const LogEntry& entry)
+{
+    static const char* const scLevelNames[] = { "debug", "info", "warning", "error" };
+
+    const auto time = Clock::to_time_t(entry.m_time);
+    const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                            entry.m_time.time_since_epoch()).count() % 1000000;
+    std::tm local;
+    localtime_r(&time, &local);
+    char stamp[32];
+    const auto size = std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+    std::snprintf(stamp + size, sizeof(stamp) - size, ".%06lld", static_cast<long long>(micros));
+
+    output << '[' << stamp << "] [" << scLevelNames[std::min(int(entry.m_level), 3)] << "] "
+           << entry.m_record << '\n';
+}
+
+/// @brief writes records of all threads to std::clog
+class LogWriter
+{
+public:
+    /// @return nullptr once the writer is destroyed at exit
+    static LogWriter* Instance()
+    {
+        if (s_destroyed.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+
+        static LogWriter writer;
+        return &writer;
+    }
+
+    ~LogWriter()
+    {
+        s_destroyed.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+
+        m_wakeup.notify_one();
+        m_thread.join();
+    }
+
+    /// @return ring of the calling thread, nullptr if the thread is exiting
+    LogRing* Ring()
+    {
+        thread_local RingHolder holder;
+        if (t_ring == nullptr && !t_exited)
+        {
+            holder.m_ring = std::make_shared<LogRing>();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_rings.push_back(holder.m_ring);
+            t_ring = holder.m_ring.get();
+        }
+
+        return t_ring;
+    }
+
+    void Flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const auto requested = ++m_numFlushesRequested;
+        m_wakeup.notify_one();
+        m_flushed.wait(lock, [this, requested]()
+        {
+            return m_numFlushesDone >= requested || m_stopped;
+        });
+    }
+
+private:
+    /// interval between drains of the rings
+    static constexpr std::chrono::milliseconds scDrainInterval { 10 };
+
+    /// @brief retires ring of the thread when it exits
+    struct RingHolder
+    {
+        ~RingHolder()
+        {
+            if (m_ring)
+            {
+                m_ring->m_retired.store(true, std::memory_order_release);
+            }
+
+            t_ring = nullptr;
+            t_exited = true;
+        }
+
+        std::shared_ptr<LogRing>    m_ring;
+    };
+
+    LogWriter()
+        : m_thread([this]()
+        {
+            run();
+        })
+    {}
+
+    void run()
+    {
+        std::vector<std::shared_ptr<LogRing>> rings;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_wakeup.wait_for(lock, scDrainInterval, [this]()
+            {
+                return m_stopped || m_numFlushesRequested != m_numFlushesDone;
+            });
+
+            const bool stopped = m_stopped;
+            const auto numFlushesRequested = m_numFlushesRequested;
+            rings = m_rings;
+            lock.unlock();
+
+            // ring retired before it is drained stays empty
+            std::vector<bool> retired;
+            for (const auto& ring : rings)
+            {
+                retired.push_back(ring->m_retired.load(std::memory_order_acquire));
+            }
+
+            drain(rings);
+
+            lock.lock();
+            for (std::size_t i = 0; i < rings.size(); ++i)
+            {
+                if (retired[i])
+                {
+                    m_rings.erase(std::find(m_rings.begin(), m_rings.end(), rings[i]));
+                }
+            }
+
+            m_numFlushesDone = numFlushesRequested;
+            m_flushed.notify_all();
+            if (stopped)
+            {
+                return;
+            }
+        }
+    }
+
+    void drain(const std::vector<std::shared_ptr<LogRing>>& rings)
+    {
+        std::size_t numDropped = 0;
+        LogEntry entry;
+        std::lock_guard<std::mutex> lock(g_outputMutex);
+        for (const auto& ring : rings)
+        {
+            while (ring->m_queue.Pop(entry))
+            {
+                writeEntry(std::clog, entry);
+            }
+
+            numDropped += ring->m_numDropped.exchange(0, std::memory_order_relaxed);
+        }
+
+        if (numDropped != 0)
+        {
+            writeEntry(std::clog, LogEntry {
+                           Clock::now(),
+                           LogLevel::Warning,
+                           std::to_string(numDropped) + " log records dropped, rings are full"
+                       });
+        }
+
+        std::clog.flush();
+    }
+
+    static inline std::atomic<bool>         s_destroyed { false };
+    static inline thread_local LogRing*     t_ring = nullptr;
+    static inline thread_local bool         t_exited = false;   ///< ring of the thread is retired
+
+    std::mutex                              m_mutex;
+    std::condition_variable                 m_wakeup;
+    std::condition_variable                 m_flushed;
+    std::vector<std::shared_ptr<LogRing>>   m_rings;    ///< rings of all threads, retired ones until drained
+    uint64_t                                m_numFlushesRequested = 0;
+    uint64_t                                m_numFlushesDone = 0;
+    bool                                    m_stopped = false;
+    std::thread                             m_thread;
+};
+
+} // namespace
+
+void Logger::SetLevel(const LogLevel level)
+{
+    s_level.store(int(level), std::memory_order_relaxed);
+}
+
+bool Logger::ParseLevel(const std::string& name, LogLevel& level)
+{
+    static const std::pair<const char*, LogLevel> scLevels[] = {
+        { "debug", LogLevel::Debug },
+        { "info", LogLevel::Info },
+        { "warning", LogLevel::Warning },
+        { "error", LogLevel::Error },
+        { "off", LogLevel::Off }
+    };
+
+    for (const auto& entry : scLevels)
+    {
+        if (name == entry.first)
+        {
+            level = entry.second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Logger::Flush()
+{
+    if (auto* writer = LogWriter::Instance())
+    {
+        writer->Flush();
+    }
+}
+
+void Logger::push(const LogLevel level, const std::string_view record)
+{
+    LogEntry entry { Clock::now(), level, std::string(record) };
+    auto* writer = LogWriter::Instance();
+    auto* ring = writer ? writer->Ring() : nullptr;
+    if (ring == nullptr)
+    {
+        // records of exiting threads are written synchronously
+        std::lock_guard<std::mutex> lock(g_outputMutex);
+        writeEntry(std::clog, entry);
+        return;
+    }
+
+    if (!ring->m_queue.Push(std::move(entry)))
+    {
+        ring->m_numDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+} // namespace kvdb
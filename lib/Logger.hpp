@@ -1,36 +1,75 @@
 #pragma once
 
-#include <memory>
+#include <atomic>
 #include <string>
-#include <thread>
+#include <string_view>
 
-#include <boost/log/sources/logger.hpp>
-#include <boost/log/sources/record_ostream.hpp>
+/// records of levels below this one are removed by the compiler, 0 keeps all of them
+#ifndef KVDB_MIN_LOG_LEVEL
+#define KVDB_MIN_LOG_LEVEL 0
+#endif
 
 namespace kvdb
 {
 
+enum class LogLevel : int
+{
+    Debug = 0,  ///< records of every command and result
+    Info,
+    Warning,
+    Error,
+    Off
+};
+
+/// @brief writes records of enabled levels
+/// Every thread puts records into a lock-free ring of it's own, rings are drained by a background
+/// writer thread, so logging thread never waits for output or for other threads. Records which
+/// do not fit the ring are dropped and counted. Level is common for all loggers of the process,
+/// records of disabled levels cost only the check of the level: records are copied only when
+/// their level is enabled, callers check it with Enabled before formatting records, so records
+/// below KVDB_MIN_LOG_LEVEL are removed with their formatting
 class Logger
 {
 public:
+    static constexpr LogLevel scMinLevel = LogLevel(KVDB_MIN_LOG_LEVEL);
+
     virtual ~Logger()
     {
         LogRecord("Logger destroyed");
     }
 
-    void LogRecord(const std::string& record)
+    /// @return true if records of the level are written
+    static bool Enabled(const LogLevel level)
+    {
+        return level >= scMinLevel && int(level) >= s_level.load(std::memory_order_relaxed);
+    }
+
+    /// @brief sets minimum level of written records, may be called by any thread
+    static void SetLevel(LogLevel level);
+
+    /// @return false if name is not one of debug, info, warning, error, off
+    static bool ParseLevel(const std::string& name, LogLevel& level);
+
+    /// @brief waits until records logged by all threads so far are written
+    static void Flush();
+
+    void LogRecord(const std::string_view record)
     {
-        if (auto lr = m_logger.open_record())
+        LogRecord(LogLevel::Info, record);
+    }
+
+    void LogRecord(const LogLevel level, const std::string_view record)
+    {
+        if (Enabled(level))
         {
-            boost::log::record_ostream ostream(lr);
-            ostream << record;
-            ostream.flush();
-            m_logger.push_record(boost::move(lr));
+            push(level, record);
         }
     }
 
 private:
-    boost::log::sources::logger_mt  m_logger;
+    static void push(LogLevel level, std::string_view record);
+
+    static inline std::atomic<int>  s_level { int(LogLevel::Info) };
 };
 
 }
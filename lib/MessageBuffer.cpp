@@ -0,0 +1,62 @@
+#include <algorithm>
+
+#include "MessageBuffer.hpp"
+
+namespace kvdb
+{
+
+MessageBuffer::MessageBuffer(const std::size_t capacity)
+    : m_data(new char[capacity])
+    , m_capacity(capacity)
+    , m_refCount(0)
+{
+}
+
+BufferPool::BufferPool()
+{
+    m_free.reserve(scMaxPooledBuffers);
+}
+
+MessageBuffer::Ptr BufferPool::Acquire(const std::size_t size)
+{
+    std::unique_ptr<MessageBuffer> buffer;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it = std::find_if(m_free.rbegin(), m_free.rend(),
+                                     [size](const std::unique_ptr<MessageBuffer>& free)
+                                     {
+                                         return free->Capacity() >= size;
+                                     });
+        if (it != m_free.rend())
+        {
+            buffer = std::move(*it);
+            m_free.erase(std::next(it).base());
+        }
+    }
+
+    if (!buffer)
+    {
+        buffer.reset(new MessageBuffer(std::max(size, scMinCapacity)));
+    }
+
+    buffer->m_size = size;
+    buffer->m_pool = shared_from_this();
+    return MessageBuffer::Ptr(buffer.release());
+}
+
+void BufferPool::recycle(MessageBuffer* buffer)
+{
+    std::unique_ptr<MessageBuffer> released(buffer);
+    if (released->Capacity() > scMaxPooledCapacity)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_free.size() < scMaxPooledBuffers)
+    {
+        m_free.push_back(std::move(released));
+    }
+}
+
+} // namespace kvdb
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/intrusive_ptr.hpp>
+
+namespace kvdb
+{
+
+class BufferPool;
+
+/// @brief memory of one received message
+/// Buffer is reference counted: messages parsed in place keep it alive while their
+/// fields refer to it, and it returns to it's pool when the last reference is released
+class MessageBuffer
+{
+public:
+    using Ptr = boost::intrusive_ptr<MessageBuffer>;
+
+    char* Data()
+    {
+        return m_data.get();
+    }
+
+    const char* Data() const
+    {
+        return m_data.get();
+    }
+
+    std::size_t Size() const
+    {
+        return m_size;
+    }
+
+    std::size_t Capacity() const
+    {
+        return m_capacity;
+    }
+
+private:
+    friend class BufferPool;
+    friend void intrusive_ptr_add_ref(MessageBuffer* buffer);
+    friend void intrusive_ptr_release(MessageBuffer* buffer);
+
+    explicit MessageBuffer(std::size_t capacity);
+
+    std::unique_ptr<char[]>     m_data;
+    std::size_t                 m_capacity = 0;
+    std::size_t                 m_size = 0;
+    std::atomic<uint32_t>       m_refCount;
+    std::shared_ptr<BufferPool> m_pool;     ///< owner of the buffer, set while buffer is in use
+};
+
+/// @brief buffers of messages received by one connection
+/// Messages may be executed by other threads after the next one is received, so buffers
+/// are released concurrently. Released buffers are reused by following messages, large ones
+/// are freed to not keep memory of rare large messages
+class BufferPool
+        : public std::enable_shared_from_this<BufferPool>
+{
+public:
+    using Ptr = std::shared_ptr<BufferPool>;
+
+    /// capacity of buffers, so small messages fit any of them
+    static constexpr std::size_t scMinCapacity = 4 * 1024;
+    /// buffers up to this capacity are kept in the pool
+    static constexpr std::size_t scMaxPooledCapacity = 64 * 1024;
+    static constexpr std::size_t scMaxPooledBuffers = 64;
+
+    BufferPool();
+
+    /// @return buffer of given size, it's content is not initialized
+    MessageBuffer::Ptr Acquire(std::size_t size);
+
+private:
+    friend void intrusive_ptr_release(MessageBuffer* buffer);
+
+    void recycle(MessageBuffer* buffer);
+
+    std::mutex                                  m_mutex;
+    std::vector<std::unique_ptr<MessageBuffer>> m_free;
+};
+
+inline void intrusive_ptr_add_ref(MessageBuffer* buffer)
+{
+    buffer->m_refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void intrusive_ptr_release(MessageBuffer* buffer)
+{
+    if (buffer->m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        // pool may be released by the last buffer, so it is kept alive until the buffer is recycled
+        const auto pool = std::move(buffer->m_pool);
+        pool->recycle(buffer);
+    }
+}
+
+} // namespace kvdb
@@ -1,13 +1,20 @@
 #pragma once
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <functional>
 #include <memory>
 
 #include <boost/asio.hpp>
 #include <boost/system/system_error.hpp>
 
+#include "HandlerMemory.hpp"
 #include "Logger.hpp"
+#include "MessageBuffer.hpp"
 #include "Serialization.hpp"
+#include "UringTransport.hpp"
 
 namespace kvdb
 {
@@ -25,10 +32,20 @@ struct MessageReceiverContext
     MessageCallback                     m_msgCallback;
     CloseCallback                       m_closeCallback;
     uint32_t                            m_dataToutMs = 1000; // will wait for data after header maximum 1 second
+    uint32_t                            m_protocolVersion = scProtocolText; ///< negotiated by handshake
+    UringTransport*                     m_uring = nullptr;  ///< socket is read through io_uring if set
+    std::weak_ptr<void>                 m_owner;            ///< kept alive by receives of m_uring
 };
 
 /// @brief continuously receives messages of type MessageType through socket
 /// and evaluates callback when message received
+/// Socket is read only when it is readable, into a buffer of the connection's pool acquired then,
+/// so idle connections do not hold buffers. One read receives as many pipelined messages as fit
+/// the buffer, they are parsed in place and share it. Incomplete message at the end of the buffer
+/// is moved into the next one, large message is received into a buffer of it's size.
+/// Header of a message larger than any command or result closes the connection.
+/// Through io_uring the connection keeps one multishot receive in flight instead, data of it's
+/// completions is copied from buffers of the ring the same way
 template<typename MessageType>
 class MessageReceiver
         : private MessageReceiverContext<MessageType>
@@ -38,134 +55,433 @@ public:
     using Ptr = std::shared_ptr<MessageReceiver<MessageType>>;
     using Context = MessageReceiverContext<MessageType>;
 
+    /// size of buffers reads are made into, unless message does not fit it
+    static constexpr std::size_t scReadSize = BufferPool::scMaxPooledCapacity;
+
     explicit MessageReceiver(const Context& context)
         : Context(context)
+        , m_receive(*this)
         , m_timer(context.m_ioContext)
+        , m_pool(std::make_shared<BufferPool>())
     {
     }
 
     virtual ~MessageReceiver()
     {
-        this->m_logger.LogRecord("MessageReceiver destroyed");
+        this->m_logger.LogRecord(LogLevel::Debug, "MessageReceiver destroyed");
     }
 
     void Start()
     {
+        // reads are made only when socket is readable, so they never wait for data
+        boost::system::error_code ec;
+        this->m_socket.non_blocking(true, ec);
+        if (ec)
+        {
+            this->m_logger.LogRecord(LogLevel::Error, std::string("Failed to switch socket to non-blocking mode: ") + ec.message());
+        }
+
+        if (this->m_uring)
+        {
+            startUringReceive();
+            return;
+        }
+
         startReceive();
     }
 
+    /// @brief starts receiving messages following data already read from the socket
+    /// @param received beginning of the first message, read in place of the handshake
+    void Start(std::string_view received)
+    {
+        m_readTime = std::chrono::steady_clock::now();
+        prepareBuffer();
+        std::memcpy(m_buffer->Data(), received.data(), received.size());
+        onDataReceived(received.size());
+        if (m_rejected)
+        {
+            m_timer.cancel();
+            this->m_closeCallback();
+            return;
+        }
+
+        Start();
+    }
+
 private:
-    /// @brief private type alaises
-    using BufPtr = std::shared_ptr<boost::asio::streambuf>;
+    /// @brief multishot receive of the connection, it's completions are handled on the strand
+    class UringReceive
+            : public UringOperation
+    {
+    public:
+        explicit UringReceive(MessageReceiver& receiver)
+            : m_receiver(receiver)
+        {}
+
+        void OnCompleted(UringCompletion& completion) override
+        {
+            m_receiver.m_strand.dispatch(MakeAllocHandler(m_receiver.m_handlerMemory,
+                                                          [&receiver = m_receiver,
+                                                           result = completion.m_result,
+                                                           buffer = completion.m_buffer,
+                                                           more = completion.m_more,
+                                                           keepAlive = std::move(completion.m_keepAlive)]()
+            {
+                receiver.onUringReceived(result, buffer, more);
+            }));
+        }
+
+    private:
+        MessageReceiver&    m_receiver;
+    };
 
     void startReceive()
     {
-        auto headerPtr = std::make_shared<MessageHeader>();
-        boost::asio::async_read(this->m_socket, // socket
-                                boost::asio::mutable_buffer(headerPtr.get(), scMessageHeaderSize),
-                                this->m_strand.wrap(std::bind(&MessageReceiver::onHeaderReceived, this,
-                                                              std::placeholders::_1, headerPtr)));
+        // readiness is awaited by peeking one byte: unlike async_wait, receive tries the socket
+        // before it waits, so data which arrived after the last read did not return is not missed
+        // when another thread took it's edge-triggered event meanwhile
+        this->m_socket.async_receive(boost::asio::buffer(&m_peeked, 1),
+                                     boost::asio::ip::tcp::socket::message_peek,
+                                     this->m_strand.wrap(MakeAllocHandler(m_handlerMemory,
+                                                                          std::bind(&MessageReceiver::onReadable, this,
+                                                                                    std::placeholders::_1))));
     }
 
-    void onHeaderReceived(const boost::system::error_code& ec, const MessageHeader::Ptr& headerPtr)
+    void onReadable(const boost::system::error_code& ec)
     {
-        // connection closed
-        if (ec == boost::asio::error::eof
-                || ec == boost::asio::error::broken_pipe
-                || ec == boost::asio::error::connection_reset)
+        if (ec == boost::asio::error::operation_aborted)
         {
-            this->m_closeCallback();
+            // Timeout occured when receiving message. Drop it and start receive again
+            m_timer.cancel();
+            m_timerArmed = false;
+            m_buffer.reset();
+            m_required = 0;
+            startReceive();
             return;
         }
         else if (ec)
         {
-            this->m_logger.LogRecord(std::string("Failed to receive message header: ") + ec.message());
-            startReceive();
+            onReadFailed(ec);
             return;
         }
 
-        if (!headerPtr->IsValid())
+        prepareBuffer();
+        const std::size_t space = m_buffer->Size() - m_filled;
+        boost::system::error_code readEc;
+        const std::size_t size = this->m_socket.read_some(boost::asio::buffer(m_buffer->Data() + m_filled, space),
+                                                          readEc);
+        if (readEc == boost::asio::error::would_block)
         {
-            this->m_logger.LogRecord("Invalid header");
             startReceive();
             return;
         }
+        else if (readEc)
+        {
+            onReadFailed(readEc);
+            return;
+        }
+
+        m_readTime = std::chrono::steady_clock::now();
+        onDataReceived(size);
+        if (m_rejected)
+        {
+            m_timer.cancel();
+            this->m_closeCallback();
+            return;
+        }
 
-        auto sbuf = std::make_shared<boost::asio::streambuf>(headerPtr->m_msgSize);
-        boost::asio::async_read(this->m_socket, *sbuf,
-                                boost::asio::transfer_exactly(headerPtr->m_msgSize),
-                                this->m_strand.wrap(std::bind(&MessageReceiver::onDataReceived, this,
-                                                              std::placeholders::_1, sbuf)));
+        // socket may still hold data, handlers of other connections run before it is read
+        if (size == space)
+        {
+            boost::asio::post(this->m_strand, MakeAllocHandler(m_handlerMemory,
+                                                               std::bind(&MessageReceiver::onReadable, this,
+                                                                         boost::system::error_code())));
+            return;
+        }
 
-        // start waiting for data
-        m_timer.expires_from_now(boost::posix_time::milliseconds(this->m_dataToutMs));
-        m_timer.async_wait(this->m_strand.wrap(std::bind(&MessageReceiver::onTimerEvent, this,
-                                                         std::placeholders::_1)));
+        startReceive();
     }
 
-    void onTimerEvent(const boost::system::error_code& ec)
+    /// @brief handles messages completed by data received into the buffer
+    void onDataReceived(const std::size_t size)
     {
-        if (!ec)
+        m_filled += size;
+        const bool parsed = parseMessages();
+        if (m_rejected)
         {
-            // timeout occured - protocol violation, abort all operations on socket
-            this->m_logger.LogRecord("Read header - timeout occured");
-            this->m_socket.cancel();
+            m_buffer.reset();
             return;
         }
 
-        if (ec == boost::asio::error::operation_aborted)
+        updateTimer(parsed);
+        if (m_filled == m_parsed)
         {
-            // data succesfully received - do nothing
-            return;
+            // buffer is released by handled messages, idle connection does not hold it
+            m_buffer.reset();
         }
+    }
 
-        this->m_logger.LogRecord(std::string("Unexpected error occured in deadline_timer : ")
-                                 + ec.message());
+    void startUringReceive()
+    {
+        // receive is not restarted once the session is released
+        if (auto owner = this->m_owner.lock())
+        {
+            this->m_uring->Receive(this->m_socket.native_handle(), m_receive, std::move(owner));
+        }
     }
 
-    void onDataReceived(const boost::system::error_code& ec, const BufPtr& sbuf)
+    void onUringReceived(const int result, const int buffer, const bool more)
     {
-        // cancel waiting for timeout
-        m_timer.cancel();
+        if (buffer >= 0)
+        {
+            // data is copied, so buffers of the ring are not held by incomplete messages
+            m_readTime = std::chrono::steady_clock::now();
+            const char* data = this->m_uring->BufferData(buffer);
+            std::size_t size = result > 0 && !m_rejected ? std::size_t(result) : 0;
+            while (size != 0 && !m_rejected)
+            {
+                prepareBuffer();
+                const std::size_t length = std::min(size, m_buffer->Size() - m_filled);
+                std::memcpy(m_buffer->Data() + m_filled, data, length);
+                data += length;
+                size -= length;
+                onDataReceived(length);
+            }
+
+            this->m_uring->ReleaseBuffer(buffer);
+        }
+
+        if (more)
+        {
+            if (m_rejected && !m_cancelled)
+            {
+                // descriptor is closed once the receive is finished
+                m_cancelled = true;
+                this->m_uring->Cancel(m_receive);
+            }
+
+            return;
+        }
+
+        if (m_rejected || result == 0 || result == -ECONNRESET || result == -EPIPE)
+        {
+            m_timer.cancel();
+            this->m_closeCallback();
+            return;
+        }
 
-        // connection may be closed
+        if (result == -ECANCELED)
+        {
+            // Timeout occured when receiving message. Drop it and start receive again
+            m_timer.cancel();
+            m_timerArmed = false;
+            m_buffer.reset();
+            m_required = 0;
+        }
+        else if (result == -ENOBUFS)
+        {
+            // buffers of the ring are held by completions queued on strands, they are returned
+            // by handlers run before the receive is restarted
+            boost::asio::post(this->m_strand, MakeAllocHandler(m_handlerMemory,
+                                                               std::bind(&MessageReceiver::startUringReceive, this)));
+            return;
+        }
+        else if (result < 0)
+        {
+            this->m_logger.LogRecord(LogLevel::Error, std::string("Unexpected error occured : ")
+                                     + std::strerror(-result));
+        }
+
+        startUringReceive();
+    }
+
+    void onReadFailed(const boost::system::error_code& ec)
+    {
+        // connection closed
         if (ec == boost::asio::error::eof
                 || ec == boost::asio::error::broken_pipe
                 || ec == boost::asio::error::connection_reset)
         {
+            m_timer.cancel();
             this->m_closeCallback();
             return;
         }
-        else if (ec == boost::asio::error::operation_aborted)
+
+        this->m_logger.LogRecord(LogLevel::Error, std::string("Unexpected error occured : ") + ec.message());
+        startReceive();
+    }
+
+    /// @brief provides buffer with free space for the next read
+    void prepareBuffer()
+    {
+        if (!m_buffer)
         {
-            // Timeout occured when receiving header. Start receive again
-            startReceive();
+            m_buffer = m_pool->Acquire(scReadSize);
+            m_parsed = 0;
+            m_filled = 0;
             return;
         }
-        else if (ec)
+
+        // rest of the buffer fits incomplete message or is large enough for the next read
+        const bool fits = m_required != 0 ? m_parsed + m_required <= m_buffer->Size()
+                                          : m_buffer->Size() - m_filled >= BufferPool::scMinCapacity;
+        if (fits)
         {
-            this->m_logger.LogRecord(std::string("Unexpected error occured : ") + ec.message());
-            startReceive();
             return;
         }
 
-        // data successfully received
-        std::istream is(sbuf.get());
-        MessageType msg;
-        try
+        // previous buffer is kept by received messages until they are handled
+        const std::size_t pending = m_filled - m_parsed;
+        auto buffer = m_pool->Acquire(std::max(scReadSize, m_required));
+        std::memcpy(buffer->Data(), m_buffer->Data() + m_parsed, pending);
+
+        m_buffer = std::move(buffer);
+        m_parsed = 0;
+        m_filled = pending;
+    }
+
+    /// @brief handles all complete messages of the buffer
+    /// @return true if any message was received
+    bool parseMessages()
+    {
+        bool parsed = false;
+        m_required = 0;
+        while (m_filled - m_parsed >= scMessageHeaderSize)
+        {
+            const char* data = m_buffer->Data() + m_parsed;
+            MessageHeader header;
+            std::memcpy(&header, data, scMessageHeaderSize);
+            if (!header.IsValid())
+            {
+                this->m_logger.LogRecord(LogLevel::Warning, "Invalid header");
+                m_parsed += scMessageHeaderSize;
+                continue;
+            }
+
+            if (header.m_msgSize > scMaxMessageSize)
+            {
+                // buffer of the size claimed by the peer is not acquired
+                this->m_logger.LogRecord(LogLevel::Warning, "Message is too large, connection is closed");
+                m_rejected = true;
+                return parsed;
+            }
+
+            const std::size_t size = scMessageHeaderSize + header.m_msgSize;
+            if (m_filled - m_parsed < size)
+            {
+                m_required = size;
+                break;
+            }
+
+            m_parsed += size;
+            parsed = true;
+
+            MessageType msg;
+            try
+            {
+                DeserializeMessage(m_buffer, data + scMessageHeaderSize, header.m_msgSize,
+                                   this->m_protocolVersion, msg);
+                setReceived(msg);
+            }
+            catch (std::runtime_error& err)
+            {
+                this->m_logger.LogRecord(LogLevel::Warning, err.what());
+                continue;
+            }
+
+            try
+            {
+                this->m_msgCallback(msg);
+            }
+            catch (std::runtime_error& err)
+            {
+                this->m_logger.LogRecord(LogLevel::Warning, err.what());
+            }
+        }
+
+        return parsed;
+    }
+
+    /// @brief marks command with the time of the read which completed it
+    void setReceived(CommandView& command) const
+    {
+        command.received = m_readTime;
+    }
+
+    template<typename OtherMessage>
+    void setReceived(OtherMessage&) const
+    {
+    }
+
+    /// @brief waits for the rest of incomplete message at most data timeout
+    /// @param parsed true if incomplete message is new one
+    void updateTimer(const bool parsed)
+    {
+        if (m_filled == m_parsed)
+        {
+            if (m_timerArmed)
+            {
+                m_timer.cancel();
+                m_timerArmed = false;
+            }
+
+            return;
+        }
+
+        if (m_timerArmed && !parsed)
         {
-            Deserialize(is, msg);
-            this->m_msgCallback(msg);
+            return;
         }
-        catch (std::runtime_error& err)
+
+        m_timerArmed = true;
+        m_timer.expires_from_now(boost::posix_time::milliseconds(this->m_dataToutMs));
+        m_timer.async_wait(this->m_strand.wrap(MakeAllocHandler(m_handlerMemory,
+                                                                std::bind(&MessageReceiver::onTimerEvent, this,
+                                                                          std::placeholders::_1))));
+    }
+
+    void onTimerEvent(const boost::system::error_code& ec)
+    {
+        if (!ec)
+        {
+            // timeout occured - protocol violation, abort all operations on socket
+            this->m_logger.LogRecord(LogLevel::Warning, "Read message - timeout occured");
+            if (this->m_uring)
+            {
+                this->m_uring->Cancel(m_receive);
+                return;
+            }
+
+            // connection may be closed meanwhile
+            boost::system::error_code cancelEc;
+            this->m_socket.cancel(cancelEc);
+            return;
+        }
+
+        if (ec == boost::asio::error::operation_aborted)
         {
-            this->m_logger.LogRecord(err.what());
+            // data succesfully received - do nothing
+            return;
         }
 
-        startReceive();
+        this->m_logger.LogRecord(LogLevel::Error, std::string("Unexpected error occured in deadline_timer : ")
+                                 + ec.message());
     }
 
+    /// read, timer and their completions, completions of io_uring queued while the strand is busy
+    HandlerMemory<8>                m_handlerMemory;
+    UringReceive                    m_receive;
+    char                            m_peeked = 0;       ///< byte peeked to wait until socket is readable
     boost::asio::deadline_timer     m_timer;
+    bool                            m_timerArmed = false;
+    bool                            m_rejected = false; ///< message too large was received, connection is closed
+    bool                            m_cancelled = false; ///< receive of io_uring is cancelled after rejected message
+    BufferPool::Ptr                 m_pool;
+    MessageBuffer::Ptr              m_buffer;           ///< buffer holding incomplete message
+    std::size_t                     m_filled = 0;       ///< number of bytes received into the buffer
+    std::size_t                     m_parsed = 0;       ///< offset of the first byte of incomplete message
+    std::size_t                     m_required = 0;     ///< size of incomplete message with header, 0 if header is incomplete
+    std::chrono::steady_clock::time_point m_readTime;   ///< time of the last read, messages it completes are received then
 };
 
 }
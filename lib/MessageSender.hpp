@@ -1,15 +1,24 @@
 #pragma once
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
 #include <memory>
-#include <sstream>
-#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <boost/asio.hpp>
-#include <boost/log/sources/logger.hpp>
 #include <boost/system/system_error.hpp>
 
-#include "Protocol.hpp"
+#include "HandlerMemory.hpp"
 #include "Logger.hpp"
+#include "Serialization.hpp"
+#include "UringTransport.hpp"
 
 namespace kvdb
 {
@@ -19,9 +28,17 @@ struct MessageSenderContext
     Logger&                             m_logger; ///< pointer to logger
     boost::asio::io_context::strand&    m_strand; ///< session's strand
     boost::asio::ip::tcp::socket&       m_socket; ///< reference to socket used to transmit data
+    uint32_t                            m_protocolVersion = scProtocolText; ///< negotiated by handshake
+    UringTransport*                     m_uring = nullptr;  ///< socket is written through io_uring if set
+    std::weak_ptr<void>                 m_owner;            ///< kept alive by sends of m_uring
 };
 
 /// @brief sends messages of type MessageType
+/// Every message is encoded together with it's header into one buffer, messages queued while
+/// previous write is in progress are sent by one vectored write. Buffers, containers of the queue
+/// and memory of handlers are reused, so sending a message does not allocate in steady state.
+/// Through io_uring the write is one sendmsg, which is submitted together with operations
+/// of other connections prepared in the same pass of the event loop
 template<typename MessageType>
 class MessageSender
         : public MessageSenderContext
@@ -29,58 +46,133 @@ class MessageSender
 public:
     using Ptr = std::shared_ptr<MessageSender<MessageType>>;
 
+    /// messages are gathered into one write until it exceeds this size
+    static const std::size_t scMaxWriteSize = 256 * 1024;
+    /// released buffers up to this capacity are kept for the following messages
+    static const std::size_t scMaxPooledCapacity = 64 * 1024;
+    static const std::size_t scMaxPooledBuffers = 256;
+
     explicit MessageSender(const MessageSenderContext& context)
         : MessageSenderContext(context)
+        , m_send(*this)
     {}
 
     virtual ~MessageSender()
     {
-        this->m_logger.LogRecord("MessageSender destroyed");
+        this->m_logger.LogRecord(LogLevel::Debug, "MessageSender destroyed");
     }
 
+    /// @brief may be called by any thread
     void SendMessage(const MessageType& msg)
     {
-        BufPtr streambuf = std::make_shared<boost::asio::streambuf>();
-        std::ostream os(streambuf.get());
-        Serialize(msg, os);
-        this->m_strand.post([this, streambuf]()
+        auto buffer = acquireBuffer();
+        buffer.resize(scMessageHeaderSize);
+        SerializeMessage(msg, m_protocolVersion, buffer);
+
+        const MessageHeader header(uint32_t(buffer.size() - scMessageHeaderSize));
+        std::memcpy(&buffer[0], &header, scMessageHeaderSize);
+        this->m_strand.post(MakeAllocHandler(m_handlerMemory, [this, buffer = std::move(buffer)]() mutable
         {
-            scheduleMessageSending(streambuf);
-        });
+            m_messageQueue.push_back(std::move(buffer));
+            trySendNextMessages();
+        }));
     }
 
 private:
-    using BufPtr = std::shared_ptr<boost::asio::streambuf>;
-    using HeaderPtr = std::shared_ptr<MessageHeader>;
+    /// @brief sendmsg of the connection, it's completion is handled on the strand
+    class UringSend
+            : public UringOperation
+    {
+    public:
+        explicit UringSend(MessageSender& sender)
+            : m_sender(sender)
+        {}
+
+        void OnCompleted(UringCompletion& completion) override
+        {
+            m_sender.m_strand.dispatch(MakeAllocHandler(m_sender.m_handlerMemory,
+                                                        [&sender = m_sender,
+                                                         result = completion.m_result,
+                                                         keepAlive = std::move(completion.m_keepAlive)]()
+            {
+                sender.onUringSent(result);
+            }));
+        }
+
+    private:
+        MessageSender&  m_sender;
+    };
 
-    void scheduleMessageSending(const BufPtr& sbuf)
+    /// @brief buffers of the write in progress, refers to m_buffers, so the write does not copy them
+    struct BufferSequence
     {
-        m_messageQueue.push_back(sbuf);
-        trySendNextMessage();
-    }
+        using value_type = boost::asio::const_buffer;
+        using const_iterator = const boost::asio::const_buffer*;
+
+        const_iterator begin() const
+        {
+            return m_begin;
+        }
+
+        const_iterator end() const
+        {
+            return m_end;
+        }
+
+        const_iterator  m_begin;
+        const_iterator  m_end;
+    };
 
-    void trySendNextMessage()
+    void trySendNextMessages()
     {
-        // if some message is currently in processing or there is no messages in queue
-        if (m_currentMessage || m_messageQueue.empty())
+        // if some messages are currently in processing or there is no messages in queue
+        if (!m_currentMessages.empty() || m_messageQueue.empty())
         {
             return;
         }
 
-        m_currentMessage = m_messageQueue.front();
-        m_messageQueue.pop_front();
-        const auto headerPtr = std::make_shared<MessageHeader>(m_currentMessage->size());
-        boost::asio::async_write(m_socket,
-                                 boost::asio::const_buffer(headerPtr.get(), scMessageHeaderSize),
-                                 boost::asio::transfer_exactly(scMessageHeaderSize),
-                                 // pass headerPtr to ensure it will exist until write operation completed
-                                 this->m_strand.wrap(std::bind(&MessageSender::onHeaderTransmitted, this,
-                                                               std::placeholders::_1, headerPtr)));
+        // at least one message is sent even if it exceeds the limit
+        std::size_t writeSize = 0;
+        auto message = m_messageQueue.begin();
+        while (message != m_messageQueue.end()
+               && (writeSize == 0 || writeSize + message->size() <= scMaxWriteSize))
+        {
+            writeSize += message->size();
+            m_currentMessages.push_back(std::move(*message));
+            ++message;
+        }
+
+        m_messageQueue.erase(m_messageQueue.begin(), message);
+
+        if (m_uring)
+        {
+            m_iovecs.clear();
+            for (auto& message : m_currentMessages)
+            {
+                m_iovecs.push_back(iovec { &message[0], message.size() });
+            }
+
+            m_sentIovecs = 0;
+            sendUring();
+            return;
+        }
+
+        m_buffers.clear();
+        for (const auto& message : m_currentMessages)
+        {
+            m_buffers.push_back(boost::asio::buffer(message));
+        }
+
+        boost::asio::async_write(m_socket, BufferSequence { m_buffers.data(), m_buffers.data() + m_buffers.size() },
+                                 this->m_strand.wrap(MakeAllocHandler(m_handlerMemory,
+                                                                      std::bind(&MessageSender::onDataTransmitted, this,
+                                                                                std::placeholders::_1))));
     }
 
-    void onHeaderTransmitted(const boost::system::error_code& ec,
-                             const HeaderPtr&)
+    void onDataTransmitted(const boost::system::error_code& ec)
     {
+        releaseCurrentMessages();
+
         // connection closed
         if (ec == boost::asio::error::eof
                 || ec == boost::asio::error::broken_pipe
@@ -92,43 +184,103 @@ private:
         }
         else if (ec)
         {
-            m_logger.LogRecord(std::string("Failed to transmit header: ") + ec.message());
-            m_currentMessage.reset();
-            trySendNextMessage();
-            return;
+            m_logger.LogRecord(LogLevel::Error, std::string("Failed to transmit data: " ) + ec.message());
         }
 
-        // Send message data
-        boost::asio::async_write(m_socket, *m_currentMessage.get(),
-                                 this->m_strand.wrap(std::bind(&MessageSender::onDataTransmitted, this,
-                                                               std::placeholders::_1)));
+        trySendNextMessages();
     }
 
-    void onDataTransmitted(const boost::system::error_code& ec)
+    void sendUring()
     {
-        // connection closed
-        if (ec == boost::asio::error::eof
-                || ec == boost::asio::error::broken_pipe
-                || ec == boost::asio::error::connection_reset)
+        // messages are dropped once the session is released or it's socket is closed
+        const auto owner = m_owner.lock();
+        if (!owner || !m_socket.is_open())
         {
-            // no more transmission
+            releaseCurrentMessages();
             m_messageQueue.clear();
             return;
         }
-        else if (ec)
+
+        std::memset(&m_header, 0, sizeof(m_header));
+        m_header.msg_iov = m_iovecs.data() + m_sentIovecs;
+        // the rest of many messages is sent by the next sendmsg like the rest of partially sent ones
+        m_header.msg_iovlen = std::min<std::size_t>(m_iovecs.size() - m_sentIovecs, IOV_MAX);
+        m_uring->Send(m_socket.native_handle(), m_header, m_send, owner);
+    }
+
+    void onUringSent(const int result)
+    {
+        if (result <= 0)
         {
-            m_logger.LogRecord(std::string("Failed to transmit data: " ) + ec.message());
-            m_currentMessage.reset();
-            trySendNextMessage();
+            // nothing sent of non-empty messages means the connection is closed
+            onDataTransmitted(boost::system::error_code(result < 0 ? -result : EPIPE,
+                                                        boost::system::system_category()));
             return;
         }
 
-        m_currentMessage.reset();
-        trySendNextMessage();
+        // the rest of partially sent messages is sent by the next sendmsg
+        std::size_t sent = std::size_t(result);
+        while (m_sentIovecs < m_iovecs.size() && sent >= m_iovecs[m_sentIovecs].iov_len)
+        {
+            sent -= m_iovecs[m_sentIovecs].iov_len;
+            ++m_sentIovecs;
+        }
+
+        if (m_sentIovecs == m_iovecs.size())
+        {
+            onDataTransmitted(boost::system::error_code());
+            return;
+        }
+
+        auto& partial = m_iovecs[m_sentIovecs];
+        partial.iov_base = static_cast<char*>(partial.iov_base) + sent;
+        partial.iov_len -= sent;
+        sendUring();
+    }
+
+    std::string acquireBuffer()
+    {
+        std::lock_guard<std::mutex> lock(m_poolMutex);
+        if (m_freeBuffers.empty())
+        {
+            return std::string();
+        }
+
+        auto buffer = std::move(m_freeBuffers.back());
+        m_freeBuffers.pop_back();
+        return buffer;
     }
 
-    std::deque<BufPtr>  m_messageQueue;
-    BufPtr              m_currentMessage;
+    void releaseCurrentMessages()
+    {
+        std::lock_guard<std::mutex> lock(m_poolMutex);
+        for (auto& message : m_currentMessages)
+        {
+            if (message.capacity() <= scMaxPooledCapacity && m_freeBuffers.size() < scMaxPooledBuffers)
+            {
+                message.clear();
+                m_freeBuffers.push_back(std::move(message));
+            }
+        }
+
+        m_currentMessages.clear();
+    }
+
+    /// posts of messages sent concurrently by the worker threads, the write and it's completion,
+    /// operation of the write holds the composed operation, so it needs larger slot
+    HandlerMemory<8, 512>                   m_handlerMemory;
+
+    // members below are accessed on the strand only
+    std::vector<std::string>                m_messageQueue;
+    std::vector<std::string>                m_currentMessages;  ///< messages of the write in progress
+    std::vector<boost::asio::const_buffer>  m_buffers;          ///< buffers of m_currentMessages
+    UringSend                               m_send;
+    std::vector<iovec>                      m_iovecs;           ///< buffers of m_currentMessages sent by io_uring
+    std::size_t                             m_sentIovecs = 0;   ///< buffers sent completely
+    msghdr                                  m_header;           ///< sendmsg in flight, refers to m_iovecs
+
+    std::mutex                              m_poolMutex;
+    std::vector<std::string>                m_freeBuffers;
 };
 
 }
@@ -0,0 +1,119 @@
+#include <cstdio>
+
+#include "Metrics.hpp"
+
+namespace kvdb
+{
+
+void MetricsWriter::Counter(const std::string& name, const std::string& help, const Labels& labels, const double value)
+{
+    appendSample(samples(name, help, "counter"), name, labels, value);
+}
+
+void MetricsWriter::Gauge(const std::string& name, const std::string& help, const Labels& labels, const double value)
+{
+    appendSample(samples(name, help, "gauge"), name, labels, value);
+}
+
+void MetricsWriter::Histogram(const std::string& name,
+                              const std::string& help,
+                              const Labels& labels,
+                              const LatencySnapshot& snapshot)
+{
+    auto& output = samples(name, help, "histogram");
+    const auto bucketName = name + "_bucket";
+
+    // buckets of the snapshot are merged up to every power of two, the same bounds
+    // are written by every scrape, so scrapes can be subtracted from each other
+    uint64_t counted = 0;
+    for (std::size_t i = 0; i < LatencyHistogram::scNumBuckets; ++i)
+    {
+        counted += snapshot.Bucket(i);
+        const auto bound = LatencyHistogram::HighestOf(i);
+        if ((i + 1) % LatencyHistogram::scNumSubBuckets != 0 || bound < scMinBucketBound)
+        {
+            continue;
+        }
+
+        char le[32];
+        std::snprintf(le, sizeof(le), "%.9g", double(bound) / 1e9);
+        auto bucketLabels = labels;
+        bucketLabels.emplace_back("le", le);
+        appendSample(output, bucketName, bucketLabels, double(counted));
+    }
+
+    auto infLabels = labels;
+    infLabels.emplace_back("le", "+Inf");
+    appendSample(output, bucketName, infLabels, double(snapshot.Count()));
+    appendSample(output, name + "_sum", labels, double(snapshot.Sum().count()) / 1e9);
+    appendSample(output, name + "_count", labels, double(snapshot.Count()));
+}
+
+std::string MetricsWriter::Text() const
+{
+    std::string text;
+    for (const auto& [name, family] : m_families)
+    {
+        text += "# HELP " + name + " " + family.m_help + "\n";
+        text += "# TYPE " + name + " " + family.m_type + "\n";
+        text += family.m_samples;
+    }
+
+    return text;
+}
+
+std::string& MetricsWriter::samples(const std::string& name, const std::string& help, const std::string& type)
+{
+    const auto [it, inserted] = m_familyIndexes.emplace(name, m_families.size());
+    if (inserted)
+    {
+        m_families.emplace_back(name, Family { help, type, std::string() });
+    }
+
+    return m_families[it->second].second.m_samples;
+}
+
+void MetricsWriter::appendSample(std::string& output, const std::string& name, const Labels& labels, const double value)
+{
+    output += name;
+    if (!labels.empty())
+    {
+        output += '{';
+        for (std::size_t i = 0; i < labels.size(); ++i)
+        {
+            if (i != 0)
+            {
+                output += ',';
+            }
+
+            output += labels[i].first + "=\"";
+            for (const char c : labels[i].second)
+            {
+                // escaping of the label values required by the format
+                if (c == '\\' || c == '"')
+                {
+                    output += '\\';
+                    output += c;
+                }
+                else if (c == '\n')
+                {
+                    output += "\\n";
+                }
+                else
+                {
+                    output += c;
+                }
+            }
+
+            output += '"';
+        }
+
+        output += '}';
+    }
+
+    char number[32];
+    std::snprintf(number, sizeof(number), " %.15g\n", value);
+    output += number;
+}
+
+} // namespace kvdb
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "LatencyHistogram.hpp"
+
+namespace kvdb
+{
+
+/// @brief formats metrics in the text exposition format of Prometheus
+/// Samples of one metric may be added by several sources (e.g. by every partition),
+/// they are grouped under one description of the metric
+class MetricsWriter
+{
+public:
+    using Labels = std::vector<std::pair<std::string, std::string>>;
+
+    /// latencies below about a microsecond are counted by the first bucket of histograms
+    static constexpr uint64_t scMinBucketBound = 1023;
+
+    void Counter(const std::string& name, const std::string& help, const Labels& labels, double value);
+
+    void Gauge(const std::string& name, const std::string& help, const Labels& labels, double value);
+
+    /// @brief adds cumulative buckets of the latencies in seconds, one bucket per power of two
+    /// nanoseconds, starting from the one of scMinBucketBound
+    void Histogram(const std::string& name, const std::string& help, const Labels& labels,
+                   const LatencySnapshot& snapshot);
+
+    /// @return metrics in the order they were added first
+    std::string Text() const;
+
+private:
+    struct Family
+    {
+        std::string     m_help;
+        std::string     m_type;
+        std::string     m_samples;
+    };
+
+    /// @return samples of the metric, it is described when it is added first time
+    std::string& samples(const std::string& name, const std::string& help, const std::string& type);
+
+    static void appendSample(std::string& output, const std::string& name, const Labels& labels, double value);
+
+    std::vector<std::pair<std::string, Family>>     m_families;
+    std::map<std::string, std::size_t>              m_familyIndexes;
+};
+
+} // namespace kvdb
@@ -0,0 +1,171 @@
+#include <functional>
+#include <istream>
+
+#include "MetricsServer.hpp"
+
+namespace kvdb
+{
+
+/// @brief receives one request and sends the response
+class MetricsServer::Connection
+        : public std::enable_shared_from_this<Connection>
+{
+public:
+    /// request line and headers of larger requests are not received
+    static constexpr std::size_t scMaxRequestSize = 8 * 1024;
+    /// connection is closed if request is not received and response is not sent in time
+    static constexpr uint32_t scToutMs = 5000;
+
+    Connection(boost::asio::io_context& ioContext, Logger& logger, const CollectCallback& collect)
+        : m_logger(logger)
+        , m_collect(collect)
+        , m_strand(ioContext)
+        , m_socket(ioContext)
+        , m_timer(ioContext)
+        , m_request(scMaxRequestSize)
+    {}
+
+    boost::asio::ip::tcp::socket& Socket()
+    {
+        return m_socket;
+    }
+
+    void Start()
+    {
+        m_timer.expires_from_now(boost::posix_time::milliseconds(scToutMs));
+        m_timer.async_wait(m_strand.wrap(std::bind(&Connection::onTimeout, shared_from_this(),
+                                                   std::placeholders::_1)));
+        boost::asio::async_read_until(m_socket, m_request, "\r\n\r\n",
+                                      m_strand.wrap(std::bind(&Connection::onRequestReceived, shared_from_this(),
+                                                              std::placeholders::_1)));
+    }
+
+private:
+    void onRequestReceived(const boost::system::error_code& ec)
+    {
+        if (ec)
+        {
+            close();
+            return;
+        }
+
+        std::istream request(&m_request);
+        std::string method;
+        std::string target;
+        request >> method >> target;
+        target = target.substr(0, target.find('?'));
+
+        std::string status = "200 OK";
+        std::string body;
+        if (method != "GET")
+        {
+            status = "405 Method Not Allowed";
+        }
+        else if (target != "/metrics")
+        {
+            status = "404 Not Found";
+        }
+        else
+        {
+            try
+            {
+                body = m_collect();
+            }
+            catch (const std::exception& e)
+            {
+                m_logger.LogRecord(LogLevel::Error, std::string("Failed to collect metrics: ") + e.what());
+                status = "500 Internal Server Error";
+            }
+        }
+
+        m_response = "HTTP/1.1 " + status + "\r\n"
+                     "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                     "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                     "Connection: close\r\n\r\n" + body;
+        boost::asio::async_write(m_socket, boost::asio::buffer(m_response),
+                                 m_strand.wrap(std::bind(&Connection::onResponseSent, shared_from_this(),
+                                                         std::placeholders::_1)));
+    }
+
+    void onResponseSent(const boost::system::error_code&)
+    {
+        close();
+    }
+
+    void onTimeout(const boost::system::error_code& ec)
+    {
+        if (ec != boost::asio::error::operation_aborted)
+        {
+            close();
+        }
+    }
+
+    void close()
+    {
+        boost::system::error_code ec;
+        m_timer.cancel(ec);
+        m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+        m_socket.close(ec);
+    }
+
+    Logger&                         m_logger;
+    CollectCallback                 m_collect;
+    boost::asio::io_context::strand m_strand;   ///< serializes the timeout with the request
+    boost::asio::ip::tcp::socket    m_socket;
+    boost::asio::deadline_timer     m_timer;
+    boost::asio::streambuf          m_request;
+    std::string                     m_response;
+};
+
+MetricsServer::MetricsServer(const MetricsServerContext& context)
+    : MetricsServerContext(context)
+    , m_acceptor(context.m_ioContext)
+{
+    m_acceptor.open(m_endpoint.protocol());
+    m_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    m_acceptor.bind(m_endpoint);
+    m_acceptor.listen();
+}
+
+MetricsServer::~MetricsServer()
+{
+    m_logger.LogRecord("MetricsServer destroyed");
+}
+
+void MetricsServer::Start()
+{
+    startAccept();
+}
+
+uint16_t MetricsServer::Port() const
+{
+    return m_acceptor.local_endpoint().port();
+}
+
+void MetricsServer::startAccept()
+{
+    auto connection = std::make_shared<Connection>(m_ioContext, m_logger, m_collect);
+    m_acceptor.async_accept(connection->Socket(), std::bind(&MetricsServer::onAccepted, this,
+                                                            std::placeholders::_1, connection));
+}
+
+void MetricsServer::onAccepted(const boost::system::error_code& ec, const std::shared_ptr<Connection>& connection)
+{
+    if (ec == boost::asio::error::operation_aborted)
+    {
+        return;
+    }
+
+    if (ec)
+    {
+        m_logger.LogRecord(LogLevel::Error, "Failed to accept metrics connection: " + ec.message());
+    }
+    else
+    {
+        connection->Start();
+    }
+
+    startAccept();
+}
+
+} // namespace kvdb
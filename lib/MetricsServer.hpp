@@ -0,0 +1,53 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include "Logger.hpp"
+
+namespace kvdb
+{
+
+struct MetricsServerContext
+{
+    /// @brief returns metrics in the text format of Prometheus
+    using CollectCallback = std::function<std::string(void)>;
+
+    boost::asio::io_context&        m_ioContext;
+    Logger&                         m_logger;
+    boost::asio::ip::tcp::endpoint  m_endpoint;     ///< endpoint to listen to
+    CollectCallback                 m_collect;      ///< called by the context for every request
+};
+
+/// @brief serves metrics to HTTP GET requests of /metrics
+/// Every connection receives one request and is closed after the response,
+/// so scrapers do not hold connections between scrapes
+class MetricsServer
+        : private MetricsServerContext
+{
+public:
+    using Ptr = std::shared_ptr<MetricsServer>;
+
+    explicit MetricsServer(const MetricsServerContext& context);
+
+    virtual ~MetricsServer();
+
+    void Start();
+
+    /// @return port requests are accepted on, it is chosen by system if endpoint's port is 0
+    uint16_t Port() const;
+
+private:
+    class Connection;
+
+    void startAccept();
+
+    void onAccepted(const boost::system::error_code& ec, const std::shared_ptr<Connection>& connection);
+
+    boost::asio::ip::tcp::acceptor  m_acceptor;
+};
+
+} // namespace kvdb
@@ -0,0 +1,72 @@
+#include "OrderedIndex.hpp"
+
+namespace kvdb
+{
+
+std::unique_ptr<OrderedIndex> OrderedIndex::Open(ReservedMappedFile& mappedFile,
+                                                 const std::string& name,
+                                                 SlabHeap& heap)
+{
+    auto& file = mappedFile.File();
+    const SlabAllocator<char> allocator(&heap);
+    auto storage = file.find_or_construct<InternalStorage>(name.c_str())(allocator);
+    return std::unique_ptr<OrderedIndex>(new OrderedIndex(storage, allocator, mappedFile.Dirty()));
+}
+
+OrderedIndex::OrderedIndex(InternalStorage* storage,
+                           const SlabAllocator<char>& allocator,
+                           DirtyRegions& dirty)
+    : m_storage(storage)
+    , m_allocator(allocator)
+    , m_dirty(dirty)
+{
+}
+
+void OrderedIndex::Insert(std::string_view key)
+{
+    // links of neighbour nodes changed by rebalancing are not tracked
+    const auto it = m_storage->insert(SlabString(key.data(), key.size(), m_allocator)).first;
+    m_dirty.Mark(m_storage);
+    m_dirty.Mark(&*it);
+    m_dirty.Mark(it->data(), it->size());
+}
+
+void OrderedIndex::Erase(std::string_view key)
+{
+    const auto it = m_storage->find(key, KeyLess());
+    if (it == m_storage->end())
+    {
+        return;
+    }
+
+    m_dirty.Mark(m_storage);
+    m_dirty.Mark(&*it);
+    m_storage->erase(it);
+}
+
+void OrderedIndex::Collect(std::string_view start,
+                           std::string_view end,
+                           const std::size_t limit,
+                           std::vector<std::string>& keys) const
+{
+    std::size_t numCollected = 0;
+    for (auto it = m_storage->lower_bound(start, KeyLess());
+         it != m_storage->end() && numCollected < limit;
+         ++it, ++numCollected)
+    {
+        const auto key = KeyLess::view(*it);
+        if (!end.empty() && key >= end)
+        {
+            break;
+        }
+
+        keys.emplace_back(key);
+    }
+}
+
+std::size_t OrderedIndex::Size() const
+{
+    return m_storage->size();
+}
+
+} // namespace kvdb
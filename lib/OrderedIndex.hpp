@@ -0,0 +1,92 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include "ReservedMappedFile.hpp"
+#include "SlabHeap.hpp"
+#include "StorageIndex.hpp"
+
+namespace kvdb
+{
+
+/// @brief secondary index of the shard keeping it's keys in lexicographical order
+/// Used by range queries only, point operations are served by the StorageIndex,
+/// so maintaining it costs one tree insertion or removal per modification.
+/// Keys are copied into the tree, which keeps it independent of the layout
+/// of the primary index
+/// Methods are not synchronized, caller is responsible to hold shard's lock
+class OrderedIndex
+{
+public:
+    /// @brief finds index with given name inside mapped file or constructs new one
+    static std::unique_ptr<OrderedIndex> Open(ReservedMappedFile& mappedFile,
+                                              const std::string& name,
+                                              SlabHeap& heap);
+
+    /// @throw boost::interprocess::bad_alloc when segment is exhausted,
+    /// index stays unchanged in this case
+    void Insert(std::string_view key);
+
+    void Erase(std::string_view key);
+
+    /// @brief appends keys from range [start, end) in ascending order
+    /// @param end empty end means range is not bounded
+    /// @param limit maximum number of keys to append
+    void Collect(std::string_view start,
+                 std::string_view end,
+                 std::size_t limit,
+                 std::vector<std::string>& keys) const;
+
+    std::size_t Size() const;
+
+private:
+    /// @brief compares stored keys with each other and with lookup keys
+    struct KeyLess
+    {
+        bool operator()(const SlabString& lhs, const SlabString& rhs) const
+        {
+            return view(lhs) < view(rhs);
+        }
+
+        bool operator()(std::string_view lhs, const SlabString& rhs) const
+        {
+            return lhs < view(rhs);
+        }
+
+        bool operator()(const SlabString& lhs, std::string_view rhs) const
+        {
+            return view(lhs) < rhs;
+        }
+
+        static std::string_view view(const SlabString& str)
+        {
+            return std::string_view(str.data(), str.size());
+        }
+    };
+
+    using InternalStorage =
+        boost::multi_index_container<
+            SlabString,
+            boost::multi_index::indexed_by<
+                boost::multi_index::ordered_unique<
+                    boost::multi_index::identity<SlabString>,
+                    KeyLess
+                >
+            >,
+            SlabAllocator<SlabString>>;
+
+    OrderedIndex(InternalStorage* storage, const SlabAllocator<char>& allocator, DirtyRegions& dirty);
+
+    InternalStorage*        m_storage;
+    SlabAllocator<char>     m_allocator;
+    DirtyRegions&           m_dirty;
+};
+
+} // namespace kvdb
@@ -0,0 +1,428 @@
+#include <algorithm>
+
+#include <boost/asio/post.hpp>
+
+#include "Hash.hpp"
+#include "PartitionRouter.hpp"
+#include "Serialization.hpp"
+
+namespace kvdb
+{
+
+namespace
+{
+
+/// seed of the hash selecting partition, so it does not correlate with selection of shards and buckets
+const uint64_t scPartitionSeed = 0x9e3779b97f4a7c15ull;
+
+const int scNoFailure = -1;
+
+/// @brief results of the command executed by several partitions
+/// Results are received by threads of the partitions, each of them writes only it's own part
+/// and the last one sends the merged result
+struct Gather
+{
+    Gather(const CommandView& command,
+           const PartitionRouter::ResultCallback& callback,
+           const std::size_t numPartitions)
+        : m_command(command)
+        , m_callback(callback)
+        , m_pending(numPartitions)
+    {}
+
+    /// @return true for the last partition
+    bool Finish()
+    {
+        return m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    /// @brief sends failure if some of partitions failed
+    /// @return false if none of partitions failed
+    bool SendFailure()
+    {
+        const int code = m_failure.load(std::memory_order_relaxed);
+        if (code == scNoFailure)
+        {
+            return false;
+        }
+
+        m_callback(ResultView(m_command.id, code, std::string_view()));
+        return true;
+    }
+
+    void SendResult(const int code, const std::string& value)
+    {
+        ResultMessage result(code, value);
+        result.commandId = m_command.id;
+        m_callback(result);
+    }
+
+    CommandView                     m_command;
+    PartitionRouter::ResultCallback m_callback;
+    std::atomic<std::size_t>        m_pending;
+    std::atomic<int>                m_failure { scNoFailure };  ///< code of any failed part
+};
+
+struct BatchGather
+        : public Gather
+{
+    BatchGather(const CommandView& command,
+                const PartitionRouter::ResultCallback& callback,
+                const std::size_t numItems,
+                const std::size_t numPartitions)
+        : Gather(command, callback, 0)
+        , m_payloads(numPartitions)
+        , m_parts(numPartitions)
+        , m_positions(numPartitions)
+        , m_items(numItems)
+    {}
+
+    std::vector<std::string>                m_payloads;     ///< keys of every partition
+    std::vector<std::string>                m_parts;        ///< results of leading items of every partition
+    std::vector<std::vector<std::size_t>>   m_positions;    ///< positions of keys of every partition in the batch
+    std::vector<BatchItem>                  m_items;
+};
+
+struct ScanGather
+        : public Gather
+{
+    ScanGather(const CommandView& command,
+               const PartitionRouter::ResultCallback& callback,
+               const std::size_t numPartitions)
+        : Gather(command, callback, numPartitions)
+        , m_pairs(numPartitions)
+        , m_cursors(numPartitions)
+    {}
+
+    std::vector<std::vector<KeyValue>>  m_pairs;
+    std::vector<std::string>            m_cursors;
+};
+
+struct CompactGather
+        : public Gather
+{
+    using Gather::Gather;
+
+    std::atomic<std::size_t>    m_reclaimed { 0 };
+};
+
+} // namespace
+
+PartitionRouter::PartitionRouter(const std::vector<Partition>& partitions)
+    : m_partitions(partitions)
+{
+    m_channels.resize(m_partitions.size() * m_partitions.size());
+    for (auto& channel : m_channels)
+    {
+        channel.reset(new Channel());
+    }
+}
+
+std::size_t PartitionRouter::PartitionOf(std::string_view key) const
+{
+    return Hash::Bytes(key.data(), key.size(), scPartitionSeed) % m_partitions.size();
+}
+
+void PartitionRouter::Dispatch(const std::size_t core, const CommandView& command, const ResultCallback& callback)
+{
+    switch (command.type)
+    {
+    case CommandMessage::INSERT:
+    case CommandMessage::UPDATE:
+    case CommandMessage::GET:
+    case CommandMessage::DELETE:
+    {
+        execute(core, PartitionOf(command.key), command, callback);
+        break;
+    }
+
+    case CommandMessage::MGET:
+    case CommandMessage::MSET:
+    case CommandMessage::MDELETE:
+    {
+        dispatchBatch(core, command, callback);
+        break;
+    }
+
+    case CommandMessage::SCAN:
+    case CommandMessage::SCAN_PREFIX:
+    {
+        dispatchScan(core, command, callback);
+        break;
+    }
+
+    case CommandMessage::COMPACT:
+    {
+        dispatchCompact(core, command, callback);
+        break;
+    }
+
+    default:
+    {
+        // unknown commands are rejected by the local partition
+        execute(core, core, command, callback);
+        break;
+    }
+    }
+}
+
+void PartitionRouter::execute(const std::size_t core,
+                              const std::size_t partition,
+                              const CommandView& command,
+                              const ResultCallback& callback)
+{
+    auto& processor = m_partitions[partition].m_processor;
+    if (partition == core)
+    {
+        processor.ProcessCommand(command, callback);
+        return;
+    }
+
+    auto& forwarded = channel(core, partition);
+    Forwarded item { command, callback };
+    if (!forwarded.m_queue.Push(std::move(item)))
+    {
+        // owner falls behind, command is posted to it bypassing the queue
+        boost::asio::post(m_partitions[partition].m_ioContext, [&processor, item = std::move(item)]()
+        {
+            processor.ProcessCommand(item.m_command, item.m_callback);
+        });
+        return;
+    }
+
+    // drain resets the flag before reading the queue, so either it finds
+    // the command or the flag is reset and new drain is posted
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!forwarded.m_scheduled.exchange(true))
+    {
+        boost::asio::post(m_partitions[partition].m_ioContext, [this, core, partition]()
+        {
+            drain(core, partition);
+        });
+    }
+}
+
+void PartitionRouter::drain(const std::size_t from, const std::size_t to)
+{
+    auto& forwarded = channel(from, to);
+    forwarded.m_scheduled.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    auto& processor = m_partitions[to].m_processor;
+    Forwarded item;
+    for (std::size_t i = 0; i < scQueueCapacity; ++i)
+    {
+        if (!forwarded.m_queue.Pop(item))
+        {
+            return;
+        }
+
+        processor.ProcessCommand(item.m_command, item.m_callback);
+    }
+
+    // busy producer does not starve other handlers of the core
+    if (!forwarded.m_scheduled.exchange(true))
+    {
+        boost::asio::post(m_partitions[to].m_ioContext, [this, from, to]()
+        {
+            drain(from, to);
+        });
+    }
+}
+
+void PartitionRouter::dispatchBatch(const std::size_t core, const CommandView& command, const ResultCallback& callback)
+{
+    const bool isSet = command.type == CommandMessage::MSET;
+    std::vector<std::string_view> keys;
+    std::vector<KeyValueView> pairs;
+    try
+    {
+        if (isSet)
+        {
+            DeserializeKeyValues(command.value, command.version, pairs);
+            for (const auto& pair : pairs)
+            {
+                keys.push_back(pair.first);
+            }
+        }
+        else
+        {
+            DeserializeKeys(command.value, command.version, keys);
+        }
+    }
+    catch (const std::runtime_error&)
+    {
+        keys.clear();
+    }
+
+    if (!command.key.empty()
+            || keys.empty()
+            || std::any_of(keys.begin(), keys.end(), [](std::string_view key)
+                           {
+                               return key.empty() || key.size() > scMaxKeySize;
+                           }))
+    {
+        // malformed batch is rejected as a whole by the local partition
+        execute(core, core, command, callback);
+        return;
+    }
+
+    auto gather = std::make_shared<BatchGather>(command, callback, keys.size(), m_partitions.size());
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        const auto partition = PartitionOf(keys[i]);
+        gather->m_positions[partition].push_back(i);
+        AppendString(gather->m_payloads[partition], keys[i], command.version);
+        if (isSet)
+        {
+            AppendString(gather->m_payloads[partition], pairs[i].second, command.version);
+        }
+    }
+
+    const auto numParts = std::size_t(std::count_if(gather->m_positions.begin(), gather->m_positions.end(),
+                                                    [](const std::vector<std::size_t>& positions)
+                                                    {
+                                                        return !positions.empty();
+                                                    }));
+
+    // local part may finish before the rest are dispatched
+    gather->m_pending = numParts;
+    for (std::size_t partition = 0; partition < m_partitions.size(); ++partition)
+    {
+        if (gather->m_positions[partition].empty())
+        {
+            continue;
+        }
+
+        CommandView part = command;
+        part.value = gather->m_payloads[partition];
+        execute(core, partition, part, [gather, partition](const ResultView& result)
+        {
+            // large results of the partition are preceded by parts
+            auto& parts = gather->m_parts[partition];
+            if (result.code == ResultMessage::BatchPart)
+            {
+                parts.append(result.value);
+                return;
+            }
+
+            if (result.code == ResultMessage::BatchSuccess)
+            {
+                if (!parts.empty())
+                {
+                    parts.append(result.value);
+                }
+
+                std::vector<BatchItem> items;
+                DeserializeBatchItems(parts.empty() ? result.value : std::string_view(parts),
+                                      gather->m_command.version, items);
+                parts.clear();
+                const auto& positions = gather->m_positions[partition];
+                for (std::size_t i = 0; i < items.size() && i < positions.size(); ++i)
+                {
+                    gather->m_items[positions[i]] = std::move(items[i]);
+                }
+            }
+            else
+            {
+                gather->m_failure = result.code;
+            }
+
+            if (gather->Finish() && !gather->SendFailure())
+            {
+                const auto& command = gather->m_command;
+                const auto rest = CommandProcessor::SendBatchParts(gather->m_items, command.id, command.version,
+                                                                   gather->m_callback);
+                gather->SendResult(ResultMessage::BatchSuccess, rest);
+            }
+        });
+    }
+}
+
+void PartitionRouter::dispatchScan(const std::size_t core, const CommandView& command, const ResultCallback& callback)
+{
+    auto gather = std::make_shared<ScanGather>(command, callback, m_partitions.size());
+    for (std::size_t partition = 0; partition < m_partitions.size(); ++partition)
+    {
+        execute(core, partition, command, [gather, partition](const ResultView& result)
+        {
+            // pairs of the partition are preceded by batches
+            if (result.code == ResultMessage::ScanBatch)
+            {
+                DeserializeKeyValues(result.value, gather->m_command.version, gather->m_pairs[partition]);
+                return;
+            }
+
+            if (result.code == ResultMessage::ScanSuccess)
+            {
+                gather->m_cursors[partition] = result.value;
+            }
+            else
+            {
+                gather->m_failure = result.code;
+            }
+
+            if (!gather->Finish() || gather->SendFailure())
+            {
+                return;
+            }
+
+            // every partition returns up to limit first pairs, so first limit of all of them
+            // are first pairs of the map, and the rest follow the last one
+            std::vector<KeyValue> pairs;
+            for (auto& partPairs : gather->m_pairs)
+            {
+                std::move(partPairs.begin(), partPairs.end(), std::back_inserter(pairs));
+            }
+
+            std::sort(pairs.begin(), pairs.end(), [](const KeyValue& lhs, const KeyValue& rhs)
+            {
+                return lhs.first < rhs.first;
+            });
+
+            const auto limit = CommandProcessor::ScanLimit(gather->m_command.limit);
+            bool more = std::any_of(gather->m_cursors.begin(), gather->m_cursors.end(),
+                                    [](const std::string& cursor)
+                                    {
+                                        return !cursor.empty();
+                                    });
+            if (pairs.size() > limit)
+            {
+                pairs.resize(limit);
+                more = true;
+            }
+
+            const auto cursor = more && !pairs.empty() ? CommandProcessor::FitCursor(pairs.back().first + '\0')
+                                                       : std::string();
+            CommandProcessor::SendScanBatches(pairs, gather->m_command.id, gather->m_command.version,
+                                              gather->m_callback);
+            gather->SendResult(ResultMessage::ScanSuccess, cursor);
+        });
+    }
+}
+
+void PartitionRouter::dispatchCompact(const std::size_t core, const CommandView& command, const ResultCallback& callback)
+{
+    auto gather = std::make_shared<CompactGather>(command, callback, m_partitions.size());
+    for (std::size_t partition = 0; partition < m_partitions.size(); ++partition)
+    {
+        execute(core, partition, command, [gather](const ResultView& result)
+        {
+            if (result.code == ResultMessage::CompactSuccess)
+            {
+                gather->m_reclaimed += std::stoull(std::string(result.value));
+            }
+            else
+            {
+                gather->m_failure = result.code;
+            }
+
+            if (gather->Finish() && !gather->SendFailure())
+            {
+                gather->SendResult(ResultMessage::CompactSuccess, std::to_string(gather->m_reclaimed.load()));
+            }
+        });
+    }
+}
+
+} // namespace kvdb
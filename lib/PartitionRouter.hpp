@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+
+#include "CommandProcessor.hpp"
+#include "SpscQueue.hpp"
+
+namespace kvdb
+{
+
+/// @brief partition of the keyspace owned by one core
+struct Partition
+{
+    boost::asio::io_context&    m_ioContext;    ///< context of the core, run by one thread
+    CommandProcessor&           m_processor;    ///< executes commands on the map of the partition
+};
+
+/// @brief routes commands received by per-core sessions to partitions of the keyspace
+/// Every core owns a partition: map of it's own, which is accessed only by the thread of the core,
+/// so locks of the map are never contended. Command on a key is executed by the owner of the key,
+/// commands received by other cores are forwarded through the queue of the pair of cores.
+/// Commands on many keys are split into commands of partitions they touch, results of them are merged.
+/// Results are sent by the owner, sender of the session is safe to use from any thread
+class PartitionRouter
+{
+public:
+    using ResultCallback = CommandProcessor::ResultCallback;
+
+    /// capacity of the queue from one core to another, commands are posted
+    /// to the owner directly when it is full
+    static constexpr std::size_t scQueueCapacity = 1024;
+
+    explicit PartitionRouter(const std::vector<Partition>& partitions);
+
+    /// @brief executes command on partitions owning it's keys
+    /// @param core index of the core, method must be called by the thread of this core
+    void Dispatch(std::size_t core, const CommandView& command, const ResultCallback& callback);
+
+    /// @return index of partition owning the key
+    /// Partitions of keys are persisted by their maps, so function MUST NOT change
+    std::size_t PartitionOf(std::string_view key) const;
+
+private:
+    struct Forwarded
+    {
+        CommandView     m_command;
+        ResultCallback  m_callback;
+    };
+
+    /// @brief commands forwarded from one core to another
+    struct Channel
+    {
+        SpscQueue<Forwarded>    m_queue { scQueueCapacity };
+        std::atomic<bool>       m_scheduled { false };      ///< drain of the queue is posted to the owner
+    };
+
+    /// @brief executes command on the partition, forwards it if partition is owned by other core
+    void execute(std::size_t core, std::size_t partition, const CommandView& command, const ResultCallback& callback);
+
+    /// @brief executes commands forwarded from one core to another, called by the owner
+    void drain(std::size_t from, std::size_t to);
+
+    /// @brief splits MGET, MSET or MDELETE by partitions of it's keys
+    void dispatchBatch(std::size_t core, const CommandView& command, const ResultCallback& callback);
+
+    /// @brief executes SCAN or SCAN_PREFIX on every partition and merges ordered results
+    void dispatchScan(std::size_t core, const CommandView& command, const ResultCallback& callback);
+
+    /// @brief compacts every partition, result holds total number of reclaimed bytes
+    void dispatchCompact(std::size_t core, const CommandView& command, const ResultCallback& callback);
+
+    Channel& channel(const std::size_t from, const std::size_t to)
+    {
+        return *m_channels[from * m_partitions.size() + to];
+    }
+
+    std::vector<Partition>                  m_partitions;
+    std::vector<std::unique_ptr<Channel>>   m_channels;     ///< channel of every pair of cores
+};
+
+} // namespace kvdb
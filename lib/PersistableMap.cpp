@@ -1,24 +1,80 @@
+#include <algorithm>
 #include <filesystem>
 #include <iostream>
+#include <numeric>
+
+#include <boost/format.hpp>
 
 #include "PersistableMap.hpp"
+#include "HashedIndex.hpp"
+#include "SwissIndex.hpp"
 
 namespace kvdb
 {
 
 static const char scMainObjectName[] = "Root";
+static const char scHeaderObjectName[] = "Header";
+static const char scOrderedObjectName[] = "Ordered";
+static const char scHeapObjectName[] = "Heap";
 static const std::size_t scDefaultMappedFileSize = 1024 * 1024 * 5;
+static const uint32_t scFormatVersion = 7;
+static const char scLogFileSuffix[] = ".wal";
+static const char scCompactFileSuffix[] = ".compact";
+
+/// compacted file size is rounded up to this value
+static const std::size_t scCompactSizeStep = 1024 * 1024;
+
+/// size of the part of the file written at once by checkpoint,
+/// growth of the file waits for at most one part
+static const std::size_t scCheckpointChunkSize = 64 * 1024 * 1024;
+
+using Clock = std::chrono::steady_clock;
+
+/// @brief name of the index object of the shard inside mapped file
+static std::string shardObjectName(const uint32_t shardIdx)
+{
+    if (shardIdx == 0)
+    {
+        return scMainObjectName;
+    }
+
+    return std::string(scMainObjectName) + "." + std::to_string(shardIdx);
+}
+
+/// @brief name of the ordered index object of the shard inside mapped file
+static std::string orderedObjectName(const uint32_t shardIdx)
+{
+    return std::string(scOrderedObjectName) + "." + std::to_string(shardIdx);
+}
+
+/// @brief name of the heap of the shard inside mapped file
+static std::string heapObjectName(const uint32_t shardIdx)
+{
+    return std::string(scHeapObjectName) + "." + std::to_string(shardIdx);
+}
 
 PersistableMap::PersistableMap(Logger& logger)
     : m_logger(logger)
+    , m_needsGrowth(false)
 {
 }
 
 PersistableMap::~PersistableMap()
 {
-    if (!m_mappedFile->flush())
+    if (m_flusher.joinable())
+    {
+        {
+            std::lock_guard lock(m_flusherMutex);
+            m_stopFlusher = true;
+        }
+
+        m_flusherCv.notify_one();
+        m_flusher.join();
+    }
+
+    if (!m_mappedFile || !Flush())
     {
-        m_logger.LogRecord("Failed to flush map content on disk");
+        m_logger.LogRecord(LogLevel::Error, "Failed to flush map content on disk");
     }
     else
     {
@@ -28,136 +84,982 @@ PersistableMap::~PersistableMap()
     m_logger.LogRecord("PersistableMap destroyed");
 }
 
-void PersistableMap::InitStorage(const std::string& filePath)
+void PersistableMap::InitStorage(const std::string& filePath, const Options& options)
 {
     m_filePath = filePath;
-    m_mappedFile = std::make_shared<MappedFile>(boost::interprocess::open_or_create,
-                                                m_filePath.c_str(),
-                                                scDefaultMappedFileSize);
+    m_options = options;
+    m_numShards = std::max<uint32_t>(options.m_numShards, 1);
+    m_engine = options.m_engine;
+    m_orderedIndex = options.m_orderedIndex;
+    initStorage();
+    m_log = std::make_unique<WriteAheadLog>(m_logger,
+                                            m_filePath + scLogFileSuffix,
+                                            options.m_walSyncPolicy,
+                                            options.m_walSyncInterval);
+    replayLog();
+    updateNeedsGrowth();
+    for (uint32_t i = 0; i < m_numShards; ++i)
+    {
+        publishStat(m_shards[i]);
+    }
+
+    publishLargestFree();
+    if (m_options.m_flushInterval.count() > 0)
+    {
+        m_flusher = std::thread(&PersistableMap::runFlusher, this);
+    }
+}
 
-    m_allocator = std::make_unique<Allocator<void>>(m_mappedFile->get_segment_manager());
+void PersistableMap::runFlusher()
+{
+    const auto budget = std::max<std::size_t>(
+                m_options.m_flushRateLimit * m_options.m_flushInterval.count() / 1000, 1);
 
+    std::unique_lock lock(m_flusherMutex);
+    while (!m_flusherCv.wait_for(lock, m_options.m_flushInterval, [this]() { return m_stopFlusher; }))
+    {
+        lock.unlock();
+        {
+            // shards are not locked, only growth waits for the flush
+            std::lock_guard growLock(m_growMutex);
+            const auto start = Clock::now();
+            const auto flushed = m_mappedFile->FlushDirty(budget);
+            if (flushed != 0)
+            {
+                m_backgroundStat.Add(flushed, std::chrono::duration_cast<Micros>(Clock::now() - start));
+            }
+        }
 
-    m_internalStorage = m_mappedFile->find_or_construct<InternalStorage>(scMainObjectName)(*m_allocator);
+        lock.lock();
+    }
+}
+
+void PersistableMap::FlushCounters::Add(const std::size_t bytes, const Micros& time)
+{
+    ++m_numFlushes;
+    m_flushedBytes += bytes;
+    m_totalTimeUs += time.count();
+    auto maxTime = m_maxTimeUs.load();
+    while (time.count() > maxTime && !m_maxTimeUs.compare_exchange_weak(maxTime, time.count()))
+    {
+    }
+}
+
+PersistableMap::FlushStat PersistableMap::FlushCounters::Get() const
+{
+    FlushStat result;
+    result.m_numFlushes = m_numFlushes;
+    result.m_flushedBytes = m_flushedBytes;
+    result.m_totalTime = Micros(m_totalTimeUs);
+    result.m_maxTime = Micros(m_maxTimeUs);
+    return result;
+}
+
+void PersistableMap::replayLog()
+{
+    using RecordType = WriteAheadLog::RecordType;
+
+    // map file may contain any part of logged modifications, so records are applied
+    // the way that does not depend on it: inserts and updates overwrite the value,
+    // deletes of missing keys are ignored
+    const auto numRecords = m_log->Replay([this](const RecordType type,
+                                                 std::string_view key,
+                                                 std::string_view value)
+    {
+        const KeyView keyView(key);
+        while (true)
+        {
+            try
+            {
+                auto& shard = shardFor(keyView);
+                if (type == RecordType::Delete)
+                {
+                    deleteEntry(shard, keyView);
+                }
+                else if (!insertEntry(shard, keyView, value))
+                {
+                    shard.m_index->Update(keyView, value);
+                }
+
+                return;
+            }
+            catch (const boost::interprocess::bad_alloc&)
+            {
+                if (!Grow())
+                {
+                    throw std::runtime_error("Failed to grow map file while replaying write-ahead log");
+                }
+            }
+        }
+    });
+
+    if (numRecords != 0)
+    {
+        m_logger.LogRecord((boost::format("Replayed %1% records of write-ahead log") % numRecords).str());
+        if (!Flush())
+        {
+            throw std::runtime_error("Failed to checkpoint replayed write-ahead log");
+        }
+    }
+}
+
+void PersistableMap::initStorage()
+{
+    m_mappedFile = std::make_unique<ReservedMappedFile>(m_filePath,
+                                                        scDefaultMappedFileSize,
+                                                        m_options.m_reservedSize);
+    auto& mappedFile = m_mappedFile->File();
+
+    // files created before format versioning was introduced have objects but no header
+    if (mappedFile.find<Header>(scHeaderObjectName).first == nullptr
+            && mappedFile.get_num_named_objects() != 0)
+    {
+        throw std::runtime_error("Map file was created by older version and can not be opened, it's data must be exported by that version");
+    }
+
+    const Header* header = mappedFile.find_or_construct<Header>(scHeaderObjectName)(
+                Header { scFormatVersion, m_numShards, m_engine, m_orderedIndex });
+
+    if (header->m_version != scFormatVersion)
+    {
+        throw std::runtime_error((boost::format("Unsupported map file format version %1%, it's data must be exported by the version which created it")
+                                  % header->m_version).str());
+    }
+
+    if (header->m_numShards != m_numShards)
+    {
+        m_logger.LogRecord(LogLevel::Warning, (boost::format("Map file has %1% shards, requested number of shards (%2%) ignored")
+                            % header->m_numShards % m_numShards).str());
+        m_numShards = header->m_numShards;
+    }
+
+    if (header->m_engine != m_engine)
+    {
+        m_logger.LogRecord(LogLevel::Warning, (boost::format("Map file uses index engine %1%, requested engine (%2%) ignored")
+                            % uint32_t(header->m_engine) % uint32_t(m_engine)).str());
+        m_engine = header->m_engine;
+    }
+
+    if (bool(header->m_orderedIndex) != m_orderedIndex)
+    {
+        m_logger.LogRecord(LogLevel::Warning, (boost::format("Map file %1% ordered index, requested setting ignored")
+                            % (header->m_orderedIndex ? "has" : "has no")).str());
+        m_orderedIndex = header->m_orderedIndex;
+    }
+
+    // shards are created only once, storage reinitialization (e.g. after growth)
+    // happens while all shards are locked
+    if (!m_shards)
+    {
+        m_shards = std::make_unique<Shard[]>(m_numShards);
+    }
+
+    for (uint32_t i = 0; i < m_numShards; ++i)
+    {
+        openIndexes(*m_mappedFile, i, m_shards[i]);
+    }
+}
+
+void PersistableMap::openIndexes(ReservedMappedFile& mappedFile,
+                                 const uint32_t shardIdx,
+                                 ShardIndexes& indexes) const
+{
+    indexes.m_heap = SlabHeap::Open(mappedFile, heapObjectName(shardIdx));
+    switch (m_engine)
+    {
+    case IndexEngine::Hashed:
+        indexes.m_index = HashedIndex::Open(mappedFile, shardObjectName(shardIdx), *indexes.m_heap);
+        break;
+    case IndexEngine::Swiss:
+        indexes.m_index = SwissIndex::Open(mappedFile, shardObjectName(shardIdx), *indexes.m_heap);
+        break;
+    default:
+        throw std::runtime_error((boost::format("Unknown index engine %1%")
+                                  % uint32_t(m_engine)).str());
+    }
+
+    if (m_orderedIndex)
+    {
+        indexes.m_ordered = OrderedIndex::Open(mappedFile, orderedObjectName(shardIdx), *indexes.m_heap);
+    }
+}
+
+PersistableMap::Shard& PersistableMap::shardFor(const KeyView& key) const
+{
+    return m_shards[shardIndex(key)];
+}
+
+uint32_t PersistableMap::shardIndex(const KeyView& key) const
+{
+    // use high bits of the hash to select shard, because the low ones are used
+    // by shard's index to select bucket
+    return uint32_t((key.m_hash >> 32) % m_numShards);
+}
+
+std::vector<std::size_t> PersistableMap::groupByShard(const std::vector<KeyView>& keys) const
+{
+    std::vector<std::size_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (m_numShards > 1)
+    {
+        std::stable_sort(order.begin(), order.end(), [this, &keys](std::size_t lhs, std::size_t rhs)
+        {
+            return shardIndex(keys[lhs]) < shardIndex(keys[rhs]);
+        });
+    }
+
+    return order;
+}
+
+template<typename Operation>
+void PersistableMap::forEachShard(const std::vector<KeyView>& keys, const Operation& operation) const
+{
+    const auto order = groupByShard(keys);
+    auto begin = order.begin();
+    while (begin != order.end())
+    {
+        const auto shardIdx = shardIndex(keys[*begin]);
+        const auto end = std::find_if(begin, order.end(), [this, &keys, shardIdx](std::size_t idx)
+        {
+            return shardIndex(keys[idx]) != shardIdx;
+        });
+
+        operation(m_shards[shardIdx], begin, end);
+        begin = end;
+    }
+}
+
+std::vector<PersistableMap::UniqueLock> PersistableMap::lockAllShards() const
+{
+    // always lock in the same order to avoid deadlocks
+    std::vector<UniqueLock> locks;
+    locks.reserve(m_numShards);
+    for (uint32_t i = 0; i < m_numShards; ++i)
+    {
+        locks.emplace_back(m_shards[i].m_mutex);
+    }
+
+    return locks;
 }
 
 bool PersistableMap::Flush()
 {
-    std::unique_lock lock(m_mutex);
-    return m_mappedFile->flush();
+    std::lock_guard checkpointLock(m_checkpointMutex);
+    const auto start = Clock::now();
+
+    // every record of the rotated log belongs to the modification made before the rotation,
+    // so it is written on disk by the following flush and the log can be dropped after it
+    const auto rotated = m_log->Rotate();
+    if (rotated == 0)
+    {
+        return false;
+    }
+
+    for (std::size_t offset = 0; ; offset += scCheckpointChunkSize)
+    {
+        std::lock_guard growLock(m_growMutex);
+        if (offset >= m_mappedFile->Size())
+        {
+            break;
+        }
+
+        if (!m_mappedFile->Flush(offset, scCheckpointChunkSize))
+        {
+            return false;
+        }
+    }
+
+    m_log->DropRotated(rotated);
+    m_checkpointStat.Add(0, std::chrono::duration_cast<Micros>(Clock::now() - start));
+    return true;
 }
 
 bool PersistableMap::Grow()
 {
-    std::unique_lock lock(m_mutex);
-    if (!m_mappedFile->flush())
+    std::lock_guard growLock(m_growMutex);
+    const auto extraBytes = m_mappedFile->Size();
+
+    // file is extended and mapped without locks, shards are locked only to register
+    // new memory in segment, because segment manager does not synchronize growth
+    // with allocations
+    if (const auto extended = m_mappedFile->Extend(extraBytes))
+    {
+        const auto locks = lockAllShards();
+        {
+            std::lock_guard fileLock(m_fileMutex);
+            m_mappedFile->File().get_segment_manager()->grow(extended);
+        }
+
+        updateNeedsGrowth();
+        publishLargestFree();
+        return true;
+    }
+
+    m_logger.LogRecord(LogLevel::Warning, "Reserved address range exhausted, remapping file");
+    return remapGrow(extraBytes);
+}
+
+bool PersistableMap::remapGrow(const std::size_t extraBytes)
+{
+    const auto locks = lockAllShards();
+    if (!m_mappedFile->Flush())
     {
         return false;
     }
 
-    // reset allocator and mapped file to be able to grow it
-    m_allocator.reset();
-    const auto newSize = m_mappedFile->get_segment_manager()->get_size() * 2;
+    // reset indexes and mapped file to be able to grow it
+    std::lock_guard fileLock(m_fileMutex);
+    for (uint32_t i = 0; i < m_numShards; ++i)
+    {
+        m_shards[i].m_index.reset();
+        m_shards[i].m_ordered.reset();
+        m_shards[i].m_heap = nullptr;
+    }
+
     m_mappedFile.reset();
 
-    // trying to grow mapped file and reinitialize allocator
-    if (!boost::interprocess::managed_mapped_file::grow(m_filePath.c_str(), newSize))
+    // trying to grow mapped file and reinitialize indexes
+    const bool result = MappedFile::grow(m_filePath.c_str(), extraBytes);
+    // reserve enough room for a few more doublings after remapping
+    m_options.m_reservedSize = std::max(m_options.m_reservedSize, extraBytes * 8);
+    initStorage();
+    updateNeedsGrowth();
+    publishLargestFree();
+    return result;
+}
+
+bool PersistableMap::NeedsGrowth() const
+{
+    return m_needsGrowth.load(std::memory_order_relaxed);
+}
+
+bool PersistableMap::belowGrowThreshold() const
+{
+    const auto segment = m_mappedFile->File().get_segment_manager();
+    return segment->get_free_memory() < m_options.m_growThreshold * segment->get_size();
+}
+
+void PersistableMap::updateNeedsGrowth()
+{
+    m_needsGrowth = belowGrowThreshold();
+}
+
+void PersistableMap::updateNeedsGrowth(Shard& shard)
+{
+    // blocks cached by the heap of the modified shard are returned to the segment
+    // before the growth is requested
+    if (belowGrowThreshold())
+    {
+        shard.m_heap->Trim();
+    }
+
+    updateNeedsGrowth();
+    publishStat(shard);
+}
+
+void PersistableMap::publishStat(Shard& shard)
+{
+    shard.m_numRecords.store(shard.m_index->Size(), std::memory_order_relaxed);
+    shard.m_payloadBytes.store(shard.m_index->PayloadBytes(), std::memory_order_relaxed);
+    shard.m_heapFree.store(shard.m_heap->FreeBytes(), std::memory_order_relaxed);
+}
+
+bool PersistableMap::insertEntry(ShardIndexes& shard, const KeyView& key, std::string_view value)
+{
+    if (!shard.m_index->Insert(key, value))
+    {
+        return false;
+    }
+
+    if (shard.m_ordered)
+    {
+        try
+        {
+            shard.m_ordered->Insert(key.m_data);
+        }
+        catch (const boost::interprocess::bad_alloc&)
+        {
+            // keep indexes consistent, operation is retried after growth
+            shard.m_index->Delete(key);
+            throw;
+        }
+    }
+
+    return true;
+}
+
+bool PersistableMap::deleteEntry(ShardIndexes& shard, const KeyView& key)
+{
+    if (!shard.m_index->Delete(key))
     {
-        InitStorage(m_filePath);
         return false;
     }
 
-    InitStorage(m_filePath);
+    if (shard.m_ordered)
+    {
+        shard.m_ordered->Erase(key.m_data);
+    }
+
     return true;
 }
 
-void PersistableMap::Insert(const std::string& key, const std::string& value, const Millis& lockTout)
+template<typename Modification>
+void PersistableMap::modifyCompacted(Shard& shard, const Modification& modification)
+{
+    if (!shard.m_compacted || m_compactFailed)
+    {
+        return;
+    }
+
+    try
+    {
+        modification(*shard.m_compacted);
+    }
+    catch (const boost::interprocess::bad_alloc&)
+    {
+        // modification of the map itself succeeded, compaction is cancelled instead
+        m_compactFailed = true;
+    }
+}
+
+void PersistableMap::Insert(std::string_view key, std::string_view value, const Millis& lockTout)
 {
-    std::unique_lock lock(m_mutex, lockTout);
+    const KeyView keyView(key);
+    auto& shard = shardFor(keyView);
+    std::unique_lock lock(shard.m_mutex, lockTout);
     if (!lock.owns_lock())
     {
         throw std::runtime_error("Failed to aquire unique lock on mutex");
     }
 
-    auto& index = m_internalStorage->get<Entry::ByKey>();
-    if (index.find(key) != index.end())
+    if (!insertEntry(shard, keyView, value))
     {
         throw std::runtime_error("Key already exist");
     }
 
-    index.insert(Entry(key, value, *m_allocator));
+    modifyCompacted(shard, [&](ShardIndexes& compacted)
+    {
+        insertEntry(compacted, keyView, value);
+    });
+
+    // record is appended under the shard's lock to keep order of modifications of the key,
+    // waiting for durability is done without it to let other writers join the same commit
+    const auto lsn = m_log->Append(WriteAheadLog::RecordType::Insert, key, value);
+    updateNeedsGrowth(shard);
+    lock.unlock();
+    m_log->WaitDurable(lsn);
 }
 
-void PersistableMap::Update(const std::string& key, const std::string& value, const Millis& lockTout)
+void PersistableMap::Update(std::string_view key, std::string_view value, const Millis& lockTout)
 {
-    std::unique_lock lock(m_mutex, lockTout);
+    const KeyView keyView(key);
+    auto& shard = shardFor(keyView);
+    std::unique_lock lock(shard.m_mutex, lockTout);
     if (!lock.owns_lock())
     {
         throw std::runtime_error("Failed to aquire unique lock on mutex");
     }
 
-    auto& index = m_internalStorage->get<Entry::ByKey>();
-    auto it = index.find(key);
-    if (it == index.end())
+    if (!shard.m_index->Update(keyView, value))
     {
         throw std::runtime_error("Key not found");
     }
 
-    if (!index.modify(it, [&value](Entry& entry) { entry.value = value; }))
+    modifyCompacted(shard, [&](ShardIndexes& compacted)
     {
-        throw std::runtime_error("Failed to set value");
-    }
+        compacted.m_index->Update(keyView, value);
+    });
+
+    // record is appended under the shard's lock to keep order of modifications of the key,
+    // waiting for durability is done without it to let other writers join the same commit
+    const auto lsn = m_log->Append(WriteAheadLog::RecordType::Update, key, value);
+    updateNeedsGrowth(shard);
+    lock.unlock();
+    m_log->WaitDurable(lsn);
 }
 
-void PersistableMap::Get(const std::string& key, std::string& output, const Millis& lockTout) const
+void PersistableMap::Get(std::string_view key, std::string& output, const Millis& lockTout) const
 {
     // several threads can access Get method
-    std::shared_lock lock(m_mutex, lockTout);
+    const KeyView keyView(key);
+    auto& shard = shardFor(keyView);
+    std::shared_lock lock(shard.m_mutex, lockTout);
     if (!lock.owns_lock())
     {
         throw std::runtime_error("Failed to aquire shared lock on mutex");
     }
 
-    auto& index = m_internalStorage->get<Entry::ByKey>();
-    auto it = index.find(key);
-    if (it == index.end())
+    if (!shard.m_index->Get(keyView, output))
     {
         throw std::runtime_error("Key not found");
     }
+}
 
-    output = (*it).value;
+bool PersistableMap::Visit(std::string_view key, const ValueVisitor& visitor, const Millis& lockTout) const
+{
+    const KeyView keyView(key);
+    auto& shard = shardFor(keyView);
+    std::shared_lock lock(shard.m_mutex, lockTout);
+    if (!lock.owns_lock())
+    {
+        throw std::runtime_error("Failed to aquire shared lock on mutex");
+    }
+
+    const Record* record = shard.m_index->Find(keyView);
+    if (!record)
+    {
+        return false;
+    }
+
+    visitor(record->Value());
+    return true;
 }
 
-void PersistableMap::Delete(const std::string& key, const Millis& lockTout)
+void PersistableMap::Delete(std::string_view key, const Millis& lockTout)
 {
-    std::unique_lock lock(m_mutex, lockTout);
+    const KeyView keyView(key);
+    auto& shard = shardFor(keyView);
+    std::unique_lock lock(shard.m_mutex, lockTout);
     if (!lock.owns_lock())
     {
         throw std::runtime_error("Failed to aquire unique lock on mutex");
     }
 
-    auto& index = m_internalStorage->get<Entry::ByKey>();
-    auto it = index.find(key);
-    if (it == index.end())
+    if (!deleteEntry(shard, keyView))
     {
         throw std::runtime_error("Key not found");
     }
 
-    index.erase(it);
+    modifyCompacted(shard, [&](ShardIndexes& compacted)
+    {
+        deleteEntry(compacted, keyView);
+    });
+
+    const auto lsn = m_log->Append(WriteAheadLog::RecordType::Delete, key, std::string_view());
+    publishStat(shard);
+    lock.unlock();
+    m_log->WaitDurable(lsn);
+}
+
+void PersistableMap::MultiGet(const std::vector<std::string_view>& keys,
+                              std::vector<std::string>& values,
+                              std::vector<BatchStatus>& statuses,
+                              const Millis& lockTout) const
+{
+    const std::vector<KeyView> keyViews(keys.begin(), keys.end());
+    values.assign(keys.size(), std::string());
+    statuses.assign(keys.size(), BatchStatus::NotFound);
+    forEachShard(keyViews, [&](const Shard& shard, auto begin, const auto end)
+    {
+        std::shared_lock lock(shard.m_mutex, lockTout);
+        if (!lock.owns_lock())
+        {
+            throw std::runtime_error("Failed to aquire shared lock on mutex");
+        }
+
+        for (; begin != end; ++begin)
+        {
+            if (shard.m_index->Get(keyViews[*begin], values[*begin]))
+            {
+                statuses[*begin] = BatchStatus::Done;
+            }
+        }
+    });
+}
+
+void PersistableMap::MultiSet(const std::vector<KeyValueView>& pairs,
+                              std::vector<BatchStatus>& statuses,
+                              const Millis& lockTout)
+{
+    std::vector<KeyView> keyViews;
+    keyViews.reserve(pairs.size());
+    for (const auto& pair : pairs)
+    {
+        keyViews.emplace_back(pair.first);
+    }
+
+    statuses.assign(pairs.size(), BatchStatus::Done);
+    WriteAheadLog::Lsn lsn = 0;
+    forEachShard(keyViews, [&](Shard& shard, auto begin, const auto end)
+    {
+        std::unique_lock lock(shard.m_mutex, lockTout);
+        if (!lock.owns_lock())
+        {
+            throw std::runtime_error("Failed to aquire unique lock on mutex");
+        }
+
+        while (begin != end)
+        {
+            const auto& key = keyViews[*begin];
+            const auto value = pairs[*begin].second;
+            try
+            {
+                if (insertEntry(shard, key, value))
+                {
+                    modifyCompacted(shard, [&](ShardIndexes& compacted)
+                    {
+                        insertEntry(compacted, key, value);
+                    });
+
+                    statuses[*begin] = BatchStatus::Done;
+                    lsn = m_log->Append(WriteAheadLog::RecordType::Insert, key.m_data, value);
+                }
+                else
+                {
+                    shard.m_index->Update(key, value);
+                    modifyCompacted(shard, [&](ShardIndexes& compacted)
+                    {
+                        compacted.m_index->Update(key, value);
+                    });
+
+                    statuses[*begin] = BatchStatus::Updated;
+                    lsn = m_log->Append(WriteAheadLog::RecordType::Update, key.m_data, value);
+                }
+            }
+            catch (const boost::interprocess::bad_alloc&)
+            {
+                // growth locks all shards, so the item is retried after it without the lock
+                lock.unlock();
+                if (!Grow())
+                {
+                    throw;
+                }
+
+                if (!lock.try_lock_for(lockTout))
+                {
+                    throw std::runtime_error("Failed to aquire unique lock on mutex");
+                }
+
+                continue;
+            }
+
+            ++begin;
+        }
+
+        updateNeedsGrowth(shard);
+    });
+
+    m_log->WaitDurable(lsn);
+}
+
+void PersistableMap::MultiDelete(const std::vector<std::string_view>& keys,
+                                 std::vector<BatchStatus>& statuses,
+                                 const Millis& lockTout)
+{
+    const std::vector<KeyView> keyViews(keys.begin(), keys.end());
+    statuses.assign(keys.size(), BatchStatus::NotFound);
+    WriteAheadLog::Lsn lsn = 0;
+    forEachShard(keyViews, [&](Shard& shard, auto begin, const auto end)
+    {
+        std::unique_lock lock(shard.m_mutex, lockTout);
+        if (!lock.owns_lock())
+        {
+            throw std::runtime_error("Failed to aquire unique lock on mutex");
+        }
+
+        for (; begin != end; ++begin)
+        {
+            const auto& key = keyViews[*begin];
+            if (!deleteEntry(shard, key))
+            {
+                continue;
+            }
+
+            modifyCompacted(shard, [&](ShardIndexes& compacted)
+            {
+                deleteEntry(compacted, key);
+            });
+
+            statuses[*begin] = BatchStatus::Done;
+            lsn = m_log->Append(WriteAheadLog::RecordType::Delete, key.m_data, std::string_view());
+        }
+
+        publishStat(shard);
+    });
+
+    m_log->WaitDurable(lsn);
+}
+
+std::string PersistableMap::Scan(std::string_view start,
+                                 std::string_view end,
+                                 std::size_t limit,
+                                 std::vector<KeyValue>& output,
+                                 const Millis& lockTout) const
+{
+    if (!m_orderedIndex)
+    {
+        throw std::runtime_error("Map has no ordered index");
+    }
+
+    // empty page can not be continued
+    limit = std::max<std::size_t>(limit, 1);
+
+    // one key more than requested is collected, so the range is known to continue
+    // when merged result exceeds the limit. Once it is collected, following shards
+    // are searched only below the last merged key
+    const auto keyLess = [](const KeyValue& lhs, const KeyValue& rhs)
+    {
+        return lhs.first < rhs.first;
+    };
+
+    std::vector<KeyValue> found;
+    std::vector<std::string> keys;
+    std::string bound(end);
+    for (uint32_t i = 0; i < m_numShards; ++i)
+    {
+        const auto& shard = m_shards[i];
+        std::shared_lock lock(shard.m_mutex, lockTout);
+        if (!lock.owns_lock())
+        {
+            throw std::runtime_error("Failed to aquire shared lock on mutex");
+        }
+
+        keys.clear();
+        shard.m_ordered->Collect(start, bound, limit + 1, keys);
+        lock.unlock();
+        if (keys.empty())
+        {
+            continue;
+        }
+
+        const auto middle = found.size();
+        for (auto& key : keys)
+        {
+            found.emplace_back(std::move(key), std::string());
+        }
+
+        // keys of every shard are already sorted
+        std::inplace_merge(found.begin(), found.begin() + middle, found.end(), keyLess);
+        if (found.size() > limit + 1)
+        {
+            found.resize(limit + 1);
+        }
+
+        if (found.size() == limit + 1)
+        {
+            bound = found.back().first;
+        }
+    }
+
+    std::string cursor;
+    if (found.size() > limit)
+    {
+        found.resize(limit);
+        // smallest key following the last returned one
+        cursor = found.back().first + '\0';
+    }
+
+    // values are read only for the returned keys, keys deleted in the meantime are skipped
+    std::size_t numFound = 0;
+    for (std::size_t i = 0; i < found.size(); ++i)
+    {
+        auto& pair = found[i];
+        const KeyView key(pair.first);
+        const auto& shard = shardFor(key);
+        std::shared_lock lock(shard.m_mutex, lockTout);
+        if (!lock.owns_lock())
+        {
+            throw std::runtime_error("Failed to aquire shared lock on mutex");
+        }
+
+        if (shard.m_index->Get(key, pair.second) && numFound++ != i)
+        {
+            found[numFound - 1] = std::move(pair);
+        }
+    }
+
+    found.resize(numFound);
+    std::move(found.begin(), found.end(), std::back_inserter(output));
+    return cursor;
+}
+
+std::string PersistableMap::PrefixEnd(std::string_view prefix)
+{
+    std::string end(prefix);
+    while (!end.empty() && uint8_t(end.back()) == 0xFF)
+    {
+        end.pop_back();
+    }
+
+    if (!end.empty())
+    {
+        end.back() = char(uint8_t(end.back()) + 1);
+    }
+
+    return end;
+}
+
+bool PersistableMap::HasOrderedIndex() const
+{
+    return m_orderedIndex;
 }
 
 PersistableMap::Stat PersistableMap::GetStat() const
 {
-    std::unique_lock lock(m_mutex);
+    // shards are not locked, so readers and writers do not wait for statistics,
+    // neither do flushes, which hold only the growth lock
+    std::lock_guard fileLock(m_fileMutex);
 
+    const auto segment = m_mappedFile->File().get_segment_manager();
     Stat result =
     {
-        m_mappedFile->get_segment_manager()->get_size(),
-        m_mappedFile->get_segment_manager()->get_free_memory(),
-        m_internalStorage->get<Entry::ByKey>().size()
+        segment->get_size(),
+        segment->get_free_memory(),
+        0,
+        m_numShards,
+        0,
+        0.0,
+        0.0,
+        0,
+        0,
+        0,
+        FlushStat(),
+        FlushStat()
     };
 
+    for (uint32_t i = 0; i < m_numShards; ++i)
+    {
+        result.m_numRecords += m_shards[i].m_numRecords.load(std::memory_order_relaxed);
+        result.m_payloadBytes += m_shards[i].m_payloadBytes.load(std::memory_order_relaxed);
+        result.m_heapFree += m_shards[i].m_heapFree.load(std::memory_order_relaxed);
+    }
+
+    // block measured earlier may have been taken by allocations since then
+    result.m_largestFree = std::min<SegmentManager::size_type>(m_largestFree.load(std::memory_order_relaxed),
+                                                               result.m_free);
+    if (result.m_numRecords != 0)
+    {
+        const auto usedBytes = double(result.m_size - result.m_free);
+        result.m_bytesPerRecord = usedBytes / result.m_numRecords;
+        result.m_overheadPerRecord = (usedBytes - result.m_payloadBytes) / result.m_numRecords;
+    }
+
+    result.m_dirtyBytes = m_mappedFile->Dirty().DirtyBytes();
+    result.m_background = m_backgroundStat.Get();
+    result.m_checkpoints = m_checkpointStat.Get();
     return result;
 }
 
+void PersistableMap::publishLargestFree()
+{
+    // segment has no query of it's largest free block, the block is found
+    // by the allocation of any size up to the whole segment, which returns
+    // the largest block when there is no block of the preferred size
+    const auto segment = m_mappedFile->File().get_segment_manager();
+    SegmentManager::size_type received = segment->get_size();
+    char* reuse = nullptr;
+    char* block = segment->allocation_command<char>(boost::interprocess::allocate_new
+                                                    | boost::interprocess::nothrow_allocation,
+                                                    1, received, reuse);
+    if (block)
+    {
+        segment->deallocate(block);
+    }
+
+    m_largestFree.store(block ? received : 0, std::memory_order_relaxed);
+}
+
+std::size_t PersistableMap::compactedSize(const Stat& stat)
+{
+    // live entries take a half of the compacted file, memory cached by heaps is reclaimed
+    const auto liveBytes = stat.m_size - stat.m_free - stat.m_heapFree;
+    const auto size = (2 * liveBytes + scCompactSizeStep - 1) / scCompactSizeStep * scCompactSizeStep;
+    return std::max(size, scDefaultMappedFileSize);
+}
+
+bool PersistableMap::NeedsCompaction(const Stat& stat) const
+{
+    return m_options.m_compactThreshold > 0.0
+            && stat.m_free + stat.m_heapFree > m_options.m_compactThreshold * stat.m_size
+            && compactedSize(stat) < stat.m_size;
+}
+
+std::size_t PersistableMap::Compact()
+{
+    std::lock_guard compactLock(m_compactMutex);
+    const auto stat = GetStat();
+    const auto size = compactedSize(stat);
+    if (size >= stat.m_size)
+    {
+        return 0;
+    }
+
+    const auto start = Clock::now();
+    const auto compactedPath = m_filePath + scCompactFileSuffix;
+    std::filesystem::remove(compactedPath);
+    auto compacted = std::make_unique<ReservedMappedFile>(compactedPath, size, m_options.m_reservedSize);
+    compacted->File().construct<Header>(scHeaderObjectName)(
+                Header { scFormatVersion, m_numShards, m_engine, m_orderedIndex });
+
+    auto copies = std::make_unique<ShardIndexes[]>(m_numShards);
+    m_compactFailed = false;
+    for (uint32_t i = 0; i < m_numShards && !m_compactFailed; ++i)
+    {
+        openIndexes(*compacted, i, copies[i]);
+
+        // readers of the shard keep working, writers wait for the copy,
+        // m_compacted is read only under unique lock, so it is set under shared one
+        auto& shard = m_shards[i];
+        SharedLock lock(shard.m_mutex);
+        try
+        {
+            shard.m_index->ForEach([this, &copies, i](const Record& record)
+            {
+                insertEntry(copies[i], record.Key(), record.Value());
+            });
+        }
+        catch (const boost::interprocess::bad_alloc&)
+        {
+            m_compactFailed = true;
+        }
+
+        shard.m_compacted = &copies[i];
+    }
+
+    // most of the pages are written before writers are blocked
+    compacted->Flush();
+
+    std::lock_guard checkpointLock(m_checkpointMutex);
+    std::lock_guard growLock(m_growMutex);
+    const auto locks = lockAllShards();
+    for (uint32_t i = 0; i < m_numShards; ++i)
+    {
+        m_shards[i].m_compacted = nullptr;
+    }
+
+    // write-ahead log is kept until the next checkpoint, it's records are
+    // applied to any of two files the same way after crash
+    if (m_compactFailed || !compacted->Flush() || !compacted->Rename(m_filePath))
+    {
+        copies.reset();
+        compacted.reset();
+        std::filesystem::remove(compactedPath);
+        m_logger.LogRecord(LogLevel::Error, (boost::format("Compaction to the file of %1% bytes failed")
+                            % size).str());
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < m_numShards; ++i)
+    {
+        static_cast<ShardIndexes&>(m_shards[i]) = std::move(copies[i]);
+        publishStat(m_shards[i]);
+    }
+
+    const auto oldSize = m_mappedFile->Size();
+    {
+        std::lock_guard fileLock(m_fileMutex);
+        m_mappedFile = std::move(compacted);
+    }
+
+    updateNeedsGrowth();
+    publishLargestFree();
+
+    const auto reclaimed = oldSize - m_mappedFile->Size();
+    m_logger.LogRecord((boost::format("Map file compacted from %1% to %2% bytes in %3% ms")
+                        % oldSize
+                        % m_mappedFile->Size()
+                        % std::chrono::duration_cast<Millis>(Clock::now() - start).count()).str());
+    return reclaimed;
+}
+
 }// namespace kvdb
@@ -1,18 +1,21 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <string>
+#include <string_view>
 #include <memory>
+#include <mutex>
 #include <shared_mutex>
-
-#include <boost/interprocess/allocators/cached_node_allocator.hpp>
-#include <boost/interprocess/managed_mapped_file.hpp>
-#include <boost/interprocess/offset_ptr.hpp>
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/hashed_index.hpp>
-#include <boost/multi_index/member.hpp>
-#include <boost/interprocess/containers/string.hpp>
+#include <thread>
+#include <vector>
 
 #include "Logger.hpp"
+#include "OrderedIndex.hpp"
+#include "ReservedMappedFile.hpp"
+#include "SlabHeap.hpp"
+#include "StorageIndex.hpp"
+#include "WriteAheadLog.hpp"
 
 namespace kvdb
 {
@@ -21,99 +24,303 @@ namespace kvdb
 /// Uses memory mapped file to store it's content
 /// All public methods can be used concurrently from different threads,
 /// all of them are blocking
+/// Keyspace is hash-partitioned into a number of shards, every shard has
+/// it's own index inside the mapped file and it's own lock, so operations
+/// on keys from different shards do not block each other
+/// File is mapped into the large reserved range of addresses, so it grows
+/// in place while reads and writes continue
+/// Modified regions of the file are written on disk by the background flusher
+/// at limited rate, checkpoints do not lock shards
+/// Optionally every shard also keeps it's keys ordered to serve range queries
+/// Mostly free file is compacted online: live entries are copied into a new
+/// smaller file which replaces the current one
 class PersistableMap
 {
 public:
-    using SegmentManager = boost::interprocess::managed_mapped_file::segment_manager;
     using Millis = std::chrono::milliseconds;
 
+    struct Options
+    {
+        /// number of shards of newly created file, existing files always
+        /// keep number of shards they were created with
+        uint32_t    m_numShards = 1;
+        /// index engine of newly created file, existing files always
+        /// keep index they were created with. Swiss table grows incrementally,
+        /// hashed one rehashes all entries of a shard at once
+        IndexEngine m_engine = IndexEngine::Swiss;
+        /// size of virtual address range reserved for the mapping
+        std::size_t m_reservedSize = std::size_t(64) * 1024 * 1024 * 1024;
+        /// growth is needed when ratio of free memory falls below this value
+        double      m_growThreshold = 0.2;
+        /// defines when modifications written to the log become durable
+        WriteAheadLog::SyncPolicy m_walSyncPolicy = WriteAheadLog::SyncPolicy::Interval;
+        Millis      m_walSyncInterval = Millis(10);
+        /// interval between two runs of background flusher, 0 disables it
+        Millis      m_flushInterval = Millis(100);
+        /// maximum number of bytes per second written by background flusher
+        std::size_t m_flushRateLimit = 64 * 1024 * 1024;
+        /// compaction is needed when ratio of free memory exceeds this value, 0 disables it
+        double      m_compactThreshold = 0.75;
+        /// maintain ordered index of keys needed by Scan in newly created file,
+        /// existing files always keep the setting they were created with
+        bool        m_orderedIndex = false;
+    };
+
+    using KeyValue = std::pair<std::string, std::string>;
+    using KeyValueView = std::pair<std::string_view, std::string_view>;
+
+    /// @brief status of one item of the batch operation
+    enum class BatchStatus : uint8_t
+    {
+        Done,       ///< key is found by MultiGet, inserted by MultiSet or deleted by MultiDelete
+        Updated,    ///< value of the existing key is replaced by MultiSet
+        NotFound,   ///< key is not found by MultiGet or MultiDelete
+    };
+
+    using Micros = std::chrono::microseconds;
+
+    /// @brief statistics of writing map content on disk
+    struct FlushStat
+    {
+        std::size_t m_numFlushes = 0;
+        std::size_t m_flushedBytes = 0;     ///< background flushes only
+        Micros      m_totalTime = Micros(0);
+        Micros      m_maxTime = Micros(0);
+    };
+
     struct Stat
     {
         SegmentManager::size_type   m_size;
         SegmentManager::size_type   m_free;
         std::size_t                 m_numRecords;
+        std::size_t                 m_numShards;
+        std::size_t                 m_payloadBytes;     ///< bytes of keys and values
+        double                      m_bytesPerRecord;   ///< used memory of the segment per record
+        double                      m_overheadPerRecord;///< used memory per record except keys and values
+        SegmentManager::size_type   m_largestFree;      ///< largest block the segment is able to allocate,
+                                                        ///< measured by the last growth or compaction
+        std::size_t                 m_heapFree;         ///< free memory cached by shards' heaps,
+                                                        ///< counted as used by the segment
+        std::size_t                 m_dirtyBytes;       ///< approximate size of not flushed regions
+        FlushStat                   m_background;       ///< incremental flushes of dirty regions
+        FlushStat                   m_checkpoints;      ///< full flushes
     };
 
     explicit PersistableMap(Logger& logger);
 
     virtual ~PersistableMap();
 
-    void InitStorage(const std::string& filePath);
+    /// @brief opens or creates mapped file and replays it's write-ahead log
+    void InitStorage(const std::string& filePath, const Options& options);
+
+    /// @brief writes map content on disk and drops write-ahead log (checkpoint)
+    /// Does not block modifications, file is written by chunks
     bool Flush();
+
+    /// @brief doubles size of the storage
+    /// Mapping is extended in place when possible, shards are locked only
+    /// for a short time needed to register new memory in the segment.
+    /// Otherwise file is remapped while all shards are locked
     bool Grow();
-    void Insert(const std::string& key, const std::string& value, const Millis& lockTout);
-    void Update(const std::string& key, const std::string& value, const Millis& lockTout);
-    void Get(const std::string& key, std::string& output, const Millis& lockTout) const;
-    void Delete(const std::string& key, const Millis& lockTout);
-    Stat GetStat() const;
 
-private:
-    template<typename Type>
-    using Allocator = boost::interprocess::allocator<Type, SegmentManager>;
+    /// @brief true when ratio of free memory is below the growth threshold
+    /// Never blocks, intended to be checked after modifying operations
+    /// to start growth before allocations fail
+    bool NeedsGrowth() const;
 
-    using AllocatorPtr = std::unique_ptr<Allocator<void>>;
-    using MappedFile = boost::interprocess::managed_mapped_file;
-    using MappedFilePtr = std::shared_ptr<MappedFile>;
-    using StringType = boost::interprocess::basic_string<char, std::char_traits<char>, Allocator<char>>;
+    void Insert(std::string_view key, std::string_view value, const Millis& lockTout);
+    void Update(std::string_view key, std::string_view value, const Millis& lockTout);
+    void Get(std::string_view key, std::string& output, const Millis& lockTout) const;
 
-    struct Entry
-    {
-        StringType  key;
-        StringType  value;
+    /// @brief receives value of the key stored in the map, value must not be used after it returns
+    using ValueVisitor = std::function<void(std::string_view value)>;
+
+    /// @brief passes value of the key to the visitor without copying it,
+    /// visitor is called under the shard's shared lock, so entry is not updated, deleted
+    /// or moved by growth and compaction until it returns. Visitor must not access the map
+    /// @return false if key not found
+    bool Visit(std::string_view key, const ValueVisitor& visitor, const Millis& lockTout) const;
+    void Delete(std::string_view key, const Millis& lockTout);
+
+    /// Batch operations lock every shard holding some of the keys once and process
+    /// all keys of the shard under this lock, log records of the batch are awaited once.
+    /// Shards are locked one by one, so batch is not atomic: it is partially applied
+    /// if lock of some shard is not acquired in time
+    /// Items of the same key are processed in the order they are passed
+    /// @param statuses receives status of every item in the order of items
+    /// @param values receives value of every found key in the order of keys
+    /// @throw std::runtime_error if lock of some shard is not acquired in time
+    void MultiGet(const std::vector<std::string_view>& keys,
+                  std::vector<std::string>& values,
+                  std::vector<BatchStatus>& statuses,
+                  const Millis& lockTout) const;
+
+    /// @brief inserts missing keys and updates existing ones,
+    /// map file is grown when it runs out of memory in the middle of the batch
+    void MultiSet(const std::vector<KeyValueView>& pairs,
+                  std::vector<BatchStatus>& statuses,
+                  const Millis& lockTout);
+
+    void MultiDelete(const std::vector<std::string_view>& keys,
+                     std::vector<BatchStatus>& statuses,
+                     const Millis& lockTout);
+
+    /// @brief appends up to limit (at least one) keys from range [start, end) together with their values
+    /// in ascending order of keys
+    /// Shards are locked one by one, so result is not an atomic snapshot of the map
+    /// @param end empty end means range is not bounded
+    /// @return cursor to pass as start of the next page or empty string when range is exhausted
+    /// @throw std::runtime_error if map has no ordered index
+    std::string Scan(std::string_view start,
+                     std::string_view end,
+                     std::size_t limit,
+                     std::vector<KeyValue>& output,
+                     const Millis& lockTout) const;
 
-        explicit Entry(Allocator<void> a)
-            : key(a)
-            , value(a)
-        {
-        }
+    /// @return exclusive end of the range of keys starting with prefix,
+    /// empty string if range is not bounded
+    static std::string PrefixEnd(std::string_view prefix);
 
-        Entry(const std::string& key, const std::string& value, Allocator<void> a)
-            : key(key, a)
-            , value(value, a)
-        {}
+    bool HasOrderedIndex() const;
 
-        struct ByKey{};
+    /// @brief collects statistics without locking shards
+    /// Shards' counters are published by writers under their locks, only registration
+    /// of grown memory and replacement of the mapped file are waited for, flushes are not.
+    /// Largest free block is best effort: it is measured by growth and compaction,
+    /// which lock all shards anyway, and is limited by the current free memory
+    Stat GetStat() const;
+
+    /// @brief copies live entries into a new compact file and replaces map file with it
+    /// Shards are copied one by one under shared locks, so only writers of the shard
+    /// being copied wait, modifications of already copied shards are applied to both
+    /// files. All shards are locked only to flush the new file and switch to it
+    /// @return number of bytes the file shrank by, 0 if compaction was not needed
+    /// or new file turned out to be too small
+    std::size_t Compact();
+
+    /// @brief true when ratio of free memory exceeds the compaction threshold
+    /// and compaction would make the file smaller
+    bool NeedsCompaction(const Stat& stat) const;
+
+private:
+    using MappedFilePtr = std::unique_ptr<ReservedMappedFile>;
+
+    /// @brief persistent description of the storage layout
+    struct Header
+    {
+        uint32_t    m_version;
+        uint32_t    m_numShards;
+        IndexEngine m_engine;
+        uint32_t    m_orderedIndex;
     };
 
-    struct StringTypeHash
+    /// @brief objects of the shard inside one mapped file
+    struct ShardIndexes
     {
-      std::size_t operator()(const std::basic_string<char>& value) const
-      {
-          return boost::hash<std::string>()(std::string(value));
-      }
+        SlabHeap*                       m_heap = nullptr;
+        std::unique_ptr<StorageIndex>   m_index;
+        std::unique_ptr<OrderedIndex>   m_ordered;  ///< nullptr if map has no ordered index
     };
 
-    struct StringTypeEqual
+    struct Shard
+            : ShardIndexes
     {
-        std::size_t operator()(const std::basic_string<char>& str1, const StringType& str2) const
-        {
-            return std::equal(str1.begin(), str1.end(), str2.begin(), str2.end());
-        }
+        ShardIndexes*                   m_compacted = nullptr;  ///< copy of the shard inside the file
+                                                                ///< being compacted, modified under
+                                                                ///< shard's lock
+        mutable std::shared_timed_mutex m_mutex;
+
+        // published by writers under the lock, read by GetStat without it
+        std::atomic<std::size_t>        m_numRecords { 0 };
+        std::atomic<std::size_t>        m_payloadBytes { 0 };
+        std::atomic<std::size_t>        m_heapFree { 0 };
     };
 
-    using InternalStorage =
-        boost::multi_index_container<
-            Entry,
-            boost::multi_index::indexed_by<
-                boost::multi_index::hashed_unique<
-                    boost::multi_index::tag<Entry::ByKey>,
-                    boost::multi_index::member<Entry,StringType,&Entry::key>,
-                    StringTypeHash,
-                    StringTypeEqual
-                >
-            >,
-            Allocator<Entry>>;
-
-    using InternalStoragePtr = InternalStorage*;
+    using UniqueLock = std::unique_lock<std::shared_timed_mutex>;
+    using SharedLock = std::shared_lock<std::shared_timed_mutex>;
 
     void initStorage();
+    void openIndexes(ReservedMappedFile& mappedFile, uint32_t shardIdx, ShardIndexes& indexes) const;
+    Shard& shardFor(const KeyView& key) const;
+    uint32_t shardIndex(const KeyView& key) const;
+
+    /// @brief orders items of the batch by their shards, items of the same shard keep their order
+    /// @return indexes of items
+    std::vector<std::size_t> groupByShard(const std::vector<KeyView>& keys) const;
+
+    /// @brief calls operation for every shard holding some of the keys with the range
+    /// of indexes of it's items, shards are locked by the operation
+    template<typename Operation>
+    void forEachShard(const std::vector<KeyView>& keys, const Operation& operation) const;
+    std::vector<UniqueLock> lockAllShards() const;
+    bool remapGrow(std::size_t extraBytes);
+
+    /// @brief inserts entry into all indexes of the shard, caller must hold shard's lock
+    /// @return false if key already exists
+    bool insertEntry(ShardIndexes& shard, const KeyView& key, std::string_view value);
+
+    /// @brief removes entry from all indexes of the shard, caller must hold shard's lock
+    /// @return false if key not found
+    bool deleteEntry(ShardIndexes& shard, const KeyView& key);
+
+    /// @brief applies modification to the copy of the shard if it is being compacted,
+    /// caller must hold shard's unique lock
+    template<typename Modification>
+    void modifyCompacted(Shard& shard, const Modification& modification);
+
+    /// @return size of the compacted file for the given statistics
+    static std::size_t compactedSize(const Stat& stat);
+
+    /// @brief publishes counters of the shard for GetStat, caller must hold shard's unique lock
+    void publishStat(Shard& shard);
+
+    /// @brief publishes the largest free block of the segment for GetStat,
+    /// caller must hold growth lock and unique locks of all shards
+    void publishLargestFree();
+
+    bool belowGrowThreshold() const;
+    void updateNeedsGrowth();
+
+    /// @brief same as updateNeedsGrowth, but trims heap of the shard first,
+    /// caller must hold shard's lock
+    void updateNeedsGrowth(Shard& shard);
+    void replayLog();
+    void runFlusher();
+
+    /// @brief thread safe accumulator of flush statistics
+    struct FlushCounters
+    {
+        std::atomic<std::size_t>    m_numFlushes { 0 };
+        std::atomic<std::size_t>    m_flushedBytes { 0 };
+        std::atomic<int64_t>        m_totalTimeUs { 0 };
+        std::atomic<int64_t>        m_maxTimeUs { 0 };
+
+        void Add(std::size_t bytes, const Micros& time);
+        FlushStat Get() const;
+    };
 
     Logger&                     m_logger;
     std::string                 m_filePath;
+    Options                     m_options;
     MappedFilePtr               m_mappedFile;
-    AllocatorPtr                m_allocator;
-    InternalStoragePtr          m_internalStorage;
-    mutable std::shared_timed_mutex m_mutex;
+    uint32_t                    m_numShards = 0;
+    IndexEngine                 m_engine = IndexEngine::Swiss;
+    bool                        m_orderedIndex = false;
+    std::unique_ptr<Shard[]>    m_shards;
+    std::unique_ptr<WriteAheadLog> m_log;
+    mutable std::mutex          m_growMutex;        ///< serializes growth and flushes
+    mutable std::mutex          m_fileMutex;        ///< keeps statistics from reading the segment being grown or replaced
+    std::atomic<bool>           m_needsGrowth;
+    std::atomic<std::size_t>    m_largestFree { 0 };    ///< published by publishLargestFree
+    std::mutex                  m_checkpointMutex;  ///< serializes checkpoints
+    std::mutex                  m_compactMutex;     ///< serializes compactions
+    std::atomic<bool>           m_compactFailed { false };  ///< copy of the map became inconsistent
+    FlushCounters               m_backgroundStat;
+    FlushCounters               m_checkpointStat;
+    std::mutex                  m_flusherMutex;
+    std::condition_variable     m_flusherCv;
+    bool                        m_stopFlusher = false;
+    std::thread                 m_flusher;
 };
 
 
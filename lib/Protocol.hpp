@@ -1,7 +1,14 @@
 #pragma once
 
+#include <chrono>
 #include <string>
+#include <string_view>
 #include <memory>
+#include <utility>
+
+#include <boost/endian/arithmetic.hpp>
+
+#include "MessageBuffer.hpp"
 
 namespace kvdb
 {
@@ -29,13 +36,50 @@ struct MessageHeader
         : m_msgSize(size)
     {}
 
-    uint32_t    m_magicInt = scMagicInt;
-    uint32_t    m_msgSize = 0;
+    boost::endian::little_uint32_t  m_magicInt = scMagicInt;
+    boost::endian::little_uint32_t  m_msgSize = 0;
 };
 
 static const uint32_t scReceiveDataTOutMs = 1000;
 static const std::size_t scMessageHeaderSize = sizeof(MessageHeader);
 
+/// versions of the encoding of messages
+/// legacy: text encoding of commands without the limit field, clients of it connect without
+/// the handshake, so the version is never sent and is detected by the header of the first command
+static const uint32_t scProtocolLegacy = 0;
+/// text: fields are separated by spaces, numbers and sizes of strings are decimal,
+/// client waits for the result of the command before sending the next one
+static const uint32_t scProtocolText = 1;
+/// binary: fixed-width little-endian fields, carries ids of commands, so client may send
+/// commands without waiting for results, and results may be sent in any order
+static const uint32_t scProtocolBinary = 2;
+static const uint32_t scMaxProtocolVersion = scProtocolBinary;
+
+/// @brief first chunk of data sent by both sides of the new connection
+/// Client proposes the highest version of the protocol it supports, server answers
+/// with the version used by the connection afterwards, or with 0 if it supports none
+struct Handshake
+{
+    using Ptr = std::shared_ptr<Handshake>;
+
+    static const uint32_t       scMagicInt = 0x4244564B; // "KVDB"
+
+    bool IsValid() const
+    {
+        return m_magicInt == scMagicInt;
+    }
+
+    explicit Handshake(const uint32_t version = 0)
+        : m_version(version)
+    {}
+
+    boost::endian::little_uint32_t  m_magicInt = scMagicInt;
+    boost::endian::little_uint32_t  m_version = 0;
+};
+
+static const std::size_t scHandshakeSize = sizeof(Handshake);
+static const uint32_t scHandshakeToutMs = 1000;
+
 /// @brief helper class implementing length limitations of strings
 class LimitedString
 {
@@ -47,13 +91,13 @@ public:
         Set(str);
     }
 
-    void Set(const std::string& str, bool nocheck = false)
+    void Set(std::string_view str, bool nocheck = false)
     {
         if (!nocheck)
         {
             checkString(str);
         }
-        m_content = str;
+        m_content.assign(str.data(), str.size());
     }
 
     const std::string& Get() const
@@ -73,7 +117,7 @@ public:
     }
 
 private:
-    void checkString(const std::string& str) const
+    void checkString(std::string_view str) const
     {
         if (str.size() > m_maxSize)
         {
@@ -90,6 +134,21 @@ using CommandID = uint32_t;
 static const std::size_t scMaxKeySize = 1024;
 static const std::size_t scMaxValueSize = 1024 * 1024;
 
+/// number of pairs returned by SCAN when command does not specify the limit
+static const uint32_t scDefaultScanLimit = 1000;
+/// maximum number of pairs returned by one SCAN command
+static const uint32_t scMaxScanLimit = 10000;
+/// SCAN results are streamed by batches of approximately this size (in bytes)
+static const std::size_t scScanBatchSize = 64 * 1024;
+/// result must fit a batch with single pair of the largest key and value
+static const std::size_t scMaxResultSize = scMaxKeySize + scMaxValueSize + 64;
+/// larger messages are rejected before they are received, fields of any command or result
+/// take less than the overhead in either encoding
+static const std::size_t scMaxMessageSize = scMaxKeySize + scMaxValueSize + 256;
+
+using KeyValue = std::pair<std::string, std::string>;
+using KeyValueView = std::pair<std::string_view, std::string_view>;
+
 /// @brief Generalized command
 struct CommandMessage
 {
@@ -99,28 +158,54 @@ struct CommandMessage
       INSERT,
       UPDATE,
       DELETE,
-      GET
+      GET,
+      SCAN,           ///< key - inclusive start of the range, value - exclusive end or empty
+      SCAN_PREFIX,    ///< key - prefix, value - cursor returned by previous SCAN_PREFIX or empty
+      COMPACT,        ///< key and value are empty
+      MGET,           ///< value - keys, result - value of every key
+      MSET,           ///< value - pairs, every key is inserted or updated
+      MDELETE         ///< value - keys
    };
 
    CommandMessage(const uint8_t type = 0,
                   const std::string& key = std::string(),
-                  const std::string& value = std::string())
+                  const std::string& value = std::string(),
+                  const uint32_t limit = 0)
        : type(type)
        , key(scMaxKeySize, key)
        , value(scMaxValueSize, value)
+       , limit(limit)
    {}
 
    bool operator==(const CommandMessage& other) const
    {
        return type == other.type
                && key == other.key
-               && value == other.value;
+               && value == other.value
+               && limit == other.limit;
    }
 
    CommandID        id = 0;
    int              type = UNKNOWN;
    LimitedString    key;
    LimitedString    value;
+   uint32_t         limit = 0;  ///< maximum number of pairs returned by SCAN, 0 - default
+};
+
+/// @brief received command parsed in place
+/// Key and value refer to the buffer of the received message, which is kept alive by the command,
+/// so they are copied only when they are stored
+struct CommandView
+{
+   CommandID            id = 0;
+   int                  type = CommandMessage::UNKNOWN;
+   std::string_view     key;
+   std::string_view     value;
+   uint32_t             limit = 0;
+   uint32_t             version = scProtocolText;   ///< protocol of the session, payloads of batches
+                                                    ///< and their results are encoded with it
+   MessageBuffer::Ptr   buffer;     ///< memory of key and value
+   std::chrono::steady_clock::time_point received; ///< time the read completing the command was made
 };
 
 /// @brief Command execution result
@@ -138,12 +223,20 @@ struct ResultMessage
       GetFailed             = 7,
       DeleteSuccess         = 8,
       DeleteFailed          = 9,
+      ScanBatch             = 10,   ///< value - batch of pairs, more results follow
+      ScanSuccess           = 11,   ///< value - cursor to continue the scan or empty when it is finished
+      ScanFailed            = 12,
+      CompactSuccess        = 13,   ///< value - number of reclaimed bytes
+      CompactFailed         = 14,
+      BatchSuccess          = 15,   ///< value - result of every item of MGET, MSET or MDELETE
+      BatchFailed           = 16,
+      BatchPart             = 17,   ///< value - results of leading items of MGET, more results follow
    };
 
    ResultMessage(const uint8_t code = 0,
                   const std::string& value = std::string())
        : code(code)
-       , value(scMaxValueSize, value)
+       , value(scMaxResultSize, value)
    {}
 
    bool operator==(const ResultMessage& other) const
@@ -158,4 +251,38 @@ struct ResultMessage
    LimitedString    value;
 };
 
+/// @brief result being sent, which does not own it's value
+/// Value may refer to the entry of the map, so the view is serialized
+/// before the lock of the entry is released
+struct ResultView
+{
+   ResultView(const CommandID commandId, const int code, const std::string_view value)
+       : commandId(commandId)
+       , code(code)
+       , value(value)
+   {}
+
+   ResultView(const ResultMessage& result)
+       : ResultView(result.commandId, result.code, result.value.Get())
+   {}
+
+   CommandID            commandId;
+   int                  code;
+   std::string_view     value;
+};
+
+/// @brief result of one item of MGET, MSET and MDELETE commands
+struct BatchItem
+{
+    int         code = ResultMessage::UnknownCommand;   ///< GetSuccess or GetFailed for MGET,
+                                                        ///< InsertSuccess or UpdateSuccess for MSET,
+                                                        ///< DeleteSuccess or DeleteFailed for MDELETE
+    std::string value;                                  ///< value of the key found by MGET
+
+    bool operator==(const BatchItem& other) const
+    {
+        return code == other.code && value == other.value;
+    }
+};
+
 }
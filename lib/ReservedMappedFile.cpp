@@ -0,0 +1,216 @@
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <boost/format.hpp>
+
+#include "ReservedMappedFile.hpp"
+
+namespace kvdb
+{
+
+static const int scMaxMapAttempts = 3;
+
+/// kernel may align file mappings to the huge page boundary and considers address hint
+/// only when range of the padded size is free
+static const std::size_t scMappingPadding = 2 * 1024 * 1024;
+
+static std::size_t pageSize()
+{
+    static const std::size_t scPageSize = ::sysconf(_SC_PAGESIZE);
+    return scPageSize;
+}
+
+static std::size_t roundUpToPage(const std::size_t size)
+{
+    return (size + pageSize() - 1) / pageSize() * pageSize();
+}
+
+ReservedMappedFile::ReservedMappedFile(const std::string& filePath,
+                                       std::size_t initialSize,
+                                       std::size_t reservedSize)
+    : m_filePath(filePath)
+    , m_size(0)
+{
+    std::error_code ec;
+    const auto fileSize = std::filesystem::file_size(m_filePath, ec);
+    const std::size_t sizeToMap = ec ? initialSize : fileSize;
+
+    for (int attempt = 0; attempt < scMaxMapAttempts && !m_mappedFile; ++attempt)
+    {
+        // mapping itself is placed by boost at the beginning of reserved range,
+        // so this part of the range must be released just before mapping
+        reserve(std::max(reservedSize, sizeToMap * 2 + scMappingPadding));
+        if (m_base)
+        {
+            ::munmap(m_base, roundUpToPage(sizeToMap) + scMappingPadding);
+        }
+
+        try
+        {
+            m_mappedFile = std::make_unique<MappedFile>(boost::interprocess::open_or_create,
+                                                        m_filePath.c_str(),
+                                                        initialSize,
+                                                        m_base);
+        }
+        catch (const boost::interprocess::interprocess_exception& e)
+        {
+            // some other mapping occupied released part of the range, try another one
+            if (!m_base || e.get_error_code() != boost::interprocess::busy_error)
+            {
+                throw;
+            }
+
+            const auto released = roundUpToPage(sizeToMap) + scMappingPadding;
+            ::munmap(m_base + released, m_reservedSize - released);
+            m_base = nullptr;
+        }
+    }
+
+    if (!m_mappedFile)
+    {
+        throw std::runtime_error("Failed to map file into reserved address range");
+    }
+
+    if (m_base)
+    {
+        // padding released for the mapping must be reserved again, if something else
+        // was mapped there file can not be extended in place
+        const auto mapped = roundUpToPage(sizeToMap);
+        void* padding = ::mmap(m_base + mapped, scMappingPadding, PROT_NONE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE,
+                               -1, 0);
+        if (padding != m_base + mapped)
+        {
+            if (padding != MAP_FAILED)
+            {
+                ::munmap(padding, scMappingPadding);
+            }
+
+            ::munmap(m_base + mapped + scMappingPadding, m_reservedSize - mapped - scMappingPadding);
+            m_base = nullptr;
+            m_reservedSize = 0;
+        }
+    }
+
+    m_size = std::filesystem::file_size(m_filePath);
+    m_mapping = static_cast<char*>(m_mappedFile->get_address());
+    m_dirty = std::make_unique<DirtyRegions>(m_mapping, m_base ? m_reservedSize : std::size_t(m_size));
+}
+
+ReservedMappedFile::~ReservedMappedFile()
+{
+    m_mappedFile.reset();
+    if (m_base)
+    {
+        // unmaps extensions of the file together with rest of the reserved range
+        ::munmap(m_base, m_reservedSize);
+    }
+}
+
+void ReservedMappedFile::reserve(const std::size_t size)
+{
+    void* base = ::mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        // address space is exhausted (e.g. on 32-bit system), file will be mapped
+        // wherever it fits and can be grown only by remapping
+        m_base = nullptr;
+        m_reservedSize = 0;
+        return;
+    }
+
+    m_base = static_cast<char*>(base);
+    m_reservedSize = size;
+}
+
+std::size_t ReservedMappedFile::Extend(const std::size_t minExtraBytes)
+{
+    if (!m_base)
+    {
+        return 0;
+    }
+
+    const std::size_t oldSize = m_size;
+    const std::size_t mappedSize = roundUpToPage(oldSize);
+    const std::size_t newSize = roundUpToPage(oldSize + minExtraBytes);
+    if (newSize > m_reservedSize)
+    {
+        return 0;
+    }
+
+    const int fd = ::open(m_filePath.c_str(), O_RDWR);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    bool success = ::ftruncate(fd, newSize) == 0;
+    if (success && newSize > mappedSize)
+    {
+        // replaces reserved pages right after the mapping with the new part of the file
+        void* extension = ::mmap(m_base + mappedSize, newSize - mappedSize,
+                                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                                 fd, mappedSize);
+        success = extension != MAP_FAILED;
+    }
+
+    ::close(fd);
+    if (!success)
+    {
+        return 0;
+    }
+
+    m_size = newSize;
+    return newSize - oldSize;
+}
+
+bool ReservedMappedFile::Rename(const std::string& filePath)
+{
+    std::error_code ec;
+    std::filesystem::rename(m_filePath, filePath, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    m_filePath = filePath;
+
+    const auto directory = std::filesystem::absolute(m_filePath).parent_path();
+    const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0)
+    {
+        ::fsync(fd);
+        ::close(fd);
+    }
+
+    return true;
+}
+
+bool ReservedMappedFile::Flush()
+{
+    return Flush(0, m_size);
+}
+
+bool ReservedMappedFile::Flush(const std::size_t offset, const std::size_t size)
+{
+    const std::size_t mappedSize = roundUpToPage(m_size);
+    if (offset >= mappedSize)
+    {
+        return true;
+    }
+
+    return ::msync(m_mapping + offset, std::min(roundUpToPage(size), mappedSize - offset), MS_SYNC) == 0;
+}
+
+std::size_t ReservedMappedFile::FlushDirty(const std::size_t maxBytes)
+{
+    return m_dirty->Flush(roundUpToPage(m_size), maxBytes, [](char* begin, const std::size_t size)
+    {
+        return ::msync(begin, size, MS_SYNC) == 0;
+    });
+}
+
+} // namespace kvdb
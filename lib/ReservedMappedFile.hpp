@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "DirtyRegions.hpp"
+#include "StorageIndex.hpp"
+
+namespace kvdb
+{
+
+/// @brief managed memory mapped file placed at the beginning of the reserved range
+/// of virtual addresses
+/// Reserved range is not backed by memory, so file can be extended in place
+/// without remapping and all pointers into the mapping stay valid
+class ReservedMappedFile
+{
+public:
+    /// @param reservedSize size of the reserved range, mapping of the file
+    /// can not be extended in place over this size
+    ReservedMappedFile(const std::string& filePath,
+                       std::size_t initialSize,
+                       std::size_t reservedSize);
+
+    ~ReservedMappedFile();
+
+    MappedFile& File()
+    {
+        return *m_mappedFile;
+    }
+
+    /// @brief size of the mapped file
+    std::size_t Size() const
+    {
+        return m_size;
+    }
+
+    /// @brief extends file and maps new part right after the mapped one
+    /// Managed segment is not grown, caller must call segment manager's grow
+    /// method with the returned number of bytes
+    /// @return number of bytes added or 0 if reserved range is exhausted
+    std::size_t Extend(std::size_t minExtraBytes);
+
+    /// @brief atomically renames the file, mapping stays valid
+    /// @return false if file was not renamed, syncing of the directory is best effort
+    bool Rename(const std::string& filePath);
+
+    /// @brief synchronously writes whole mapping on disk
+    bool Flush();
+
+    /// @brief synchronously writes part of the mapping on disk
+    /// Safe to call concurrently with modifications and in-place extension
+    bool Flush(std::size_t offset, std::size_t size);
+
+    /// @brief regions of the mapping modified by indexes
+    DirtyRegions& Dirty()
+    {
+        return *m_dirty;
+    }
+
+    /// @brief writes up to maxBytes of dirty regions on disk
+    /// @return number of written bytes
+    std::size_t FlushDirty(std::size_t maxBytes);
+
+private:
+    void reserve(std::size_t size);
+
+    std::string                 m_filePath;
+    char*                       m_base = nullptr;   ///< start of the reserved range
+    std::size_t                 m_reservedSize = 0;
+    std::atomic<std::size_t>    m_size;
+    std::unique_ptr<MappedFile> m_mappedFile;
+    char*                       m_mapping = nullptr;    ///< start of the file mapping
+    std::unique_ptr<DirtyRegions> m_dirty;
+};
+
+} // namespace kvdb
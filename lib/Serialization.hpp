@@ -1,8 +1,14 @@
 #pragma once
 
+#include <charconv>
 #include <string>
+#include <string_view>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <vector>
 
+#include <boost/endian/conversion.hpp>
 #include <boost/fusion/sequence/io.hpp>
 #include <boost/fusion/include/io.hpp>
 #include <boost/fusion/adapted.hpp>
@@ -16,6 +22,7 @@ BOOST_FUSION_ADAPT_STRUCT
       (int, type)
       (kvdb::LimitedString, key)
       (kvdb::LimitedString, value)
+      (uint32_t, limit)
 )
 
 BOOST_FUSION_ADAPT_STRUCT
@@ -138,4 +145,489 @@ inline void Deserialize<ResultMessage>(std::istream& istream, ResultMessage& msg
     DeserializeProtocolMessage(istream, msg);
 }
 
+/// Binary encoding of messages (scProtocolBinary) consists of fixed-width little-endian
+/// integers, strings are prefixed with their 32-bit size and may contain any bytes:
+/// CommandMessage: id (4), type (1), limit (4), key size (4), key, value size (4), value
+/// ResultMessage: commandId (4), code (1), value size (4), value
+
+/// @brief appends binary encoded fields to the string
+class BinaryWriter
+{
+public:
+    explicit BinaryWriter(std::string& output)
+        : m_output(output)
+    {}
+
+    void WriteUint8(const uint8_t value)
+    {
+        m_output.push_back(char(value));
+    }
+
+    void WriteUint32(const uint32_t value)
+    {
+        unsigned char bytes[sizeof(uint32_t)];
+        boost::endian::store_little_u32(bytes, value);
+        m_output.append(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+    }
+
+    void WriteString(std::string_view str)
+    {
+        WriteUint32(uint32_t(str.size()));
+        m_output.append(str);
+    }
+
+private:
+    std::string& m_output;
+};
+
+/// @brief reads binary encoded fields from the buffer
+/// @throw std::runtime_error if buffer ends before the field or string is too long
+class BinaryReader
+{
+public:
+    BinaryReader(const char* data, const std::size_t size)
+        : m_data(data)
+        , m_left(size)
+    {}
+
+    uint8_t ReadUint8()
+    {
+        return uint8_t(*take(sizeof(uint8_t)));
+    }
+
+    uint32_t ReadUint32()
+    {
+        return boost::endian::load_little_u32(reinterpret_cast<const unsigned char*>(take(sizeof(uint32_t))));
+    }
+
+    void ReadString(LimitedString& str)
+    {
+        str.Set(ReadView(str.MaxSize()), true);
+    }
+
+    /// @return string referring to the buffer
+    std::string_view ReadView(const std::size_t maxSize)
+    {
+        const auto size = ReadUint32();
+        if (size > maxSize)
+        {
+            throw std::runtime_error("String of the message is too long");
+        }
+
+        return std::string_view(take(size), size);
+    }
+
+    /// @throw std::runtime_error if some bytes of the buffer are not read
+    void CheckEnd() const
+    {
+        if (m_left != 0)
+        {
+            throw std::runtime_error("Message has trailing data");
+        }
+    }
+
+private:
+    const char* take(const std::size_t size)
+    {
+        if (size > m_left)
+        {
+            throw std::runtime_error("Message is truncated");
+        }
+
+        const char* data = m_data;
+        m_data += size;
+        m_left -= size;
+        return data;
+    }
+
+    const char* m_data;
+    std::size_t m_left;
+};
+
+inline void SerializeBinary(const CommandMessage& msg, std::string& output)
+{
+    output.reserve(output.size() + 17 + msg.key.Get().size() + msg.value.Get().size());
+    BinaryWriter writer(output);
+    writer.WriteUint32(msg.id);
+    writer.WriteUint8(uint8_t(msg.type));
+    writer.WriteUint32(msg.limit);
+    writer.WriteString(msg.key.Get());
+    writer.WriteString(msg.value.Get());
+}
+
+inline void DeserializeBinary(const char* data, const std::size_t size, CommandMessage& msg)
+{
+    BinaryReader reader(data, size);
+    msg.id = reader.ReadUint32();
+    msg.type = reader.ReadUint8();
+    msg.limit = reader.ReadUint32();
+    reader.ReadString(msg.key);
+    reader.ReadString(msg.value);
+    reader.CheckEnd();
+}
+
+inline void SerializeBinary(const ResultMessage& msg, std::string& output)
+{
+    output.reserve(output.size() + 9 + msg.value.Get().size());
+    BinaryWriter writer(output);
+    writer.WriteUint32(msg.commandId);
+    writer.WriteUint8(uint8_t(msg.code));
+    writer.WriteString(msg.value.Get());
+}
+
+inline void DeserializeBinary(const char* data, const std::size_t size, ResultMessage& msg)
+{
+    BinaryReader reader(data, size);
+    msg.commandId = reader.ReadUint32();
+    msg.code = reader.ReadUint8();
+    reader.ReadString(msg.value);
+    reader.CheckEnd();
+}
+
+/// @brief read-only stream buffer over memory of received message
+class MemoryStreamBuf
+        : public std::streambuf
+{
+public:
+    MemoryStreamBuf(const char* data, const std::size_t size)
+    {
+        char* begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+};
+
+/// @brief encodes result in the format of ResultMessage without copying it's value
+inline void SerializeMessage(const ResultView& result, const uint32_t version, std::string& output)
+{
+    // both encodings are written straight into the output, so value is copied once
+    if (version == scProtocolBinary)
+    {
+        output.reserve(output.size() + 9 + result.value.size());
+        BinaryWriter writer(output);
+        writer.WriteUint32(result.commandId);
+        writer.WriteUint8(uint8_t(result.code));
+        writer.WriteString(result.value);
+        return;
+    }
+
+    const auto code = std::to_string(result.code);
+    const auto size = std::to_string(result.value.size());
+    output.reserve(output.size() + code.size() + size.size() + result.value.size() + 3);
+    output.append(code).append(1, ' ');
+    output.append(size).append(1, ' ');
+    output.append(result.value).append(1, ' ');
+}
+
+/// @brief encodes message with given version of the protocol
+template<typename MessageType>
+inline void SerializeMessage(const MessageType& msg, const uint32_t version, std::string& output)
+{
+    if (version == scProtocolBinary)
+    {
+        SerializeBinary(msg, output);
+        return;
+    }
+
+    std::ostringstream ostream;
+    Serialize(msg, ostream);
+    output.append(ostream.str());
+}
+
+/// @brief decodes message encoded with given version of the protocol
+/// @throw std::runtime_error if message is malformed
+template<typename MessageType>
+inline void DeserializeMessage(const char* data, const std::size_t size,
+                               const uint32_t version, MessageType& msg)
+{
+    if (version == scProtocolBinary)
+    {
+        DeserializeBinary(data, size, msg);
+        return;
+    }
+
+    MemoryStreamBuf sbuf(data, size);
+    std::istream istream(&sbuf);
+    Deserialize(istream, msg);
+}
+
+/// Payloads of SCAN batches and of MGET, MSET, MDELETE commands and their results are sequences
+/// of strings encoded as strings of messages of the session protocol: text strings are prefixed
+/// with their decimal size followed by space, binary ones with their 32-bit size.
+/// Code of the batch item precedes it's value as decimal number followed by space or as one byte
+
+/// @brief parses decimal number followed by space
+/// @param offset position of the number, moved past the space
+inline std::size_t ParseDecimal(std::string_view data, std::size_t& offset)
+{
+    std::size_t number = 0;
+    const char* end = data.data() + data.size();
+    const auto result = std::from_chars(data.data() + offset, end, number);
+    if (result.ec != std::errc() || result.ptr == end || *result.ptr != ' ')
+    {
+        throw std::runtime_error("Failed to parse string");
+    }
+
+    offset = std::size_t(result.ptr - data.data()) + 1;
+    return number;
+}
+
+/// @brief parses string prefixed with it's decimal size
+/// @param offset position of the size, moved past the string
+/// @return string referring to the data
+inline std::string_view ParseStringView(std::string_view data, std::size_t& offset)
+{
+    const auto size = ParseDecimal(data, offset);
+    if (size > data.size() - offset)
+    {
+        throw std::runtime_error("Failed to parse string");
+    }
+
+    const auto str = data.substr(offset, size);
+    offset += size;
+    return str;
+}
+
+/// @brief parses string of the payload encoded with the protocol version
+inline std::string_view ParseStringView(std::string_view data, std::size_t& offset, const uint32_t version)
+{
+    if (version != scProtocolBinary)
+    {
+        return ParseStringView(data, offset);
+    }
+
+    BinaryReader reader(data.data() + offset, data.size() - offset);
+    const auto str = reader.ReadView(data.size());
+    offset += sizeof(uint32_t) + str.size();
+    return str;
+}
+
+inline void ParseString(std::string_view data, std::size_t& offset, const uint32_t version, std::string& str)
+{
+    const auto view = ParseStringView(data, offset, version);
+    str.assign(view.data(), view.size());
+}
+
+inline int ParseCode(std::string_view data, std::size_t& offset, const uint32_t version)
+{
+    if (version != scProtocolBinary)
+    {
+        return int(ParseDecimal(data, offset));
+    }
+
+    BinaryReader reader(data.data() + offset, data.size() - offset);
+    const auto code = reader.ReadUint8();
+    offset += sizeof(uint8_t);
+    return code;
+}
+
+inline void AppendString(std::string& output, std::string_view str, const uint32_t version)
+{
+    if (version == scProtocolBinary)
+    {
+        BinaryWriter(output).WriteString(str);
+        return;
+    }
+
+    output.append(std::to_string(str.size()));
+    output.push_back(' ');
+    output.append(str);
+}
+
+inline void AppendCode(std::string& output, const int code, const uint32_t version)
+{
+    if (version == scProtocolBinary)
+    {
+        BinaryWriter(output).WriteUint8(uint8_t(code));
+        return;
+    }
+
+    output.append(std::to_string(code));
+    output.push_back(' ');
+}
+
+/// @brief encodes pairs of the SCAN result batch or of the MSET command
+inline std::string SerializeKeyValues(const std::vector<KeyValue>& pairs, const uint32_t version)
+{
+    std::string output;
+    for (const auto& pair : pairs)
+    {
+        AppendString(output, pair.first, version);
+        AppendString(output, pair.second, version);
+    }
+
+    return output;
+}
+
+inline void DeserializeKeyValues(std::string_view data, const uint32_t version, std::vector<KeyValue>& pairs)
+{
+    std::size_t offset = 0;
+    while (offset < data.size())
+    {
+        KeyValue pair;
+        ParseString(data, offset, version, pair.first);
+        ParseString(data, offset, version, pair.second);
+        pairs.push_back(std::move(pair));
+    }
+}
+
+/// @brief parses pairs referring to the data
+inline void DeserializeKeyValues(std::string_view data, const uint32_t version, std::vector<KeyValueView>& pairs)
+{
+    std::size_t offset = 0;
+    while (offset < data.size())
+    {
+        const auto key = ParseStringView(data, offset, version);
+        pairs.emplace_back(key, ParseStringView(data, offset, version));
+    }
+}
+
+/// @brief encodes keys of the MGET or MDELETE command
+inline std::string SerializeKeys(const std::vector<std::string>& keys, const uint32_t version)
+{
+    std::string output;
+    for (const auto& key : keys)
+    {
+        AppendString(output, key, version);
+    }
+
+    return output;
+}
+
+inline void DeserializeKeys(std::string_view data, const uint32_t version, std::vector<std::string>& keys)
+{
+    std::size_t offset = 0;
+    while (offset < data.size())
+    {
+        keys.emplace_back();
+        ParseString(data, offset, version, keys.back());
+    }
+}
+
+/// @brief parses keys referring to the data
+inline void DeserializeKeys(std::string_view data, const uint32_t version, std::vector<std::string_view>& keys)
+{
+    std::size_t offset = 0;
+    while (offset < data.size())
+    {
+        keys.push_back(ParseStringView(data, offset, version));
+    }
+}
+
+/// @brief appends result of one item of batch command, code followed by value string
+inline void AppendBatchItem(std::string& output, const BatchItem& item, const uint32_t version)
+{
+    AppendCode(output, item.code, version);
+    AppendString(output, item.value, version);
+}
+
+/// @brief encodes results of items of batch command
+inline std::string SerializeBatchItems(const std::vector<BatchItem>& items, const uint32_t version)
+{
+    std::string output;
+    for (const auto& item : items)
+    {
+        AppendBatchItem(output, item, version);
+    }
+
+    return output;
+}
+
+inline void DeserializeBatchItems(std::string_view data, const uint32_t version, std::vector<BatchItem>& items)
+{
+    std::size_t offset = 0;
+    while (offset < data.size())
+    {
+        BatchItem item;
+        item.code = ParseCode(data, offset, version);
+        ParseString(data, offset, version, item.value);
+        items.push_back(std::move(item));
+    }
+}
+
+/// Received commands are parsed in place, their strings refer to the buffer of the message
+
+inline void DeserializeBinary(const char* data, const std::size_t size, CommandView& command)
+{
+    BinaryReader reader(data, size);
+    command.id = reader.ReadUint32();
+    command.type = reader.ReadUint8();
+    command.limit = reader.ReadUint32();
+    command.key = reader.ReadView(scMaxKeySize);
+    command.value = reader.ReadView(scMaxValueSize);
+    reader.CheckEnd();
+}
+
+/// @brief parses fields of the text encoding, every field is followed by space
+/// Commands of the legacy encoding end with the value
+inline void DeserializeText(std::string_view data, const uint32_t version, CommandView& command)
+{
+    const auto parseString = [&data](std::size_t& offset, const std::size_t maxSize)
+    {
+        const auto str = ParseStringView(data, offset);
+        if (str.size() > maxSize)
+        {
+            throw std::runtime_error("String of the message is too long");
+        }
+
+        if (offset == data.size() || data[offset] != ' ')
+        {
+            throw std::runtime_error("Failed to deserialize message");
+        }
+
+        ++offset;
+        return str;
+    };
+
+    std::size_t offset = 0;
+    command.type = int(ParseDecimal(data, offset));
+    command.key = parseString(offset, scMaxKeySize);
+    command.value = parseString(offset, scMaxValueSize);
+    if (version == scProtocolLegacy)
+    {
+        return;
+    }
+
+    const auto limit = ParseDecimal(data, offset);
+    if (limit > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::runtime_error("Failed to deserialize message");
+    }
+
+    command.limit = uint32_t(limit);
+}
+
+/// @brief decodes message received into part of the buffer
+/// @throw std::runtime_error if message is malformed
+template<typename MessageType>
+inline void DeserializeMessage(const MessageBuffer::Ptr&, const char* data, const std::size_t size,
+                               const uint32_t version, MessageType& msg)
+{
+    DeserializeMessage(data, size, version, msg);
+}
+
+/// @brief parses command in place, command keeps the buffer alive
+/// Buffer may hold other messages received by the same read, they share it
+inline void DeserializeMessage(const MessageBuffer::Ptr& buffer, const char* data, const std::size_t size,
+                               const uint32_t version, CommandView& command)
+{
+    if (version == scProtocolBinary)
+    {
+        DeserializeBinary(data, size, command);
+    }
+    else
+    {
+        DeserializeText(std::string_view(data, size), version, command);
+    }
+
+    command.version = version;
+    command.buffer = buffer;
+}
+
+/// @brief decodes message received into the whole buffer
+template<typename MessageType>
+inline void DeserializeMessage(const MessageBuffer::Ptr& buffer, const uint32_t version, MessageType& msg)
+{
+    DeserializeMessage(buffer, buffer->Data(), buffer->Size(), version, msg);
+}
+
 }// namespace kvdb
@@ -7,10 +7,25 @@ namespace kvdb
 
 Server::Server(const ServerContext& context)
     : ServerContext(context)
-    , m_acceptor(context.m_ioContext, context.m_endpoint)
+    , m_acceptor(context.m_ioContext)
     , m_strand(context.m_ioContext)
 {
+    using ReusePort = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+    m_acceptor.open(m_endpoint.protocol());
+    m_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    if (m_reusePort)
+    {
+        m_acceptor.set_option(ReusePort(true));
+    }
+
+    m_acceptor.bind(m_endpoint);
     m_acceptor.listen(scMaxConnections);
+
+    if (m_ioUring)
+    {
+        m_uring = std::make_unique<UringTransport>(m_ioContext, m_logger);
+    }
 }
 
 Server::~Server()
@@ -20,9 +35,19 @@ Server::~Server()
 
 void Server::Start()
 {
+    if (m_uring)
+    {
+        m_uring->Start();
+    }
+
     initNewSession();
 }
 
+uint16_t Server::Port() const
+{
+    return m_acceptor.local_endpoint().port();
+}
+
 void Server::initNewSession()
 {
     const ServerSessionContext::CloseCallback closeCallback
@@ -34,19 +59,55 @@ void Server::initNewSession()
                             m_processor,
                             // protect m_sessions set from concurrent access by executing on strand
                             m_strand.wrap(std::bind(&Server::onSessionInitialized, this, std::placeholders::_1)),
-                            closeCallback
+                            closeCallback,
+                            m_router,
+                            m_core,
+                            m_uring.get()
                         });
 }
 
+void Server::CollectMetrics(MetricsWriter& writer, const MetricsWriter::Labels& labels) const
+{
+    std::size_t numSessions = 0;
+    uint64_t numAccepted = 0;
+    ServerSession::Stat stat;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        numSessions = m_sessions.size();
+        numAccepted = m_numAccepted;
+        stat = m_closedStat;
+        for (const auto& session : m_sessions)
+        {
+            stat += session->GetStat();
+        }
+    }
+
+    writer.Gauge("kvdb_sessions", "Number of open sessions", labels, double(numSessions));
+    writer.Counter("kvdb_sessions_accepted_total", "Number of accepted connections", labels, double(numAccepted));
+    writer.Counter("kvdb_session_commands_total", "Number of commands received by sessions",
+                   labels, double(stat.m_numCommands));
+    writer.Counter("kvdb_session_results_total", "Number of results sent by sessions, including batches of scans",
+                   labels, double(stat.m_numResults));
+}
+
 void Server::onSessionInitialized(const ServerSessionPtr& session)
 {
-    m_sessions.insert(session);
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        m_sessions.insert(session);
+        ++m_numAccepted;
+    }
+
     initNewSession(); // continue to accept clients
 }
 
 void Server::onSessionClosed(const ServerSessionPtr& session)
 {
-    m_sessions.erase(session);
+    std::lock_guard<std::mutex> lock(m_sessionsMutex);
+    if (m_sessions.erase(session) != 0)
+    {
+        m_closedStat += session->GetStat();
+    }
 }
 
 } // namespace kvdb
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <set>
 
 #include <boost/asio.hpp>
@@ -8,6 +9,8 @@
 #include "Logger.hpp"
 #include "ServerSession.hpp"
 #include "CommandProcessor.hpp"
+#include "Metrics.hpp"
+#include "UringTransport.hpp"
 
 namespace kvdb
 {
@@ -18,24 +21,41 @@ struct ServerContext
     Logger&                         m_logger;
     CommandProcessor&               m_processor;
     boost::asio::ip::tcp::endpoint  m_endpoint; // endpoint to listen to
+    bool                            m_reusePort = false;    ///< several servers listen to the same endpoint,
+                                                            ///< system distributes connections among them
+    PartitionRouter*                m_router = nullptr;     ///< executes commands on partitions of the keyspace,
+                                                            ///< commands are executed by m_processor if empty
+    std::size_t                     m_core = 0;             ///< index of the core running m_ioContext
+    bool                            m_ioUring = false;      ///< sockets of sessions are read and written
+                                                            ///< through io_uring of the server
 };
 
 static const uint32_t scMaxConnections = 100;
 
 /// @brief KVDB server class
 /// continuously accepts client connections and executes commands received from clients
+/// Sessions of accepted connections are run by the context of the server, so servers
+/// of several per-core contexts keep every connection on one core
+/// Optional io_uring transport of the server submits operations of all it's sessions
 class Server
         : public ServerContext
 {
 public:
     using Ptr = std::shared_ptr<Server>;
 
+    /// @throw std::runtime_error if io_uring is requested, but not supported
     explicit Server(const ServerContext& context);
 
     virtual ~Server();
 
     void Start();
 
+    /// @return port connections are accepted on, it is chosen by system if endpoint's port is 0
+    uint16_t Port() const;
+
+    /// @brief adds counters of open and closed sessions to metrics, may be called by any thread
+    void CollectMetrics(MetricsWriter& writer, const MetricsWriter::Labels& labels) const;
+
 private:
     void initNewSession();
 
@@ -43,9 +63,15 @@ private:
 
     void onSessionClosed(const ServerSessionPtr& session);
 
+    /// destroyed after sessions, which are kept alive by it's operations in flight
+    std::unique_ptr<UringTransport> m_uring;
     boost::asio::io_context::strand m_strand;
     boost::asio::ip::tcp::acceptor  m_acceptor;
+    /// sessions are modified on the strand, they are locked to be read by metrics
+    mutable std::mutex              m_sessionsMutex;
     std::set<ServerSessionPtr>      m_sessions;
+    uint64_t                        m_numAccepted = 0;
+    ServerSession::Stat             m_closedStat;   ///< counters of closed sessions
 };
 
 }
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <functional>
 
 #include <boost/format.hpp>
@@ -11,11 +12,14 @@ ServerSession::ServerSession(const ServerSessionContext& context)
     : ServerSessionContext(context)
     , m_strand(context.m_ioContext)
     , m_socket(context.m_ioContext)
-{}
+    , m_handshakeTimer(context.m_ioContext)
+{
+    m_freeKeyQueues.reserve(scMaxFreeKeyQueues);
+}
 
 ServerSession::~ServerSession()
 {
-    m_logger.LogRecord("ServerSession destroyed");
+    m_logger.LogRecord(LogLevel::Debug, "ServerSession destroyed");
 }
 
 void ServerSession::Init(const ServerSessionContext& context)
@@ -28,26 +32,127 @@ void ServerSession::Init(const ServerSessionContext& context)
 
 std::string ServerSession::Address() const
 {
-    return (boost::format("%1%:%2%")
-            % m_socket.remote_endpoint().address().to_string()
-            % m_socket.remote_endpoint().port()).str();
+    return m_address;
+}
+
+ServerSession::Stat ServerSession::GetStat() const
+{
+    Stat stat;
+    stat.m_numCommands = m_numCommands.load(std::memory_order_relaxed);
+    stat.m_numResults = m_numResults.load(std::memory_order_relaxed);
+    return stat;
 }
 
 void ServerSession::onConnectionAccepted(const boost::system::error_code& error)
 {
     if (error)
     {
-        m_logger.LogRecord((boost::format("Failed to accept new connection : %1%") % error).str());
+        m_logger.LogRecord(LogLevel::Error, (boost::format("Failed to accept new connection : %1%") % error).str());
         return;
     }
 
+    boost::system::error_code ec;
+    // small coalesced messages must not wait behind Nagle for acks of previous writes
+    m_socket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+    const auto endpoint = m_socket.remote_endpoint(ec);
+    m_address = (boost::format("%1%:%2%") % endpoint.address().to_string() % endpoint.port()).str();
     m_logger.LogRecord(std::string("Connection accepted ") + Address());
 
+    // session is registered before the handshake, which may close it on another thread
+    m_initCallback(shared_from_this());
+
+    // timer is armed before the read, which may complete on another thread before it would be
+    m_handshakeTimer.expires_from_now(boost::posix_time::milliseconds(scHandshakeToutMs));
+    m_handshakeTimer.async_wait(m_strand.wrap(std::bind(&ServerSession::onHandshakeTimeout, shared_from_this(),
+                                                        std::placeholders::_1)));
+
+    // commands are received only after the client proposes version of the protocol
+    auto handshake = std::make_shared<Handshake>();
+    boost::asio::async_read(m_socket,
+                            boost::asio::mutable_buffer(handshake.get(), scHandshakeSize),
+                            m_strand.wrap(std::bind(&ServerSession::onHandshakeReceived, shared_from_this(),
+                                                    std::placeholders::_1, handshake)));
+}
+
+void ServerSession::onHandshakeReceived(const boost::system::error_code& ec, const Handshake::Ptr& handshake)
+{
+    m_handshakeTimer.cancel();
+
+    if (ec)
+    {
+        m_logger.LogRecord(LogLevel::Warning, std::string("Failed to receive handshake: ") + ec.message());
+        onConnectionClosed();
+        return;
+    }
+
+    if (handshake->m_magicInt == MessageHeader::scMagicInt)
+    {
+        // clients preceding the handshake start with the header of the first command
+        m_logger.LogRecord(LogLevel::Debug, std::string("Client without handshake, legacy protocol is used ")
+                           + Address());
+        startSession(scProtocolLegacy, std::string_view(reinterpret_cast<const char*>(handshake.get()),
+                                                        scHandshakeSize));
+        return;
+    }
+
+    if (!handshake->IsValid())
+    {
+        m_logger.LogRecord(LogLevel::Warning, "Invalid handshake");
+        onConnectionClosed();
+        return;
+    }
+
+    // client supports all versions below the proposed one
+    const uint32_t version = std::min<uint32_t>(handshake->m_version, scMaxProtocolVersion);
+    if (m_logger.Enabled(LogLevel::Debug))
+    {
+        m_logger.LogRecord(LogLevel::Debug, (boost::format("Client %1% proposed protocol version %2%, accepted %3%")
+                            % Address() % handshake->m_version % version).str());
+    }
+
+    auto answer = std::make_shared<Handshake>(version);
+    boost::asio::async_write(m_socket,
+                             boost::asio::const_buffer(answer.get(), scHandshakeSize),
+                             m_strand.wrap(std::bind(&ServerSession::onHandshakeSent, shared_from_this(),
+                                                     std::placeholders::_1, answer)));
+}
+
+void ServerSession::onHandshakeTimeout(const boost::system::error_code& ec)
+{
+    if (!ec)
+    {
+        // client did not send handshake in time, pending read fails
+        m_logger.LogRecord(LogLevel::Warning, std::string("Handshake timeout ") + Address());
+        // connection may be closed meanwhile
+        boost::system::error_code cancelEc;
+        m_socket.cancel(cancelEc);
+    }
+}
+
+void ServerSession::onHandshakeSent(const boost::system::error_code& ec, const Handshake::Ptr& handshake)
+{
+    if (ec || handshake->m_version == 0)
+    {
+        m_logger.LogRecord(LogLevel::Warning, std::string("Protocol is not negotiated with ") + Address());
+        onConnectionClosed();
+        return;
+    }
+
+    startSession(handshake->m_version, std::string_view());
+}
+
+void ServerSession::startSession(const uint32_t version, std::string_view received)
+{
+    // results of legacy clients are encoded and ordered as results of the text protocol
+    m_protocolVersion = version == scProtocolLegacy ? scProtocolText : version;
     m_sender = std::make_shared<Sender>(
                    MessageSenderContext {
                        m_logger,
                        m_strand,
-                       m_socket
+                       m_socket,
+                       version,
+                       m_uring,
+                       weak_from_this()
                    });
 
     m_receiver = std::make_shared<Receiver>(
@@ -58,29 +163,258 @@ void ServerSession::onConnectionAccepted(const boost::system::error_code& error)
                          m_logger,
                          std::bind(&ServerSession::onCommandReceived, this, std::placeholders::_1),
                          std::bind(&ServerSession::onConnectionClosed, this),
-                         scReceiveDataTOutMs
+                         scReceiveDataTOutMs,
+                         version,
+                         m_uring,
+                         weak_from_this()
                      });
 
-    m_receiver->Start();
-    m_initCallback(shared_from_this());
+    if (received.empty())
+    {
+        m_receiver->Start();
+        return;
+    }
+
+    m_receiver->Start(received);
+}
+
+void ServerSession::onCommandReceived(const CommandView& command)
+{
+    m_numCommands.fetch_add(1, std::memory_order_relaxed);
+    if (m_logger.Enabled(LogLevel::Debug))
+    {
+        m_logger.LogRecord(LogLevel::Debug,
+                           (boost::format("Command received:\n\ttype = %1%"
+                                          "\n\tkey.size = %2%\n\tvalue.size = %3%")
+                            % int(command.type)
+                            % command.key.size()
+                            % command.value.size()).str());
+    }
+
+    if (m_protocolVersion == scProtocolText && !m_router)
+    {
+        // COMPACT and retries of commands failed to allocate may complete after the session is closed
+        m_processor.ProcessCommand(command, [self = shared_from_this()](const ResultView& result)
+        {
+            self->m_numResults.fetch_add(1, std::memory_order_relaxed);
+            self->m_sender->SendMessage(result);
+        });
+        return;
+    }
+
+    if (m_barrierExecuting || !m_blocked.empty())
+    {
+        if (!isBarrier(command.type) && !isKeyCommand(command.type))
+        {
+            // commands which do not read or modify entries are not ordered
+            dispatchCommand(command);
+            return;
+        }
+
+        m_blocked.push_back(command);
+        return;
+    }
+
+    if (isBarrier(command.type))
+    {
+        m_blocked.push_back(command);
+        dispatchBlocked();
+        return;
+    }
+
+    routeKeyCommand(command);
+}
+
+void ServerSession::routeKeyCommand(const CommandView& command)
+{
+    if (!isKeyCommand(command.type))
+    {
+        dispatchCommand(command);
+        return;
+    }
+
+    const auto it = m_keyQueues.find(command.key);
+    if (it != m_keyQueues.end())
+    {
+        it->second.push_back(command);
+        return;
+    }
+
+    if (m_freeKeyQueues.empty())
+    {
+        m_keyQueues.emplace(command.key, std::deque<CommandView>());
+    }
+    else
+    {
+        auto node = std::move(m_freeKeyQueues.back());
+        m_freeKeyQueues.pop_back();
+        node.key() = command.key;
+        m_keyQueues.insert(std::move(node));
+    }
+
+    dispatchCommand(command);
+}
+
+void ServerSession::dispatchBlocked()
+{
+    while (!m_barrierExecuting && !m_blocked.empty())
+    {
+        const auto& command = m_blocked.front();
+        if (isBarrier(command.type))
+        {
+            if (m_numExecuting != 0)
+            {
+                return;
+            }
+
+            m_barrierExecuting = true;
+            dispatchCommand(command);
+        }
+        else
+        {
+            routeKeyCommand(command);
+        }
+
+        m_blocked.pop_front();
+    }
 }
 
-void ServerSession::onCommandReceived(const CommandMessage& command)
+void ServerSession::dispatchCommand(const CommandView& command)
 {
-    m_logger.LogRecord((boost::format("Command received:\n\ttype = %1%"
-                                      "\n\tkey.size = %2%\n\tvalue.size = %3%")
-                         % int(command.type)
-                         % command.key.Get().size()
-                         % command.value.Get().size()).str());
+    const bool ordered = isBarrier(command.type) || isKeyCommand(command.type);
+    if (ordered)
+    {
+        ++m_numExecuting;
+    }
+
+    auto* dispatched = acquireDispatched();
+    dispatched->m_session = shared_from_this();
+    dispatched->m_command = command;
+    dispatched->m_ordered = ordered;
+    boost::asio::post(m_ioContext, MakeAllocHandler(m_handlerMemory, [this, dispatched]()
+    {
+        const CommandProcessor::ResultCallback callback = [this, dispatched](const ResultView& result)
+        {
+            onResult(dispatched, result);
+        };
 
-    m_processor.ProcessCommand(command,
-                               std::bind(&Sender::SendMessage, m_sender,
-                                         std::placeholders::_1));
+        if (m_router)
+        {
+            m_router->Dispatch(m_core, dispatched->m_command, callback);
+            return;
+        }
+
+        m_processor.ProcessCommand(dispatched->m_command, callback);
+    }));
+}
+
+void ServerSession::onResult(Dispatched* dispatched, const ResultView& result)
+{
+    m_numResults.fetch_add(1, std::memory_order_relaxed);
+    m_sender->SendMessage(result);
+
+    // results of scans and large batches are preceded by parts
+    if (result.code == ResultMessage::ScanBatch || result.code == ResultMessage::BatchPart)
+    {
+        return;
+    }
+
+    if (!dispatched->m_ordered)
+    {
+        releaseDispatched(dispatched);
+        return;
+    }
+
+    m_strand.post(MakeAllocHandler(m_handlerMemory, [this, dispatched]()
+    {
+        onCommandFinished(dispatched->m_command);
+        releaseDispatched(dispatched);
+    }));
+}
+
+ServerSession::Dispatched* ServerSession::acquireDispatched()
+{
+    std::lock_guard<std::mutex> lock(m_dispatchedMutex);
+    if (m_freeDispatched.empty())
+    {
+        m_dispatched.emplace_back(new Dispatched());
+        m_freeDispatched.reserve(m_dispatched.size());
+        return m_dispatched.back().get();
+    }
+
+    auto* dispatched = m_freeDispatched.back();
+    m_freeDispatched.pop_back();
+    return dispatched;
+}
+
+void ServerSession::releaseDispatched(Dispatched* dispatched)
+{
+    // session may be destroyed with the last record, after the lock is released
+    const auto session = std::move(dispatched->m_session);
+    dispatched->m_command = CommandView();
+
+    std::lock_guard<std::mutex> lock(m_dispatchedMutex);
+    m_freeDispatched.push_back(dispatched);
+}
+
+void ServerSession::onCommandFinished(const CommandView& command)
+{
+    --m_numExecuting;
+    if (isBarrier(command.type))
+    {
+        m_barrierExecuting = false;
+    }
+    else
+    {
+        auto node = m_keyQueues.extract(command.key);
+        auto& queue = node.mapped();
+        if (!queue.empty())
+        {
+            // key of the queue refers to the buffer of the finished command,
+            // it is replaced by the key of the next one
+            const auto next = std::move(queue.front());
+            queue.pop_front();
+            node.key() = next.key;
+            m_keyQueues.insert(std::move(node));
+            dispatchCommand(next);
+        }
+        else if (m_freeKeyQueues.size() < scMaxFreeKeyQueues)
+        {
+            m_freeKeyQueues.push_back(std::move(node));
+        }
+    }
+
+    dispatchBlocked();
+}
+
+bool ServerSession::isBarrier(const int type) const
+{
+    // results of the text protocol are sent in the order of commands
+    return m_protocolVersion == scProtocolText
+            || type == CommandMessage::SCAN
+            || type == CommandMessage::SCAN_PREFIX
+            || type == CommandMessage::MGET
+            || type == CommandMessage::MSET
+            || type == CommandMessage::MDELETE;
+}
+
+bool ServerSession::isKeyCommand(const int type)
+{
+    return type == CommandMessage::INSERT
+            || type == CommandMessage::UPDATE
+            || type == CommandMessage::GET
+            || type == CommandMessage::DELETE;
 }
 
 void ServerSession::onConnectionClosed()
 {
     m_logger.LogRecord(std::string("Connection closed ") + Address());
+    if (m_uring)
+    {
+        // prepared operations refer to the descriptor, which may be reused once it is closed
+        m_uring->Flush();
+    }
+
     m_socket.close();
     m_closeCallback(shared_from_this());
 }
@@ -1,15 +1,21 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
 
+#include "HandlerMemory.hpp"
 #include "MessageSender.hpp"
 #include "MessageReceiver.hpp"
 #include "Logger.hpp"
 #include "CommandProcessor.hpp"
-#include "Logger.hpp"
+#include "PartitionRouter.hpp"
 
 namespace kvdb
 {
@@ -28,9 +34,21 @@ struct ServerSessionContext
     CommandProcessor&               m_processor;
     InitCallback                    m_initCallback;
     CloseCallback                   m_closeCallback;
+    PartitionRouter*                m_router;       ///< routes commands to partitions, may be empty
+    std::size_t                     m_core;         ///< index of the core running m_ioContext
+    UringTransport*                 m_uring = nullptr;  ///< sockets are read and written through io_uring if set
 };
 
 /// @brief manages connection with one client
+/// Commands of the binary protocol are executed by the worker pool concurrently, while
+/// the session keeps receiving following ones. Commands on the same key are executed
+/// in the order they are received. Commands on many keys (scans and batches) wait for all
+/// previous commands and following commands wait for them. Results are sent as soon as commands are finished.
+/// Commands of the text protocol are executed one by one, since it's results have no ids.
+/// Commands routed to partitions of other cores are executed asynchronously, so every
+/// command of the text protocol waits for the previous one then.
+/// Records of dispatched commands, queues of keys and memory of handlers are recycled,
+/// so commands do not allocate in steady state
 class ServerSession
         : private ServerSessionContext
         , public std::enable_shared_from_this<ServerSession>
@@ -38,6 +56,20 @@ class ServerSession
 public:
     using Ptr = std::shared_ptr<ServerSession>;
 
+    /// @brief counters of the session
+    struct Stat
+    {
+        uint64_t    m_numCommands = 0;  ///< received commands
+        uint64_t    m_numResults = 0;   ///< sent results, including batches of scans
+
+        Stat& operator+=(const Stat& other)
+        {
+            m_numCommands += other.m_numCommands;
+            m_numResults += other.m_numResults;
+            return *this;
+        }
+    };
+
     explicit ServerSession(const ServerSessionContext& context);
 
     virtual ~ServerSession();
@@ -46,18 +78,87 @@ public:
 
     std::string Address() const;
 
+    /// @brief may be called by any thread
+    Stat GetStat() const;
+
 private:
-    using Sender = MessageSender<ResultMessage>;
-    using Receiver = MessageReceiver<CommandMessage>;
+    using Sender = MessageSender<ResultView>;
+    using Receiver = MessageReceiver<CommandView>;
+    using KeyQueues = std::unordered_map<std::string_view, std::deque<CommandView>>;
+
+    /// queues of keys kept for the following commands, with memory of their deques
+    static const std::size_t scMaxFreeKeyQueues = 64;
+
+    /// @brief command executed by the worker pool
+    /// Result callback refers to the record, so it is small enough to be stored by std::function in place
+    struct Dispatched
+    {
+        ServerSessionPtr    m_session;  ///< keeps the session alive until the final result
+        CommandView         m_command;
+        bool                m_ordered = false;
+    };
 
     void onConnectionAccepted(const boost::system::error_code& error);
-    void onCommandReceived(const CommandMessage& command);
+
+    /// @brief chooses version of the protocol proposed by the client
+    void onHandshakeReceived(const boost::system::error_code& ec, const Handshake::Ptr& handshake);
+    void onHandshakeTimeout(const boost::system::error_code& ec);
+    void onHandshakeSent(const boost::system::error_code& ec, const Handshake::Ptr& handshake);
+
+    /// @brief starts receiving commands encoded with the version
+    /// @param received beginning of the first command read in place of the handshake
+    void startSession(uint32_t version, std::string_view received);
+
+    void onCommandReceived(const CommandView& command);
     void onConnectionClosed();
 
+    /// @brief executes command on the worker pool
+    void dispatchCommand(const CommandView& command);
+    void onCommandFinished(const CommandView& command);
+
+    /// @brief sends result of the dispatched command, releases the record after the final one
+    void onResult(Dispatched* dispatched, const ResultView& result);
+
+    /// @brief called on the strand
+    Dispatched* acquireDispatched();
+    /// @brief may be called by any thread
+    void releaseDispatched(Dispatched* dispatched);
+
+    /// @brief dispatches point command or queues it after command on the same key
+    void routeKeyCommand(const CommandView& command);
+
+    /// @brief dispatches commands queued after the barrier when it's their turn
+    void dispatchBlocked();
+
+    /// @return true for commands on many keys and for any command which has to wait for previous ones
+    bool isBarrier(int type) const;
+    static bool isKeyCommand(int type);
+
+    /// posts of commands and of their completions
+    HandlerMemory<16>               m_handlerMemory;
     boost::asio::io_context::strand m_strand;
     boost::asio::ip::tcp::socket    m_socket;
+    boost::asio::deadline_timer     m_handshakeTimer;
+    std::string                     m_address;  ///< remote address, kept after socket is closed
     Sender::Ptr                     m_sender;
     Receiver::Ptr                   m_receiver;
+    uint32_t                        m_protocolVersion = 0;
+    std::atomic<uint64_t>           m_numCommands { 0 };
+    std::atomic<uint64_t>           m_numResults { 0 };     ///< incremented by worker threads
+
+    // members below are accessed on the strand only
+    std::size_t                     m_numExecuting = 0; ///< ordered commands dispatched to the pool
+    bool                            m_barrierExecuting = false;
+    /// commands waiting for the command on the same key, key is present while it has one executing
+    /// and refers to the buffer of the executing command
+    KeyQueues                       m_keyQueues;
+    std::vector<KeyQueues::node_type> m_freeKeyQueues;
+    /// barrier waiting for previous commands and commands received after it
+    std::deque<CommandView>         m_blocked;
+
+    std::mutex                              m_dispatchedMutex;
+    std::vector<std::unique_ptr<Dispatched>> m_dispatched;      ///< all records, in use or free
+    std::vector<Dispatched*>                m_freeDispatched;
 };
 
 } // namespace kvdb
@@ -0,0 +1,163 @@
+#include <algorithm>
+
+#include "SlabHeap.hpp"
+
+namespace kvdb
+{
+
+/// number of classes of sizes up to 128 bytes, they are spaced by 16 bytes
+static const std::size_t scNumLinearClasses = 8;
+static const std::size_t scLinearClassStep = 16;
+/// larger sizes are split into 2^scClassesShift classes per doubling
+static const std::size_t scClassesShift = 3;
+static const std::size_t scClassesPerDoubling = std::size_t(1) << scClassesShift;
+
+/// @return shift of the highest power of 2 which is less than size
+static std::size_t powerBelow(const std::size_t size)
+{
+    return std::size_t(63 - __builtin_clzll(size - 1));
+}
+
+SlabHeap::SlabHeap(SegmentManager* segment)
+    : m_segment(segment)
+{
+}
+
+SlabHeap* SlabHeap::Open(ReservedMappedFile& mappedFile, const std::string& name)
+{
+    auto& file = mappedFile.File();
+    return file.find_or_construct<SlabHeap>(name.c_str())(file.get_segment_manager());
+}
+
+std::size_t SlabHeap::classOf(std::size_t size)
+{
+    size = std::max<std::size_t>(size, 1);
+    if (size <= scNumLinearClasses * scLinearClassStep)
+    {
+        return (size + scLinearClassStep - 1) / scLinearClassStep - 1;
+    }
+
+    // sizes from (2^shift, 2^(shift + 1)] are split into classes of equal steps
+    const auto shift = powerBelow(size);
+    const std::size_t step = std::size_t(1) << (shift - scClassesShift);
+    const auto numSteps = (size - 1) / step + 1;
+    return scNumLinearClasses + (shift - 7) * scClassesPerDoubling + (numSteps - scClassesPerDoubling - 1);
+}
+
+std::size_t SlabHeap::classSize(const std::size_t idx)
+{
+    if (idx < scNumLinearClasses)
+    {
+        return (idx + 1) * scLinearClassStep;
+    }
+
+    const auto shift = 7 + (idx - scNumLinearClasses) / scClassesPerDoubling;
+    const std::size_t step = std::size_t(1) << (shift - scClassesShift);
+    return (scClassesPerDoubling + 1 + (idx - scNumLinearClasses) % scClassesPerDoubling) * step;
+}
+
+std::size_t SlabHeap::BlockSize(const std::size_t size)
+{
+    if (size <= scMaxBlockSize)
+    {
+        return classSize(classOf(size));
+    }
+
+    // large blocks are rounded to 1/32 of the power of 2,
+    // which lets the segment reuse them for values of similar sizes
+    const std::size_t step = std::size_t(1) << (powerBelow(size) - 5);
+    return (size + step - 1) / step * step;
+}
+
+void* SlabHeap::Allocate(const std::size_t size)
+{
+    const auto blockSize = BlockSize(size);
+    if (blockSize > scMaxBlockSize)
+    {
+        return allocateFromSegment(blockSize);
+    }
+
+    auto& sizeClass = m_classes[classOf(size)];
+    if (sizeClass.m_free)
+    {
+        FreeBlock* block = sizeClass.m_free.get();
+        sizeClass.m_free = block->m_next;
+        block->~FreeBlock();
+        m_freeBytes -= blockSize;
+        return block;
+    }
+
+    if (blockSize > scMaxSlabBlockSize)
+    {
+        return allocateFromSegment(blockSize);
+    }
+
+    if (sizeClass.m_slabLeft < blockSize)
+    {
+        // tail of the previous slab smaller than the block is lost
+        const auto slabSize = scSlabSize / blockSize * blockSize;
+        sizeClass.m_slab = static_cast<char*>(allocateFromSegment(slabSize));
+        m_freeBytes += slabSize - sizeClass.m_slabLeft;
+        sizeClass.m_slabLeft = slabSize;
+    }
+
+    char* block = sizeClass.m_slab.get();
+    sizeClass.m_slab = block + blockSize;
+    sizeClass.m_slabLeft -= blockSize;
+    m_freeBytes -= blockSize;
+    return block;
+}
+
+void SlabHeap::Deallocate(void* block, const std::size_t size)
+{
+    const auto blockSize = BlockSize(size);
+    if (blockSize > scMaxBlockSize)
+    {
+        m_segment->deallocate(block);
+        return;
+    }
+
+    auto& sizeClass = m_classes[classOf(size)];
+    sizeClass.m_free = new (block) FreeBlock { sizeClass.m_free };
+    m_freeBytes += blockSize;
+}
+
+std::size_t SlabHeap::Trim()
+{
+    std::size_t trimmed = 0;
+    for (std::size_t idx = classOf(scMaxSlabBlockSize + 1); idx < scNumClasses; ++idx)
+    {
+        auto& sizeClass = m_classes[idx];
+        while (sizeClass.m_free)
+        {
+            FreeBlock* block = sizeClass.m_free.get();
+            sizeClass.m_free = block->m_next;
+            block->~FreeBlock();
+            m_segment->deallocate(block);
+            trimmed += classSize(idx);
+        }
+    }
+
+    m_freeBytes -= trimmed;
+    return trimmed;
+}
+
+void* SlabHeap::allocateFromSegment(const std::size_t size)
+{
+    try
+    {
+        return m_segment->allocate(size);
+    }
+    catch (const boost::interprocess::bad_alloc&)
+    {
+        // cached blocks of other classes may be merged by the segment
+        if (Trim() == 0)
+        {
+            throw;
+        }
+    }
+
+    return m_segment->allocate(size);
+}
+
+} // namespace kvdb
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <boost/interprocess/containers/string.hpp>
+#include <boost/interprocess/offset_ptr.hpp>
+
+#include "ReservedMappedFile.hpp"
+#include "StorageIndex.hpp"
+
+namespace kvdb
+{
+
+/// @brief size-class allocator of one shard placed inside mapped file
+/// Requested sizes are rounded up to one of the size classes (8 classes per
+/// doubling), freed blocks are kept in per-class free lists and reused by the
+/// next allocations of the same class. Small blocks are carved from slabs
+/// allocated from the segment, so they have no allocator headers, larger ones
+/// are allocated from the segment one by one, and blocks above scMaxBlockSize
+/// are not cached at all. Rounding makes freed blocks fit following allocations
+/// of similar sizes, so repeated updates do not fragment the segment
+/// Heap is not synchronized, it is used under the lock of it's shard only.
+/// Like the segment allocator, heap does not mark memory it modifies as dirty
+class SlabHeap
+{
+public:
+    /// blocks up to this size are cached in free lists
+    static const std::size_t scMaxBlockSize = 64 * 1024;
+    /// blocks up to this size are carved from slabs
+    static const std::size_t scMaxSlabBlockSize = 1024;
+    static const std::size_t scSlabSize = 64 * 1024;
+
+    explicit SlabHeap(SegmentManager* segment);
+
+    /// @brief finds heap with given name inside mapped file or constructs new one
+    static SlabHeap* Open(ReservedMappedFile& mappedFile, const std::string& name);
+
+    /// @throw boost::interprocess::bad_alloc when segment is exhausted
+    void* Allocate(std::size_t size);
+
+    /// @param size size passed to Allocate
+    void Deallocate(void* block, std::size_t size);
+
+    /// @brief returns cached blocks which are not carved from slabs to the segment
+    /// @return number of returned bytes
+    std::size_t Trim();
+
+    /// @return size of the block actually allocated for the requested size,
+    /// all of it can be used by the caller
+    static std::size_t BlockSize(std::size_t size);
+
+    /// @return bytes of cached free blocks and not carved parts of slabs
+    std::size_t FreeBytes() const
+    {
+        return m_freeBytes;
+    }
+
+private:
+    static const std::size_t scNumClasses = 80;
+
+    struct FreeBlock
+    {
+        boost::interprocess::offset_ptr<FreeBlock> m_next;
+    };
+
+    struct SizeClass
+    {
+        boost::interprocess::offset_ptr<FreeBlock>  m_free;         ///< head of the free list
+        boost::interprocess::offset_ptr<char>       m_slab;         ///< not carved part of the current slab
+        std::size_t                                 m_slabLeft = 0;
+    };
+
+    static std::size_t classOf(std::size_t size);
+    static std::size_t classSize(std::size_t idx);
+
+    void* allocateFromSegment(std::size_t size);
+
+    boost::interprocess::offset_ptr<SegmentManager> m_segment;
+    SizeClass                                       m_classes[scNumClasses];
+    std::size_t                                     m_freeBytes = 0;
+};
+
+/// @brief allocator of containers placed inside mapped file, takes memory from the slab heap
+template<typename Type>
+class SlabAllocator
+{
+public:
+    using value_type = Type;
+    using pointer = boost::interprocess::offset_ptr<Type>;
+    using const_pointer = boost::interprocess::offset_ptr<const Type>;
+    using void_pointer = boost::interprocess::offset_ptr<void>;
+    using const_void_pointer = boost::interprocess::offset_ptr<const void>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+
+    template<typename Other>
+    struct rebind
+    {
+        using other = SlabAllocator<Other>;
+    };
+
+    explicit SlabAllocator(SlabHeap* heap)
+        : m_heap(heap)
+    {}
+
+    template<typename Other>
+    SlabAllocator(const SlabAllocator<Other>& other)
+        : m_heap(other.Heap())
+    {}
+
+    pointer allocate(const size_type count)
+    {
+        return pointer(static_cast<Type*>(m_heap->Allocate(count * sizeof(Type))));
+    }
+
+    void deallocate(const pointer& ptr, const size_type count)
+    {
+        m_heap->Deallocate(ptr.get(), count * sizeof(Type));
+    }
+
+    SlabHeap* Heap() const
+    {
+        return m_heap.get();
+    }
+
+    template<typename Other>
+    bool operator==(const SlabAllocator<Other>& other) const
+    {
+        return m_heap == other.Heap();
+    }
+
+    template<typename Other>
+    bool operator!=(const SlabAllocator<Other>& other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    boost::interprocess::offset_ptr<SlabHeap> m_heap;
+};
+
+using SlabString = boost::interprocess::basic_string<char, std::char_traits<char>, SlabAllocator<char>>;
+
+} // namespace kvdb
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace kvdb
+{
+
+/// @brief bounded lock-free queue of one producer thread and one consumer thread
+/// Producer and consumer indexes are placed on separate cache lines, each side
+/// caches index of the other one and rereads it only when queue looks full or empty
+template<typename Type>
+class SpscQueue
+{
+public:
+    /// @param capacity maximum number of items, rounded up to power of two
+    explicit SpscQueue(const std::size_t capacity)
+    {
+        std::size_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+
+        m_items.resize(size);
+        m_mask = size - 1;
+    }
+
+    /// @brief called by producer thread only
+    /// @return false if queue is full, item is left untouched then
+    bool Push(Type&& item)
+    {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_headCache == m_items.size())
+        {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            if (tail - m_headCache == m_items.size())
+            {
+                return false;
+            }
+        }
+
+        m_items[tail & m_mask] = std::move(item);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief called by consumer thread only
+    /// @return false if queue is empty
+    bool Pop(Type& item)
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tailCache)
+        {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tailCache)
+            {
+                return false;
+            }
+        }
+
+        // slot is reset, so resources of the item are not held until it is reused
+        item = std::move(m_items[head & m_mask]);
+        m_items[head & m_mask] = Type();
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static constexpr std::size_t scCacheLineSize = 64;
+
+    std::vector<Type>                               m_items;
+    std::size_t                                     m_mask = 0;
+
+    alignas(scCacheLineSize) std::atomic<std::size_t> m_head { 0 };   ///< next item to pop
+    std::size_t                                     m_tailCache = 0;  ///< tail seen by consumer
+
+    alignas(scCacheLineSize) std::atomic<std::size_t> m_tail { 0 };   ///< next slot to push
+    std::size_t                                     m_headCache = 0;  ///< head seen by producer
+};
+
+} // namespace kvdb
@@ -0,0 +1,130 @@
+#include <cstddef>
+#include <cstring>
+
+#include "SlabHeap.hpp"
+#include "StorageIndex.hpp"
+
+namespace kvdb
+{
+
+static void copyBytes(char* destination, std::string_view source)
+{
+    if (!source.empty())
+    {
+        std::memcpy(destination, source.data(), source.size());
+    }
+}
+
+Record* Record::Create(SlabHeap& heap, const KeyView& key, std::string_view value)
+{
+    const bool external = value.size() > scMaxInlineValueSize;
+    const std::size_t headerSize = sizeof(Record) + (external ? sizeof(ValuePtr) : 0);
+    const std::size_t size = SlabHeap::BlockSize(headerSize + key.m_data.size() + (external ? 0 : value.size()));
+
+    char* externalValue = nullptr;
+    std::size_t capacity = size - headerSize - key.m_data.size();
+    if (external)
+    {
+        capacity = SlabHeap::BlockSize(value.size());
+        externalValue = static_cast<char*>(heap.Allocate(capacity));
+    }
+
+    void* memory = nullptr;
+    try
+    {
+        memory = heap.Allocate(size);
+    }
+    catch (...)
+    {
+        if (externalValue)
+        {
+            heap.Deallocate(externalValue, capacity);
+        }
+
+        throw;
+    }
+
+    auto record = new (memory) Record();
+    record->m_hash = key.m_hash;
+    record->m_keySize = uint32_t(key.m_data.size());
+    record->m_valueSize = uint32_t(value.size());
+    record->m_capacity = uint32_t(capacity);
+    record->m_external = external ? 1 : 0;
+
+    char* keyData = record->data();
+    char* valueData = keyData + key.m_data.size();
+    if (external)
+    {
+        new (record->data()) ValuePtr(externalValue);
+        keyData = record->data() + sizeof(ValuePtr);
+        valueData = externalValue;
+    }
+
+    copyBytes(keyData, key.m_data);
+    copyBytes(valueData, value);
+    return record;
+}
+
+void Record::Destroy(SlabHeap& heap, Record* record)
+{
+    if (record->isExternal())
+    {
+        heap.Deallocate(reinterpret_cast<ValuePtr*>(record->data())->get(), record->m_capacity);
+    }
+
+    const auto size = record->allocationSize();
+    record->~Record();
+    heap.Deallocate(record, size);
+}
+
+bool Record::AssignValue(SlabHeap& heap, std::string_view value)
+{
+    if (!isExternal())
+    {
+        if (value.size() > m_capacity)
+        {
+            return false;
+        }
+
+        copyBytes(data() + m_keySize, value);
+        m_valueSize = uint32_t(value.size());
+        return true;
+    }
+
+    // small value is moved back into the record
+    if (value.size() <= scMaxInlineValueSize)
+    {
+        return false;
+    }
+
+    // external value is reallocated when it does not fit, or when most of
+    // it's memory would be wasted
+    auto& valuePtr = *reinterpret_cast<ValuePtr*>(data());
+    if (value.size() > m_capacity || value.size() < m_capacity / 2)
+    {
+        const auto capacity = SlabHeap::BlockSize(value.size());
+        char* newValue = static_cast<char*>(heap.Allocate(capacity));
+        heap.Deallocate(valuePtr.get(), m_capacity);
+        valuePtr = newValue;
+        m_capacity = uint32_t(capacity);
+    }
+
+    copyBytes(valuePtr.get(), value);
+    m_valueSize = uint32_t(value.size());
+    return true;
+}
+
+void Record::MarkDirty(DirtyRegions& dirty) const
+{
+    if (isExternal())
+    {
+        dirty.Mark(this, sizeof(Record) + sizeof(ValuePtr) + m_keySize);
+        dirty.Mark(valueData(), m_valueSize);
+    }
+    else
+    {
+        dirty.Mark(this, sizeof(Record) + m_keySize + m_valueSize);
+    }
+}
+
+} // namespace kvdb
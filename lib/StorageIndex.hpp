@@ -0,0 +1,192 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include <boost/interprocess/managed_mapped_file.hpp>
+#include <boost/interprocess/containers/string.hpp>
+
+#include "DirtyRegions.hpp"
+#include "Hash.hpp"
+
+namespace kvdb
+{
+
+using MappedFile = boost::interprocess::managed_mapped_file;
+using SegmentManager = MappedFile::segment_manager;
+
+template<typename Type>
+using SegmentAllocator = boost::interprocess::allocator<Type, SegmentManager>;
+
+using SegmentString = boost::interprocess::basic_string<char, std::char_traits<char>, SegmentAllocator<char>>;
+
+class SlabHeap;
+
+/// @brief type of the index used to find entries by key inside mapped file
+/// Selected when map file is created and stored in it's header
+enum class IndexEngine : uint32_t
+{
+    Hashed  = 0,    ///< node based boost::multi_index hashed_unique container
+    Swiss   = 1,    ///< open addressing table with SIMD-probed control bytes
+};
+
+/// @brief key with precomputed hash, used for lookups
+/// without creation of temporary strings
+struct KeyView
+{
+    std::size_t         m_hash;
+    std::string_view    m_data;
+
+    explicit KeyView(std::string_view data)
+        : m_hash(Hash::String(data))
+        , m_data(data)
+    {}
+
+    KeyView(const std::size_t hash, std::string_view data)
+        : m_hash(hash)
+        , m_data(data)
+    {}
+
+    bool operator==(const KeyView& other) const
+    {
+        // compare hashes first, bytes are compared only on full hash match
+        return m_hash == other.m_hash && m_data == other.m_data;
+    }
+};
+
+/// @brief key-value record stored inside mapped file as a single allocation
+/// Layout: header | key | value, values longer than scMaxInlineValueSize are
+/// allocated separately and the header is followed by the pointer to them:
+/// header | value pointer | key
+/// Memory left by rounding of the allocation to the heap's size class is used
+/// to update value in place
+class Record
+{
+public:
+    /// values up to this size are stored inside the record
+    static const std::size_t scMaxInlineValueSize = 512;
+
+    /// @throw boost::interprocess::bad_alloc when segment is exhausted
+    static Record* Create(SlabHeap& heap, const KeyView& key, std::string_view value);
+
+    static void Destroy(SlabHeap& heap, Record* record);
+
+    /// @brief replaces value when it fits the record's memory, external value
+    /// is reallocated if needed
+    /// @return false if record must be recreated to store the value
+    /// @throw boost::interprocess::bad_alloc when segment is exhausted,
+    /// record stays unchanged in this case
+    bool AssignValue(SlabHeap& heap, std::string_view value);
+
+    std::size_t Hash() const
+    {
+        return m_hash;
+    }
+
+    KeyView Key() const
+    {
+        return KeyView(m_hash, std::string_view(keyData(), m_keySize));
+    }
+
+    std::string_view Value() const
+    {
+        return std::string_view(valueData(), m_valueSize);
+    }
+
+    /// @return number of bytes of key and value
+    std::size_t PayloadSize() const
+    {
+        return std::size_t(m_keySize) + m_valueSize;
+    }
+
+    /// @brief marks record and it's external value as modified
+    void MarkDirty(DirtyRegions& dirty) const;
+
+private:
+    using ValuePtr = boost::interprocess::offset_ptr<char>;
+
+    Record() = default;
+    Record(const Record&) = delete;
+    Record& operator=(const Record&) = delete;
+
+    bool isExternal() const
+    {
+        return m_external != 0;
+    }
+
+    /// @return size of the record's allocation
+    std::size_t allocationSize() const
+    {
+        return isExternal() ? sizeof(Record) + sizeof(ValuePtr) + m_keySize
+                            : sizeof(Record) + m_keySize + m_capacity;
+    }
+
+    char* data()
+    {
+        return reinterpret_cast<char*>(this + 1);
+    }
+
+    const char* data() const
+    {
+        return reinterpret_cast<const char*>(this + 1);
+    }
+
+    const char* keyData() const
+    {
+        return isExternal() ? data() + sizeof(ValuePtr) : data();
+    }
+
+    const char* valueData() const
+    {
+        return isExternal() ? reinterpret_cast<const ValuePtr*>(data())->get() : data() + m_keySize;
+    }
+
+    std::size_t     m_hash;         ///< full hash of the key, cached to avoid rehashing
+    uint32_t        m_keySize;
+    uint32_t        m_valueSize;
+    uint32_t        m_capacity;     ///< number of bytes available for the value
+    uint32_t        m_external;     ///< non zero if value is allocated separately
+};
+
+/// @brief index of one shard of the map
+/// Instances are created on top of the objects stored inside mapped file and must be
+/// recreated each time file is remapped. Methods are not synchronized,
+/// caller is responsible to hold shard's lock
+/// All methods may throw boost::interprocess::bad_alloc when segment is exhausted,
+/// index stays unchanged in this case
+/// Modifying methods mark memory they write as dirty, so it can be flushed
+/// incrementally
+class StorageIndex
+{
+public:
+    virtual ~StorageIndex() = default;
+
+    /// @return false if key already exists
+    virtual bool Insert(const KeyView& key, std::string_view value) = 0;
+
+    /// @return false if key not found
+    virtual bool Update(const KeyView& key, std::string_view value) = 0;
+
+    /// @return false if key not found
+    virtual bool Get(const KeyView& key, std::string& output) const = 0;
+
+    /// @return record of the key or nullptr if key not found,
+    /// record is not moved or modified while shard's lock is held
+    virtual const Record* Find(const KeyView& key) const = 0;
+
+    /// @return false if key not found
+    virtual bool Delete(const KeyView& key) = 0;
+
+    virtual std::size_t Size() const = 0;
+
+    /// @return total number of bytes of keys and values
+    virtual std::size_t PayloadBytes() const = 0;
+
+    using RecordCallback = std::function<void(const Record& record)>;
+
+    /// @brief calls callback for every record of the index in no particular order
+    virtual void ForEach(const RecordCallback& callback) const = 0;
+};
+
+} // namespace kvdb
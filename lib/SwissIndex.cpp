@@ -0,0 +1,549 @@
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "SwissIndex.hpp"
+
+namespace kvdb
+{
+
+namespace
+{
+
+const int8_t scEmpty = -128;    // 0b10000000
+const int8_t scDeleted = -2;    // 0b11111110
+const std::size_t scGroupSize = 16;
+const std::size_t scMinCapacity = scGroupSize;
+
+// Number of groups migrated by every modifying operation. Current arrays are
+// at least as large as old ones and filled less than a half, so migration
+// always completes before current arrays are full
+const std::size_t scGroupsPerStep = 2;
+
+// Number of control bytes of the next arrays initialized by every insert.
+// Preparation starts when less than 1/32 of the capacity is left, and takes
+// 1/2048 of the capacity inserts for the doubled arrays
+const std::size_t scCtrlBytesPerStep = 4096;
+const std::size_t scPrepareThresholdDivisor = 32;
+
+/// @brief group of control bytes probed at once
+class Group
+{
+public:
+    explicit Group(const int8_t* ctrl)
+    {
+#if defined(__SSE2__)
+        m_ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+#else
+        std::memcpy(m_ctrl, ctrl, scGroupSize);
+#endif
+    }
+
+    /// @return bitmask of full slots with given 7 bits of hash
+    uint32_t Match(const int8_t h2) const
+    {
+#if defined(__SSE2__)
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), m_ctrl));
+#else
+        return matchIf([h2](int8_t ctrl) { return ctrl == h2; });
+#endif
+    }
+
+    uint32_t MatchEmpty() const
+    {
+#if defined(__SSE2__)
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(scEmpty), m_ctrl));
+#else
+        return matchIf([](int8_t ctrl) { return ctrl == scEmpty; });
+#endif
+    }
+
+    uint32_t MatchEmptyOrDeleted() const
+    {
+        // only empty and deleted control bytes have sign bit set
+#if defined(__SSE2__)
+        return _mm_movemask_epi8(m_ctrl);
+#else
+        return matchIf([](int8_t ctrl) { return ctrl < 0; });
+#endif
+    }
+
+private:
+#if defined(__SSE2__)
+    __m128i m_ctrl;
+#else
+    template<typename Predicate>
+    uint32_t matchIf(const Predicate& predicate) const
+    {
+        uint32_t result = 0;
+        for (std::size_t i = 0; i < scGroupSize; ++i)
+        {
+            result |= uint32_t(predicate(m_ctrl[i])) << i;
+        }
+
+        return result;
+    }
+
+    int8_t m_ctrl[scGroupSize];
+#endif
+};
+
+/// @brief sequence of groups probed for the hash
+/// Uses triangular numbers, which visits every group exactly once
+/// when number of groups is a power of 2
+class ProbeSequence
+{
+public:
+    ProbeSequence(const std::size_t hash, const std::size_t capacity)
+        : m_mask(capacity / scGroupSize - 1)
+        , m_group((hash >> 7) & m_mask)
+    {}
+
+    /// @return index of the first slot of current group
+    std::size_t Offset() const
+    {
+        return m_group * scGroupSize;
+    }
+
+    void Next()
+    {
+        ++m_index;
+        m_group = (m_group + m_index) & m_mask;
+    }
+
+private:
+    std::size_t m_mask;
+    std::size_t m_group;
+    std::size_t m_index = 0;
+};
+
+int8_t h2(const std::size_t hash)
+{
+    return static_cast<int8_t>(hash & 0x7F);
+}
+
+std::size_t maxLoad(const std::size_t capacity)
+{
+    // keep load factor below 7/8
+    return capacity - capacity / 8;
+}
+
+/// @brief iterates over indices of set bits
+template<typename Func>
+bool forEachBit(uint32_t mask, const Func& func)
+{
+    while (mask)
+    {
+        if (func(__builtin_ctz(mask)))
+        {
+            return true;
+        }
+
+        mask &= mask - 1;
+    }
+
+    return false;
+}
+
+} // namespace
+
+std::unique_ptr<StorageIndex> SwissIndex::Open(ReservedMappedFile& mappedFile,
+                                               const std::string& name,
+                                               SlabHeap& heap)
+{
+    auto& file = mappedFile.File();
+    auto table = file.find_or_construct<Table>(name.c_str())();
+    return std::unique_ptr<StorageIndex>(new SwissIndex(table,
+                                                        file.get_segment_manager(),
+                                                        heap,
+                                                        mappedFile.Dirty()));
+}
+
+SwissIndex::SwissIndex(Table* table, SegmentManager* segment, SlabHeap& heap, DirtyRegions& dirty)
+    : m_table(table)
+    , m_segment(segment)
+    , m_heap(heap)
+    , m_dirty(dirty)
+{
+}
+
+bool SwissIndex::Insert(const KeyView& key, std::string_view value)
+{
+    migrate(scGroupsPerStep);
+    if (find(key))
+    {
+        return false;
+    }
+
+    // both calls may throw, table is not modified yet
+    reserveForInsert();
+    Record* record = Record::Create(m_heap, key, value);
+
+    place(key.m_hash, record);
+    ++m_table->m_size;
+    m_table->m_payloadBytes += record->PayloadSize();
+    m_dirty.Mark(m_table);
+    record->MarkDirty(m_dirty);
+    return true;
+}
+
+bool SwissIndex::Update(const KeyView& key, std::string_view value)
+{
+    migrate(scGroupsPerStep);
+    Slot* slot = find(key);
+    if (!slot)
+    {
+        return false;
+    }
+
+    Record* record = slot->m_record.get();
+    const auto payloadSize = record->PayloadSize();
+    if (!record->AssignValue(m_heap, value))
+    {
+        // value does not fit, record is replaced by the new one
+        record = Record::Create(m_heap, key, value);
+        Record::Destroy(m_heap, slot->m_record.get());
+        slot->m_record = record;
+        m_dirty.Mark(slot);
+    }
+
+    m_table->m_payloadBytes += record->PayloadSize();
+    m_table->m_payloadBytes -= payloadSize;
+    m_dirty.Mark(m_table);
+    record->MarkDirty(m_dirty);
+    return true;
+}
+
+bool SwissIndex::Get(const KeyView& key, std::string& output) const
+{
+    const Slot* slot = find(key);
+    if (!slot)
+    {
+        return false;
+    }
+
+    const auto value = slot->m_record->Value();
+    output.assign(value.data(), value.size());
+    return true;
+}
+
+const Record* SwissIndex::Find(const KeyView& key) const
+{
+    const Slot* slot = find(key);
+    return slot ? slot->m_record.get() : nullptr;
+}
+
+bool SwissIndex::Delete(const KeyView& key)
+{
+    migrate(scGroupsPerStep);
+    bool isOld = false;
+    Slot* slot = find(key, &isOld);
+    if (!slot)
+    {
+        return false;
+    }
+
+    m_table->m_payloadBytes -= slot->m_record->PayloadSize();
+    slot->m_record->MarkDirty(m_dirty);
+    Record::Destroy(m_heap, slot->m_record.get());
+
+    const auto arrays = isOld ? old() : current();
+    if (eraseSlot(arrays, slot - arrays.m_slots) && !isOld)
+    {
+        ++m_table->m_growthLeft;
+    }
+
+    --m_table->m_size;
+    m_dirty.Mark(m_table);
+    return true;
+}
+
+std::size_t SwissIndex::Size() const
+{
+    return m_table->m_size;
+}
+
+std::size_t SwissIndex::PayloadBytes() const
+{
+    return m_table->m_payloadBytes;
+}
+
+void SwissIndex::ForEach(const RecordCallback& callback) const
+{
+    // migrated groups of old arrays are already cleared, so every entry is visited once
+    for (const auto& arrays : { current(), old() })
+    {
+        for (std::size_t idx = 0; idx < arrays.m_capacity; ++idx)
+        {
+            if (arrays.m_ctrl[idx] >= 0)
+            {
+                callback(*arrays.m_slots[idx].m_record);
+            }
+        }
+    }
+}
+
+SwissIndex::Arrays SwissIndex::current() const
+{
+    return Arrays { m_table->m_ctrl.get(), m_table->m_slots.get(), m_table->m_capacity };
+}
+
+SwissIndex::Arrays SwissIndex::old() const
+{
+    return Arrays { m_table->m_oldCtrl.get(), m_table->m_oldSlots.get(), m_table->m_oldCapacity };
+}
+
+SwissIndex::Slot* SwissIndex::find(const Arrays& arrays, const KeyView& key)
+{
+    if (arrays.m_capacity == 0)
+    {
+        return nullptr;
+    }
+
+    const auto hash2 = h2(key.m_hash);
+    ProbeSequence sequence(key.m_hash, arrays.m_capacity);
+    for (std::size_t i = 0; i < arrays.m_capacity / scGroupSize; ++i, sequence.Next())
+    {
+        const Group group(arrays.m_ctrl + sequence.Offset());
+        Slot* result = nullptr;
+        const bool found = forEachBit(group.Match(hash2), [&](const std::size_t bit)
+        {
+            Slot& slot = arrays.m_slots[sequence.Offset() + bit];
+            if (slot.m_hash == key.m_hash && slot.m_record->Key() == key)
+            {
+                result = &slot;
+                return true;
+            }
+
+            return false;
+        });
+
+        if (found)
+        {
+            return result;
+        }
+
+        if (group.MatchEmpty())
+        {
+            return nullptr;
+        }
+    }
+
+    return nullptr;
+}
+
+std::size_t SwissIndex::findFreeSlot(const Arrays& arrays, const std::size_t hash)
+{
+    ProbeSequence sequence(hash, arrays.m_capacity);
+    while (true)
+    {
+        const auto mask = Group(arrays.m_ctrl + sequence.Offset()).MatchEmptyOrDeleted();
+        if (mask)
+        {
+            return sequence.Offset() + __builtin_ctz(mask);
+        }
+
+        sequence.Next();
+    }
+}
+
+bool SwissIndex::eraseSlot(const Arrays& arrays, const std::size_t idx)
+{
+    // If the group still has empty slots, no probe sequence could pass it,
+    // so slot can be marked empty. Otherwise some lookup may rely
+    // on this group being full, and slot must become tombstone
+    const Group group(arrays.m_ctrl + idx / scGroupSize * scGroupSize);
+    markSlotDirty(arrays, idx);
+    if (group.MatchEmpty())
+    {
+        arrays.m_ctrl[idx] = scEmpty;
+        return true;
+    }
+
+    arrays.m_ctrl[idx] = scDeleted;
+    return false;
+}
+
+void SwissIndex::markSlotDirty(const Arrays& arrays, const std::size_t idx)
+{
+    m_dirty.Mark(arrays.m_ctrl + idx, 1);
+    m_dirty.Mark(arrays.m_slots + idx);
+}
+
+SwissIndex::Slot* SwissIndex::find(const KeyView& key, bool* isOld) const
+{
+    if (Slot* slot = find(current(), key))
+    {
+        return slot;
+    }
+
+    if (isOld)
+    {
+        *isOld = true;
+    }
+
+    // groups that are already migrated contain only empty and deleted slots
+    return find(old(), key);
+}
+
+void SwissIndex::place(const std::size_t hash, Record* record)
+{
+    const auto arrays = current();
+    const auto idx = findFreeSlot(arrays, hash);
+    if (arrays.m_ctrl[idx] == scEmpty)
+    {
+        --m_table->m_growthLeft;
+    }
+
+    arrays.m_ctrl[idx] = h2(hash);
+    new (&arrays.m_slots[idx]) Slot { hash, record };
+    markSlotDirty(arrays, idx);
+}
+
+void SwissIndex::reserveForInsert()
+{
+    prepareResize();
+    if (m_table->m_growthLeft > 0)
+    {
+        return;
+    }
+
+    // Should not happen unless current arrays are full of tombstones,
+    // in this case complete migration synchronously
+    if (m_table->m_oldCapacity != 0)
+    {
+        migrate(std::numeric_limits<std::size_t>::max());
+        if (m_table->m_growthLeft > 0)
+        {
+            return;
+        }
+    }
+
+    // normally next arrays are completely prepared at this moment
+    if (m_table->m_nextCapacity == 0)
+    {
+        allocateNext();
+    }
+
+    initializeNext(std::numeric_limits<std::size_t>::max());
+    startMigration();
+}
+
+void SwissIndex::prepareResize()
+{
+    if (m_table->m_oldCapacity != 0
+            || m_table->m_growthLeft > m_table->m_capacity / scPrepareThresholdDivisor)
+    {
+        return;
+    }
+
+    if (m_table->m_nextCapacity == 0)
+    {
+        allocateNext();
+    }
+
+    initializeNext(scCtrlBytesPerStep);
+}
+
+void SwissIndex::allocateNext()
+{
+    const auto capacity = m_table->m_capacity;
+    std::size_t newCapacity = std::max(capacity * 2, scMinCapacity);
+    if (capacity != 0 && m_table->m_size * 2 < maxLoad(capacity))
+    {
+        // table is mostly filled with tombstones, purge them
+        newCapacity = capacity;
+    }
+
+    auto ctrl = static_cast<Ctrl*>(m_segment->allocate(newCapacity));
+    Slot* slots = nullptr;
+    try
+    {
+        slots = static_cast<Slot*>(m_segment->allocate(newCapacity * sizeof(Slot)));
+    }
+    catch (...)
+    {
+        m_segment->deallocate(ctrl);
+        throw;
+    }
+
+    m_table->m_nextCapacity = newCapacity;
+    m_table->m_nextInitialized = 0;
+    m_table->m_nextCtrl = ctrl;
+    m_table->m_nextSlots = slots;
+    m_dirty.Mark(m_table);
+}
+
+void SwissIndex::initializeNext(const std::size_t maxBytes)
+{
+    const auto size = std::min(maxBytes, m_table->m_nextCapacity - m_table->m_nextInitialized);
+    std::memset(m_table->m_nextCtrl.get() + m_table->m_nextInitialized, scEmpty, size);
+    m_dirty.Mark(m_table->m_nextCtrl.get() + m_table->m_nextInitialized, size);
+    m_table->m_nextInitialized += size;
+    m_dirty.Mark(m_table);
+}
+
+void SwissIndex::startMigration()
+{
+    m_table->m_oldCapacity = m_table->m_capacity;
+    m_table->m_oldCtrl = m_table->m_ctrl;
+    m_table->m_oldSlots = m_table->m_slots;
+    m_table->m_migratedGroups = 0;
+
+    m_table->m_capacity = m_table->m_nextCapacity;
+    m_table->m_ctrl = m_table->m_nextCtrl;
+    m_table->m_slots = m_table->m_nextSlots;
+    m_table->m_growthLeft = maxLoad(m_table->m_capacity);
+
+    m_table->m_nextCapacity = 0;
+    m_table->m_nextInitialized = 0;
+    m_table->m_nextCtrl = nullptr;
+    m_table->m_nextSlots = nullptr;
+
+    migrate(scGroupsPerStep);
+}
+
+void SwissIndex::migrate(const std::size_t maxGroups)
+{
+    if (m_table->m_oldCapacity == 0)
+    {
+        return;
+    }
+
+    // entries are moved using cached hashes, keys are not touched
+    const auto oldArrays = old();
+    const auto numGroups = oldArrays.m_capacity / scGroupSize;
+    for (std::size_t i = 0; i < maxGroups && m_table->m_migratedGroups < numGroups; ++i)
+    {
+        const auto offset = m_table->m_migratedGroups * scGroupSize;
+        const Group group(oldArrays.m_ctrl + offset);
+        forEachBit(~group.MatchEmptyOrDeleted() & 0xFFFF, [&](const std::size_t bit)
+        {
+            const Slot& slot = oldArrays.m_slots[offset + bit];
+            place(slot.m_hash, slot.m_record.get());
+            return false;
+        });
+
+        // the same rule as for erasing of single slot
+        std::memset(oldArrays.m_ctrl + offset, group.MatchEmpty() ? scEmpty : scDeleted, scGroupSize);
+        m_dirty.Mark(oldArrays.m_ctrl + offset, scGroupSize);
+        ++m_table->m_migratedGroups;
+    }
+
+    m_dirty.Mark(m_table);
+
+    if (m_table->m_migratedGroups == numGroups)
+    {
+        m_segment->deallocate(oldArrays.m_ctrl);
+        m_segment->deallocate(oldArrays.m_slots);
+        m_table->m_oldCapacity = 0;
+        m_table->m_migratedGroups = 0;
+        m_table->m_oldCtrl = nullptr;
+        m_table->m_oldSlots = nullptr;
+    }
+}
+
+} // namespace kvdb
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <memory>
+
+#include <boost/interprocess/offset_ptr.hpp>
+
+#include "ReservedMappedFile.hpp"
+#include "SlabHeap.hpp"
+#include "StorageIndex.hpp"
+
+namespace kvdb
+{
+
+/// @brief open addressing hash table in the spirit of abseil's "Swiss tables"
+/// Table consists of two flat arrays allocated inside mapped file: control bytes
+/// and slots. Every control byte describes state of the corresponding slot:
+/// empty, deleted or full (in this case it contains 7 bits of the key's hash).
+/// Lookup compares group of 16 control bytes at once (SSE2) and touches slots
+/// and records only on match. Slots refer to records by offset, so the table
+/// stays valid when file is remapped at the different address. Records are
+/// allocated from shard's heap, arrays directly from the segment
+/// Table grows incrementally: when it is almost full, new arrays are allocated
+/// and initialized by small steps. When table is full, new arrays become current,
+/// previous ones are kept until all their entries are migrated. Every modifying
+/// operation migrates a bounded number of groups, lookups check both arrays
+class SwissIndex
+        : public StorageIndex
+{
+public:
+    /// @brief finds index with given name inside mapped file or constructs new one
+    static std::unique_ptr<StorageIndex> Open(ReservedMappedFile& mappedFile,
+                                              const std::string& name,
+                                              SlabHeap& heap);
+
+    bool Insert(const KeyView& key, std::string_view value) override;
+    bool Update(const KeyView& key, std::string_view value) override;
+    bool Get(const KeyView& key, std::string& output) const override;
+    const Record* Find(const KeyView& key) const override;
+    bool Delete(const KeyView& key) override;
+    std::size_t Size() const override;
+    std::size_t PayloadBytes() const override;
+    void ForEach(const RecordCallback& callback) const override;
+
+private:
+    using Ctrl = int8_t;
+    using RecordPtr = boost::interprocess::offset_ptr<Record>;
+
+    struct Slot
+    {
+        std::size_t m_hash;     ///< copy of the record's hash, so probes do not touch records
+        RecordPtr   m_record;
+    };
+
+    /// @brief persistent part of the table stored inside mapped file
+    struct Table
+    {
+        std::size_t                             m_capacity = 0;     ///< number of slots, power of 2
+        std::size_t                             m_size = 0;         ///< number of entries in both arrays
+        std::size_t                             m_payloadBytes = 0; ///< bytes of keys and values of all entries
+        std::size_t                             m_growthLeft = 0;   ///< number of empty slots that can be filled before rehash
+        boost::interprocess::offset_ptr<Ctrl>   m_ctrl;
+        boost::interprocess::offset_ptr<Slot>   m_slots;
+
+        // arrays being migrated, m_oldCapacity is 0 when there's no migration in progress
+        std::size_t                             m_oldCapacity = 0;
+        std::size_t                             m_migratedGroups = 0;
+        boost::interprocess::offset_ptr<Ctrl>   m_oldCtrl;
+        boost::interprocess::offset_ptr<Slot>   m_oldSlots;
+
+        // arrays being prepared, m_nextCapacity is 0 when there's no resize prepared
+        std::size_t                             m_nextCapacity = 0;
+        std::size_t                             m_nextInitialized = 0;  ///< number of initialized control bytes
+        boost::interprocess::offset_ptr<Ctrl>   m_nextCtrl;
+        boost::interprocess::offset_ptr<Slot>   m_nextSlots;
+    };
+
+    /// @brief control bytes and slots of one of the arrays of the table
+    struct Arrays
+    {
+        Ctrl*       m_ctrl;
+        Slot*       m_slots;
+        std::size_t m_capacity;
+    };
+
+    SwissIndex(Table* table, SegmentManager* segment, SlabHeap& heap, DirtyRegions& dirty);
+
+    Arrays current() const;
+    Arrays old() const;
+
+    /// @return slot containing entry with given key or nullptr
+    static Slot* find(const Arrays& arrays, const KeyView& key);
+
+    /// @return index of the first empty or deleted slot in the probe sequence of hash
+    static std::size_t findFreeSlot(const Arrays& arrays, std::size_t hash);
+
+    /// @brief marks slot as free
+    /// @return true if slot became empty, false if it became tombstone
+    bool eraseSlot(const Arrays& arrays, std::size_t idx);
+
+    void markSlotDirty(const Arrays& arrays, std::size_t idx);
+
+    /// @return slot containing entry with given key in any of two arrays or nullptr
+    Slot* find(const KeyView& key, bool* isOld = nullptr) const;
+
+    /// @brief places entry into current arrays, caller must reserve space
+    void place(std::size_t hash, Record* record);
+
+    /// @brief makes sure there's room for one more entry
+    void reserveForInsert();
+
+    /// @brief makes a step of preparation of new arrays when current ones are almost full
+    void prepareResize();
+
+    /// @brief allocates arrays for the next resize
+    void allocateNext();
+
+    /// @brief initializes up to maxBytes of control bytes of the next arrays
+    void initializeNext(std::size_t maxBytes);
+
+    /// @brief makes prepared arrays current and starts migration of entries into them
+    void startMigration();
+
+    /// @brief moves up to maxGroups of groups from old arrays into the current ones
+    void migrate(std::size_t maxGroups);
+
+    Table*          m_table;
+    SegmentManager* m_segment;
+    SlabHeap&       m_heap;
+    DirtyRegions&   m_dirty;
+};
+
+} // namespace kvdb
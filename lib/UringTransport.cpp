@@ -0,0 +1,559 @@
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+
+#include "UringTransport.hpp"
+
+/// io_uring transport is compiled when kernel headers are available, 0 removes it
+#ifndef KVDB_IO_URING
+#if __has_include(<linux/io_uring.h>)
+#define KVDB_IO_URING 1
+#else
+#define KVDB_IO_URING 0
+#endif
+#endif
+
+#if KVDB_IO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace kvdb
+{
+
+#if KVDB_IO_URING
+
+namespace
+{
+
+int uringSetup(const uint32_t entries, io_uring_params& params)
+{
+    return int(syscall(__NR_io_uring_setup, entries, &params));
+}
+
+int uringEnter(const int fd, const uint32_t toSubmit, const uint32_t minComplete, const uint32_t flags)
+{
+    return int(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int uringRegister(const int fd, const uint32_t opcode, const void* arg, const uint32_t numArgs)
+{
+    return int(syscall(__NR_io_uring_register, fd, opcode, arg, numArgs));
+}
+
+std::string systemError(const std::string& what, const int error)
+{
+    return what + ": " + std::strerror(error);
+}
+
+/// group of the provided buffers of the ring
+constexpr uint16_t scBufferGroup = 0;
+
+} // namespace
+
+/// @brief mapped queues of the ring and it's provided buffers
+struct UringTransport::Ring
+{
+    /// @brief members set before a failure are released by the destructor
+    void Open()
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+        params.cq_entries = scNumCompletions;
+        m_fd = uringSetup(scNumEntries, params);
+        if (m_fd < 0)
+        {
+            throw std::runtime_error(systemError("Failed to set up io_uring", errno));
+        }
+
+        // completions are never dropped and queues share one mapping since Linux 5.5
+        if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_SINGLE_MMAP))
+        {
+            throw std::runtime_error("io_uring of the kernel is too old");
+        }
+
+        m_queuesSize = std::max<std::size_t>(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+                                             params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        m_queues = map(m_queuesSize, IORING_OFF_SQ_RING);
+        m_entriesSize = params.sq_entries * sizeof(io_uring_sqe);
+        m_entries = static_cast<io_uring_sqe*>(map(m_entriesSize, IORING_OFF_SQES));
+
+        m_sqHead = field<uint32_t>(params.sq_off.head);
+        m_sqTail = field<uint32_t>(params.sq_off.tail);
+        m_sqMask = *field<uint32_t>(params.sq_off.ring_mask);
+        m_sqFlags = field<uint32_t>(params.sq_off.flags);
+        m_sqEntries = params.sq_entries;
+        m_cqHead = field<uint32_t>(params.cq_off.head);
+        m_cqTail = field<uint32_t>(params.cq_off.tail);
+        m_cqMask = *field<uint32_t>(params.cq_off.ring_mask);
+        m_completions = field<io_uring_cqe>(params.cq_off.cqes);
+
+        // entries are always written in the order of the queue
+        auto* array = field<uint32_t>(params.sq_off.array);
+        for (uint32_t i = 0; i < params.sq_entries; ++i)
+        {
+            array[i] = i;
+        }
+
+        registerBuffers();
+    }
+
+    ~Ring()
+    {
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+
+        if (m_queues)
+        {
+            munmap(m_queues, m_queuesSize);
+        }
+
+        if (m_entries)
+        {
+            munmap(m_entries, m_entriesSize);
+        }
+
+        if (m_bufferRing)
+        {
+            munmap(m_bufferRing, m_bufferRingSize);
+        }
+
+        if (m_buffers)
+        {
+            munmap(m_buffers, scNumBuffers * scBufferSize);
+        }
+    }
+
+    template<typename Field>
+    Field* field(const uint32_t offset) const
+    {
+        return reinterpret_cast<Field*>(static_cast<char*>(m_queues) + offset);
+    }
+
+    void* map(const std::size_t size, const off_t offset)
+    {
+        void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        if (address == MAP_FAILED)
+        {
+            throw std::runtime_error(systemError("Failed to map io_uring", errno));
+        }
+
+        return address;
+    }
+
+    void registerBuffers()
+    {
+        m_bufferRingSize = scNumBuffers * sizeof(io_uring_buf);
+        void* ring = mmap(nullptr, m_bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED)
+        {
+            throw std::runtime_error(systemError("Failed to allocate buffers of io_uring", errno));
+        }
+
+        m_bufferRing = static_cast<io_uring_buf_ring*>(ring);
+        void* buffers = mmap(nullptr, scNumBuffers * scBufferSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffers == MAP_FAILED)
+        {
+            throw std::runtime_error(systemError("Failed to allocate buffers of io_uring", errno));
+        }
+
+        m_buffers = static_cast<char*>(buffers);
+
+        for (std::size_t i = 0; i < scNumBuffers; ++i)
+        {
+            addBuffer(uint16_t(i), uint16_t(i));
+        }
+
+        publishBuffers(uint16_t(scNumBuffers));
+
+        io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(m_bufferRing);
+        reg.ring_entries = scNumBuffers;
+        reg.bgid = scBufferGroup;
+        if (uringRegister(m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+        {
+            throw std::runtime_error(systemError("Failed to register buffers of io_uring, Linux 5.19 is required",
+                                                 errno));
+        }
+    }
+
+    /// @brief writes buffer into the entry of the ring, it is visible to the kernel after publishBuffers
+    void addBuffer(const uint16_t buffer, const uint16_t index)
+    {
+        // ring is an array of buffers, it's bufs member is shifted by the empty struct in C++
+        auto& entry = reinterpret_cast<io_uring_buf*>(m_bufferRing)[index & (scNumBuffers - 1)];
+        entry.addr = reinterpret_cast<uint64_t>(m_buffers + buffer * scBufferSize);
+        entry.len = scBufferSize;
+        entry.bid = buffer;
+    }
+
+    void publishBuffers(const uint16_t tail)
+    {
+        __atomic_store_n(&m_bufferRing->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    int                 m_fd = -1;
+    void*               m_queues = nullptr;
+    std::size_t         m_queuesSize = 0;
+    io_uring_sqe*       m_entries = nullptr;
+    std::size_t         m_entriesSize = 0;
+    uint32_t*           m_sqHead = nullptr;
+    uint32_t*           m_sqTail = nullptr;
+    uint32_t            m_sqMask = 0;
+    uint32_t*           m_sqFlags = nullptr;
+    uint32_t            m_sqEntries = 0;
+    uint32_t*           m_cqHead = nullptr;
+    uint32_t*           m_cqTail = nullptr;
+    uint32_t            m_cqMask = 0;
+    io_uring_cqe*       m_completions = nullptr;
+    io_uring_buf_ring*  m_bufferRing = nullptr;
+    std::size_t         m_bufferRingSize = 0;
+    char*               m_buffers = nullptr;
+    uint16_t            m_bufferTail = uint16_t(scNumBuffers);  ///< guarded by m_bufferMutex
+};
+
+UringTransport::UringTransport(boost::asio::io_context& ioContext, Logger& logger)
+    : m_ioContext(ioContext)
+    , m_logger(logger)
+    , m_ring(std::make_unique<Ring>())
+    , m_event(ioContext)
+{
+    static_assert((scNumBuffers & (scNumBuffers - 1)) == 0, "ring of buffers must be a power of two");
+
+    m_ring->Open();
+    const int event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event < 0)
+    {
+        throw std::runtime_error(systemError("Failed to create eventfd", errno));
+    }
+
+    m_event.assign(event);
+    if (uringRegister(m_ring->m_fd, IORING_REGISTER_EVENTFD, &event, 1) != 0)
+    {
+        throw std::runtime_error(systemError("Failed to register eventfd of io_uring", errno));
+    }
+}
+
+UringTransport::~UringTransport()
+{
+    // operations are abandoned with the ring, their owners are released afterwards,
+    // since owners may be destroyed with their operations
+    std::vector<std::shared_ptr<void>> owners;
+    {
+        std::lock_guard<std::mutex> lock(m_submitMutex);
+        for (auto* operation = m_inFlight; operation; operation = operation->m_next)
+        {
+            owners.push_back(std::move(operation->m_keepAlive));
+        }
+
+        m_inFlight = nullptr;
+    }
+
+    boost::system::error_code ec;
+    m_event.close(ec);
+    m_ring.reset();
+    owners.clear();
+    m_logger.LogRecord("UringTransport destroyed");
+}
+
+bool UringTransport::IsCompiled()
+{
+    return true;
+}
+
+void UringTransport::Start()
+{
+    startWait();
+}
+
+void UringTransport::Receive(const int fd, UringOperation& operation, std::shared_ptr<void> keepAlive)
+{
+    submit(&operation, std::move(keepAlive), [fd](io_uring_sqe& entry)
+    {
+        entry.opcode = IORING_OP_RECV;
+        entry.fd = fd;
+        entry.ioprio = IORING_RECV_MULTISHOT;
+        entry.flags = IOSQE_BUFFER_SELECT;
+        entry.buf_group = scBufferGroup;
+    });
+}
+
+void UringTransport::Send(const int fd, const msghdr& message, UringOperation& operation,
+                          std::shared_ptr<void> keepAlive)
+{
+    submit(&operation, std::move(keepAlive), [fd, &message](io_uring_sqe& entry)
+    {
+        entry.opcode = IORING_OP_SENDMSG;
+        entry.fd = fd;
+        entry.addr = reinterpret_cast<uint64_t>(&message);
+        entry.len = 1;
+        entry.msg_flags = MSG_NOSIGNAL;
+    });
+}
+
+void UringTransport::Cancel(UringOperation& operation)
+{
+    // completion of the cancellation itself has no operation
+    submit(nullptr, nullptr, [&operation](io_uring_sqe& entry)
+    {
+        entry.opcode = IORING_OP_ASYNC_CANCEL;
+        entry.fd = -1;
+        entry.addr = reinterpret_cast<uint64_t>(&operation);
+    });
+}
+
+const char* UringTransport::BufferData(const int buffer) const
+{
+    return m_ring->m_buffers + std::size_t(buffer) * scBufferSize;
+}
+
+void UringTransport::ReleaseBuffer(const int buffer)
+{
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+    m_ring->addBuffer(uint16_t(buffer), m_ring->m_bufferTail);
+    m_ring->publishBuffers(++m_ring->m_bufferTail);
+}
+
+template<typename Prepare>
+void UringTransport::submit(UringOperation* operation, std::shared_ptr<void> keepAlive, const Prepare& prepare)
+{
+    std::lock_guard<std::mutex> lock(m_submitMutex);
+    const uint32_t tail = *m_ring->m_sqTail;
+    if (tail - __atomic_load_n(m_ring->m_sqHead, __ATOMIC_ACQUIRE) == m_ring->m_sqEntries)
+    {
+        // queue is full, entries prepared so far are submitted without waiting for the flush
+        enterLocked();
+    }
+
+    auto& entry = m_ring->m_entries[tail & m_ring->m_sqMask];
+    std::memset(&entry, 0, sizeof(entry));
+    prepare(entry);
+    entry.user_data = reinterpret_cast<uint64_t>(operation);
+    if (operation)
+    {
+        operation->m_keepAlive = std::move(keepAlive);
+        operation->m_prev = nullptr;
+        operation->m_next = m_inFlight;
+        if (m_inFlight)
+        {
+            m_inFlight->m_prev = operation;
+        }
+
+        m_inFlight = operation;
+    }
+
+    __atomic_store_n(m_ring->m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++m_numPrepared;
+
+    // operations prepared by handlers run before the flush are submitted together
+    if (!m_flushPosted)
+    {
+        m_flushPosted = true;
+        boost::asio::post(m_ioContext, std::bind(&UringTransport::onFlush, this));
+    }
+}
+
+void UringTransport::enterLocked()
+{
+    while (m_numPrepared != 0)
+    {
+        const int submitted = uringEnter(m_ring->m_fd, m_numPrepared, 0, 0);
+        if (submitted < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // completions are not drained fast enough, entries are submitted by the next flush
+            if (errno != EAGAIN && errno != EBUSY)
+            {
+                m_logger.LogRecord(LogLevel::Error, systemError("Failed to submit to io_uring", errno));
+            }
+
+            return;
+        }
+
+        m_numPrepared -= uint32_t(submitted);
+    }
+}
+
+void UringTransport::Flush()
+{
+    std::lock_guard<std::mutex> lock(m_submitMutex);
+    enterLocked();
+}
+
+void UringTransport::onFlush()
+{
+    std::lock_guard<std::mutex> lock(m_submitMutex);
+    m_flushPosted = false;
+    enterLocked();
+    if (m_numPrepared != 0)
+    {
+        m_flushPosted = true;
+        boost::asio::post(m_ioContext, std::bind(&UringTransport::onFlush, this));
+    }
+}
+
+void UringTransport::startWait()
+{
+    // eventfd is read before it is waited for, so completions posted
+    // after the last drain are not missed
+    m_event.async_read_some(boost::asio::buffer(&m_eventCount, sizeof(m_eventCount)),
+                            std::bind(&UringTransport::onEvent, this, std::placeholders::_1));
+}
+
+void UringTransport::onEvent(const boost::system::error_code& ec)
+{
+    if (ec == boost::asio::error::operation_aborted)
+    {
+        return;
+    }
+
+    if (ec)
+    {
+        m_logger.LogRecord(LogLevel::Error, std::string("Failed to wait for io_uring completions: ") + ec.message());
+    }
+
+    drain();
+}
+
+void UringTransport::drain()
+{
+    auto& ring = *m_ring;
+    uint32_t head = *ring.m_cqHead;
+    std::size_t numDrained = 0;
+    for (;;)
+    {
+        const uint32_t tail = __atomic_load_n(ring.m_cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            // completions which did not fit the queue are moved into it by the kernel on request
+            if (!(__atomic_load_n(ring.m_sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW))
+            {
+                break;
+            }
+
+            uringEnter(ring.m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+            continue;
+        }
+
+        if (numDrained == scMaxDrained)
+        {
+            break;
+        }
+
+        const io_uring_cqe& cqe = ring.m_completions[head & ring.m_cqMask];
+        auto* operation = reinterpret_cast<UringOperation*>(cqe.user_data);
+        UringCompletion completion;
+        completion.m_result = cqe.res;
+        completion.m_more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+        completion.m_buffer = (cqe.flags & IORING_CQE_F_BUFFER) ? int(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+        ++head;
+        ++numDrained;
+        __atomic_store_n(ring.m_cqHead, head, __ATOMIC_RELEASE);
+
+        if (!operation)
+        {
+            continue;
+        }
+
+        if (!completion.m_more)
+        {
+            std::lock_guard<std::mutex> lock(m_submitMutex);
+            completion.m_keepAlive = std::move(operation->m_keepAlive);
+            if (operation->m_prev)
+            {
+                operation->m_prev->m_next = operation->m_next;
+            }
+            else
+            {
+                m_inFlight = operation->m_next;
+            }
+
+            if (operation->m_next)
+            {
+                operation->m_next->m_prev = operation->m_prev;
+            }
+        }
+
+        operation->OnCompleted(completion);
+    }
+
+    if (numDrained == scMaxDrained)
+    {
+        // handlers of the drained completions run before the rest is drained
+        boost::asio::post(m_ioContext, std::bind(&UringTransport::drain, this));
+        return;
+    }
+
+    startWait();
+}
+
+#else
+
+struct UringTransport::Ring
+{
+};
+
+UringTransport::UringTransport(boost::asio::io_context& ioContext, Logger& logger)
+    : m_ioContext(ioContext)
+    , m_logger(logger)
+    , m_event(ioContext)
+{
+    throw std::runtime_error("io_uring support is not compiled");
+}
+
+UringTransport::~UringTransport() = default;
+
+bool UringTransport::IsCompiled()
+{
+    return false;
+}
+
+void UringTransport::Start()
+{
+}
+
+void UringTransport::Receive(int, UringOperation&, std::shared_ptr<void>)
+{
+}
+
+void UringTransport::Send(int, const msghdr&, UringOperation&, std::shared_ptr<void>)
+{
+}
+
+void UringTransport::Cancel(UringOperation&)
+{
+}
+
+void UringTransport::Flush()
+{
+}
+
+const char* UringTransport::BufferData(int) const
+{
+    return nullptr;
+}
+
+void UringTransport::ReleaseBuffer(int)
+{
+}
+
+#endif
+
+} // namespace kvdb
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include "Logger.hpp"
+
+struct msghdr;
+
+namespace kvdb
+{
+
+/// @brief completion of an operation submitted to the ring
+struct UringCompletion
+{
+    int                     m_result = 0;       ///< number of bytes or negated errno
+    bool                    m_more = false;     ///< operation is still in flight and completes again
+    int                     m_buffer = -1;      ///< provided buffer holding received data, -1 if none
+    std::shared_ptr<void>   m_keepAlive;        ///< owner of the operation, set by the final completion
+};
+
+/// @brief operation of a connection submitted to the ring
+/// Operation is completed by the thread draining the ring, it's owner is kept alive
+/// until the final completion, so memory referred by the operation stays valid
+class UringOperation
+{
+public:
+    virtual ~UringOperation() = default;
+
+    bool InFlight() const
+    {
+        return m_keepAlive != nullptr;
+    }
+
+    /// @brief called by the thread draining the ring, must not block
+    virtual void OnCompleted(UringCompletion& completion) = 0;
+
+private:
+    friend class UringTransport;
+
+    std::shared_ptr<void>   m_keepAlive;
+    UringOperation*         m_prev = nullptr;   ///< operations in flight are listed by the transport
+    UringOperation*         m_next = nullptr;
+};
+
+/// @brief socket I/O of one event loop through io_uring
+/// Connections keep one multishot receive in flight, which completes with data of every read
+/// in a buffer of the ring provided to the kernel, buffers are returned once data is copied.
+/// Sends gather queued messages into one sendmsg. Operations prepared by handlers of one pass
+/// of the event loop are submitted by one system call. Completions are announced by an eventfd
+/// waited for by the io context, so timers, strands and posts of the context keep working
+class UringTransport
+{
+public:
+    /// buffers data is received into, a completion takes one buffer whatever it's size is
+    static constexpr std::size_t scNumBuffers = 4096;
+    static constexpr std::size_t scBufferSize = 4 * 1024;
+    static constexpr uint32_t scNumEntries = 1024;         ///< submissions in one system call
+    static constexpr uint32_t scNumCompletions = 16384;    ///< completions kept by the ring
+    /// completions handled before other handlers of the context are run
+    static constexpr std::size_t scMaxDrained = 256;
+
+    /// @throw std::runtime_error if kernel or build does not support io_uring with provided buffers
+    UringTransport(boost::asio::io_context& ioContext, Logger& logger);
+
+    virtual ~UringTransport();
+
+    /// @return false if io_uring support is not compiled
+    static bool IsCompiled();
+
+    void Start();
+
+    /// @brief receives data of the connection until it is closed, failed, canceled or buffers run out
+    void Receive(int fd, UringOperation& operation, std::shared_ptr<void> keepAlive);
+
+    /// @brief sends data referred by the message, it is kept unchanged until completion
+    void Send(int fd, const msghdr& message, UringOperation& operation, std::shared_ptr<void> keepAlive);
+
+    /// @brief cancels operation in flight, it completes with -ECANCELED
+    void Cancel(UringOperation& operation);
+
+    /// @brief submits prepared operations, so their descriptors may be closed
+    void Flush();
+
+    /// @return data of the provided buffer received by a completion
+    const char* BufferData(int buffer) const;
+
+    /// @brief returns provided buffer to the kernel, may be called by any thread
+    void ReleaseBuffer(int buffer);
+
+private:
+    struct Ring;
+
+    /// @brief operation is written into the next entry of the submission queue
+    template<typename Prepare>
+    void submit(UringOperation* operation, std::shared_ptr<void> keepAlive, const Prepare& prepare);
+
+    /// @brief submits prepared entries, caller must hold m_submitMutex
+    void enterLocked();
+    void onFlush();
+
+    void startWait();
+    void onEvent(const boost::system::error_code& ec);
+    void drain();
+
+    boost::asio::io_context&                m_ioContext;
+    Logger&                                 m_logger;
+    std::unique_ptr<Ring>                   m_ring;
+    boost::asio::posix::stream_descriptor   m_event;            ///< signalled by every completion
+    uint64_t                                m_eventCount = 0;
+
+    std::mutex                              m_submitMutex;      ///< submission queue and list of operations
+    uint32_t                                m_numPrepared = 0;  ///< entries not submitted yet
+    bool                                    m_flushPosted = false;
+    UringOperation*                         m_inFlight = nullptr;
+
+    std::mutex                              m_bufferMutex;      ///< tail of the ring of provided buffers
+};
+
+} // namespace kvdb
@@ -0,0 +1,421 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "Hash.hpp"
+#include "WriteAheadLog.hpp"
+
+namespace kvdb
+{
+
+static const std::size_t scRecordHeaderSize = sizeof(uint32_t) + sizeof(uint64_t);
+static const std::size_t scPayloadHeaderSize = sizeof(uint8_t) + sizeof(uint32_t);
+static const std::size_t scReadChunkSize = 1024 * 1024;
+
+static void putInteger(std::string& output, uint64_t value, const std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        output.push_back(char(value & 0xFF));
+        value >>= 8;
+    }
+}
+
+static uint64_t getInteger(const char* input, const std::size_t size)
+{
+    uint64_t value = 0;
+    for (std::size_t i = size; i > 0; --i)
+    {
+        value = (value << 8) | uint8_t(input[i - 1]);
+    }
+
+    return value;
+}
+
+static bool writeAll(const int fd, const char* data, std::size_t size)
+{
+    while (size > 0)
+    {
+        const auto written = ::write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += written;
+        size -= std::size_t(written);
+    }
+
+    return true;
+}
+
+WriteAheadLog::WriteAheadLog(Logger& logger,
+                             const std::string& filePath,
+                             const SyncPolicy policy,
+                             const Millis& syncInterval)
+    : m_logger(logger)
+    , m_filePath(filePath)
+    , m_policy(policy)
+    , m_syncInterval(std::max(syncInterval, Millis(1)))
+{
+    m_fd = ::open(m_filePath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        throw std::runtime_error("Failed to open write-ahead log " + m_filePath);
+    }
+
+    const auto rotated = rotatedFiles();
+    m_lastRotated = rotated.empty() ? 0 : rotated.back();
+    m_writer = std::thread(&WriteAheadLog::run, this);
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_writerCv.notify_one();
+    m_writer.join();
+    ::close(m_fd);
+}
+
+std::string WriteAheadLog::rotatedPath(const uint64_t sequence) const
+{
+    return m_filePath + "." + std::to_string(sequence);
+}
+
+std::vector<uint64_t> WriteAheadLog::rotatedFiles() const
+{
+    const std::filesystem::path path(m_filePath);
+    const auto prefix = path.filename().string() + ".";
+    std::vector<uint64_t> result;
+    const auto directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+    for (const auto& entry : std::filesystem::directory_iterator(directory))
+    {
+        const auto name = entry.path().filename().string();
+        if (name.size() > prefix.size()
+                && name.compare(0, prefix.size(), prefix) == 0
+                && name.find_first_not_of("0123456789", prefix.size()) == std::string::npos)
+        {
+            result.push_back(std::stoull(name.substr(prefix.size())));
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::size_t WriteAheadLog::Replay(const ReplayCallback& callback)
+{
+    std::size_t numRecords = 0;
+    std::size_t validSize = 0;
+    std::size_t fileSize = 0;
+
+    // rotated files are complete, they are synced before rotation
+    for (const auto sequence : rotatedFiles())
+    {
+        const auto path = rotatedPath(sequence);
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Failed to open write-ahead log " + path);
+        }
+
+        numRecords += replayFile(fd, callback, validSize, fileSize);
+        ::close(fd);
+    }
+
+    numRecords += replayFile(m_fd, callback, validSize, fileSize);
+    if (validSize != fileSize)
+    {
+        m_logger.LogRecord(LogLevel::Warning, (boost::format("Write-ahead log has torn tail of %1% bytes, truncating")
+                            % (fileSize - validSize)).str());
+        if (::ftruncate(m_fd, off_t(validSize)) != 0)
+        {
+            throw std::runtime_error("Failed to truncate write-ahead log " + m_filePath);
+        }
+    }
+
+    return numRecords;
+}
+
+std::size_t WriteAheadLog::replayFile(const int fd,
+                                      const ReplayCallback& callback,
+                                      std::size_t& validSize,
+                                      std::size_t& fileSize)
+{
+    std::string data;
+    std::size_t numRecords = 0;
+    validSize = 0;
+    fileSize = 0;
+    std::vector<char> chunk(scReadChunkSize);
+
+    while (true)
+    {
+        const auto numRead = ::pread(fd, chunk.data(), chunk.size(), off_t(fileSize));
+        if (numRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (numRead <= 0)
+        {
+            break;
+        }
+
+        fileSize += std::size_t(numRead);
+        data.append(chunk.data(), std::size_t(numRead));
+
+        // parse all complete records, rest is kept until next chunk is read
+        std::size_t offset = 0;
+        bool corrupted = false;
+        while (data.size() - offset >= scRecordHeaderSize)
+        {
+            const auto payloadSize = getInteger(data.data() + offset, sizeof(uint32_t));
+            const auto checksum = getInteger(data.data() + offset + sizeof(uint32_t), sizeof(uint64_t));
+            if (data.size() - offset - scRecordHeaderSize < payloadSize)
+            {
+                break;
+            }
+
+            const char* payload = data.data() + offset + scRecordHeaderSize;
+            if (payloadSize < scPayloadHeaderSize || Hash::Bytes(payload, payloadSize) != checksum)
+            {
+                corrupted = true;
+                break;
+            }
+
+            const auto type = RecordType(uint8_t(payload[0]));
+            const auto keySize = getInteger(payload + sizeof(uint8_t), sizeof(uint32_t));
+            if (keySize > payloadSize - scPayloadHeaderSize)
+            {
+                corrupted = true;
+                break;
+            }
+
+            const std::string_view key(payload + scPayloadHeaderSize, keySize);
+            const std::string_view value(payload + scPayloadHeaderSize + keySize,
+                                         payloadSize - scPayloadHeaderSize - keySize);
+            callback(type, key, value);
+
+            offset += scRecordHeaderSize + payloadSize;
+            validSize += scRecordHeaderSize + payloadSize;
+            ++numRecords;
+        }
+
+        data.erase(0, offset);
+        if (corrupted)
+        {
+            break;
+        }
+    }
+
+    return numRecords;
+}
+
+WriteAheadLog::Lsn WriteAheadLog::Append(const RecordType type,
+                                         std::string_view key,
+                                         std::string_view value)
+{
+    const std::size_t payloadSize = scPayloadHeaderSize + key.size() + value.size();
+
+    // record is encoded and checksummed outside of the lock, buffer is reused
+    // to avoid allocation per record
+    thread_local std::string record;
+    record.clear();
+    putInteger(record, payloadSize, sizeof(uint32_t));
+    putInteger(record, 0, sizeof(uint64_t));
+    putInteger(record, uint8_t(type), sizeof(uint8_t));
+    putInteger(record, key.size(), sizeof(uint32_t));
+    record.append(key);
+    record.append(value);
+
+    auto checksum = Hash::Bytes(record.data() + scRecordHeaderSize, payloadSize);
+    for (std::size_t i = 0; i < sizeof(uint64_t); ++i)
+    {
+        record[sizeof(uint32_t) + i] = char(checksum & 0xFF);
+        checksum >>= 8;
+    }
+
+    bool wakeWriter = false;
+    Lsn lsn = 0;
+    {
+        std::lock_guard lock(m_mutex);
+        wakeWriter = m_buffer.empty() && m_policy == SyncPolicy::PerOperation;
+        m_buffer.append(record);
+        lsn = ++m_appended;
+    }
+
+    if (wakeWriter)
+    {
+        m_writerCv.notify_one();
+    }
+
+    return lsn;
+}
+
+void WriteAheadLog::WaitDurable(const Lsn lsn)
+{
+    if (m_policy != SyncPolicy::PerOperation)
+    {
+        return;
+    }
+
+    std::unique_lock lock(m_mutex);
+    m_durableCv.wait(lock, [this, lsn]() { return m_synced >= lsn || m_failed; });
+    if (m_failed)
+    {
+        throw std::runtime_error("Failed to write write-ahead log");
+    }
+}
+
+bool WriteAheadLog::Sync()
+{
+    std::unique_lock lock(m_mutex);
+    const auto target = m_appended;
+    m_syncRequested = true;
+    m_writerCv.notify_one();
+    m_durableCv.wait(lock, [this, target]() { return m_synced >= target || m_failed; });
+    return !m_failed;
+}
+
+uint64_t WriteAheadLog::Rotate()
+{
+    std::unique_lock lock(m_mutex);
+    const auto rotated = m_lastRotated;
+    m_rotateRequested = true;
+    m_writerCv.notify_one();
+    m_durableCv.wait(lock, [this, rotated]() { return m_lastRotated != rotated || m_failed; });
+    return m_failed ? 0 : m_lastRotated;
+}
+
+void WriteAheadLog::DropRotated(const uint64_t sequence)
+{
+    for (const auto rotated : rotatedFiles())
+    {
+        if (rotated <= sequence)
+        {
+            std::error_code ec;
+            std::filesystem::remove(rotatedPath(rotated), ec);
+        }
+    }
+}
+
+void WriteAheadLog::rotate()
+{
+    m_rotateRequested = false;
+    const auto path = rotatedPath(m_lastRotated + 1);
+    if (::rename(m_filePath.c_str(), path.c_str()) != 0)
+    {
+        m_logger.LogRecord(LogLevel::Error, "Failed to rotate write-ahead log " + m_filePath);
+        m_failed = true;
+        return;
+    }
+
+    const int fd = ::open(m_filePath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        m_logger.LogRecord(LogLevel::Error, "Failed to open write-ahead log " + m_filePath);
+        m_failed = true;
+        return;
+    }
+
+    // rename and creation of the log are made durable before records are appended to the new file
+    const auto directory = std::filesystem::absolute(m_filePath).parent_path();
+    const int directoryFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directoryFd >= 0)
+    {
+        ::fsync(directoryFd);
+        ::close(directoryFd);
+    }
+
+    ::close(m_fd);
+    m_fd = fd;
+    ++m_lastRotated;
+}
+
+void WriteAheadLog::run()
+{
+    std::unique_lock lock(m_mutex);
+    while (!m_stop)
+    {
+        if (m_policy == SyncPolicy::PerOperation)
+        {
+            // records appended while previous batch is written form the next batch
+            m_writerCv.wait(lock, [this]()
+            {
+                return m_stop || m_syncRequested || m_rotateRequested || !m_buffer.empty();
+            });
+        }
+        else
+        {
+            m_writerCv.wait_for(lock, m_syncInterval, [this]()
+            {
+                return m_stop || m_syncRequested || m_rotateRequested;
+            });
+        }
+
+        // rotated file must contain all records appended before rotation
+        const bool rotateRequested = m_rotateRequested;
+        writePending(lock, m_policy != SyncPolicy::None || m_syncRequested || rotateRequested);
+        if (rotateRequested && !m_failed)
+        {
+            rotate();
+        }
+
+        m_durableCv.notify_all();
+    }
+
+    writePending(lock, true);
+}
+
+void WriteAheadLog::writePending(std::unique_lock<std::mutex>& lock, const bool sync)
+{
+    std::string batch;
+    batch.swap(m_buffer);
+    const auto target = m_appended;
+    m_syncRequested = false;
+    if (batch.empty() && (!sync || m_synced >= target))
+    {
+        return;
+    }
+
+    lock.unlock();
+    bool success = writeAll(m_fd, batch.data(), batch.size());
+    if (success && sync)
+    {
+        success = ::fdatasync(m_fd) == 0;
+    }
+
+    lock.lock();
+    if (!success)
+    {
+        if (!m_failed)
+        {
+            m_logger.LogRecord(LogLevel::Error, "Failed to write write-ahead log " + m_filePath);
+        }
+
+        m_failed = true;
+    }
+    else if (sync)
+    {
+        m_synced = target;
+    }
+
+    m_durableCv.notify_all();
+}
+
+} // namespace kvdb
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "Logger.hpp"
+
+namespace kvdb
+{
+
+/// @brief append-only log of map modifications stored next to the map file
+/// Records appended by concurrent writers are collected in memory and written
+/// by the background thread in batches, so one fsync makes durable all of them
+/// (group commit)
+/// Record format (little endian):
+///     u32 payload size | u64 payload checksum | u8 type | u32 key size | key | value
+/// At checkpoint current file is rotated to <path>.<sequence number> and removed
+/// once map content is flushed, so records are never dropped while writers wait
+class WriteAheadLog
+{
+public:
+    using Millis = std::chrono::milliseconds;
+
+    /// sequence number of the record, grows monotonically
+    using Lsn = uint64_t;
+
+    enum class SyncPolicy : uint32_t
+    {
+        PerOperation    = 0,    ///< every acknowledged operation is synced on disk
+        Interval        = 1,    ///< log is synced on disk every sync interval
+        None            = 2,    ///< log is written every sync interval but never synced
+    };
+
+    enum class RecordType : uint8_t
+    {
+        Insert  = 1,
+        Update  = 2,
+        Delete  = 3,
+    };
+
+    using ReplayCallback = std::function<void(RecordType type,
+                                              std::string_view key,
+                                              std::string_view value)>;
+
+    WriteAheadLog(Logger& logger,
+                  const std::string& filePath,
+                  SyncPolicy policy,
+                  const Millis& syncInterval);
+
+    virtual ~WriteAheadLog();
+
+    /// @brief passes all valid records of rotated and current files to the callback
+    /// in the order they were appended
+    /// Torn or corrupted tail of the log (e.g. after crash) is truncated
+    /// Must be called before any record is appended
+    /// @return number of replayed records
+    std::size_t Replay(const ReplayCallback& callback);
+
+    /// @brief adds record to the log, does not block on IO
+    /// Records of the same key must be appended under the same lock
+    /// as the modification itself to keep their order
+    Lsn Append(RecordType type, std::string_view key, std::string_view value);
+
+    /// @brief blocks until record is durable according to the sync policy
+    /// @throw std::runtime_error if log can not be written
+    void WaitDurable(Lsn lsn);
+
+    /// @brief writes and syncs all appended records regardless of the policy
+    bool Sync();
+
+    /// @brief syncs current file and starts new one, records appended after the call
+    /// are written into the new file
+    /// @return sequence number of the rotated file or 0 on failure
+    uint64_t Rotate();
+
+    /// @brief removes rotated files up to given sequence number,
+    /// called when map content is flushed on disk
+    void DropRotated(uint64_t sequence);
+
+private:
+    void run();
+
+    std::string rotatedPath(uint64_t sequence) const;
+
+    /// @return sequence numbers of rotated files in ascending order
+    std::vector<uint64_t> rotatedFiles() const;
+
+    /// @return number of replayed records, size of the valid part of the file is stored to validSize
+    std::size_t replayFile(int fd, const ReplayCallback& callback, std::size_t& validSize, std::size_t& fileSize);
+
+    /// @brief renames current file and opens new one, called from the writer thread only
+    void rotate();
+
+    /// @brief writes buffered records, called from the writer thread only
+    void writePending(std::unique_lock<std::mutex>& lock, bool sync);
+
+    Logger&                 m_logger;
+    std::string             m_filePath;
+    SyncPolicy              m_policy;
+    Millis                  m_syncInterval;
+    int                     m_fd = -1;
+
+    std::mutex              m_mutex;            ///< protects all fields below
+    std::condition_variable m_writerCv;         ///< wakes up writer thread
+    std::condition_variable m_durableCv;        ///< wakes up waiting writers
+    std::string             m_buffer;           ///< records not written yet
+    Lsn                     m_appended = 0;
+    Lsn                     m_synced = 0;
+    bool                    m_syncRequested = false;
+    bool                    m_rotateRequested = false;
+    uint64_t                m_lastRotated = 0;  ///< sequence number of the last rotated file
+    bool                    m_failed = false;
+    bool                    m_stop = false;
+    std::thread             m_writer;
+};
+
+} // namespace kvdb
@@ -1,13 +1,17 @@
 
+#include <filesystem>
+
 #include <boost/program_options.hpp>
 #include <boost/asio.hpp>
-#include <boost/log/sinks.hpp>
-#include <boost/core/null_deleter.hpp>
 #include <boost/format.hpp>
 
 #include "../lib/Logger.hpp"
+#include "../lib/Metrics.hpp"
+#include "../lib/MetricsServer.hpp"
 #include "../lib/Server.hpp"
 #include "../lib/Application.hpp"
+#include "../lib/IoContextPool.hpp"
+#include "../lib/PartitionRouter.hpp"
 
 namespace kvdb
 {
@@ -19,32 +23,28 @@ public:
     static const uint32_t scReportingIntervalSec = 60;
 
     ServerApp(int argc, char** argv)
-        : m_map(m_logger)
-        , m_commandProcessor(CommandProcessorContext {
-                             m_ioContext,
-                             m_logger,
-                             m_map,
-                             scReportingIntervalSec})
     {
         static constexpr char scArgPort[] = "port";
         static constexpr char scArgFile[] = "file";
+        static constexpr char scArgShards[] = "shards";
+        static constexpr char scArgEngine[] = "engine";
+        static constexpr char scArgGrowThreshold[] = "grow-threshold";
+        static constexpr char scArgReserveGb[] = "reserve-gb";
+        static constexpr char scArgWalSync[] = "wal-sync";
+        static constexpr char scArgWalSyncIntervalMs[] = "wal-sync-interval-ms";
+        static constexpr char scArgFlushIntervalMs[] = "flush-interval-ms";
+        static constexpr char scArgFlushRateMb[] = "flush-rate-mb";
+        static constexpr char scArgOrderedIndex[] = "ordered-index";
+        static constexpr char scArgCompactThreshold[] = "compact-threshold";
+        static constexpr char scArgPerCore[] = "per-core";
+        static constexpr char scArgPinThreads[] = "pin-threads";
+        static constexpr char scArgPartitions[] = "partitions";
+        static constexpr char scArgLogLevel[] = "log-level";
+        static constexpr char scArgMetricsPort[] = "metrics-port";
+        static constexpr char scArgTransport[] = "transport";
         static constexpr int scDefaultPort = 1524;
         static const std::string scMappedFile = "./memfile.map";
 
-        ///-----------------------------------------------------------------------------------------
-        /// Configure logger
-
-        {
-            using namespace boost::log;
-
-            using text_sink = sinks::asynchronous_sink<sinks::text_ostream_backend>;
-            boost::shared_ptr<text_sink> sink = boost::make_shared<text_sink>();
-
-            boost::shared_ptr<std::ostream> stream{ &std::clog, boost::null_deleter{} };
-            sink->locked_backend()->add_stream(stream);
-            core::get()->add_sink(sink);
-        }
-
         ///-----------------------------------------------------------------------------------------
         /// Configure application arguments
         using namespace boost::program_options;
@@ -54,7 +54,39 @@ public:
                 (scArgPort, value<int>()->default_value(scDefaultPort),
                  "[required] port")
                 (scArgFile, value<std::string>()->default_value(scMappedFile),
-                 "[required] memory mapped file path");
+                 "[required] memory mapped file path")
+                (scArgShards, value<uint32_t>()->default_value(1),
+                 "[optional] number of independently locked shards of newly created map file")
+                (scArgEngine, value<std::string>()->default_value("swiss"),
+                 "[optional] index engine of newly created map file: swiss or hashed")
+                (scArgGrowThreshold, value<double>()->default_value(0.2),
+                 "[optional] map file is grown in background when ratio of free memory falls below this value")
+                (scArgReserveGb, value<std::size_t>()->default_value(64),
+                 "[optional] size of address range (in GiB) reserved to grow map file without remapping")
+                (scArgWalSync, value<std::string>()->default_value("interval"),
+                 "[optional] durability of write-ahead log: per-op, interval or none")
+                (scArgWalSyncIntervalMs, value<uint32_t>()->default_value(10),
+                 "[optional] interval between syncs of write-ahead log (in milliseconds)")
+                (scArgFlushIntervalMs, value<uint32_t>()->default_value(100),
+                 "[optional] interval between flushes of modified regions of map file (in milliseconds), 0 disables them")
+                (scArgFlushRateMb, value<std::size_t>()->default_value(64),
+                 "[optional] maximum rate of flushes of modified regions of map file (in MiB per second)")
+                (scArgOrderedIndex, bool_switch(),
+                 "[optional] keep keys of newly created map file ordered to serve SCAN and SCAN_PREFIX commands")
+                (scArgCompactThreshold, value<double>()->default_value(0.75),
+                 "[optional] map file is compacted in background when ratio of free memory exceeds this value, 0 disables it")
+                (scArgPerCore, bool_switch(),
+                 "[optional] run event loop per CPU core, each accepting own connections and executing their commands")
+                (scArgPinThreads, bool_switch(),
+                 "[optional] pin threads of per-core event loops to CPUs")
+                (scArgPartitions, value<uint32_t>()->default_value(0),
+                 "[optional] run given number of per-core event loops, each owning a partition of keys stored in a map file of it's own")
+                (scArgMetricsPort, value<int>()->default_value(0),
+                 "[optional] port of HTTP endpoint serving metrics in the text format of Prometheus at /metrics, 0 disables it")
+                (scArgTransport, value<std::string>()->default_value("asio"),
+                 "[optional] socket I/O of sessions: asio or io_uring (Linux 6.0 or newer)")
+                (scArgLogLevel, value<std::string>()->default_value("info"),
+                 "[optional] minimum level of logged records: debug, info, warning, error or off");
 
         variables_map vm;
         try
@@ -64,47 +96,257 @@ public:
         }
         catch (boost::program_options::error& e)
         {
-            m_logger.LogRecord(std::string("Error while parse comand line arguments: ") + e.what());
-            std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+            m_logger.LogRecord(LogLevel::Error, std::string("Error while parse comand line arguments: ") + e.what());
+            Logger::Flush();
             exit(-1);
         }
 
+        LogLevel logLevel = LogLevel::Info;
+        const auto logLevelName = vm[scArgLogLevel].as<std::string>();
+        if (!Logger::ParseLevel(logLevelName, logLevel))
+        {
+            m_logger.LogRecord(LogLevel::Error, std::string("Unknown log level : ") + logLevelName);
+            Logger::Flush();
+            exit(-1);
+        }
+
+        Logger::SetLevel(logLevel);
+
         if (vm.count(scArgFile) == 0)
         {
-            m_logger.LogRecord("file is required");
-            std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+            m_logger.LogRecord(LogLevel::Error, "file is required");
+            Logger::Flush();
+            exit(-1);
+        }
+
+        IndexEngine engine = IndexEngine::Swiss;
+        const auto engineName = vm[scArgEngine].as<std::string>();
+        if (engineName == "hashed")
+        {
+            engine = IndexEngine::Hashed;
+        }
+        else if (engineName != "swiss")
+        {
+            m_logger.LogRecord(LogLevel::Error, std::string("Unknown index engine : ") + engineName);
+            Logger::Flush();
             exit(-1);
         }
 
-        m_map.InitStorage(vm[scArgFile].as<std::string>());
+        WriteAheadLog::SyncPolicy walSyncPolicy = WriteAheadLog::SyncPolicy::Interval;
+        const auto walSyncName = vm[scArgWalSync].as<std::string>();
+        if (walSyncName == "per-op")
+        {
+            walSyncPolicy = WriteAheadLog::SyncPolicy::PerOperation;
+        }
+        else if (walSyncName == "none")
+        {
+            walSyncPolicy = WriteAheadLog::SyncPolicy::None;
+        }
+        else if (walSyncName != "interval")
+        {
+            m_logger.LogRecord(LogLevel::Error, std::string("Unknown write-ahead log sync policy : ") + walSyncName);
+            Logger::Flush();
+            exit(-1);
+        }
+
+        const auto transportName = vm[scArgTransport].as<std::string>();
+        if (transportName != "asio" && transportName != "io_uring")
+        {
+            m_logger.LogRecord(LogLevel::Error, std::string("Unknown transport : ") + transportName);
+            Logger::Flush();
+            exit(-1);
+        }
+
+        const bool ioUring = transportName == "io_uring";
+        if (ioUring && !UringTransport::IsCompiled())
+        {
+            m_logger.LogRecord(LogLevel::Error, "Server is built without io_uring transport");
+            Logger::Flush();
+            exit(-1);
+        }
+
+        PersistableMap::Options options;
+        options.m_numShards = vm[scArgShards].as<uint32_t>();
+        options.m_engine = engine;
+        options.m_growThreshold = vm[scArgGrowThreshold].as<double>();
+        options.m_reservedSize = vm[scArgReserveGb].as<std::size_t>() * 1024 * 1024 * 1024;
+        options.m_walSyncPolicy = walSyncPolicy;
+        options.m_walSyncInterval = std::chrono::milliseconds(vm[scArgWalSyncIntervalMs].as<uint32_t>());
+        options.m_flushInterval = std::chrono::milliseconds(vm[scArgFlushIntervalMs].as<uint32_t>());
+        options.m_flushRateLimit = vm[scArgFlushRateMb].as<std::size_t>() * 1024 * 1024;
+        options.m_orderedIndex = vm[scArgOrderedIndex].as<bool>();
+        options.m_compactThreshold = vm[scArgCompactThreshold].as<double>();
+        const auto filePath = vm[scArgFile].as<std::string>();
+        const uint32_t numPartitions = vm[scArgPartitions].as<uint32_t>();
+        if (vm[scArgPerCore].as<bool>() || numPartitions != 0)
+        {
+            // every core accepts connections on it's own socket bound to the same port,
+            // shared context is left for signals and background tasks of the shared map
+            m_pinThreads = vm[scArgPinThreads].as<bool>();
+            m_cores = std::make_unique<IoContextPool>(m_logger, numPartitions != 0 ? numPartitions
+                                                                                   : std::thread::hardware_concurrency());
+        }
+
+        if (numPartitions == 0)
+        {
+            m_maps.emplace_back(new PersistableMap(m_logger));
+            m_maps.back()->InitStorage(filePath, options);
+            m_processors.emplace_back(new CommandProcessor(CommandProcessorContext {
+                                                               m_ioContext,
+                                                               m_logger,
+                                                               *m_maps.back(),
+                                                               scReportingIntervalSec
+                                                           }));
+        }
+        else
+        {
+            // keys are assigned to partitions by their number, so it must not change
+            const auto partitionFile = [&filePath](const uint32_t idx)
+            {
+                return filePath + "." + std::to_string(idx);
+            };
+
+            if (std::filesystem::exists(partitionFile(numPartitions))
+                    || (std::filesystem::exists(partitionFile(0))
+                        && !std::filesystem::exists(partitionFile(numPartitions - 1))))
+            {
+                m_logger.LogRecord(LogLevel::Error, "Map file was created with other number of partitions");
+                Logger::Flush();
+                exit(-1);
+            }
+
+            // partition is accessed only by the thread of it's core, including background tasks
+            std::vector<Partition> partitions;
+            for (uint32_t i = 0; i < numPartitions; ++i)
+            {
+                m_maps.emplace_back(new PersistableMap(m_logger));
+                m_maps.back()->InitStorage(partitionFile(i), options);
+                m_processors.emplace_back(new CommandProcessor(CommandProcessorContext {
+                                                                   m_cores->Context(i),
+                                                                   m_logger,
+                                                                   *m_maps.back(),
+                                                                   scReportingIntervalSec
+                                                               }));
+                partitions.push_back(Partition { m_cores->Context(i), *m_processors.back() });
+            }
+
+            m_router = std::make_unique<PartitionRouter>(partitions);
+        }
 
         {
             using namespace boost::asio::ip;
 
             const tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), vm[scArgPort].as<int>());
-            m_server = std::make_shared<Server>(ServerContext {
-                                                    m_ioContext,
-                                                    m_logger,
-                                                    m_commandProcessor,
-                                                    endpoint
-                                                });
+            try
+            {
+                if (!m_cores)
+                {
+                    m_servers.push_back(std::make_shared<Server>(ServerContext {
+                                                                     m_ioContext,
+                                                                     m_logger,
+                                                                     *m_processors.front(),
+                                                                     endpoint,
+                                                                     false,
+                                                                     nullptr,
+                                                                     0,
+                                                                     ioUring
+                                                                 }));
+                }
+                else
+                {
+                    for (std::size_t i = 0; i < m_cores->Size(); ++i)
+                    {
+                        m_servers.push_back(std::make_shared<Server>(ServerContext {
+                                                                         m_cores->Context(i),
+                                                                         m_logger,
+                                                                         *m_processors[m_router ? i : 0],
+                                                                         endpoint,
+                                                                         true,
+                                                                         m_router.get(),
+                                                                         i,
+                                                                         ioUring
+                                                                     }));
+                    }
+                }
+            }
+            catch (std::runtime_error& err)
+            {
+                m_logger.LogRecord(LogLevel::Error, std::string("Failed to start server: ") + err.what());
+                Logger::Flush();
+                exit(-1);
+            }
+
+            // metrics are collected by the shared context, so commands of cores are not delayed by scrapes
+            const int metricsPort = vm[scArgMetricsPort].as<int>();
+            if (metricsPort != 0)
+            {
+                m_metricsServer = std::make_unique<MetricsServer>(MetricsServerContext {
+                                                                      m_ioContext,
+                                                                      m_logger,
+                                                                      tcp::endpoint(tcp::v4(), metricsPort),
+                                                                      std::bind(&ServerApp::collectMetrics, this)
+                                                                  });
+            }
         }
     }
 
     void Run()
     {
         const auto numThreads = std::thread::hardware_concurrency();
-        m_logger.LogRecord(std::string("Starting KVDB Server. Num threads : ") + std::to_string(numThreads));
-        m_commandProcessor.Start();
-        m_server->Start();
-        Application::Run(numThreads);
+        m_logger.LogRecord(std::string("Starting KVDB Server. Num threads : ") + std::to_string(numThreads)
+                           + (m_router ? ", partition per core" : m_cores ? ", event loop per core" : ""));
+        for (auto& processor : m_processors)
+        {
+            processor->Start();
+        }
+
+        for (auto& server : m_servers)
+        {
+            server->Start();
+        }
+
+        if (m_metricsServer)
+        {
+            m_metricsServer->Start();
+        }
+
+        if (!m_cores)
+        {
+            Application::Run(numThreads);
+            return;
+        }
+
+        m_cores->Start(m_pinThreads);
+        Application::Run(1);
+        m_cores->Stop();
     }
 
 private:
+    std::string collectMetrics() const
+    {
+        MetricsWriter writer;
+        for (std::size_t i = 0; i < m_processors.size(); ++i)
+        {
+            m_processors[i]->CollectMetrics(writer, { { "partition", std::to_string(i) } });
+        }
+
+        for (std::size_t i = 0; i < m_servers.size(); ++i)
+        {
+            m_servers[i]->CollectMetrics(writer, { { "core", std::to_string(i) } });
+        }
+
+        return writer.Text();
+    }
+
     // all fields must be in the order of initialization
-    PersistableMap          m_map;
-    CommandProcessor        m_commandProcessor;
-    Server::Ptr             m_server;
+    std::unique_ptr<IoContextPool>                  m_cores;        ///< contexts of cores, empty if all threads
+                                                                    ///< run shared context
+    std::vector<std::unique_ptr<PersistableMap>>    m_maps;         ///< the only map or map of every partition
+    std::vector<std::unique_ptr<CommandProcessor>>  m_processors;   ///< processor of every map
+    std::unique_ptr<PartitionRouter>                m_router;       ///< empty unless keys are partitioned
+    bool                                            m_pinThreads = false;
+    std::vector<Server::Ptr>                        m_servers;
+    std::unique_ptr<MetricsServer>                  m_metricsServer;    ///< empty unless metrics port is set
 };
 
 }
@@ -1,10 +1,64 @@
 #include <string>
 #include <iostream>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
 
 #include <boost/asio.hpp>
+#include <boost/format.hpp>
 
+#include "../lib/ClientSession.hpp"
+#include "../lib/IoContextPool.hpp"
+#include "../lib/LatencyHistogram.hpp"
+#include "../lib/Metrics.hpp"
+#include "../lib/MetricsServer.hpp"
 #include "../lib/Protocol.hpp"
 #include "../lib/Serialization.hpp"
+#include "../lib/PersistableMap.hpp"
+#include "../lib/PartitionRouter.hpp"
+#include "../lib/Server.hpp"
+#include "../lib/SpscQueue.hpp"
+#include "../lib/SlabHeap.hpp"
+
+/// allocations made by all threads of the process, counted by replaced operator new
+static std::atomic<std::size_t> g_numAllocations(0);
+
+void* operator new(const std::size_t size)
+{
+    g_numAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+static std::string testMapFile(const std::string& name)
+{
+    const auto path = std::filesystem::temp_directory_path() / name;
+    std::filesystem::remove(path);
+    std::filesystem::remove(path.string() + ".wal");
+    return path.string();
+}
 
 
 void testCommandMessageDeSerialize()
@@ -69,10 +123,2272 @@ void testResultMessageDeSerialize()
     assert(resIn == resOut);
 }
 
+void testKeyValuesDeSerialize()
+{
+    const std::vector<kvdb::KeyValue> pairsIn = {
+        { "key", "value with spaces" },
+        { std::string("\0 1", 3), std::string() },
+        { "1 2", "3" },
+    };
 
-int main(int argc, char** argv)
+    for (const auto version : { kvdb::scProtocolText, kvdb::scProtocolBinary })
+    {
+        std::vector<kvdb::KeyValue> pairsOut;
+        kvdb::DeserializeKeyValues(kvdb::SerializeKeyValues(pairsIn, version), version, pairsOut);
+        assert(pairsIn == pairsOut);
+
+        try
+        {
+            kvdb::DeserializeKeyValues("10 short", version, pairsOut);
+            assert(false);
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+
+    // binary strings are prefixed with their 32-bit size
+    const auto encoded = kvdb::SerializeKeyValues({ { "k", std::string() } }, kvdb::scProtocolBinary);
+    assert(encoded == std::string("\x01\0\0\0k\0\0\0\0", 9));
+}
+
+void testBatchItemsDeSerialize()
 {
-    testCommandMessageDeSerialize();
-    testResultMessageDeSerialize();
+    const std::vector<std::string> keysIn = { "key", std::string("\0 1", 3), "1 2" };
+    const std::vector<kvdb::BatchItem> itemsIn = {
+        { kvdb::ResultMessage::GetSuccess, "value with spaces" },
+        { kvdb::ResultMessage::GetFailed, std::string() },
+        { kvdb::ResultMessage::GetSuccess, std::string("\0", 1) },
+    };
+
+    for (const auto version : { kvdb::scProtocolText, kvdb::scProtocolBinary })
+    {
+        std::vector<std::string> keysOut;
+        kvdb::DeserializeKeys(kvdb::SerializeKeys(keysIn, version), version, keysOut);
+        assert(keysIn == keysOut);
+
+        std::vector<kvdb::BatchItem> itemsOut;
+        kvdb::DeserializeBatchItems(kvdb::SerializeBatchItems(itemsIn, version), version, itemsOut);
+        assert(itemsIn == itemsOut);
+    }
+
+    const std::vector<std::pair<uint32_t, std::string>> malformed = {
+        { kvdb::scProtocolText, "6 3 abcd" },
+        { kvdb::scProtocolText, "6 " },
+        { kvdb::scProtocolText, "6" },
+        { kvdb::scProtocolText, "x 3 abc" },
+        { kvdb::scProtocolText, "6 3 ab" },
+        { kvdb::scProtocolBinary, std::string("\x06\x03\0\0\0ab", 7) },
+        { kvdb::scProtocolBinary, std::string("\x06\x03\0\0", 4) },
+        { kvdb::scProtocolBinary, std::string("\x06", 1) },
+    };
+
+    for (const auto& data : malformed)
+    {
+        try
+        {
+            std::vector<kvdb::BatchItem> itemsOut;
+            kvdb::DeserializeBatchItems(data.second, data.first, itemsOut);
+            assert(false);
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+}
+
+void testBinaryDeSerialize()
+{
+    // strings of binary protocol may contain any bytes
+    kvdb::CommandMessage comIn(kvdb::CommandMessage::SCAN, std::string("\0key \xff", 6),
+                               std::string(1000, '\0'), 123);
+    comIn.id = 0x01020304;
+
+    std::string buffer;
+    kvdb::SerializeBinary(comIn, buffer);
+    assert(buffer.size() == 17 + 6 + 1000);
+    // fields are little-endian
+    assert(buffer.substr(0, 5) == std::string("\x04\x03\x02\x01\x05", 5));
+
+    kvdb::CommandMessage comOut;
+    kvdb::DeserializeMessage(buffer.data(), buffer.size(), kvdb::scProtocolBinary, comOut);
+    assert(comIn == comOut);
+    assert(comOut.id == comIn.id);
+
+    kvdb::ResultMessage resIn(kvdb::ResultMessage::GetSuccess, std::string("\0\0 1", 4));
+    resIn.commandId = 42;
+    buffer.clear();
+    kvdb::SerializeMessage(resIn, kvdb::scProtocolBinary, buffer);
+
+    kvdb::ResultMessage resOut;
+    kvdb::DeserializeMessage(buffer.data(), buffer.size(), kvdb::scProtocolBinary, resOut);
+    assert(resIn == resOut);
+
+    // malformed messages are rejected
+    const auto isRejected = [](const std::string& data)
+    {
+        try
+        {
+            kvdb::ResultMessage result;
+            kvdb::DeserializeMessage(data.data(), data.size(), kvdb::scProtocolBinary, result);
+        }
+        catch (const std::runtime_error&)
+        {
+            return true;
+        }
+
+        return false;
+    };
+
+    assert(isRejected(buffer.substr(0, buffer.size() - 1)));
+    assert(isRejected(buffer + ' '));
+
+    std::string tooLong;
+    kvdb::BinaryWriter writer(tooLong);
+    writer.WriteUint32(0);
+    writer.WriteUint8(kvdb::ResultMessage::GetSuccess);
+    writer.WriteUint32(uint32_t(kvdb::scMaxResultSize + 1));
+    assert(isRejected(tooLong));
+
+    // text protocol is still available
+    buffer.clear();
+    kvdb::SerializeMessage(comIn, kvdb::scProtocolText, buffer);
+    comOut = kvdb::CommandMessage();
+    kvdb::DeserializeMessage(buffer.data(), buffer.size(), kvdb::scProtocolText, comOut);
+    assert(comIn == comOut);
+}
+
+void testCommandViewDeserialize()
+{
+    auto pool = std::make_shared<kvdb::BufferPool>();
+    kvdb::CommandMessage comIn(kvdb::CommandMessage::INSERT, std::string("\0key ", 5), std::string(100, '\0'), 7);
+    comIn.id = 42;
+
+    for (const auto version : { kvdb::scProtocolText, kvdb::scProtocolBinary })
+    {
+        std::string encoded;
+        kvdb::SerializeMessage(comIn, version, encoded);
+
+        const char* data = nullptr;
+        {
+            auto buffer = pool->Acquire(encoded.size());
+            std::copy(encoded.begin(), encoded.end(), buffer->Data());
+            data = buffer->Data();
+
+            // command refers to the buffer and keeps it after it is released by the receiver
+            kvdb::CommandView command;
+            kvdb::DeserializeMessage(buffer, version, command);
+            buffer.reset();
+            assert(command.type == comIn.type);
+            assert(command.key == comIn.key.Get());
+            assert(command.value == comIn.value.Get());
+            assert(command.limit == comIn.limit);
+            assert(command.id == (version == kvdb::scProtocolBinary ? comIn.id : 0));
+            assert(command.key.data() >= data && command.key.data() < data + encoded.size());
+
+            // malformed commands are rejected
+            for (const auto size : { std::size_t(0), encoded.size() / 2, encoded.size() - 1 })
+            {
+                try
+                {
+                    auto truncated = pool->Acquire(size);
+                    std::copy(encoded.begin(), encoded.begin() + size, truncated->Data());
+                    kvdb::CommandView rejected;
+                    kvdb::DeserializeMessage(truncated, version, rejected);
+                    assert(false);
+                }
+                catch (const std::runtime_error&)
+                {
+                }
+            }
+        }
+
+        // released buffer is reused by the next message
+        const auto reused = pool->Acquire(encoded.size());
+        assert(reused->Data() == data);
+    }
+
+    // large buffers are not kept by the pool, otherwise the last released one would be reused
+    pool->Acquire(kvdb::BufferPool::scMaxPooledCapacity + 1);
+    const auto small = pool->Acquire(1);
+    assert(small->Capacity() <= kvdb::BufferPool::scMaxPooledCapacity);
+}
+
+void testShardedMap(const kvdb::IndexEngine engine)
+{
+    static const std::size_t scNumThreads = 4;
+    static const std::size_t scKeysPerThread = 1000;
+    const auto lockTout = std::chrono::milliseconds(500);
+    const auto filePath = testMapFile("kvdb_test_sharded.map");
+
+    kvdb::Logger logger;
+
+    {
+        kvdb::PersistableMap map(logger);
+        map.InitStorage(filePath, {4, engine});
+
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < scNumThreads; ++t)
+        {
+            threads.emplace_back([&map, &lockTout, t]()
+            {
+                for (std::size_t i = 0; i < scKeysPerThread; ++i)
+                {
+                    const auto key = std::to_string(t) + ":" + std::to_string(i);
+                    map.Insert(key, key, lockTout);
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        const auto stat = map.GetStat();
+        assert(stat.m_numShards == 4);
+        assert(stat.m_numRecords == scNumThreads * scKeysPerThread);
+
+        const auto sizeBefore = stat.m_size;
+        const bool grown = map.Grow();
+        assert(grown);
+        assert(map.GetStat().m_size > sizeBefore);
+        assert(map.GetStat().m_numRecords == scNumThreads * scKeysPerThread);
+    }
+
+    // existing file keeps number of shards it was created with
+    kvdb::PersistableMap map(logger);
+    map.InitStorage(filePath, {2});
+    assert(map.GetStat().m_numShards == 4);
+
+    for (std::size_t t = 0; t < scNumThreads; ++t)
+    {
+        for (std::size_t i = 0; i < scKeysPerThread; ++i)
+        {
+            const auto key = std::to_string(t) + ":" + std::to_string(i);
+            std::string value;
+            map.Get(key, value, lockTout);
+            assert(value == key);
+            map.Delete(key, lockTout);
+        }
+    }
+
+    assert(map.GetStat().m_numRecords == 0);
+}
+
+void testMapKeysOfAnySize(const kvdb::IndexEngine engine)
+{
+    const auto lockTout = std::chrono::milliseconds(500);
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    map.InitStorage(testMapFile("kvdb_test_keys.map"), {1, engine});
+
+    // cover all branches of the hash function, keys also contain \0 symbols
+    std::vector<std::string> keys;
+    for (std::size_t size = 1; size < 200; ++size)
+    {
+        std::string key(size, '\0');
+        for (std::size_t i = 0; i < size; i += 3)
+        {
+            key[i] = char('a' + i % 26);
+        }
+
+        keys.push_back(key);
+        map.Insert(key, std::to_string(size), lockTout);
+    }
+
+    assert(kvdb::Hash::String("abc") != kvdb::Hash::String(std::string_view("abc", 4)));
+
+    for (const auto& key : keys)
+    {
+        std::string value;
+        map.Get(std::string_view(key), value, lockTout);
+        assert(value == std::to_string(key.size()));
+    }
+
+    assert(map.GetStat().m_numRecords == keys.size());
+}
+
+void testMapOperations(const kvdb::IndexEngine engine)
+{
+    static const std::size_t scNumKeys = 20000;
+    const auto lockTout = std::chrono::milliseconds(500);
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    map.InitStorage(testMapFile("kvdb_test_operations.map"), {1, engine});
+
+    const auto expectFailure = [](const auto& operation)
+    {
+        try
+        {
+            operation();
+        }
+        catch (const std::runtime_error&)
+        {
+            return;
+        }
+
+        assert(false);
+    };
+
+    // several rounds of insert/delete leave a lot of deleted slots in open addressing table
+    for (std::size_t round = 0; round < 3; ++round)
+    {
+        for (std::size_t i = 0; i < scNumKeys; ++i)
+        {
+            const auto key = std::to_string(round) + ":" + std::to_string(i);
+            try
+            {
+                map.Insert(key, key, lockTout);
+            }
+            catch (const boost::interprocess::bad_alloc&)
+            {
+                const bool grown = map.Grow();
+                assert(grown);
+                map.Insert(key, key, lockTout);
+            }
+
+            // check some of previously inserted keys, which may be not migrated yet
+            std::string value;
+            const auto prevKey = std::to_string(round) + ":" + std::to_string(i / 2);
+            map.Get(prevKey, value, lockTout);
+            assert(value == prevKey);
+        }
+
+        for (std::size_t i = 0; i < scNumKeys; i += 2)
+        {
+            const auto key = std::to_string(round) + ":" + std::to_string(i);
+            map.Delete(key, lockTout);
+            expectFailure([&]() { map.Delete(key, lockTout); });
+            expectFailure([&]() { map.Update(key, "value", lockTout); });
+        }
+    }
+
+    assert(map.GetStat().m_numRecords == 3 * scNumKeys / 2);
+
+    for (std::size_t round = 0; round < 3; ++round)
+    {
+        for (std::size_t i = 0; i < scNumKeys; ++i)
+        {
+            const auto key = std::to_string(round) + ":" + std::to_string(i);
+            std::string value;
+            const auto copyValue = [&value](std::string_view stored)
+            {
+                value = stored;
+            };
+
+            if (i % 2 == 0)
+            {
+                expectFailure([&]() { map.Get(key, value, lockTout); });
+                const bool visited = map.Visit(key, copyValue, lockTout);
+                assert(!visited);
+                continue;
+            }
+
+            expectFailure([&]() { map.Insert(key, "value", lockTout); });
+            map.Update(key, key + key, lockTout);
+            map.Get(key, value, lockTout);
+            assert(value == key + key);
+            value.clear();
+            const bool visited = map.Visit(key, copyValue, lockTout);
+            assert(visited && value == key + key);
+        }
+    }
+}
+
+void testMultiOperations(const kvdb::IndexEngine engine)
+{
+    using BatchStatus = kvdb::PersistableMap::BatchStatus;
+    static const std::size_t scNumBatches = 20;
+    static const std::size_t scBatchSize = 1000;
+    static const std::string scValue(256, 'v');
+    const auto lockTout = std::chrono::milliseconds(500);
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    kvdb::PersistableMap::Options options;
+    options.m_numShards = 4;
+    options.m_engine = engine;
+    map.InitStorage(testMapFile("kvdb_test_multi.map"), options);
+    const auto initialSize = map.GetStat().m_size;
+
+    // batches run out of memory of the initial file, which is grown in the middle of them
+    std::vector<BatchStatus> statuses;
+    for (std::size_t batch = 0; batch < scNumBatches; ++batch)
+    {
+        std::vector<std::string> keys;
+        for (std::size_t i = 0; i < scBatchSize; ++i)
+        {
+            keys.push_back(std::to_string(batch * scBatchSize + i));
+        }
+
+        std::vector<kvdb::PersistableMap::KeyValueView> pairs;
+        for (const auto& key : keys)
+        {
+            pairs.emplace_back(key, scValue);
+        }
+
+        map.MultiSet(pairs, statuses, lockTout);
+        assert(statuses == std::vector<BatchStatus>(scBatchSize, BatchStatus::Done));
+    }
+
+    assert(map.GetStat().m_size > initialSize);
+    assert(map.GetStat().m_numRecords == scNumBatches * scBatchSize);
+
+    // items of the same key are applied in order, other keys of the batch are not affected
+    const std::vector<kvdb::PersistableMap::KeyValueView> pairs = {
+        { "7", "first" }, { "new", "first" }, { "7", "second" }, { "new", "second" },
+    };
+    map.MultiSet(pairs, statuses, lockTout);
+    assert((statuses == std::vector<BatchStatus> {
+               BatchStatus::Updated, BatchStatus::Done, BatchStatus::Updated, BatchStatus::Updated }));
+
+    std::vector<std::string> values;
+    map.MultiGet({ "7", "missing", "new", "8", "7" }, values, statuses, lockTout);
+    assert((statuses == std::vector<BatchStatus> {
+               BatchStatus::Done, BatchStatus::NotFound, BatchStatus::Done, BatchStatus::Done, BatchStatus::Done }));
+    assert((values == std::vector<std::string> { "second", std::string(), "second", scValue, "second" }));
+
+    map.MultiDelete({ "7", "missing", "7", "new" }, statuses, lockTout);
+    assert((statuses == std::vector<BatchStatus> {
+               BatchStatus::Done, BatchStatus::NotFound, BatchStatus::NotFound, BatchStatus::Done }));
+    assert(map.GetStat().m_numRecords == scNumBatches * scBatchSize - 1);
+
+    std::string value;
+    map.Get("8", value, lockTout);
+    assert(value == scValue);
+}
+
+void testOnlineGrowth(const kvdb::IndexEngine engine)
+{
+    static const std::size_t scNumKeys = 40000;
+    const auto lockTout = std::chrono::milliseconds(500);
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    kvdb::PersistableMap::Options options;
+    options.m_engine = engine;
+    options.m_reservedSize = std::size_t(1) * 1024 * 1024 * 1024;
+    options.m_growThreshold = 0.5;
+    map.InitStorage(testMapFile("kvdb_test_growth.map"), options);
+
+    // readers keep working on existing keys while map grows in place
+    map.Insert("stable", "value", lockTout);
+    std::atomic<bool> stop(false);
+    std::thread reader([&]()
+    {
+        while (!stop)
+        {
+            std::string value;
+            map.Get("stable", value, lockTout);
+            assert(value == "value");
+        }
+    });
+
+    std::size_t numGrowths = 0;
+    for (std::size_t i = 0; i < scNumKeys; ++i)
+    {
+        map.Insert(std::to_string(i), std::string(64, 'v'), lockTout);
+        if (map.NeedsGrowth())
+        {
+            const auto sizeBefore = map.GetStat().m_size;
+            const bool grown = map.Grow();
+            assert(grown);
+            assert(map.GetStat().m_size >= sizeBefore * 2);
+            assert(!map.NeedsGrowth());
+            ++numGrowths;
+        }
+    }
+
+    stop = true;
+    reader.join();
+
+    // growth was always started ahead of allocation failures
+    assert(numGrowths > 0);
+    assert(map.GetStat().m_numRecords == scNumKeys + 1);
+    for (std::size_t i = 0; i < scNumKeys; ++i)
+    {
+        std::string value;
+        map.Get(std::to_string(i), value, lockTout);
+        assert(value == std::string(64, 'v'));
+    }
+}
+
+void testWriteAheadLogReplay(const kvdb::IndexEngine engine)
+{
+    const auto lockTout = std::chrono::milliseconds(500);
+    const auto filePath = testMapFile("kvdb_test_wal.map");
+    const auto logPath = filePath + ".wal";
+    const auto checkpointPath = filePath + ".checkpoint";
+    const auto crashLogPath = logPath + ".crash";
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap::Options options;
+    options.m_engine = engine;
+    options.m_walSyncPolicy = kvdb::WriteAheadLog::SyncPolicy::PerOperation;
+
+    {
+        kvdb::PersistableMap map(logger);
+        map.InitStorage(filePath, options);
+        map.Insert("deleted", "value", lockTout);
+        map.Insert("updated", "value", lockTout);
+        const bool flushed = map.Flush();
+        assert(flushed);
+        assert(std::filesystem::file_size(logPath) == 0);
+
+        // state of the map file at the moment of crash is emulated by the last checkpoint
+        std::filesystem::copy_file(filePath, checkpointPath,
+                                   std::filesystem::copy_options::overwrite_existing);
+
+        for (int i = 0; i < 100; ++i)
+        {
+            map.Insert(std::to_string(i), std::string(i, '\0'), lockTout);
+        }
+
+        map.Update("updated", "new value", lockTout);
+        map.Delete("deleted", lockTout);
+
+        // acknowledged modifications are already durable in the log
+        std::filesystem::copy_file(logPath, crashLogPath,
+                                   std::filesystem::copy_options::overwrite_existing);
+    }
+
+    std::filesystem::rename(checkpointPath, filePath);
+    std::filesystem::rename(crashLogPath, logPath);
+    {
+        // torn record written at the moment of crash
+        std::ofstream log(logPath, std::ios::binary | std::ios::app);
+        log << std::string("\x20\x00\x00\x00garbage", 11);
+    }
+
+    kvdb::PersistableMap map(logger);
+    map.InitStorage(filePath, options);
+    assert(map.GetStat().m_numRecords == 101);
+    assert(std::filesystem::file_size(logPath) == 0);
+
+    std::string value;
+    map.Get("updated", value, lockTout);
+    assert(value == "new value");
+    for (int i = 0; i < 100; ++i)
+    {
+        map.Get(std::to_string(i), value, lockTout);
+        assert(value == std::string(i, '\0'));
+    }
+
+    try
+    {
+        map.Get("deleted", value, lockTout);
+        assert(false);
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+void testBackgroundFlush(const kvdb::IndexEngine engine)
+{
+    static const std::size_t scNumKeys = 20000;
+    const auto lockTout = std::chrono::milliseconds(500);
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    kvdb::PersistableMap::Options options;
+    options.m_engine = engine;
+    options.m_flushInterval = std::chrono::milliseconds(1);
+    map.InitStorage(testMapFile("kvdb_test_flush.map"), options);
+
+    // checkpoints run concurrently with writers
+    std::atomic<bool> stop(false);
+    std::thread checkpointer([&]()
+    {
+        while (!stop)
+        {
+            const bool flushed = map.Flush();
+            assert(flushed);
+        }
+    });
+
+    for (std::size_t i = 0; i < scNumKeys; ++i)
+    {
+        const auto key = std::to_string(i);
+        try
+        {
+            map.Insert(key, key, lockTout);
+        }
+        catch (const boost::interprocess::bad_alloc&)
+        {
+            const bool grown = map.Grow();
+            assert(grown);
+            map.Insert(key, key, lockTout);
+        }
+    }
+
+    stop = true;
+    checkpointer.join();
+
+    // flusher eventually writes all tracked regions
+    while (map.GetStat().m_dirtyBytes != 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    const auto stat = map.GetStat();
+    assert(stat.m_numRecords == scNumKeys);
+    assert(stat.m_background.m_numFlushes > 0);
+    assert(stat.m_background.m_flushedBytes > 0);
+    assert(stat.m_checkpoints.m_numFlushes > 0);
+    assert(stat.m_checkpoints.m_maxTime >= stat.m_checkpoints.m_totalTime / stat.m_checkpoints.m_numFlushes);
+}
+
+void testOrderedScan(const kvdb::IndexEngine engine)
+{
+    static const std::size_t scNumKeys = 1000;
+    const auto lockTout = std::chrono::milliseconds(500);
+    const auto filePath = testMapFile("kvdb_test_scan.map");
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap::Options options;
+    options.m_numShards = 4;
+    options.m_engine = engine;
+    options.m_orderedIndex = true;
+
+    const auto keyOf = [](const std::size_t i)
+    {
+        return (boost::format("key:%04u") % i).str();
+    };
+
+    {
+        kvdb::PersistableMap map(logger);
+        map.InitStorage(filePath, options);
+        assert(map.HasOrderedIndex());
+
+        // inserted in the order different from the order of keys
+        for (std::size_t i = 0; i < scNumKeys; ++i)
+        {
+            const auto key = keyOf((i * 7) % scNumKeys);
+            map.Insert(key, "v" + key, lockTout);
+        }
+
+        map.Insert("other", "value", lockTout);
+        map.Delete(keyOf(500), lockTout);
+        map.Update(keyOf(501), "updated", lockTout);
+
+        // paging through the prefix range with a cursor
+        std::vector<kvdb::PersistableMap::KeyValue> pairs;
+        std::string cursor = "key:";
+        const auto end = kvdb::PersistableMap::PrefixEnd("key:");
+        std::size_t numPages = 0;
+        do
+        {
+            cursor = map.Scan(cursor, end, 64, pairs, lockTout);
+            ++numPages;
+        }
+        while (!cursor.empty());
+
+        assert(numPages == (scNumKeys - 1 + 63) / 64);
+        assert(pairs.size() == scNumKeys - 1);
+        for (std::size_t i = 0, idx = 0; i < scNumKeys; ++i)
+        {
+            if (i == 500)
+            {
+                continue;
+            }
+
+            assert(pairs[idx].first == keyOf(i));
+            assert(pairs[idx].second == (i == 501 ? "updated" : "v" + keyOf(i)));
+            ++idx;
+        }
+
+        // range with exclusive end
+        pairs.clear();
+        cursor = map.Scan(keyOf(10), keyOf(20), 100, pairs, lockTout);
+        assert(cursor.empty());
+        assert(pairs.size() == 10 && pairs.front().first == keyOf(10) && pairs.back().first == keyOf(19));
+
+        // unbounded range
+        pairs.clear();
+        cursor = map.Scan("o", std::string(), 100, pairs, lockTout);
+        assert(cursor.empty());
+        assert(pairs.size() == 1 && pairs.front().first == "other");
+    }
+
+    assert(kvdb::PersistableMap::PrefixEnd("ab") == "ac");
+    assert(kvdb::PersistableMap::PrefixEnd("a\xFF") == "b");
+    assert(kvdb::PersistableMap::PrefixEnd("\xFF").empty());
+
+    // ordered index is persisted in the file
+    kvdb::PersistableMap map(logger);
+    options.m_orderedIndex = false;
+    map.InitStorage(filePath, options);
+    assert(map.HasOrderedIndex());
+
+    std::vector<kvdb::PersistableMap::KeyValue> pairs;
+    map.Scan(std::string(), std::string(), 10000, pairs, lockTout);
+    assert(pairs.size() == scNumKeys);
+
+    // map without ordered index does not serve scans
+    kvdb::PersistableMap unordered(logger);
+    unordered.InitStorage(testMapFile("kvdb_test_unordered.map"), options);
+    try
+    {
+        unordered.Scan(std::string(), std::string(), 10, pairs, lockTout);
+        assert(false);
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+void testCompactRecords(const kvdb::IndexEngine engine)
+{
+    static const std::size_t scNumKeys = 10000;
+    const auto lockTout = std::chrono::milliseconds(500);
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    kvdb::PersistableMap::Options options;
+    options.m_engine = engine;
+    map.InitStorage(testMapFile("kvdb_test_records.map"), options);
+
+    // value moves between inline and external storage and is resized in place
+    const std::size_t inlineSize = kvdb::Record::scMaxInlineValueSize;
+    const std::vector<std::size_t> sizes = {
+        0, 1, 50, 51, inlineSize, inlineSize + 1, 4 * inlineSize, 3 * inlineSize, inlineSize + 1, 10, 0
+    };
+
+    std::string value;
+    for (std::size_t i = 0; i < sizes.size(); ++i)
+    {
+        const std::string expected(sizes[i], char('a' + i));
+        if (i == 0)
+        {
+            map.Insert("key", expected, lockTout);
+        }
+        else
+        {
+            map.Update("key", expected, lockTout);
+        }
+
+        map.Get("key", value, lockTout);
+        assert(value == expected);
+        assert(map.GetStat().m_payloadBytes == 3 + sizes[i]);
+    }
+
+    map.Delete("key", lockTout);
+    assert(map.GetStat().m_payloadBytes == 0);
+
+    // typical workload: 20 bytes keys and 50 bytes values
+    for (std::size_t i = 0; i < scNumKeys; ++i)
+    {
+        map.Insert((boost::format("key:%016u") % i).str(), std::string(50, 'v'), lockTout);
+    }
+
+    const auto stat = map.GetStat();
+    assert(stat.m_payloadBytes == scNumKeys * 70);
+    assert(stat.m_bytesPerRecord > 70.0);
+    assert(std::abs(stat.m_overheadPerRecord - (stat.m_bytesPerRecord - 70.0)) < 1e-6);
+}
+
+void testSlabHeapBlockSize()
+{
+    for (std::size_t size = 1; size < 1024 * 1024; size += 1 + size / 64)
+    {
+        const auto blockSize = kvdb::SlabHeap::BlockSize(size);
+        assert(blockSize >= size);
+        assert(blockSize <= size + size / 4 + 16);
+        assert(kvdb::SlabHeap::BlockSize(blockSize) == blockSize);
+    }
+}
+
+void testUpdateChurn(const kvdb::IndexEngine engine)
+{
+    static const std::size_t scNumKeys = 200;
+    static const std::size_t scNumRounds = 20;
+    const auto lockTout = std::chrono::milliseconds(500);
+
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    kvdb::PersistableMap::Options options;
+    options.m_engine = engine;
+    map.InitStorage(testMapFile("kvdb_test_churn.map"), options);
+
+    // values of random sizes, every 16th one is not cached by the heap
+    std::minstd_rand random(42);
+    const auto randomValue = [&random](const std::size_t idx)
+    {
+        const std::size_t maxSize = idx % 16 == 0 ? 100 * 1024 : 16 * 1024;
+        return std::string(random() % maxSize, char('a' + idx % 26));
+    };
+
+    std::vector<std::string> values(scNumKeys);
+    for (std::size_t round = 0; round < scNumRounds; ++round)
+    {
+        for (std::size_t i = 0; i < scNumKeys; ++i)
+        {
+            values[i] = randomValue(i);
+            if (round == 0)
+            {
+                map.Insert(std::to_string(i), values[i], lockTout);
+            }
+            else
+            {
+                map.Update(std::to_string(i), values[i], lockTout);
+            }
+
+            if (map.NeedsGrowth())
+            {
+                const bool grown = map.Grow();
+                assert(grown);
+            }
+        }
+    }
+
+    std::string value;
+    for (std::size_t i = 0; i < scNumKeys; ++i)
+    {
+        map.Get(std::to_string(i), value, lockTout);
+        assert(value == values[i]);
+    }
+
+    const auto stat = map.GetStat();
+    assert(stat.m_largestFree > 0);
+    assert(stat.m_largestFree <= stat.m_free);
+
+    // memory of deleted records is reused by the same records inserted again
+    for (std::size_t i = 0; i < scNumKeys; ++i)
+    {
+        map.Delete(std::to_string(i), lockTout);
+    }
+
+    assert(map.GetStat().m_heapFree > stat.m_heapFree);
+    for (std::size_t i = 0; i < scNumKeys; ++i)
+    {
+        map.Insert(std::to_string(i), values[i], lockTout);
+    }
+
+    // records were updated in place, so their blocks may be larger than needed
+    // for the same values inserted again
+    const auto reinserted = map.GetStat();
+    assert(reinserted.m_size == stat.m_size);
+    assert(reinserted.m_size - reinserted.m_free <= stat.m_size - stat.m_free);
+}
+
+void testCompaction(const kvdb::IndexEngine engine)
+{
+    static const std::size_t scNumKeys = 40000;
+    static const std::size_t scNumKept = 2000;
+    const auto lockTout = std::chrono::milliseconds(5000);
+    const auto filePath = testMapFile("kvdb_test_compact.map");
+    const auto valueOf = [](const std::string& key)
+    {
+        return key + std::string(200, 'v');
+    };
+
+    kvdb::PersistableMap::Options options;
+    options.m_numShards = 4;
+    options.m_engine = engine;
+    options.m_orderedIndex = true;
+    std::map<std::string, std::string> expected;
+    {
+        kvdb::Logger logger;
+        kvdb::PersistableMap map(logger);
+        map.InitStorage(filePath, options);
+        const auto emptyReclaimed = map.Compact();
+        assert(emptyReclaimed == 0);
+
+        for (std::size_t i = 0; i < scNumKeys; ++i)
+        {
+            const auto key = (boost::format("key:%08u") % i).str();
+            map.Insert(key, valueOf(key), lockTout);
+            if (map.NeedsGrowth())
+            {
+                const bool grown = map.Grow();
+                assert(grown);
+            }
+        }
+
+        for (std::size_t i = scNumKept; i < scNumKeys; ++i)
+        {
+            map.Delete((boost::format("key:%08u") % i).str(), lockTout);
+        }
+
+        for (std::size_t i = 0; i < scNumKept; ++i)
+        {
+            const auto key = (boost::format("key:%08u") % i).str();
+            expected[key] = valueOf(key);
+        }
+
+        const auto stat = map.GetStat();
+        assert(map.NeedsCompaction(stat));
+
+        // entries are modified while they are copied
+        std::atomic<bool> stop(false);
+        std::map<std::string, std::string> written;
+        std::thread writer([&]()
+        {
+            for (std::size_t i = 0; !stop || i < 1000; ++i)
+            {
+                const auto key = (boost::format("new:%08u") % i).str();
+                map.Insert(key, "inserted", lockTout);
+                map.Update(key, valueOf(key), lockTout);
+                written[key] = valueOf(key);
+                if (i % 3 == 0)
+                {
+                    map.Delete(key, lockTout);
+                    written.erase(key);
+                }
+            }
+        });
+
+        std::thread reader([&]()
+        {
+            std::string value;
+            while (!stop)
+            {
+                map.Get("key:00000001", value, lockTout);
+                assert(value == valueOf("key:00000001"));
+            }
+        });
+
+        const auto reclaimed = map.Compact();
+        stop = true;
+        writer.join();
+        reader.join();
+        expected.insert(written.begin(), written.end());
+
+        assert(reclaimed > 0);
+        assert(map.GetStat().m_size + reclaimed == stat.m_size);
+        assert(!std::filesystem::exists(filePath + ".compact"));
+        assert(std::filesystem::file_size(filePath) + reclaimed >= stat.m_size);
+        assert(!map.NeedsCompaction(map.GetStat()));
+
+        // map keeps working on the compacted file
+        map.Insert("after", "compaction", lockTout);
+        expected["after"] = "compaction";
+    }
+
+    // compacted file replaced the map file
+    kvdb::Logger logger;
+    kvdb::PersistableMap map(logger);
+    map.InitStorage(filePath, options);
+    assert(map.GetStat().m_numRecords == expected.size());
+    std::string value;
+    for (const auto& entry : expected)
+    {
+        map.Get(entry.first, value, lockTout);
+        assert(value == entry.second);
+    }
+
+    std::vector<kvdb::PersistableMap::KeyValue> pairs;
+    const auto cursor = map.Scan(std::string(), std::string(), expected.size() + 1, pairs, lockTout);
+    assert(cursor.empty());
+    assert(pairs.size() == expected.size());
+    assert(std::equal(pairs.begin(), pairs.end(), expected.begin(),
+                      [](const kvdb::PersistableMap::KeyValue& lhs, const auto& rhs)
+                      {
+                          return lhs.first == rhs.first && lhs.second == rhs.second;
+                      }));
+}
+
+/// @brief server listening on loopback with it's own map and worker threads
+class TestServer
+{
+public:
+    TestServer(const std::string& fileName,
+               const kvdb::PersistableMap::Options& options,
+               const std::size_t numThreads,
+               const bool ioUring = false)
+        : m_map(m_logger)
+        , m_processor(kvdb::CommandProcessorContext { m_ioContext, m_logger, m_map, 60 })
+        , m_server(kvdb::ServerContext {
+                       m_ioContext,
+                       m_logger,
+                       m_processor,
+                       boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+                       false,
+                       nullptr,
+                       0,
+                       ioUring
+                   })
+        , m_work(boost::asio::make_work_guard(m_ioContext))
+    {
+        m_map.InitStorage(testMapFile(fileName), options);
+        m_server.Start();
+        for (std::size_t i = 0; i < numThreads; ++i)
+        {
+            m_threads.emplace_back([this]()
+            {
+                m_ioContext.run();
+            });
+        }
+    }
+
+    ~TestServer()
+    {
+        m_ioContext.stop();
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    /// @return session connected with given version of protocol or nullptr
+    kvdb::ClientSession* Connect(const uint32_t version)
+    {
+        std::promise<bool> connected;
+        m_sessions.emplace_back(new kvdb::ClientSession(kvdb::ClientSessionContext {
+                                                            m_ioContext,
+                                                            m_logger,
+                                                            [&connected](bool success)
+                                                            {
+                                                                connected.set_value(success);
+                                                            },
+                                                            []() {},
+                                                            version
+                                                        }));
+        m_sessions.back()->Connect("127.0.0.1", m_server.Port());
+        return connected.get_future().get() ? m_sessions.back().get() : nullptr;
+    }
+
+    /// @brief sends command and waits for it's result
+    static bool Execute(kvdb::ClientSession& session, const kvdb::CommandMessage& command, std::string& value)
+    {
+        std::promise<bool> done;
+        session.SendCommand(command, [&done, &value](bool success, const std::string& result)
+        {
+            value = result;
+            done.set_value(success);
+        });
+
+        return done.get_future().get();
+    }
+
+    uint16_t Port() const
+    {
+        return m_server.Port();
+    }
+
+    /// @return port metrics of the processor and the server are served on
+    uint16_t StartMetrics()
+    {
+        m_metricsServer.reset(new kvdb::MetricsServer(kvdb::MetricsServerContext {
+                                                          m_ioContext,
+                                                          m_logger,
+                                                          boost::asio::ip::tcp::endpoint(
+                                                              boost::asio::ip::address_v4::loopback(), 0),
+                                                          [this]()
+                                                          {
+                                                              kvdb::MetricsWriter writer;
+                                                              m_processor.CollectMetrics(writer, { { "partition", "0" } });
+                                                              m_server.CollectMetrics(writer, { { "core", "0" } });
+                                                              return writer.Text();
+                                                          }
+                                                      }));
+        m_metricsServer->Start();
+        return m_metricsServer->Port();
+    }
+
+private:
+    kvdb::Logger                                        m_logger;
+    kvdb::PersistableMap                                m_map;
+    boost::asio::io_context                             m_ioContext;
+    kvdb::CommandProcessor                              m_processor;
+    kvdb::Server                                        m_server;
+    std::unique_ptr<kvdb::MetricsServer>                m_metricsServer;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_work;
+    std::vector<std::thread>                            m_threads;
+    std::vector<std::unique_ptr<kvdb::ClientSession>>   m_sessions;
+};
+
+void testProtocolNegotiation()
+{
+    TestServer server("kvdb_test_protocol.map", kvdb::PersistableMap::Options(), 4);
+    const auto execute = &TestServer::Execute;
+
+    // both versions carry any bytes in keys and values
+    for (const auto version : { kvdb::scProtocolText, kvdb::scProtocolBinary })
+    {
+        auto& session = *server.Connect(version);
+
+        const std::string key = std::string("key\0 ", 5) + std::to_string(version);
+        const std::string value("\0value \0", 9);
+        std::string result;
+        const bool inserted = execute(session, kvdb::CommandMessage(kvdb::CommandMessage::INSERT, key, value), result);
+        assert(inserted);
+        const bool found = execute(session, kvdb::CommandMessage(kvdb::CommandMessage::GET, key), result);
+        assert(found);
+        assert(result == value);
+        const bool foundWithZero = execute(session,
+                                           kvdb::CommandMessage(kvdb::CommandMessage::GET, key + '\0'),
+                                           result);
+        assert(!foundWithZero);
+
+        // commands are sent without waiting for results, every result is matched with it's command
+        static const std::size_t scNumCommands = 1000;
+        std::atomic<std::size_t> numFinished(0);
+        std::atomic<std::size_t> numMatched(0);
+        std::promise<void> finished;
+        const auto onFinished = [&]()
+        {
+            if (++numFinished == 3 * scNumCommands)
+            {
+                finished.set_value();
+            }
+        };
+
+        for (std::size_t i = 0; i < scNumCommands; ++i)
+        {
+            const auto pipelinedKey = (boost::format("pipelined:%1%:%2%") % version % i).str();
+            session.SendCommand(kvdb::CommandMessage(kvdb::CommandMessage::INSERT, pipelinedKey, std::to_string(i)),
+                                [&](bool success, const std::string&)
+                                {
+                                    numMatched += success ? 1 : 0;
+                                    onFinished();
+                                });
+            session.SendCommand(kvdb::CommandMessage(kvdb::CommandMessage::GET, pipelinedKey),
+                                [&, i](bool success, const std::string& result)
+                                {
+                                    numMatched += success && result == std::to_string(i) ? 1 : 0;
+                                    onFinished();
+                                });
+            session.SendCommand(kvdb::CommandMessage(kvdb::CommandMessage::GET, pipelinedKey + "?"),
+                                [&](bool success, const std::string&)
+                                {
+                                    numMatched += success ? 0 : 1;
+                                    onFinished();
+                                });
+        }
+
+        finished.get_future().wait();
+        assert(numMatched == 3 * scNumCommands);
+    }
+
+    // server does not support versions below the text one
+    const auto* unsupported = server.Connect(0);
+    assert(!unsupported);
+}
+
+void testPipelinedOrdering()
+{
+    static const std::size_t scNumKeys = 200;
+    kvdb::PersistableMap::Options options;
+    options.m_numShards = 4;
+    options.m_orderedIndex = true;
+    TestServer server("kvdb_test_ordering.map", options, 4);
+    auto& session = *server.Connect(kvdb::scProtocolBinary);
+
+    // commands on the same key are executed in order they are sent,
+    // commands on different keys are executed concurrently
+    std::atomic<std::size_t> numFinished(0);
+    std::atomic<std::size_t> numMatched(0);
+    std::promise<void> finished;
+    // 6 commands for every key are sent before the scan and 1 after it
+    const std::size_t numCommands = 7 * scNumKeys;
+    const auto onFinished = [&]()
+    {
+        if (++numFinished == numCommands)
+        {
+            finished.set_value();
+        }
+    };
+
+    const auto send = [&](const int type, const std::string& key, const std::string& value,
+                          const bool expectedSuccess, const std::string& expectedValue)
+    {
+        session.SendCommand(kvdb::CommandMessage(type, key, value),
+                            [&, expectedSuccess, expectedValue](bool success, const std::string& result)
+                            {
+                                numMatched += success == expectedSuccess && result == expectedValue ? 1 : 0;
+                                onFinished();
+                            });
+    };
+
+    std::map<std::string, std::string> expected;
+    for (std::size_t i = 0; i < scNumKeys; ++i)
+    {
+        const auto key = (boost::format("ordered:%03u") % i).str();
+        send(kvdb::CommandMessage::INSERT, key, "0", true, std::string());
+        send(kvdb::CommandMessage::UPDATE, key, "1", true, std::string());
+        send(kvdb::CommandMessage::GET, key, std::string(), true, "1");
+        send(kvdb::CommandMessage::DELETE, key, std::string(), true, std::string());
+        send(kvdb::CommandMessage::GET, key, std::string(), false, std::string());
+        send(kvdb::CommandMessage::INSERT, key, std::to_string(i), true, std::string());
+        expected[key] = std::to_string(i);
+    }
+
+    // scan is executed after all previous commands, following commands wait for it
+    std::vector<kvdb::KeyValue> scanned;
+    std::promise<bool> scanFinished;
+    session.SendScan(kvdb::CommandMessage(kvdb::CommandMessage::SCAN_PREFIX, "ordered:", std::string(), 1000),
+                     [&scanned](const std::vector<kvdb::KeyValue>& pairs)
+                     {
+                         scanned.insert(scanned.end(), pairs.begin(), pairs.end());
+                     },
+                     [&scanFinished](bool success, const std::string& cursor)
+                     {
+                         scanFinished.set_value(success && cursor.empty());
+                     });
+
+    for (std::size_t i = 0; i < scNumKeys; ++i)
+    {
+        const auto key = (boost::format("ordered:%03u") % i).str();
+        send(kvdb::CommandMessage::DELETE, key, std::string(), true, std::string());
+    }
+
+    const bool scanSucceeded = scanFinished.get_future().get();
+    assert(scanSucceeded);
+    finished.get_future().wait();
+    assert(numMatched == numCommands);
+    assert(scanned.size() == expected.size());
+    assert(std::equal(scanned.begin(), scanned.end(), expected.begin(),
+                      [](const kvdb::KeyValue& lhs, const auto& rhs)
+                      {
+                          return lhs.first == rhs.first && lhs.second == rhs.second;
+                      }));
+}
+
+void testCoalescedResults()
+{
+    static const std::size_t scNumKeys = 40;
+    TestServer server("kvdb_test_coalesced.map", kvdb::PersistableMap::Options(), 2);
+    auto& session = *server.Connect(kvdb::scProtocolBinary);
+
+    // results queued while previous write is in progress are sent together,
+    // large ones exceed the size of one write
+    std::atomic<std::size_t> numMatched(0);
+    std::atomic<std::size_t> numFinished(0);
+    std::promise<void> finished;
+    const auto onFinished = [&]()
+    {
+        if (++numFinished == 2 * scNumKeys)
+        {
+            finished.set_value();
+        }
+    };
+
+    for (std::size_t i = 0; i < scNumKeys; ++i)
+    {
+        const auto key = "coalesced:" + std::to_string(i);
+        const std::string value(i % 4 == 0 ? 100 * 1024 + i : i, char('a' + i % 26));
+        session.SendCommand(kvdb::CommandMessage(kvdb::CommandMessage::INSERT, key, value),
+                            [&](bool success, const std::string&)
+                            {
+                                numMatched += success ? 1 : 0;
+                                onFinished();
+                            });
+        session.SendCommand(kvdb::CommandMessage(kvdb::CommandMessage::GET, key),
+                            [&, value](bool success, const std::string& result)
+                            {
+                                numMatched += success && result == value ? 1 : 0;
+                                onFinished();
+                            });
+    }
+
+    finished.get_future().wait();
+    assert(numMatched == 2 * scNumKeys);
+}
+
+void testBatchedReceive()
+{
+    static const std::size_t scNumCommands = 500;
+    TestServer server("kvdb_test_batched_receive.map", kvdb::PersistableMap::Options(), 2);
+
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::socket socket(ioContext);
+    socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), server.Port()));
+    socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+    kvdb::Handshake handshake(kvdb::scProtocolBinary);
+    boost::asio::write(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+    boost::asio::read(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+    assert(handshake.IsValid() && handshake.m_version == kvdb::scProtocolBinary);
+
+    const auto frame = [](const kvdb::CommandMessage& command)
+    {
+        std::string buffer(kvdb::scMessageHeaderSize, '\0');
+        kvdb::SerializeMessage(command, kvdb::scProtocolBinary, buffer);
+        const kvdb::MessageHeader header(uint32_t(buffer.size() - kvdb::scMessageHeaderSize));
+        std::memcpy(&buffer[0], &header, kvdb::scMessageHeaderSize);
+        return buffer;
+    };
+
+    // many pipelined commands are received by one read, header of invalid message is skipped
+    std::string stream;
+    for (std::size_t i = 0; i < scNumCommands; ++i)
+    {
+        kvdb::CommandMessage command(kvdb::CommandMessage::INSERT, "batched:" + std::to_string(i), std::to_string(i));
+        command.id = kvdb::CommandID(i);
+        stream += frame(command);
+        if (i == scNumCommands / 2)
+        {
+            stream += std::string(kvdb::scMessageHeaderSize, 'x');
+        }
+    }
+
+    // large command is split in the middle of it's header and of it's body, so it is moved
+    // into a buffer of it's size and the rest is received directly into it
+    const std::string large(300 * 1024, 'l');
+    kvdb::CommandMessage command(kvdb::CommandMessage::INSERT, "batched:large", large);
+    command.id = kvdb::CommandID(scNumCommands);
+    const auto largeFrame = frame(command);
+    const std::size_t splits[] = { 0, stream.size() + 3, stream.size() + largeFrame.size() / 2 };
+    stream += largeFrame;
+    for (std::size_t i = 0; i < 3; ++i)
+    {
+        const auto end = i + 1 < 3 ? splits[i + 1] : stream.size();
+        boost::asio::write(socket, boost::asio::buffer(stream.data() + splits[i], end - splits[i]));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    std::vector<bool> received(scNumCommands + 1, false);
+    for (std::size_t i = 0; i < received.size(); ++i)
+    {
+        kvdb::MessageHeader header;
+        boost::asio::read(socket, boost::asio::buffer(&header, kvdb::scMessageHeaderSize));
+        assert(header.IsValid());
+        std::string data(header.m_msgSize, '\0');
+        boost::asio::read(socket, boost::asio::buffer(&data[0], data.size()));
+
+        kvdb::ResultMessage result;
+        kvdb::DeserializeMessage(data.data(), data.size(), kvdb::scProtocolBinary, result);
+        assert(result.code == kvdb::ResultMessage::InsertSuccess);
+        assert(result.commandId < received.size() && !received[result.commandId]);
+        received[result.commandId] = true;
+    }
+
+    auto& session = *server.Connect(kvdb::scProtocolBinary);
+    std::string value;
+    const bool foundLarge = TestServer::Execute(session,
+                                                kvdb::CommandMessage(kvdb::CommandMessage::GET, "batched:large"),
+                                                value);
+    assert(foundLarge);
+    assert(value == large);
+    const bool foundSmall = TestServer::Execute(session,
+                                                kvdb::CommandMessage(kvdb::CommandMessage::GET, "batched:7"),
+                                                value);
+    assert(foundSmall);
+    assert(value == "7");
+}
+
+void testOversizedMessage()
+{
+    for (const bool ioUring : { false, true })
+    {
+        std::unique_ptr<TestServer> server;
+        try
+        {
+            if (!ioUring || kvdb::UringTransport::IsCompiled())
+            {
+                server.reset(new TestServer("kvdb_test_oversized_message.map",
+                                            kvdb::PersistableMap::Options(), 1, ioUring));
+            }
+        }
+        catch (std::runtime_error&)
+        {
+        }
+
+        if (!server)
+        {
+            continue;
+        }
+
+        boost::asio::io_context ioContext;
+        boost::asio::ip::tcp::socket socket(ioContext);
+        socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), server->Port()));
+        kvdb::Handshake handshake(kvdb::scProtocolBinary);
+        boost::asio::write(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+        boost::asio::read(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+
+        // size claimed by the header is not allocated, connection is closed instead
+        const kvdb::MessageHeader header(0xFFFFFFF0);
+        boost::asio::write(socket, boost::asio::buffer(&header, kvdb::scMessageHeaderSize));
+        boost::system::error_code ec;
+        char byte = 0;
+        boost::asio::read(socket, boost::asio::buffer(&byte, 1), ec);
+        assert(ec == boost::asio::error::eof || ec == boost::asio::error::connection_reset);
+
+        // other connections are served
+        auto& session = *server->Connect(kvdb::scProtocolBinary);
+        std::string value;
+        const bool inserted = TestServer::Execute(session,
+                                                  kvdb::CommandMessage(kvdb::CommandMessage::INSERT, "oversized",
+                                                                       "value"),
+                                                  value);
+        assert(inserted);
+    }
+}
+
+void testLegacyClient()
+{
+    TestServer server("kvdb_test_legacy_client.map", kvdb::PersistableMap::Options(), 1);
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::socket socket(ioContext);
+    socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), server.Port()));
+
+    // clients preceding the handshake send header of the first command instead of it
+    const auto execute = [&socket](const std::string& command)
+    {
+        const kvdb::MessageHeader header(uint32_t(command.size()));
+        std::string message(reinterpret_cast<const char*>(&header), kvdb::scMessageHeaderSize);
+        message.append(command);
+        boost::asio::write(socket, boost::asio::buffer(message));
+
+        kvdb::MessageHeader resultHeader;
+        boost::asio::read(socket, boost::asio::buffer(&resultHeader, kvdb::scMessageHeaderSize));
+        assert(resultHeader.IsValid());
+        std::string result(resultHeader.m_msgSize, '\0');
+        boost::asio::read(socket, boost::asio::buffer(result));
+        return result;
+    };
+
+    // commands of the legacy encoding have no limit field
+    assert(execute("1 6 legacy 5 value ") == "2 0  ");
+    assert(execute("4 6 legacy 0  ") == "6 5 value ");
+    assert(execute("4 7 missing 0  ") == "7 0  ");
+}
+
+void testGetAllocations()
+{
+    static const std::size_t scNumCommands = 2000;
+    TestServer server("kvdb_test_get_allocations.map", kvdb::PersistableMap::Options(), 1);
+    auto& session = *server.Connect(kvdb::scProtocolBinary);
+    std::string value;
+    const bool inserted = TestServer::Execute(session,
+                                              kvdb::CommandMessage(kvdb::CommandMessage::INSERT, "allocations",
+                                                                   "value"),
+                                              value);
+    assert(inserted);
+
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::socket socket(ioContext);
+    socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), server.Port()));
+    kvdb::Handshake handshake(kvdb::scProtocolBinary);
+    boost::asio::write(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+    boost::asio::read(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+
+    std::string message(kvdb::scMessageHeaderSize, '\0');
+    kvdb::SerializeMessage(kvdb::CommandMessage(kvdb::CommandMessage::GET, "allocations"),
+                           kvdb::scProtocolBinary, message);
+    const kvdb::MessageHeader header(uint32_t(message.size() - kvdb::scMessageHeaderSize));
+    std::memcpy(&message[0], &header, kvdb::scMessageHeaderSize);
+    std::vector<char> result(kvdb::scMaxResultSize);
+    const auto get = [&]()
+    {
+        kvdb::MessageHeader resultHeader;
+        boost::asio::write(socket, boost::asio::buffer(message));
+        boost::asio::read(socket, boost::asio::buffer(&resultHeader, kvdb::scMessageHeaderSize));
+        boost::asio::read(socket, boost::asio::buffer(result.data(), resultHeader.m_msgSize));
+        // code follows the id of the command
+        assert(result[sizeof(kvdb::CommandID)] == kvdb::ResultMessage::GetSuccess);
+    };
+
+    // commands are logged at debug level only, pools are filled by first commands
+    for (std::size_t i = 0; i < scNumCommands; ++i)
+    {
+        get();
+    }
+
+    const auto numAllocations = g_numAllocations.load();
+    for (std::size_t i = 0; i < scNumCommands; ++i)
+    {
+        get();
+    }
+
+    // background flushes of the map may allocate rarely, commands do not
+    const auto allocated = g_numAllocations.load() - numAllocations;
+    assert(allocated < scNumCommands / 100);
+}
+
+void testLogLevels()
+{
+    using namespace kvdb;
+
+    LogLevel level = LogLevel::Info;
+    const bool parsedDebug = Logger::ParseLevel("debug", level);
+    assert(parsedDebug && level == LogLevel::Debug);
+    const bool parsedOff = Logger::ParseLevel("off", level);
+    assert(parsedOff && level == LogLevel::Off);
+    const bool parsedVerbose = Logger::ParseLevel("verbose", level);
+    assert(!parsedVerbose && level == LogLevel::Off);
+
+    assert(!Logger::Enabled(LogLevel::Debug));
+    assert(Logger::Enabled(LogLevel::Info));
+
+    // records of disabled levels are not copied, literals are not converted to strings
+    Logger logger;
+    const std::string record(100, 'r');
+    const auto numAllocations = g_numAllocations.load();
+    logger.LogRecord(LogLevel::Debug, record);
+    logger.LogRecord(LogLevel::Debug, "Record longer than the buffer of short strings");
+    assert(g_numAllocations.load() == numAllocations);
+
+    Logger::SetLevel(LogLevel::Error);
+    assert(!Logger::Enabled(LogLevel::Warning));
+    assert(Logger::Enabled(LogLevel::Error));
+
+    // records of exited threads are written by the writer
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&logger, i]()
+        {
+            logger.LogRecord(LogLevel::Error, "Record of thread " + std::to_string(i));
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    Logger::Flush();
+    Logger::SetLevel(LogLevel::Info);
+}
+
+void testGetDuringUpdates()
+{
+    static const std::size_t scNumRounds = 200;
+    TestServer server("kvdb_test_get_updates.map", kvdb::PersistableMap::Options(), 4);
+
+    // values are stored inline and outside of the record, so updates rewrite them
+    // in place and replace records, GET results are sent while the entry is locked
+    const std::string small(100, 's');
+    const std::string large(200 * 1024, 'l');
+    for (const auto version : { kvdb::scProtocolText, kvdb::scProtocolBinary })
+    {
+        auto& writer = *server.Connect(version);
+        auto& reader = *server.Connect(version);
+        const auto key = "updated:" + std::to_string(version);
+        std::string result;
+        const bool inserted = TestServer::Execute(writer,
+                                                  kvdb::CommandMessage(kvdb::CommandMessage::INSERT, key, small),
+                                                  result);
+        assert(inserted);
+
+        std::atomic<std::size_t> numMatched(0);
+        std::atomic<std::size_t> numFinished(0);
+        std::promise<void> finished;
+        const auto onFinished = [&]()
+        {
+            if (++numFinished == 2 * scNumRounds)
+            {
+                finished.set_value();
+            }
+        };
+
+        for (std::size_t i = 0; i < scNumRounds; ++i)
+        {
+            writer.SendCommand(kvdb::CommandMessage(kvdb::CommandMessage::UPDATE, key, i % 2 ? small : large),
+                               [&](bool success, const std::string&)
+                               {
+                                   numMatched += success ? 1 : 0;
+                                   onFinished();
+                               });
+            reader.SendCommand(kvdb::CommandMessage(kvdb::CommandMessage::GET, key),
+                               [&](bool success, const std::string& value)
+                               {
+                                   numMatched += success && (value == small || value == large) ? 1 : 0;
+                                   onFinished();
+                               });
+        }
+
+        finished.get_future().wait();
+        assert(numMatched == 2 * scNumRounds);
+    }
+}
+
+/// @brief checks that MGET returns values which do not fit one result together
+void testLargeMultiGet(kvdb::ClientSession& session, const std::string& prefix)
+{
+    const std::vector<kvdb::KeyValue> pairs = {
+        { prefix + "large1", std::string(600 * 1024, 'x') },
+        { prefix + "large2", std::string(600 * 1024, 'y') },
+        { prefix + "large3", std::string(kvdb::scMaxValueSize, 'z') },
+    };
+
+    std::string result;
+    for (const auto& pair : pairs)
+    {
+        const bool inserted = TestServer::Execute(session,
+                                                  kvdb::CommandMessage(kvdb::CommandMessage::INSERT, pair.first,
+                                                                       pair.second),
+                                                  result);
+        assert(inserted);
+    }
+
+    std::promise<std::vector<kvdb::BatchItem>> done;
+    session.MultiGet({ pairs[0].first, pairs[1].first, prefix + "missing", pairs[2].first, pairs[0].first },
+                     [&done](bool success, const std::vector<kvdb::BatchItem>& items)
+                     {
+                         assert(success);
+                         done.set_value(items);
+                     });
+    const auto items = done.get_future().get();
+    assert((items == std::vector<kvdb::BatchItem> {
+               { kvdb::ResultMessage::GetSuccess, pairs[0].second },
+               { kvdb::ResultMessage::GetSuccess, pairs[1].second },
+               { kvdb::ResultMessage::GetFailed, std::string() },
+               { kvdb::ResultMessage::GetSuccess, pairs[2].second },
+               { kvdb::ResultMessage::GetSuccess, pairs[0].second } }));
+}
+
+void testBatchCommands()
+{
+    kvdb::PersistableMap::Options options;
+    options.m_numShards = 4;
+    TestServer server("kvdb_test_batch.map", options, 4);
+
+    for (const auto version : { kvdb::scProtocolText, kvdb::scProtocolBinary })
+    {
+        auto& session = *server.Connect(version);
+        const auto execute = [&session](const auto& operation, const auto& arg)
+        {
+            std::promise<std::vector<kvdb::BatchItem>> done;
+            (session.*operation)(arg, [&done](bool success, const std::vector<kvdb::BatchItem>& items)
+            {
+                assert(success);
+                done.set_value(items);
+            });
+
+            return done.get_future().get();
+        };
+
+        const auto prefix = std::to_string(version) + ":";
+        const std::vector<kvdb::KeyValue> pairs = {
+            { prefix + "a", "1" }, { prefix + std::string("\0 b", 3), std::string("\0 2", 3) }, { prefix + "a", "3" },
+        };
+        auto items = execute(&kvdb::ClientSession::MultiSet, pairs);
+        assert((items == std::vector<kvdb::BatchItem> {
+                   { kvdb::ResultMessage::InsertSuccess, std::string() },
+                   { kvdb::ResultMessage::InsertSuccess, std::string() },
+                   { kvdb::ResultMessage::UpdateSuccess, std::string() } }));
+
+        const std::vector<std::string> keys = { prefix + "a", prefix + "missing", pairs[1].first };
+        items = execute(&kvdb::ClientSession::MultiGet, keys);
+        assert((items == std::vector<kvdb::BatchItem> {
+                   { kvdb::ResultMessage::GetSuccess, "3" },
+                   { kvdb::ResultMessage::GetFailed, std::string() },
+                   { kvdb::ResultMessage::GetSuccess, pairs[1].second } }));
+
+        items = execute(&kvdb::ClientSession::MultiDelete, keys);
+        assert((items == std::vector<kvdb::BatchItem> {
+                   { kvdb::ResultMessage::DeleteSuccess, std::string() },
+                   { kvdb::ResultMessage::DeleteFailed, std::string() },
+                   { kvdb::ResultMessage::DeleteSuccess, std::string() } }));
+
+        // results of large values are split into parts
+        testLargeMultiGet(session, prefix);
+
+        // empty batches and batches with invalid keys are rejected as a whole
+        std::string result;
+        const bool emptyExecuted = TestServer::Execute(session,
+                                                       kvdb::CommandMessage(kvdb::CommandMessage::MGET, std::string(),
+                                                                            std::string()),
+                                                       result);
+        assert(!emptyExecuted);
+        const bool invalidExecuted = TestServer::Execute(session,
+                                                         kvdb::CommandMessage(kvdb::CommandMessage::MDELETE,
+                                                                              std::string(),
+                                                                              kvdb::SerializeKeys({ "a", "" }, version)),
+                                                         result);
+        assert(!invalidExecuted);
+        const bool malformedExecuted = TestServer::Execute(session,
+                                                           kvdb::CommandMessage(kvdb::CommandMessage::MGET,
+                                                                                std::string(), "5 abc"),
+                                                           result);
+        assert(!malformedExecuted);
+    }
+}
+
+/// @brief servers of per-core contexts listening on the same loopback port, every core owns
+/// a partition of the keyspace when numPartitions is not 0, clients are run by the shared context
+class PerCoreTestServer
+{
+public:
+    PerCoreTestServer(const std::string& fileName,
+                      const kvdb::PersistableMap::Options& options,
+                      const std::size_t numCores,
+                      const bool partitioned)
+        : m_work(boost::asio::make_work_guard(m_ioContext))
+        , m_cores(m_logger, numCores)
+    {
+        std::vector<kvdb::Partition> partitions;
+        for (std::size_t i = 0; i < (partitioned ? numCores : 1); ++i)
+        {
+            m_maps.emplace_back(new kvdb::PersistableMap(m_logger));
+            m_maps.back()->InitStorage(testMapFile(fileName + "." + std::to_string(i)), options);
+            auto& context = partitioned ? m_cores.Context(i) : m_ioContext;
+            m_processors.emplace_back(new kvdb::CommandProcessor(kvdb::CommandProcessorContext {
+                                                                     context, m_logger, *m_maps.back(), 60
+                                                                 }));
+            partitions.push_back(kvdb::Partition { context, *m_processors.back() });
+        }
+
+        if (partitioned)
+        {
+            m_router.reset(new kvdb::PartitionRouter(partitions));
+        }
+
+        // servers of all cores listen to the port chosen for the first one
+        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), 0);
+        for (std::size_t i = 0; i < numCores; ++i)
+        {
+            m_servers.emplace_back(new kvdb::Server(kvdb::ServerContext {
+                                                        m_cores.Context(i),
+                                                        m_logger,
+                                                        *m_processors[partitioned ? i : 0],
+                                                        endpoint,
+                                                        true,
+                                                        m_router.get(),
+                                                        i
+                                                    }));
+            m_servers.back()->Start();
+            endpoint.port(m_servers.front()->Port());
+            assert(m_servers.back()->Port() == endpoint.port());
+        }
+
+        m_cores.Start(true);
+        m_thread = std::thread([this]()
+        {
+            m_ioContext.run();
+        });
+    }
+
+    ~PerCoreTestServer()
+    {
+        m_ioContext.stop();
+        m_thread.join();
+        m_cores.Stop();
+    }
+
+    kvdb::ClientSession* Connect(const uint32_t version)
+    {
+        std::promise<bool> connected;
+        m_sessions.emplace_back(new kvdb::ClientSession(kvdb::ClientSessionContext {
+                                                            m_ioContext,
+                                                            m_logger,
+                                                            [&connected](bool success)
+                                                            {
+                                                                connected.set_value(success);
+                                                            },
+                                                            []() {},
+                                                            version
+                                                        }));
+        m_sessions.back()->Connect("127.0.0.1", m_servers.front()->Port());
+        return connected.get_future().get() ? m_sessions.back().get() : nullptr;
+    }
+
+    kvdb::PersistableMap& Map(const std::size_t idx)
+    {
+        return *m_maps[idx];
+    }
+
+private:
+    kvdb::Logger                                            m_logger;
+    boost::asio::io_context                                 m_ioContext;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_work;
+    kvdb::IoContextPool                                     m_cores;
+    std::vector<std::unique_ptr<kvdb::PersistableMap>>      m_maps;
+    std::vector<std::unique_ptr<kvdb::CommandProcessor>>    m_processors;
+    std::unique_ptr<kvdb::PartitionRouter>                  m_router;
+    std::vector<std::unique_ptr<kvdb::Server>>              m_servers;
+    std::thread                                             m_thread;
+    std::vector<std::unique_ptr<kvdb::ClientSession>>       m_sessions;
+};
+
+void testPerCoreServers()
+{
+    static const std::size_t scNumClients = 8;
+    PerCoreTestServer server("kvdb_test_per_core.map", kvdb::PersistableMap::Options(), 3, false);
+
+    // connections accepted by any core execute commands on the same map
+    std::vector<kvdb::ClientSession*> sessions;
+    for (std::size_t i = 0; i < scNumClients; ++i)
+    {
+        sessions.push_back(server.Connect(kvdb::scProtocolBinary));
+        assert(sessions.back());
+
+        std::string result;
+        const auto key = "core:" + std::to_string(i);
+        const bool inserted = TestServer::Execute(*sessions.back(),
+                                                  kvdb::CommandMessage(kvdb::CommandMessage::INSERT, key, key),
+                                                  result);
+        assert(inserted);
+    }
+
+    for (std::size_t i = 0; i < scNumClients; ++i)
+    {
+        std::string result;
+        const auto key = "core:" + std::to_string((i + 1) % scNumClients);
+        const bool found = TestServer::Execute(*sessions[i],
+                                               kvdb::CommandMessage(kvdb::CommandMessage::GET, key),
+                                               result);
+        assert(found);
+        assert(result == key);
+    }
+}
+
+void testSpscQueue()
+{
+    static const int scNumItems = 100000;
+    kvdb::SpscQueue<int> queue(5);
+
+    // capacity is rounded up to power of two
+    for (int i = 0; i < 8; ++i)
+    {
+        const bool pushed = queue.Push(int(i));
+        assert(pushed);
+    }
+
+    const bool pushedToFull = queue.Push(8);
+    assert(!pushedToFull);
+    int item = -1;
+    const bool popped = queue.Pop(item);
+    assert(popped && item == 0);
+    const bool pushedAfterPop = queue.Push(8);
+    assert(pushedAfterPop);
+
+    for (int i = 1; i <= 8; ++i)
+    {
+        const bool poppedInOrder = queue.Pop(item);
+        assert(poppedInOrder && item == i);
+    }
+
+    const bool poppedFromEmpty = queue.Pop(item);
+    assert(!poppedFromEmpty);
+
+    // items pass between threads in the order they are pushed
+    std::thread producer([&queue]()
+    {
+        for (int i = 0; i < scNumItems; ++i)
+        {
+            while (!queue.Push(int(i)))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    for (int i = 0; i < scNumItems; ++i)
+    {
+        while (!queue.Pop(item))
+        {
+            std::this_thread::yield();
+        }
+
+        assert(item == i);
+    }
+
+    producer.join();
+}
+
+void testLatencyHistogram()
+{
+    using kvdb::LatencyHistogram;
+
+    // buckets follow each other without gaps and bound the values they count
+    for (std::size_t i = 0; i + 1 < LatencyHistogram::scNumBuckets; ++i)
+    {
+        assert(LatencyHistogram::HighestOf(i) + 1 == LatencyHistogram::LowestOf(i + 1));
+        assert(LatencyHistogram::BucketOf(LatencyHistogram::LowestOf(i)) == i);
+        assert(LatencyHistogram::BucketOf(LatencyHistogram::HighestOf(i)) == i);
+    }
+
+    assert(LatencyHistogram::BucketOf(uint64_t(1) << 50) == LatencyHistogram::scNumBuckets - 1);
+
+    // threads record into stripes of their own, snapshot merges all of them
+    static constexpr std::size_t scNumThreads = 4;
+    static constexpr uint64_t scNumValues = 100000;
+    kvdb::LatencyRecorder recorder(2);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < scNumThreads; ++t)
+    {
+        threads.emplace_back([&recorder]()
+        {
+            for (uint64_t value = 1; value <= scNumValues; ++value)
+            {
+                recorder.Record(1, std::chrono::microseconds(value));
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    assert(recorder.Snapshot(0).Count() == 0);
+    assert(recorder.Snapshot(0).Percentile(0.99).count() == 0);
+
+    const auto snapshot = recorder.Snapshot(1);
+    assert(snapshot.Count() == scNumThreads * scNumValues);
+    assert(snapshot.Max() == std::chrono::microseconds(scNumValues));
+
+    const auto checkPercentile = [&snapshot](const double fraction)
+    {
+        const double expected = fraction * scNumValues * 1000;
+        const double actual = double(snapshot.Percentile(fraction).count());
+        assert(std::abs(actual - expected) <= expected / LatencyHistogram::scNumSubBuckets);
+    };
+
+    checkPercentile(0.5);
+    checkPercentile(0.99);
+    checkPercentile(0.999);
+}
+
+/// @return response of the metrics server to the request line
+std::string requestMetrics(const uint16_t port, const std::string& requestLine)
+{
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::socket socket(ioContext);
+    socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+    boost::asio::write(socket, boost::asio::buffer(requestLine + "\r\nHost: localhost\r\n\r\n"));
+
+    // connection is closed after the response
+    std::string response;
+    boost::system::error_code ec;
+    boost::asio::read(socket, boost::asio::dynamic_buffer(response), ec);
+    assert(ec == boost::asio::error::eof);
+    return response;
+}
+
+void testMetricsEndpoint()
+{
+    static const std::size_t scNumInserts = 10;
+    TestServer server("kvdb_test_metrics.map", kvdb::PersistableMap::Options(), 2);
+    const auto port = server.StartMetrics();
+    auto& session = *server.Connect(kvdb::scProtocolBinary);
+    std::string value;
+    for (std::size_t i = 0; i < scNumInserts; ++i)
+    {
+        const bool inserted = TestServer::Execute(session,
+                                                  kvdb::CommandMessage(kvdb::CommandMessage::INSERT,
+                                                                       "metrics" + std::to_string(i), "value"),
+                                                  value);
+        assert(inserted);
+    }
+
+    const bool found = TestServer::Execute(session, kvdb::CommandMessage(kvdb::CommandMessage::GET, "missing"), value);
+    assert(!found);
+
+    const auto response = requestMetrics(port, "GET /metrics HTTP/1.1");
+    assert(response.rfind("HTTP/1.1 200 OK\r\n", 0) == 0);
+    const auto contains = [&response](const std::string& line)
+    {
+        return response.find("\n" + line + "\n") != std::string::npos;
+    };
+
+    const auto inserts = std::to_string(scNumInserts);
+    assert(contains("# TYPE kvdb_results_total counter"));
+    assert(contains("kvdb_results_total{partition=\"0\",result=\"insert_ok\"} " + inserts));
+    assert(contains("kvdb_results_total{partition=\"0\",result=\"get_failed\"} 1"));
+    assert(contains("# TYPE kvdb_command_execution_seconds histogram"));
+    assert(contains("kvdb_command_execution_seconds_bucket{partition=\"0\",result=\"insert_ok\",le=\"+Inf\"} "
+                    + inserts));
+    assert(contains("kvdb_command_service_seconds_count{partition=\"0\",result=\"insert_ok\"} " + inserts));
+    assert(contains("kvdb_map_records{partition=\"0\"} " + inserts));
+    assert(contains("kvdb_sessions{core=\"0\"} 1"));
+    assert(contains("kvdb_session_commands_total{core=\"0\"} " + std::to_string(scNumInserts + 1)));
+
+    const auto notFound = requestMetrics(port, "GET /other HTTP/1.1");
+    assert(notFound.rfind("HTTP/1.1 404 Not Found\r\n", 0) == 0);
+    const auto notAllowed = requestMetrics(port, "POST /metrics HTTP/1.1");
+    assert(notAllowed.rfind("HTTP/1.1 405 Method Not Allowed\r\n", 0) == 0);
+}
+
+void testMetricsDuringInserts()
+{
+    static const std::size_t scNumWriters = 2;
+    static const std::size_t scKeysPerWriter = 300;
+    // values are larger than slab blocks, so every insert allocates from the segment
+    static const std::size_t scValueSize = 2 * kvdb::SlabHeap::scMaxSlabBlockSize;
+    TestServer server("kvdb_test_metrics_inserts.map", kvdb::PersistableMap::Options(), 3);
+    const auto port = server.StartMetrics();
+    const auto mapSize = [port]()
+    {
+        static const std::string scPrefix = "\nkvdb_map_size_bytes{partition=\"0\"} ";
+        const auto response = requestMetrics(port, "GET /metrics HTTP/1.1");
+        const auto pos = response.find(scPrefix);
+        assert(pos != std::string::npos);
+        return std::stoull(response.substr(pos + scPrefix.size()));
+    };
+
+    // inserts fit the initial file, scrapes must not make them fail and grow it
+    const auto sizeBefore = mapSize();
+    std::atomic<std::size_t> numRunning { scNumWriters };
+    std::vector<std::thread> writers;
+    for (std::size_t w = 0; w < scNumWriters; ++w)
+    {
+        auto& session = *server.Connect(kvdb::scProtocolBinary);
+        writers.emplace_back([&session, &numRunning, w]()
+        {
+            std::string value;
+            for (std::size_t i = 0; i < scKeysPerWriter; ++i)
+            {
+                const auto key = std::to_string(w) + ":" + std::to_string(i);
+                const bool inserted = TestServer::Execute(session,
+                                                          kvdb::CommandMessage(kvdb::CommandMessage::INSERT, key,
+                                                                               std::string(scValueSize, 'v')),
+                                                          value);
+                assert(inserted);
+            }
+
+            --numRunning;
+        });
+    }
+
+    while (numRunning != 0)
+    {
+        assert(mapSize() == sizeBefore);
+    }
+
+    for (auto& writer : writers)
+    {
+        writer.join();
+    }
+
+    assert(mapSize() == sizeBefore);
+}
+
+void testUringTransport()
+{
+    static const std::size_t scNumKeys = 1000;
+    if (!kvdb::UringTransport::IsCompiled())
+    {
+        return;
+    }
+
+    std::unique_ptr<TestServer> server;
+    try
+    {
+        server.reset(new TestServer("kvdb_test_uring.map", kvdb::PersistableMap::Options(), 2, true));
+    }
+    catch (std::runtime_error& err)
+    {
+        // kernel does not support io_uring with provided buffers
+        std::cout << "io_uring transport is not tested: " << err.what() << std::endl;
+        return;
+    }
+
+    // pipelined commands are received by multishot receives, large commands span many buffers
+    // of the ring and large results are sent by several sendmsg
+    for (const auto version : { kvdb::scProtocolText, kvdb::scProtocolBinary })
+    {
+        auto& session = *server->Connect(version);
+        std::atomic<std::size_t> numMatched(0);
+        std::atomic<std::size_t> numFinished(0);
+        std::promise<void> finished;
+        const auto onFinished = [&]()
+        {
+            if (++numFinished == 2 * scNumKeys)
+            {
+                finished.set_value();
+            }
+        };
+
+        for (std::size_t i = 0; i < scNumKeys; ++i)
+        {
+            const auto key = (boost::format("uring:%1%:%2%") % version % i).str();
+            const std::string value(i % 100 == 0 ? 300 * 1024 + i : 64, char('a' + i % 26));
+            session.SendCommand(kvdb::CommandMessage(kvdb::CommandMessage::INSERT, key, value),
+                                [&](bool success, const std::string&)
+                                {
+                                    numMatched += success ? 1 : 0;
+                                    onFinished();
+                                });
+            session.SendCommand(kvdb::CommandMessage(kvdb::CommandMessage::GET, key),
+                                [&, value](bool success, const std::string& result)
+                                {
+                                    numMatched += success && result == value ? 1 : 0;
+                                    onFinished();
+                                });
+        }
+
+        finished.get_future().wait();
+        assert(numMatched == 2 * scNumKeys);
+    }
+
+    // closed connections release their sessions, following ones are served
+    for (std::size_t i = 0; i < 20; ++i)
+    {
+        boost::asio::io_context ioContext;
+        boost::asio::ip::tcp::socket socket(ioContext);
+        socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), server->Port()));
+        kvdb::Handshake handshake(kvdb::scProtocolBinary);
+        boost::asio::write(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+        boost::asio::read(socket, boost::asio::buffer(&handshake, kvdb::scHandshakeSize));
+        assert(handshake.IsValid());
+    }
+
+    const auto port = server->StartMetrics();
+    const auto sessionsClosed = [port]()
+    {
+        const auto response = requestMetrics(port, "GET /metrics HTTP/1.1");
+        return response.find("\nkvdb_sessions{core=\"0\"} 2\n") != std::string::npos;
+    };
+
+    for (std::size_t i = 0; i < 100 && !sessionsClosed(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    assert(sessionsClosed());
+    std::string value;
+    auto& session = *server->Connect(kvdb::scProtocolBinary);
+    const bool found = TestServer::Execute(session,
+                                           kvdb::CommandMessage(kvdb::CommandMessage::GET, "uring:2:100"),
+                                           value);
+    assert(found);
+    assert(value == std::string(300 * 1024 + 100, 'a' + 100 % 26));
+}
+
+void testPartitionedServers()
+{
+    static const std::size_t scNumCores = 3;
+    static const std::size_t scNumKeys = 300;
+
+    kvdb::PersistableMap::Options options;
+    options.m_orderedIndex = true;
+    PerCoreTestServer server("kvdb_test_partitioned.map", options, scNumCores, true);
+
+    for (const auto version : { kvdb::scProtocolText, kvdb::scProtocolBinary })
+    {
+        // commands received by any core are executed by owners of their keys
+        auto& session = *server.Connect(version);
+        const auto prefix = std::to_string(version) + ":";
+        std::vector<std::string> keys;
+        std::string result;
+        for (std::size_t i = 0; i < scNumKeys; ++i)
+        {
+            keys.push_back(prefix + std::to_string(1000 + i));
+            const bool inserted = TestServer::Execute(session,
+                                                      kvdb::CommandMessage(kvdb::CommandMessage::INSERT, keys.back(),
+                                                                           "v" + keys.back()),
+                                                      result);
+            assert(inserted);
+        }
+
+        for (const auto& key : keys)
+        {
+            const bool found = TestServer::Execute(session,
+                                                   kvdb::CommandMessage(kvdb::CommandMessage::GET, key),
+                                                   result);
+            assert(found);
+            assert(result == "v" + key);
+        }
+
+        // items of batches are merged in the order of keys
+        std::promise<std::vector<kvdb::BatchItem>> done;
+        session.MultiGet({ keys[7], prefix + "missing", keys[3], keys[7] },
+                         [&done](bool success, const std::vector<kvdb::BatchItem>& items)
+                         {
+                             assert(success);
+                             done.set_value(items);
+                         });
+        const auto doneItems = done.get_future().get();
+        assert((doneItems == std::vector<kvdb::BatchItem> {
+                   { kvdb::ResultMessage::GetSuccess, "v" + keys[7] },
+                   { kvdb::ResultMessage::GetFailed, std::string() },
+                   { kvdb::ResultMessage::GetSuccess, "v" + keys[3] },
+                   { kvdb::ResultMessage::GetSuccess, "v" + keys[7] } }));
+
+        std::promise<std::vector<kvdb::BatchItem>> set;
+        session.MultiSet({ { keys[1], "v" + keys[1] }, { prefix + "0", "v" + prefix + "0" } },
+                         [&set](bool success, const std::vector<kvdb::BatchItem>& items)
+                         {
+                             assert(success);
+                             set.set_value(items);
+                         });
+        const auto setItems = set.get_future().get();
+        assert((setItems == std::vector<kvdb::BatchItem> {
+                   { kvdb::ResultMessage::UpdateSuccess, std::string() },
+                   { kvdb::ResultMessage::InsertSuccess, std::string() } }));
+        keys.insert(keys.begin(), prefix + "0");
+        testLargeMultiGet(session, "large" + prefix);
+
+        // pages of the prefix scan are ordered across partitions
+        std::vector<std::string> scanned;
+        std::string cursor;
+        do
+        {
+            std::promise<bool> page;
+            session.SendScan(kvdb::CommandMessage(kvdb::CommandMessage::SCAN_PREFIX, prefix, cursor, 70),
+                             [&scanned](const std::vector<kvdb::KeyValue>& pairs)
+                             {
+                                 for (const auto& pair : pairs)
+                                 {
+                                     assert(pair.second == "v" + pair.first);
+                                     scanned.push_back(pair.first);
+                                 }
+                             },
+                             [&cursor, &page](bool success, const std::string& next)
+                             {
+                                 cursor = next;
+                                 page.set_value(success);
+                             });
+            const bool pageReceived = page.get_future().get();
+            assert(pageReceived);
+        }
+        while (!cursor.empty());
+
+        assert(scanned == keys);
+    }
+
+    // every partition is compacted
+    auto& session = *server.Connect(kvdb::scProtocolBinary);
+    std::string result;
+    const bool compacted = TestServer::Execute(session, kvdb::CommandMessage(kvdb::CommandMessage::COMPACT), result);
+    assert(compacted);
+
+    for (std::size_t i = 0; i < scNumCores; ++i)
+    {
+        assert(server.Map(i).GetStat().m_numRecords > 0);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    testCommandMessageDeSerialize();
+    testResultMessageDeSerialize();
+    testKeyValuesDeSerialize();
+    testBatchItemsDeSerialize();
+    testBinaryDeSerialize();
+    testCommandViewDeserialize();
+    testProtocolNegotiation();
+    testPipelinedOrdering();
+    testCoalescedResults();
+    testGetDuringUpdates();
+    testBatchCommands();
+    testBatchedReceive();
+    testOversizedMessage();
+    testLegacyClient();
+    testGetAllocations();
+    testLogLevels();
+    testPerCoreServers();
+    testSpscQueue();
+    testLatencyHistogram();
+    testMetricsEndpoint();
+    testMetricsDuringInserts();
+    testUringTransport();
+    testPartitionedServers();
+    testSlabHeapBlockSize();
+
+    for (const auto engine : { kvdb::IndexEngine::Hashed, kvdb::IndexEngine::Swiss })
+    {
+        testShardedMap(engine);
+        testMapKeysOfAnySize(engine);
+        testMapOperations(engine);
+        testMultiOperations(engine);
+        testOnlineGrowth(engine);
+        testWriteAheadLogReplay(engine);
+        testBackgroundFlush(engine);
+        testOrderedScan(engine);
+        testCompactRecords(engine);
+        testUpdateChurn(engine);
+        testCompaction(engine);
+    }
+
     return 0;
 }